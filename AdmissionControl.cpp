@@ -0,0 +1,175 @@
+#include <algorithm>
+#include "AdmissionControl.h"
+#include "LatencyHistogram.h"
+
+static const size_t maxTrackedClients = 100000;
+static const int64_t clientCleanIntervalUsec = 60 * 1000 * 1000;
+
+AdmissionController::AdmissionController(int32_t maxOutstanding, int32_t maxTableOutstanding, bool hitsOnly,
+	double clientQPS, double clientBurst): _maxOutstanding(maxOutstanding), _maxTableOutstanding(maxTableOutstanding),
+	_hitsOnly(hitsOnly), _global(std::make_shared<AdmissionCounter>()), _clientLimited(false), _clientQPS(0), _clientBurst(0),
+	_configuredBurst(0), _lastClientCleanUsec(latencyNowUsec())
+{
+	applyClientRate(clientQPS, clientBurst);
+}
+
+//-- caller must hold _clientMutex, or be the constructor.
+void AdmissionController::applyClientRate(double clientQPS, double clientBurst)
+{
+	_clientQPS = clientQPS > 0 ? clientQPS : 0;
+	_configuredBurst = clientBurst >= 1 ? clientBurst : 0;
+	_clientBurst = _configuredBurst ? _configuredBurst : std::max(_clientQPS, 1.0);
+	_clientLimited.store(_clientQPS > 0, std::memory_order_relaxed);
+}
+
+//-- Buckets are kept: tokens over a lower burst are cut at the next refill.
+void AdmissionController::setClientQPS(double clientQPS)
+{
+	std::unique_lock<std::mutex> lck(_clientMutex);
+	applyClientRate(clientQPS, _configuredBurst);
+}
+
+void AdmissionController::setClientBurst(double clientBurst)
+{
+	std::unique_lock<std::mutex> lck(_clientMutex);
+	applyClientRate(_clientQPS, clientBurst);
+}
+
+//-- caller must hold _clientMutex.
+void AdmissionController::cleanClients(int64_t now)
+{
+	//-- A bucket idle long enough to be full again is the same as no bucket.
+	int64_t refillUsec = (int64_t)(_clientBurst / _clientQPS * 1000 * 1000);
+	for (auto it = _clients.begin(); it != _clients.end(); )
+	{
+		if (now - it->second.lastUsec >= refillUsec)
+			it = _clients.erase(it);
+		else
+			++it;
+	}
+	_lastClientCleanUsec = now;
+}
+
+bool AdmissionController::allowClient(const std::string& ip)
+{
+	//-- No lock on every request when the client rate is unlimited.
+	if (!_clientLimited.load(std::memory_order_relaxed))
+		return true;
+
+	std::unique_lock<std::mutex> lck(_clientMutex);
+	if (_clientQPS <= 0)
+		return true;
+
+	int64_t now = latencyNowUsec();
+	if (now - _lastClientCleanUsec >= clientCleanIntervalUsec || _clients.size() >= maxTrackedClients)
+		cleanClients(now);
+
+	auto it = _clients.find(ip);
+	if (it == _clients.end())
+	{
+		ClientBucket bucket;
+		bucket.tokens = _clientBurst;
+		bucket.lastUsec = now;
+		it = _clients.insert(std::make_pair(ip, bucket)).first;
+	}
+
+	ClientBucket& bucket = it->second;
+	bucket.tokens = std::min(_clientBurst, bucket.tokens + (double)(now - bucket.lastUsec) * _clientQPS / 1000000.0);
+	bucket.lastUsec = now;
+
+	if (bucket.tokens < 1)
+	{
+		_statistics.rejectedClientRequests++;
+		return false;
+	}
+
+	bucket.tokens -= 1;
+	return true;
+}
+
+AdmissionCounterPtr AdmissionController::tableCounter(const std::string& tableName)
+{
+	std::unique_lock<std::mutex> lck(_tableMutex);
+	AdmissionCounterPtr& counter = _tables[tableName];
+	if (!counter)
+		counter = std::make_shared<AdmissionCounter>();
+
+	return counter;
+}
+
+AdmissionTicketPtr AdmissionController::acquire(const std::string& tableName, RequestKind kind)
+{
+	AdmissionCounterPtr table = tableCounter(tableName);
+	int32_t maxOutstanding = _maxOutstanding;
+	int32_t maxTableOutstanding = _maxTableOutstanding;
+
+	//-- Taken first & given back when over a limit, so concurrent acquires never exceed it.
+	bool globalLimited = _global->outstanding.fetch_add(1) >= maxOutstanding && maxOutstanding > 0;
+	bool tableLimited = table->outstanding.fetch_add(1) >= maxTableOutstanding && maxTableOutstanding > 0;
+	if (!globalLimited && !tableLimited)
+		return std::make_shared<AdmissionTicket>(_global, table);
+
+	_global->outstanding--;
+	table->outstanding--;
+
+	if (globalLimited)
+		_global->rejected++;
+	table->rejected++;
+
+	if (kind == Write)
+		_statistics.rejectedWrites++;
+	else if (_hitsOnly)
+		_statistics.hitsOnlyFetches++;
+	else
+		_statistics.rejectedFetches++;
+
+	return nullptr;
+}
+
+std::string AdmissionController::infos()
+{
+	std::unordered_map<std::string, AdmissionCounterPtr> tables;
+	double clientQPS, clientBurst;
+	size_t trackedClients;
+	{
+		std::unique_lock<std::mutex> lck(_tableMutex);
+		tables = _tables;
+	}
+	{
+		std::unique_lock<std::mutex> lck(_clientMutex);
+		clientQPS = _clientQPS;
+		clientBurst = _clientBurst;
+		trackedClients = _clients.size();
+	}
+
+	std::string infos("{\"maxOutstanding\":");
+	infos.append(std::to_string(_maxOutstanding));
+	infos.append(",\"maxTableOutstanding\":").append(std::to_string(_maxTableOutstanding));
+	infos.append(",\"hitsOnly\":").append(_hitsOnly ? "true" : "false");
+	infos.append(",\"outstanding\":").append(std::to_string(_global->outstanding));
+	infos.append(",\"rejectedByGlobalLimit\":").append(std::to_string(_global->rejected));
+	infos.append(",\"rejectedFetches\":").append(std::to_string(_statistics.rejectedFetches));
+	infos.append(",\"hitsOnlyFetches\":").append(std::to_string(_statistics.hitsOnlyFetches));
+	infos.append(",\"unloadedItems\":").append(std::to_string(_statistics.unloadedItems));
+	infos.append(",\"rejectedWrites\":").append(std::to_string(_statistics.rejectedWrites));
+	infos.append(",\"clientQPS\":").append(std::to_string(clientQPS));
+	infos.append(",\"clientBurst\":").append(std::to_string(clientBurst));
+	infos.append(",\"trackedClients\":").append(std::to_string(trackedClients));
+	infos.append(",\"rejectedClientRequests\":").append(std::to_string(_statistics.rejectedClientRequests));
+
+	infos.append(",\"tables\":{");
+	bool needComma = false;
+	for (auto& tablePair: tables)
+	{
+		if (needComma)
+			infos.append(",");
+		else
+			needComma = true;
+
+		infos.append("\"").append(tablePair.first).append("\":{\"outstanding\":");
+		infos.append(std::to_string(tablePair.second->outstanding));
+		infos.append(",\"rejected\":").append(std::to_string(tablePair.second->rejected)).append("}");
+	}
+	infos.append("}}");
+	return infos;
+}
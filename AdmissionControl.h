@@ -0,0 +1,114 @@
+#ifndef Admission_Control_H
+#define Admission_Control_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+
+struct AdmissionStatistics
+{
+	std::atomic<uint64_t> rejectedClientRequests;		//-- over the client rate limit.
+	std::atomic<uint64_t> rejectedFetches;
+	std::atomic<uint64_t> hitsOnlyFetches;		//-- answered with cached rows only.
+	std::atomic<uint64_t> unloadedItems;		//-- missed rows not loaded by hits only answers.
+	std::atomic<uint64_t> rejectedWrites;
+
+	AdmissionStatistics(): rejectedClientRequests(0), rejectedFetches(0), hitsOnlyFetches(0),
+		unloadedItems(0), rejectedWrites(0) {}
+};
+
+//-- Outstanding DBProxy requests of the whole server, or of one table.
+struct AdmissionCounter
+{
+	std::atomic<int32_t> outstanding;
+	std::atomic<uint64_t> rejected;
+
+	AdmissionCounter(): outstanding(0), rejected(0) {}
+};
+typedef std::shared_ptr<AdmissionCounter> AdmissionCounterPtr;
+
+//-- Held until the DBProxy request is finished: the counters are released when the ticket is destroyed.
+class AdmissionTicket
+{
+	AdmissionCounterPtr _global;
+	AdmissionCounterPtr _table;
+
+public:
+	AdmissionTicket(AdmissionCounterPtr global, AdmissionCounterPtr table): _global(global), _table(table) {}
+	~AdmissionTicket()
+	{
+		_global->outstanding--;
+		_table->outstanding--;
+	}
+};
+typedef std::shared_ptr<AdmissionTicket> AdmissionTicketPtr;
+
+/*
+	Load shedding before DBProxy. A fetch miss, write-through modify or delete takes a ticket;
+	when the outstanding requests of the server or of the table are at the limit, the request is
+	rejected (fetches can be answered with cached rows only instead).
+	Client rate limit: token bucket of clientQPS requests per second and clientBurst requests
+	for each client IP, checked before any work.
+	Limits of 0 are unlimited. Created even with no limit, so the limits can be tuned on.
+*/
+class AdmissionController
+{
+public:
+	enum RequestKind
+	{
+		Fetch,
+		Write
+	};
+
+private:
+	struct ClientBucket
+	{
+		double tokens;
+		int64_t lastUsec;
+	};
+
+	std::atomic<int32_t> _maxOutstanding;
+	std::atomic<int32_t> _maxTableOutstanding;
+	bool _hitsOnly;
+
+	AdmissionCounterPtr _global;
+	std::mutex _tableMutex;
+	std::unordered_map<std::string, AdmissionCounterPtr> _tables;
+
+	std::mutex _clientMutex;
+	std::unordered_map<std::string, ClientBucket> _clients;
+	std::atomic<bool> _clientLimited;		//-- clientQPS > 0, read without the lock.
+	double _clientQPS;		//-- guarded by _clientMutex.
+	double _clientBurst;
+	double _configuredBurst;		//-- 0: follows clientQPS.
+	int64_t _lastClientCleanUsec;
+
+	AdmissionStatistics _statistics;
+
+	AdmissionCounterPtr tableCounter(const std::string& tableName);
+	void cleanClients(int64_t now);		//-- caller must hold _clientMutex.
+	void applyClientRate(double clientQPS, double clientBurst);
+
+public:
+	AdmissionController(int32_t maxOutstanding, int32_t maxTableOutstanding, bool hitsOnly,
+		double clientQPS, double clientBurst);
+
+	bool hitsOnly() const { return _hitsOnly; }
+	bool allowClient(const std::string& ip);
+
+	//-- nullptr if over a limit.
+	AdmissionTicketPtr acquire(const std::string& tableName, RequestKind kind);
+	void unloaded(size_t items) { _statistics.unloadedItems.fetch_add((uint64_t)items); }
+
+	void setMaxOutstanding(int32_t maxOutstanding) { _maxOutstanding = maxOutstanding; }
+	void setMaxTableOutstanding(int32_t maxTableOutstanding) { _maxTableOutstanding = maxTableOutstanding; }
+	void setClientQPS(double clientQPS);		//-- keeps the configured burst.
+	void setClientBurst(double clientBurst);		//-- less than 1: follows clientQPS.
+
+	std::string infos();
+};
+
+#endif
@@ -0,0 +1,257 @@
+#include <new>
+#include <algorithm>
+#include <fstream>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "FPLog.h"
+#include "StringUtil.h"
+#include "CacheArena.h"
+
+using namespace fpnn;
+
+static const size_t arenaChunkSize = 32 * 1024 * 1024;
+static const size_t defaultHugePageSize = 2 * 1024 * 1024;
+static const int maxNumaNodes = 1024;
+static const int numaPolicyPreferred = 1;		//-- MPOL_PREFERRED
+static const int numaPolicyInterleave = 3;		//-- MPOL_INTERLEAVE
+
+CacheArena::CacheArena(size_t blockSize, HugePageMode mode, const std::vector<int>& numaNodes):
+	_mode(mode), _numaNodes(numaNodes), _chunkCursor(NULL), _chunkEnd(NULL), _freeBlocks(NULL)
+{
+	_blockSize = (std::max(blockSize, sizeof(FreeBlock)) + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+	_hugePageSize = systemHugePageSize();
+	_chunkSize = regionBytes(arenaChunkSize);
+}
+
+CacheArena::~CacheArena()
+{
+	for (auto& chunk: _chunks)
+		munmap(chunk.address, chunk.bytes);
+	for (auto& array: _arrays)
+		munmap(array.address, array.bytes);
+}
+
+size_t CacheArena::systemHugePageSize()
+{
+	std::ifstream meminfo("/proc/meminfo");
+	std::string line;
+	while (std::getline(meminfo, line))
+	{
+		if (line.compare(0, 13, "Hugepagesize:") == 0)
+		{
+			size_t kb = (size_t)strtoull(line.c_str() + 13, NULL, 10);
+			if (kb)
+				return kb * 1024;
+		}
+	}
+	return defaultHugePageSize;
+}
+
+bool CacheArena::parseHugePageMode(const std::string& name, HugePageMode& mode)
+{
+	if (name.empty() || name == "none")
+		mode = NoHugePage;
+	else if (name == "transparent")
+		mode = TransparentHugePage;
+	else if (name == "explicit")
+		mode = ExplicitHugePage;
+	else
+		return false;
+
+	return true;
+}
+
+bool CacheArena::parseNumaNodes(const std::string& spec, std::vector<int>& nodes)
+{
+	nodes.clear();
+	std::string list = spec;
+	if (spec == "all")
+	{
+		//-- as "0-1,4".
+		std::ifstream online("/sys/devices/system/node/online");
+		if (!std::getline(online, list))
+			return false;
+	}
+
+	std::vector<std::string> items;
+	StringUtil::split(list, ", \n", items);
+	for (auto& item: items)
+	{
+		char* end;
+		long first = strtol(item.c_str(), &end, 10);
+		long last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+
+		if (*end || first < 0 || last < first || last >= maxNumaNodes)
+			return false;
+
+		for (long node = first; node <= last; node++)
+			nodes.push_back((int)node);
+	}
+	return true;
+}
+
+void CacheArena::bindNodes(void* address, size_t bytes)
+{
+	if (_numaNodes.empty())
+		return;
+
+	unsigned long mask[maxNumaNodes / (8 * sizeof(unsigned long))] = { 0 };
+	for (int node: _numaNodes)
+		mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+
+	int policy = _numaNodes.size() > 1 ? numaPolicyInterleave : numaPolicyPreferred;
+	if (syscall(SYS_mbind, address, bytes, policy, mask, (unsigned long)maxNumaNodes, 0) != 0)
+		LOG_WARN("Bind cache memory to NUMA nodes failed. errno: %d", errno);
+}
+
+//-- bytes is a multiple of the huge page size.
+void* CacheArena::mapRegion(size_t bytes, bool& hugeTlb)
+{
+	hugeTlb = false;
+	if (_mode == ExplicitHugePage)
+	{
+		void* region = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (region != MAP_FAILED)
+		{
+			hugeTlb = true;
+			bindNodes(region, bytes);
+			return region;
+		}
+
+		if (_statistics.hugeTlbFallbacks++ == 0)
+			LOG_WARN("Explicit huge pages are short (vm.nr_hugepages). Cache memory falls back to transparent huge pages.");
+	}
+
+	//-- Aligned to the huge page size, so every huge page range of the region can be backed by one.
+	size_t mapped = bytes + _hugePageSize;
+	char* raw = (char*)mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == (char*)MAP_FAILED)
+		return NULL;
+
+	char* region = (char*)(((uintptr_t)raw + _hugePageSize - 1) & ~(uintptr_t)(_hugePageSize - 1));
+	if (region > raw)
+		munmap(raw, region - raw);
+	if (raw + mapped > region + bytes)
+		munmap(region + bytes, raw + mapped - (region + bytes));
+
+	if (_mode != NoHugePage)
+		madvise(region, bytes, MADV_HUGEPAGE);
+
+	bindNodes(region, bytes);
+	return region;
+}
+
+void* CacheArena::allocate()
+{
+	_statistics.liveBlocks++;
+	if (_freeBlocks)
+	{
+		FreeBlock* block = _freeBlocks;
+		_freeBlocks = block->next;
+		_statistics.freeBlocks--;
+		return block;
+	}
+
+	if (_chunkCursor == NULL || _chunkCursor + _blockSize > _chunkEnd)
+	{
+		bool hugeTlb;
+		void* chunk = mapRegion(_chunkSize, hugeTlb);
+		if (!chunk)
+		{
+			_statistics.liveBlocks--;
+			throw std::bad_alloc();
+		}
+
+		Region region = { chunk, _chunkSize, hugeTlb };
+		_chunks.push_back(region);
+		_chunkCursor = (char*)chunk;
+		_chunkEnd = _chunkCursor + _chunkSize;
+
+		_statistics.chunkCount++;
+		_statistics.chunkBytes += _chunkSize;
+		if (hugeTlb)
+			_statistics.hugeTlbBytes += _chunkSize;
+	}
+
+	void* block = _chunkCursor;
+	_chunkCursor += _blockSize;
+	return block;
+}
+
+void CacheArena::deallocate(void* block)
+{
+	FreeBlock* freeBlock = (FreeBlock*)block;
+	freeBlock->next = _freeBlocks;
+	_freeBlocks = freeBlock;
+
+	_statistics.liveBlocks--;
+	_statistics.freeBlocks++;
+}
+
+void* CacheArena::allocateArray(size_t bytes)
+{
+	bool hugeTlb;
+	size_t size = regionBytes(bytes);
+	void* region = mapRegion(size, hugeTlb);
+	if (!region)
+		return NULL;
+
+	Region array = { region, size, hugeTlb };
+	_arrays.push_back(array);
+
+	_statistics.arrayBytes += size;
+	if (hugeTlb)
+		_statistics.hugeTlbBytes += size;
+	return region;
+}
+
+void CacheArena::deallocateArray(void* address)
+{
+	for (size_t i = 0; i < _arrays.size(); i++)
+	{
+		if (_arrays[i].address != address)
+			continue;
+
+		munmap(address, _arrays[i].bytes);
+		_statistics.arrayBytes -= _arrays[i].bytes;
+		if (_arrays[i].hugeTlb)
+			_statistics.hugeTlbBytes -= _arrays[i].bytes;
+
+		_arrays.erase(_arrays.begin() + i);
+		return;
+	}
+}
+
+std::string CacheArena::infos() const
+{
+	const char* modeNames[] = { "none", "transparent", "explicit" };
+
+	std::string infos("{\"hugePages\":\"");
+	infos.append(modeNames[_mode]).append("\"");
+	infos.append(",\"hugePageSize\":").append(std::to_string(_hugePageSize));
+
+	infos.append(",\"numaNodes\":[");
+	for (size_t i = 0; i < _numaNodes.size(); i++)
+	{
+		if (i)
+			infos.append(",");
+		infos.append(std::to_string(_numaNodes[i]));
+	}
+	infos.append("]");
+
+	infos.append(",\"blockSize\":").append(std::to_string(_blockSize));
+	infos.append(",\"liveBlocks\":").append(std::to_string(_statistics.liveBlocks));
+	infos.append(",\"freeBlocks\":").append(std::to_string(_statistics.freeBlocks));
+	infos.append(",\"chunkCount\":").append(std::to_string(_statistics.chunkCount));
+	infos.append(",\"chunkBytes\":").append(std::to_string(_statistics.chunkBytes));
+	infos.append(",\"arrayBytes\":").append(std::to_string(_statistics.arrayBytes));
+	infos.append(",\"hugeTlbBytes\":").append(std::to_string(_statistics.hugeTlbBytes));
+	infos.append(",\"hugeTlbFallbacks\":").append(std::to_string(_statistics.hugeTlbFallbacks));
+	infos.append("}");
+	return infos;
+}
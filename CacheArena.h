@@ -0,0 +1,102 @@
+#ifndef Cache_Arena_H
+#define Cache_Arena_H
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+struct CacheArenaStatistics
+{
+	uint64_t chunkCount;
+	uint64_t chunkBytes;
+	uint64_t arrayBytes;		//-- bucket arrays currently mapped.
+	uint64_t hugeTlbBytes;		//-- mapped from the explicit huge page pool.
+	uint64_t hugeTlbFallbacks;		//-- explicit huge pages wanted, but the pool was short.
+	uint64_t liveBlocks;
+	uint64_t freeBlocks;
+
+	CacheArenaStatistics(): chunkCount(0), chunkBytes(0), arrayBytes(0), hugeTlbBytes(0),
+		hugeTlbFallbacks(0), liveBlocks(0), freeBlocks(0) {}
+};
+
+/*
+	Memory of the cache map outside the malloc heap: fixed size blocks for the map nodes, carved
+	from large chunks, and zeroed regions for the bucket arrays.
+	Every region is mapped aligned to the huge page size, and optionally:
+		TransparentHugePage: madvise(MADV_HUGEPAGE), so lookups walk chains on few TLB entries.
+		ExplicitHugePage:    MAP_HUGETLB from the vm.nr_hugepages pool, falling back to
+		                     transparent huge pages when the pool is short.
+		NUMA nodes:          pages interleaved on the nodes (mbind, before the first touch), so no
+		                     node holds the whole cache, and every worker pays the same average.
+	Chunks are kept until the arena is destroyed; freed blocks are reused.
+	Not thread safe, like the map using it.
+*/
+class CacheArena
+{
+public:
+	enum HugePageMode
+	{
+		NoHugePage,
+		TransparentHugePage,
+		ExplicitHugePage
+	};
+
+private:
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	struct Region
+	{
+		void* address;
+		size_t bytes;
+		bool hugeTlb;
+	};
+
+	size_t _blockSize;
+	size_t _chunkSize;
+	size_t _hugePageSize;
+	HugePageMode _mode;
+	std::vector<int> _numaNodes;
+
+	std::vector<Region> _chunks;
+	std::vector<Region> _arrays;
+	char* _chunkCursor;
+	char* _chunkEnd;
+	FreeBlock* _freeBlocks;
+
+	CacheArenaStatistics _statistics;
+
+	void* mapRegion(size_t bytes, bool& hugeTlb);
+	void bindNodes(void* address, size_t bytes);
+	size_t regionBytes(size_t bytes) const { return (bytes + _hugePageSize - 1) / _hugePageSize * _hugePageSize; }
+
+	CacheArena(const CacheArena&);
+	CacheArena& operator = (const CacheArena&);
+
+public:
+	CacheArena(size_t blockSize, HugePageMode mode, const std::vector<int>& numaNodes);
+	~CacheArena();
+
+	//-- throw std::bad_alloc as operator new does.
+	void* allocate();
+	void deallocate(void* block);
+
+	//-- zeroed, as calloc().
+	void* allocateArray(size_t bytes);
+	void deallocateArray(void* address);
+
+	HugePageMode mode() const { return _mode; }
+	const CacheArenaStatistics& statistics() const { return _statistics; }
+	std::string infos() const;
+
+	//-- "none" (or empty), "transparent", "explicit".
+	static bool parseHugePageMode(const std::string& name, HugePageMode& mode);
+	//-- empty: no policy; "all": the online nodes; or a list, as "0,1".
+	static bool parseNumaNodes(const std::string& spec, std::vector<int>& nodes);
+	static size_t systemHugePageSize();
+};
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include "CacheSimulator.h"
+
+//===============================================//
+//-- SimulatedCache
+//===============================================//
+SimulatedCache::SimulatedCache(Policy policy, size_t capacity): _policy(policy), _capacity(capacity ? capacity : 1),
+	_accessCount(0), _hitCount(0)
+{
+	reset();
+}
+
+void SimulatedCache::reset()
+{
+	_map.reset(new KeyMap(_capacity, _capacity + 1));
+	_accessCount = 0;
+	_hitCount = 0;
+}
+
+bool SimulatedCache::access(uint64_t key)
+{
+	SimulatedKey simulatedKey;
+	simulatedKey.value = key;
+
+	_accessCount++;
+	KeyMap::node_type* node = _map->find(simulatedKey);
+	if (node)
+	{
+		if (_policy == LRU)
+			_map->fresh_node(node);
+
+		_hitCount++;
+		return true;
+	}
+
+	if (_map->count() >= _capacity)
+		_map->remove_node(_map->most_stale());
+
+	_map->insert(simulatedKey, 0);
+	return false;
+}
+
+void SimulatedCache::invalidate(uint64_t key)
+{
+	SimulatedKey simulatedKey;
+	simulatedKey.value = key;
+
+	KeyMap::node_type* node = _map->find(simulatedKey);
+	if (node)
+		_map->remove_node(node);
+}
+
+//===============================================//
+//-- MissRatioEstimator
+//===============================================//
+MissRatioEstimator::MissRatioEstimator(double sampleRatio, const std::vector<size_t>& capacities, SimulatedCache::Policy policy):
+	_sampleRatio(sampleRatio), _capacities(capacities), _totalAccesses(0)
+{
+	if (_sampleRatio > 1)
+		_sampleRatio = 1;
+
+	_threshold = (uint64_t)(_sampleRatio * 1000000);
+	for (size_t capacity: _capacities)
+	{
+		size_t shadowCapacity = (size_t)(capacity * _sampleRatio);
+		_shadows.push_back(std::make_shared<SimulatedCache>(policy, shadowCapacity ? shadowCapacity : 1));
+	}
+}
+
+void MissRatioEstimator::record(const std::vector<uint64_t>& keys)
+{
+	std::unique_lock<std::mutex> lck(_mutex);
+	for (auto& shadow: _shadows)
+		for (uint64_t key: keys)
+			shadow->access(key);
+}
+
+void MissRatioEstimator::invalidate(const std::string& tableName, int64_t hintId)
+{
+	uint64_t key = simulatedKeyHash(tableName, hintId);
+	if (!sampled(key))
+		return;
+
+	std::unique_lock<std::mutex> lck(_mutex);
+	for (auto& shadow: _shadows)
+		shadow->invalidate(key);
+}
+
+void MissRatioEstimator::reset()
+{
+	std::unique_lock<std::mutex> lck(_mutex);
+	for (auto& shadow: _shadows)
+		shadow->reset();
+
+	_totalAccesses = 0;
+}
+
+std::string MissRatioEstimator::infos()
+{
+	std::unique_lock<std::mutex> lck(_mutex);
+
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%g", _sampleRatio);
+
+	uint64_t totalAccesses = _totalAccesses;
+	uint64_t sampledAccesses = _shadows.empty() ? 0 : _shadows[0]->accessCount();
+	double expectedAccesses = totalAccesses * _sampleRatio;
+
+	std::string infos("{\"sampleRatio\":");
+	infos.append(buf);
+	infos.append(",\"totalAccesses\":").append(std::to_string(totalAccesses));
+	infos.append(",\"sampledAccesses\":").append(std::to_string(sampledAccesses));
+	infos.append(",\"curve\":[");
+
+	for (size_t i = 0; i < _shadows.size(); i++)
+	{
+		if (i)
+			infos.append(",");
+
+		double hitRatio = 0;
+		if (expectedAccesses >= 1)
+			hitRatio = (_shadows[i]->hitCount() + (expectedAccesses - sampledAccesses)) / expectedAccesses;
+
+		if (hitRatio < 0)
+			hitRatio = 0;
+		else if (hitRatio > 1)
+			hitRatio = 1;
+
+		snprintf(buf, sizeof(buf), "%.4f", hitRatio);
+		infos.append("{\"capacity\":").append(std::to_string(_capacities[i]));
+		infos.append(",\"hitRatio\":").append(buf).append("}");
+	}
+
+	infos.append("]}");
+	return infos;
+}
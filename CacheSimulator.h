@@ -0,0 +1,115 @@
+#ifndef Cache_Simulator_H
+#define Cache_Simulator_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "jenkins.h"
+#include "LruHashMap.h"
+
+using namespace fpnn;
+
+//-- 64 bits identity of a cached row. Also decides whether the row is sampled.
+inline uint64_t simulatedKeyHash(const std::string& tableName, int64_t hintId)
+{
+	uint64_t x = (uint64_t)hintId * 0x9E3779B97F4A7C15ULL;
+	x ^= (uint64_t)jenkins_hash(tableName.data(), tableName.length(), 0) << 32;
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+}
+
+struct SimulatedKey
+{
+	uint64_t value;
+
+	bool operator == (const struct SimulatedKey& key) const { return value == key.value; }
+	unsigned int hash() const { return (unsigned int)(value ^ (value >> 32)); }
+};
+
+/*
+	Key-only cache driven by the same LruHashMap as the real cache.
+	LRU freshes a key on hit; FIFO evicts in insertion order.
+*/
+class SimulatedCache
+{
+public:
+	enum Policy { LRU, FIFO };
+
+private:
+	typedef LruHashMap<SimulatedKey, char> KeyMap;
+
+	Policy _policy;
+	size_t _capacity;
+	std::unique_ptr<KeyMap> _map;
+	uint64_t _accessCount;
+	uint64_t _hitCount;
+
+public:
+	SimulatedCache(Policy policy, size_t capacity);
+
+	bool access(uint64_t key);		//-- returns hit. The key is cached after the access.
+	void invalidate(uint64_t key);
+	void reset();
+
+	static const char* policyName(Policy policy) { return policy == LRU ? "lru" : "fifo"; }
+	Policy policy() const { return _policy; }
+	size_t capacity() const { return _capacity; }
+	uint64_t accessCount() const { return _accessCount; }
+	uint64_t hitCount() const { return _hitCount; }
+	double hitRatio() const { return _accessCount ? (double)_hitCount / _accessCount : 0; }
+};
+
+/*
+	SHARDS style miss ratio curve estimation: rows whose key hash falls under the sample
+	ratio are replayed into shadow caches, each sized capacity * sampleRatio. The hit ratio
+	of a shadow cache estimates the hit ratio of a full cache of that capacity.
+	Reported ratios are SHARDS-adj corrected: the gap between expected and actual sampled
+	accesses (mostly from a few hot keys being sampled or not) is counted as hits.
+*/
+class MissRatioEstimator
+{
+	std::mutex _mutex;
+	uint64_t _threshold;		//-- sampled if hash % 1000000 < threshold.
+	double _sampleRatio;
+	std::vector<size_t> _capacities;
+	std::vector<std::shared_ptr<SimulatedCache>> _shadows;
+	std::atomic<uint64_t> _totalAccesses;
+
+	void record(const std::vector<uint64_t>& keys);
+
+public:
+	MissRatioEstimator(double sampleRatio, const std::vector<size_t>& capacities, SimulatedCache::Policy policy = SimulatedCache::LRU);
+
+	inline bool sampled(uint64_t key) const { return (key % 1000000) < _threshold; }
+
+	template <typename Container>
+	void access(const std::string& tableName, const Container& hintIds)
+	{
+		std::vector<uint64_t> keys;
+		_totalAccesses.fetch_add((uint64_t)hintIds.size(), std::memory_order_relaxed);
+		for (int64_t hintId: hintIds)
+		{
+			uint64_t key = simulatedKeyHash(tableName, hintId);
+			if (sampled(key))
+				keys.push_back(key);
+		}
+
+		if (keys.size())
+			record(keys);
+	}
+
+	void invalidate(const std::string& tableName, int64_t hintId);
+	void reset();
+
+	double sampleRatio() const { return _sampleRatio; }
+	std::string infos();
+};
+
+#endif
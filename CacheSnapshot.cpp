@@ -0,0 +1,631 @@
+#include <chrono>
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "FPLog.h"
+#include "CacheSnapshot.h"
+
+static const char* const snapshotMagic = "TCSNAP01";
+static const size_t snapshotMagicLength = 8;
+static const size_t snapshotIOBufferSize = 4 * 1024 * 1024;
+static const uint64_t snapshotMaxItemLength = 1024 * 1024 * 1024;
+static const uint64_t snapshotMaxBlockItems = 16 * 1024 * 1024;
+
+enum SnapshotTag
+{
+	TableTag = 1,
+	RowsTag = 2,
+	TableEndTag = 3,
+	FileEndTag = 0xFF,
+};
+
+enum JournalTag
+{
+	JournalRowTag = 1,
+	JournalTableTag = 2,
+	JournalOverflowTag = 3,		//-- msec only: entries before it are lost.
+	JournalOpenTag = 4,		//-- msec only: the journal is appended by a running server.
+	JournalCloseTag = 5,		//-- msec only: all entries before it are written.
+};
+
+static const size_t journalFlushBytes = 1024 * 1024;
+static const int64_t journalMinCompactIntervalMsec = 60 * 1000;
+
+static int64_t currentMsec()
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+static void appendVarint(std::string& buf, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		buf.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+	buf.push_back((char)value);
+}
+
+static void appendInt64(std::string& buf, int64_t value)
+{
+	uint64_t v = (uint64_t)value;
+	for (int i = 0; i < 8; i++)
+		buf.push_back((char)((v >> (i * 8)) & 0xFF));
+}
+
+static void appendString(std::string& buf, const std::string& value)
+{
+	appendVarint(buf, value.length());
+	buf.append(value);
+}
+
+static bool readVarintFrom(FILE* fp, uint64_t& value)
+{
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		int c = fgetc(fp);
+		if (c == EOF)
+			return false;
+
+		value |= ((uint64_t)(c & 0x7F)) << shift;
+		if ((c & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+static bool readInt64From(FILE* fp, int64_t& value)
+{
+	unsigned char buf[8];
+	if (fread(buf, 1, 8, fp) != 8)
+		return false;
+
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; i--)
+		v = (v << 8) | buf[i];
+
+	value = (int64_t)v;
+	return true;
+}
+
+static bool readStringFrom(FILE* fp, std::string& value)
+{
+	uint64_t len;
+	if (!readVarintFrom(fp, len) || len > snapshotMaxItemLength)
+		return false;
+
+	value.resize(len);
+	if (len == 0)
+		return true;
+
+	return fread(&value[0], 1, len, fp) == len;
+}
+
+//===============================================//
+//-- SnapshotFileWriter
+//===============================================//
+SnapshotFileWriter::~SnapshotFileWriter()
+{
+	abort();
+}
+
+void SnapshotFileWriter::writeBytes(const void* data, size_t size)
+{
+	if (_fp && fwrite(data, 1, size, _fp) != size)
+	{
+		LOG_ERROR("Write snapshot file %s failed. errno: %d", _tmpPath.c_str(), errno);
+		abort();
+	}
+}
+
+bool SnapshotFileWriter::open(const std::string& path, int64_t createMsec)
+{
+	_path = path;
+	_tmpPath = path + ".tmp";
+	_totalRows = 0;
+
+	_fp = fopen(_tmpPath.c_str(), "wb");
+	if (!_fp)
+	{
+		LOG_ERROR("Create snapshot file %s failed. errno: %d", _tmpPath.c_str(), errno);
+		return false;
+	}
+	setvbuf(_fp, NULL, _IOFBF, snapshotIOBufferSize);
+
+	std::string buf(snapshotMagic, snapshotMagicLength);
+	appendInt64(buf, createMsec);
+	writeBytes(buf.data(), buf.length());
+	return _fp != NULL;
+}
+
+void SnapshotFileWriter::beginTable(const std::string& tableName, const std::string& splitHint, const std::vector<std::vector<std::string>>& desc)
+{
+	std::string buf;
+	buf.push_back((char)TableTag);
+	appendString(buf, tableName);
+	appendString(buf, splitHint);
+	appendVarint(buf, desc.size());
+	for (const auto& descRow: desc)
+	{
+		appendVarint(buf, descRow.size());
+		for (const auto& item: descRow)
+			appendString(buf, item);
+	}
+	writeBytes(buf.data(), buf.length());
+}
+
+void SnapshotFileWriter::writeRows(const std::vector<std::vector<std::string>>& rows)
+{
+	if (rows.empty())
+		return;
+
+	std::string buf(1, (char)RowsTag);
+	appendVarint(buf, rows.size());
+
+	for (const auto& row: rows)
+		for (const auto& item: row)
+			appendString(buf, item);
+
+	writeBytes(buf.data(), buf.length());
+	_totalRows += (int64_t)rows.size();
+}
+
+void SnapshotFileWriter::endTable()
+{
+	std::string tag(1, (char)TableEndTag);
+	writeBytes(tag.data(), tag.length());
+}
+
+bool SnapshotFileWriter::commit()
+{
+	if (!_fp)
+		return false;
+
+	std::string buf(1, (char)FileEndTag);
+	appendInt64(buf, _totalRows);
+	writeBytes(buf.data(), buf.length());
+	if (!_fp)
+		return false;
+
+	bool ok = (fflush(_fp) == 0) && (fsync(fileno(_fp)) == 0);
+	fclose(_fp);
+	_fp = NULL;
+
+	if (!ok || rename(_tmpPath.c_str(), _path.c_str()) != 0)
+	{
+		LOG_ERROR("Commit snapshot file %s failed. errno: %d", _path.c_str(), errno);
+		unlink(_tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+void SnapshotFileWriter::abort()
+{
+	if (_fp)
+	{
+		fclose(_fp);
+		_fp = NULL;
+		unlink(_tmpPath.c_str());
+	}
+}
+
+//===============================================//
+//-- SnapshotFileReader
+//===============================================//
+SnapshotFileReader::~SnapshotFileReader()
+{
+	if (_fp)
+		fclose(_fp);
+}
+
+bool SnapshotFileReader::readBytes(void* buf, size_t size)
+{
+	if (fread(buf, 1, size, _fp) != size)
+		_failed = true;
+	return !_failed;
+}
+
+bool SnapshotFileReader::readVarint(uint64_t& value)
+{
+	if (!readVarintFrom(_fp, value))
+		_failed = true;
+	return !_failed;
+}
+
+bool SnapshotFileReader::readInt64(int64_t& value)
+{
+	if (!readInt64From(_fp, value))
+		_failed = true;
+	return !_failed;
+}
+
+bool SnapshotFileReader::readString(std::string& value)
+{
+	if (!readStringFrom(_fp, value))
+		_failed = true;
+	return !_failed;
+}
+
+bool SnapshotFileReader::open(const std::string& path)
+{
+	_fp = fopen(path.c_str(), "rb");
+	if (!_fp)
+		return false;
+
+	setvbuf(_fp, NULL, _IOFBF, snapshotIOBufferSize);
+
+	char magic[snapshotMagicLength];
+	if (!readBytes(magic, snapshotMagicLength) || memcmp(magic, snapshotMagic, snapshotMagicLength) != 0)
+	{
+		LOG_ERROR("Snapshot file %s has invalid magic.", path.c_str());
+		return false;
+	}
+
+	return readInt64(_createMsec);
+}
+
+SnapshotFileReader::BlockType SnapshotFileReader::nextBlock()
+{
+	unsigned char tag;
+	if (_failed || !readBytes(&tag, 1))
+		return Corrupted;
+
+	switch (tag)
+	{
+		case TableTag: return TableBlock;
+		case RowsTag: return RowsBlock;
+		case TableEndTag: return TableEndBlock;
+		case FileEndTag: return FileEnd;
+		default: return Corrupted;
+	}
+}
+
+bool SnapshotFileReader::readTableHeader(std::string& tableName, std::string& splitHint, std::vector<std::vector<std::string>>& desc)
+{
+	uint64_t columnCount;
+	if (!readString(tableName) || !readString(splitHint) || !readVarint(columnCount))
+		return false;
+
+	if (columnCount > snapshotMaxBlockItems)
+	{
+		_failed = true;
+		return false;
+	}
+
+	desc.clear();
+	desc.resize(columnCount);
+	for (auto& descRow: desc)
+	{
+		uint64_t itemCount;
+		if (!readVarint(itemCount) || itemCount > snapshotMaxBlockItems)
+			return false;
+
+		descRow.resize(itemCount);
+		for (auto& item: descRow)
+			if (!readString(item))
+				return false;
+	}
+	return true;
+}
+
+bool SnapshotFileReader::readRows(size_t columnCount, std::vector<std::vector<std::string>>& rows)
+{
+	uint64_t rowCount;
+	if (!readVarint(rowCount) || rowCount > snapshotMaxBlockItems)
+		return false;
+
+	rows.clear();
+	rows.resize(rowCount);
+	for (auto& row: rows)
+	{
+		row.resize(columnCount);
+		for (auto& item: row)
+			if (!readString(item))
+				return false;
+	}
+	return true;
+}
+
+bool SnapshotFileReader::readFileEnd(int64_t& totalRows)
+{
+	return readInt64(totalRows);
+}
+
+//===============================================//
+//-- InvalidationJournal
+//===============================================//
+InvalidationJournal::~InvalidationJournal()
+{
+	close();
+}
+
+bool InvalidationJournal::open(const std::string& path, size_t maxBytes, int64_t maxAgeMsec, int flushMsec)
+{
+	{
+		std::unique_lock<std::mutex> lck(_fileMutex);
+		_path = path;
+		_fp = fopen(path.c_str(), "ab");
+		if (!_fp)
+		{
+			LOG_ERROR("Open invalidation journal %s failed. errno: %d", path.c_str(), errno);
+			return false;
+		}
+
+		//-- Until close() writes the close mark, the journal may miss the entries buffered at a crash.
+		std::string mark;
+		mark.push_back((char)JournalOpenTag);
+		appendInt64(mark, currentMsec());
+		if (fwrite(mark.data(), 1, mark.length(), _fp) != mark.length() || fflush(_fp) != 0)
+		{
+			LOG_ERROR("Write invalidation journal %s failed. errno: %d", path.c_str(), errno);
+			fclose(_fp);
+			_fp = NULL;
+			return false;
+		}
+
+		long size = ftell(_fp);
+		_fileBytes = size > 0 ? (uint64_t)size : 0;
+		_maxBytes = maxBytes;
+		_maxAgeMsec = maxAgeMsec;
+		_flushMsec = flushMsec > 0 ? flushMsec : 1;
+		_lastCompactMsec = currentMsec();
+	}
+
+	std::unique_lock<std::mutex> lck(_mutex);
+	_running = true;
+	_flushThread = std::thread(&InvalidationJournal::flushThread, this);
+	return true;
+}
+
+void InvalidationJournal::close()
+{
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		_running = false;
+	}
+	_flushCondition.notify_all();
+
+	if (_flushThread.joinable())
+		_flushThread.join();
+
+	std::string buf;
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		buf.swap(_pending);
+	}
+	writePending(buf);
+
+	std::unique_lock<std::mutex> lck(_fileMutex);
+	if (_fp)
+	{
+		std::string mark;
+		mark.push_back((char)JournalCloseTag);
+		appendInt64(mark, currentMsec());
+		if (fwrite(mark.data(), 1, mark.length(), _fp) != mark.length() || fflush(_fp) != 0)
+			LOG_ERROR("Write invalidation journal %s failed. errno: %d", _path.c_str(), errno);
+
+		fclose(_fp);
+		_fp = NULL;
+	}
+}
+
+void InvalidationJournal::encodeEntry(const Entry& entry, std::string& buf)
+{
+	buf.push_back((char)(entry.wholeTable ? JournalTableTag : JournalRowTag));
+	appendInt64(buf, entry.msec);
+	appendString(buf, entry.tableName);
+	if (!entry.wholeTable)
+		appendInt64(buf, entry.hintId);
+}
+
+//-- Only buffered: the request path never waits for the file.
+void InvalidationJournal::append(const Entry& entry)
+{
+	std::unique_lock<std::mutex> lck(_mutex);
+	if (!_running)
+		return;
+
+	encodeEntry(entry, _pending);
+	if (_pending.length() >= journalFlushBytes)
+		_flushCondition.notify_one();
+}
+
+void InvalidationJournal::invalidate(const std::string& tableName, int64_t hintId)
+{
+	Entry entry;
+	entry.msec = currentMsec();
+	entry.wholeTable = false;
+	entry.tableName = tableName;
+	entry.hintId = hintId;
+	append(entry);
+}
+
+void InvalidationJournal::invalidateTable(const std::string& tableName)
+{
+	Entry entry;
+	entry.msec = currentMsec();
+	entry.wholeTable = true;
+	entry.tableName = tableName;
+	entry.hintId = 0;
+	append(entry);
+}
+
+void InvalidationJournal::flushThread()
+{
+	std::string buf;
+	std::unique_lock<std::mutex> lck(_mutex);
+	while (_running)
+	{
+		if (_pending.length() < journalFlushBytes)
+			_flushCondition.wait_for(lck, std::chrono::milliseconds(_flushMsec));
+
+		buf.swap(_pending);
+		lck.unlock();
+
+		writePending(buf);
+		buf.clear();
+
+		lck.lock();
+	}
+}
+
+void InvalidationJournal::writePending(std::string& buf)
+{
+	std::unique_lock<std::mutex> lck(_fileMutex);
+	if (!_fp)
+		return;
+
+	if (buf.length())
+	{
+		if (fwrite(buf.data(), 1, buf.length(), _fp) != buf.length() || fflush(_fp) != 0)
+			LOG_ERROR("Write invalidation journal %s failed. errno: %d", _path.c_str(), errno);
+		_fileBytes += buf.length();
+	}
+
+	int64_t compactInterval = std::max<int64_t>(_maxAgeMsec, journalMinCompactIntervalMsec);
+	if ((_maxBytes && _fileBytes > _maxBytes) || (_maxAgeMsec && currentMsec() - _lastCompactMsec >= compactInterval))
+		compactFile();
+}
+
+bool InvalidationJournal::readEntries(const std::string& path, std::vector<Entry>& entries, int64_t& overflowMsec, bool& closed)
+{
+	overflowMsec = 0;
+	closed = false;
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (!fp)
+		return false;
+
+	while (true)
+	{
+		int tag = fgetc(fp);
+		if (tag == EOF)
+			break;
+
+		if (tag == JournalOverflowTag || tag == JournalOpenTag || tag == JournalCloseTag)
+		{
+			int64_t msec;
+			if (!readInt64From(fp, msec))
+			{
+				LOG_WARN("Invalidation journal %s has truncated tail. Ignored.", path.c_str());
+				closed = false;
+				break;
+			}
+
+			if (tag == JournalOverflowTag)
+				overflowMsec = std::max(overflowMsec, msec);
+			closed = (tag == JournalCloseTag);
+			continue;
+		}
+
+		closed = false;
+
+		Entry entry;
+		entry.wholeTable = (tag == JournalTableTag);
+		entry.hintId = 0;
+
+		if ((tag != JournalTableTag && tag != JournalRowTag)
+			|| !readInt64From(fp, entry.msec) || !readStringFrom(fp, entry.tableName)
+			|| (!entry.wholeTable && !readInt64From(fp, entry.hintId)))
+		{
+			LOG_WARN("Invalidation journal %s has truncated tail. Ignored.", path.c_str());
+			break;
+		}
+
+		entries.push_back(entry);
+	}
+
+	fclose(fp);
+	return true;
+}
+
+InvalidationJournal::LoadResult InvalidationJournal::load(const std::string& path, int64_t sinceMsec, std::vector<Entry>& entries)
+{
+	std::vector<Entry> all;
+	int64_t overflowMsec;
+	bool closed;
+	readEntries(path, all, overflowMsec, closed);
+	if (!closed)
+		return NotClosed;
+
+	if (overflowMsec && overflowMsec >= sinceMsec)
+		return Overflowed;
+
+	for (auto& entry: all)
+		if (entry.msec >= sinceMsec)
+			entries.push_back(entry);
+
+	return Loaded;
+}
+
+void InvalidationJournal::compact(int64_t sinceMsec)
+{
+	std::unique_lock<std::mutex> lck(_fileMutex);
+	_floorMsec = std::max(_floorMsec, sinceMsec);
+	if (_fp)
+		compactFile();
+}
+
+void InvalidationJournal::compactFile()
+{
+	int64_t now = currentMsec();
+	_lastCompactMsec = now;
+
+	//-- Entries older than maxAge can only apply to snapshots too old to be loaded.
+	int64_t floorMsec = _floorMsec;
+	if (_maxAgeMsec)
+		floorMsec = std::max(floorMsec, now - _maxAgeMsec);
+
+	//-- Open & close marks are dropped: the journal is open, and the close mark is written by close().
+	std::vector<Entry> all;
+	int64_t overflowMsec;
+	bool closed;
+	readEntries(_path, all, overflowMsec, closed);
+
+	std::string buf;
+	if (overflowMsec && overflowMsec >= floorMsec)
+	{
+		buf.push_back((char)JournalOverflowTag);
+		appendInt64(buf, overflowMsec);
+	}
+
+	for (auto& entry: all)
+	{
+		if (entry.msec < floorMsec)
+			continue;
+
+		encodeEntry(entry, buf);
+	}
+
+	//-- Half of the limit, so a full journal is not compacted again on every flush.
+	if (_maxBytes && buf.length() > _maxBytes / 2)
+	{
+		LOG_WARN("Invalidation journal %s exceeds %llu bytes. Current snapshot will not be loaded.",
+			_path.c_str(), (unsigned long long)_maxBytes);
+		buf.clear();
+		buf.push_back((char)JournalOverflowTag);
+		appendInt64(buf, now);
+	}
+
+	std::string tmpPath = _path + ".tmp";
+	FILE* fp = fopen(tmpPath.c_str(), "wb");
+	if (!fp)
+		return;
+
+	bool ok = (fwrite(buf.data(), 1, buf.length(), fp) == buf.length());
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok || rename(tmpPath.c_str(), _path.c_str()) != 0)
+	{
+		unlink(tmpPath.c_str());
+		return;
+	}
+
+	fclose(_fp);
+	_fp = fopen(_path.c_str(), "ab");
+	_fileBytes = buf.length();
+}
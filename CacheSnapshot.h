@@ -0,0 +1,142 @@
+#ifndef Cache_Snapshot_H
+#define Cache_Snapshot_H
+
+#include <stdio.h>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <condition_variable>
+#include <vector>
+#include <stdint.h>
+
+/*
+	Snapshot file layout (all integers are little-endian, strings are varint length + bytes):
+
+		magic[8] "TCSNAP01", createMsec:int64
+		{ TABLE tag, tableName, splitHint, columnCount:varint, { descRow:[string] } * columnCount
+			{ ROWS tag, rowCount:varint, { row:string * columnCount } * rowCount } *
+			TABLE_END tag } *
+		FILE_END tag, totalRows:int64
+*/
+
+class SnapshotFileWriter
+{
+	FILE* _fp;
+	std::string _path;
+	std::string _tmpPath;
+	int64_t _totalRows;
+
+	void writeBytes(const void* data, size_t size);
+
+public:
+	SnapshotFileWriter(): _fp(NULL), _totalRows(0) {}
+	~SnapshotFileWriter();
+
+	bool open(const std::string& path, int64_t createMsec);
+	void beginTable(const std::string& tableName, const std::string& splitHint, const std::vector<std::vector<std::string>>& desc);
+	void writeRows(const std::vector<std::vector<std::string>>& rows);
+	void endTable();
+	bool commit();		//-- flush, fsync & rename the temporary file to the target path.
+	void abort();
+
+	int64_t totalRows() const { return _totalRows; }
+};
+
+class SnapshotFileReader
+{
+	FILE* _fp;
+	int64_t _createMsec;
+	bool _failed;
+
+	bool readBytes(void* buf, size_t size);
+	bool readVarint(uint64_t& value);
+	bool readInt64(int64_t& value);
+	bool readString(std::string& value);
+
+public:
+	enum BlockType { TableBlock, RowsBlock, TableEndBlock, FileEnd, Corrupted };
+
+	SnapshotFileReader(): _fp(NULL), _createMsec(0), _failed(false) {}
+	~SnapshotFileReader();
+
+	bool open(const std::string& path);
+	int64_t createMsec() const { return _createMsec; }
+
+	BlockType nextBlock();
+	bool readTableHeader(std::string& tableName, std::string& splitHint, std::vector<std::vector<std::string>>& desc);
+	bool readRows(size_t columnCount, std::vector<std::vector<std::string>>& rows);
+	bool readFileEnd(int64_t& totalRows);
+};
+
+/*
+	Invalidations happened after a snapshot was taken. Replayed on the loaded snapshot, so that
+	rows & tables invalidated between the snapshot and the restart are not served stale.
+
+	Entries are buffered and written by a flush thread every flushMsec: a crash loses the last
+	flushMsec of the journal. The file is compacted when it exceeds maxBytes, and every maxAgeMsec:
+	entries older than the last dumped snapshot, or than maxAgeMsec (the snapshot would be too old
+	to load), are dropped. When the remaining entries still exceed the limit, they are replaced by
+	an overflow mark: snapshots created before it are not loaded any more.
+	close() ends the file with a close mark. Without it the server crashed, the buffered entries
+	may be lost, and no snapshot is loaded with the journal.
+*/
+class InvalidationJournal
+{
+public:
+	struct Entry
+	{
+		int64_t msec;
+		bool wholeTable;
+		std::string tableName;
+		int64_t hintId;
+	};
+
+	enum LoadResult
+	{
+		Loaded,
+		Overflowed,		//-- invalidations after the snapshot are lost.
+		NotClosed		//-- the server crashed, the buffered entries may be lost.
+	};
+
+private:
+	std::mutex _mutex;		//-- guards _pending & _running.
+	std::condition_variable _flushCondition;
+	std::string _pending;
+	bool _running;
+	std::thread _flushThread;
+
+	std::mutex _fileMutex;		//-- guards the file & the fields below.
+	FILE* _fp;
+	std::string _path;
+	uint64_t _fileBytes;
+	int64_t _floorMsec;		//-- create time of the last dumped snapshot.
+	int64_t _lastCompactMsec;
+
+	size_t _maxBytes;
+	int64_t _maxAgeMsec;
+	int _flushMsec;
+
+	static void encodeEntry(const Entry& entry, std::string& buf);
+	static bool readEntries(const std::string& path, std::vector<Entry>& entries, int64_t& overflowMsec, bool& closed);
+	void append(const Entry& entry);
+	void flushThread();
+	void writePending(std::string& buf);
+	void compactFile();		//-- caller must hold _fileMutex.
+
+public:
+	InvalidationJournal(): _running(false), _fp(NULL), _fileBytes(0), _floorMsec(0), _lastCompactMsec(0),
+		_maxBytes(0), _maxAgeMsec(0), _flushMsec(100) {}
+	~InvalidationJournal();
+
+	//-- maxBytes & maxAgeMsec: 0 means no limit.
+	bool open(const std::string& path, size_t maxBytes, int64_t maxAgeMsec, int flushMsec);
+	void close();		//-- writes the buffered entries & the close mark.
+	void invalidate(const std::string& tableName, int64_t hintId);
+	void invalidateTable(const std::string& tableName);
+
+	void compact(int64_t sinceMsec);		//-- drop entries older than sinceMsec, the create time of the dumped snapshot.
+
+	static LoadResult load(const std::string& path, int64_t sinceMsec, std::vector<Entry>& entries);
+};
+
+#endif
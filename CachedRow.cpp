@@ -0,0 +1,415 @@
+#include <new>
+#include <chrono>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include "jenkins.h"
+#include "CachedRow.h"
+
+static const uint16_t cachedRowStackColumns = 64;
+static const uint8_t compressedCell = 4;
+
+//-- Leads the buffer of a row with compressed cells, so the row releases its bytes from the table counters.
+struct CompressedRowHeader
+{
+	std::shared_ptr<CompressionStatistics> compression;
+	uint64_t rawBytes;
+	uint64_t storedBytes;
+};
+
+static inline uint64_t cachedRowNowNsec()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void appendVarint(std::string& buf, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		buf.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+	buf.push_back((char)value);
+}
+
+static uint64_t readVarint(const char* data, uint32_t& offset)
+{
+	uint64_t value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		uint8_t c = (uint8_t)data[offset++];
+		value |= ((uint64_t)(c & 0x7F)) << shift;
+		if ((c & 0x80) == 0)
+			break;
+	}
+	return value;
+}
+
+static inline uint64_t zigzag(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+static inline int64_t unzigzag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+//-- Proleptic Gregorian calendar, days since 1970-01-01.
+static int64_t daysFromCivil(int64_t y, unsigned m, unsigned d)
+{
+	y -= m <= 2;
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = (unsigned)(y - era * 400);
+	unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void civilFromDays(int64_t days, int& y, unsigned& m, unsigned& d)
+{
+	days += 719468;
+	int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+	unsigned doe = (unsigned)(days - era * 146097);
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+	d = doy - (153 * mp + 2) / 5 + 1;
+	m = mp < 10 ? mp + 3 : mp - 9;
+	y = (int)(yoe + era * 400 + (m <= 2));
+}
+
+static bool parseDigits(const char* p, int count, int& value)
+{
+	value = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (!isdigit((unsigned char)p[i]))
+			return false;
+		value = value * 10 + (p[i] - '0');
+	}
+	return true;
+}
+
+//-- "YYYY-MM-DD", a real calendar day.
+static bool parseDate(const char* p, int64_t& days)
+{
+	int y, m, d;
+	if (!parseDigits(p, 4, y) || p[4] != '-' || !parseDigits(p + 5, 2, m) || p[7] != '-' || !parseDigits(p + 8, 2, d))
+		return false;
+
+	if (m < 1 || m > 12 || d < 1 || d > 31)
+		return false;
+
+	days = daysFromCivil(y, (unsigned)m, (unsigned)d);
+
+	int cy;
+	unsigned cm, cd;
+	civilFromDays(days, cy, cm, cd);
+	return cy == y && (int)cm == m && (int)cd == d;
+}
+
+static bool parseDatetime(const std::string& value, int64_t& seconds)
+{
+	if (value.length() != 19 || value[10] != ' ' || value[13] != ':' || value[16] != ':')
+		return false;
+
+	int64_t days;
+	int h, mi, s;
+	const char* p = value.data();
+	if (!parseDate(p, days) || !parseDigits(p + 11, 2, h) || !parseDigits(p + 14, 2, mi) || !parseDigits(p + 17, 2, s))
+		return false;
+
+	if (h > 23 || mi > 59 || s > 59)
+		return false;
+
+	seconds = days * 86400 + h * 3600 + mi * 60 + s;
+	return true;
+}
+
+static void formatDate(int64_t days, char* buf, size_t size)
+{
+	int y;
+	unsigned m, d;
+	civilFromDays(days, y, m, d);
+	snprintf(buf, size, "%04d-%02u-%02u", y, m, d);
+}
+
+bool CachedRow::parseInt(const std::string& value, int64_t& result)
+{
+	size_t length = value.length();
+	size_t pos = 0;
+	bool negative = false;
+
+	if (length && value[0] == '-')
+	{
+		negative = true;
+		pos = 1;
+	}
+
+	if (pos == length || length - pos > 19)
+		return false;
+
+	if (value[pos] == '0' && (length - pos > 1 || negative))
+		return false;		//-- leading zero or "-0".
+
+	uint64_t abs = 0;
+	for (; pos < length; pos++)
+	{
+		char c = value[pos];
+		if (c < '0' || c > '9')
+			return false;
+		abs = abs * 10 + (uint64_t)(c - '0');
+	}
+
+	if (negative)
+	{
+		if (abs > (uint64_t)INT64_MAX + 1)
+			return false;
+		result = (int64_t)(0 - abs);
+	}
+	else
+	{
+		if (abs > (uint64_t)INT64_MAX)
+			return false;
+		result = (int64_t)abs;
+	}
+	return true;
+}
+
+int64_t CachedRow::rowVersion(const std::vector<std::string>& row)
+{
+	uint32_t high = 0;
+	uint32_t low = 0x9E3779B9;
+	for (auto& value: row)
+	{
+		high = jenkins_hash(value.data(), value.length(), high);
+		low = jenkins_hash(value.data(), value.length(), low);
+	}
+
+	int64_t version = (int64_t)((((uint64_t)high << 32) | low) & 0x1FFFFFFFFFFFFFULL);
+	return version ? version : 1;
+}
+
+std::vector<uint8_t> CachedRow::columnTypes(const std::vector<std::vector<std::string>>& descColumns)
+{
+	std::vector<uint8_t> types;
+	types.reserve(descColumns.size());
+
+	for (auto& column: descColumns)
+	{
+		std::string type = column.size() > 1 ? column[1] : std::string();
+		for (auto& c: type)
+			c = (char)tolower((unsigned char)c);
+
+		if (type.compare(0, 8, "datetime") == 0 || type.compare(0, 9, "timestamp") == 0)
+			types.push_back(DatetimeColumn);
+		else if (type.compare(0, 4, "date") == 0)
+			types.push_back(DateColumn);
+		else if (type.compare(0, 7, "tinyint") == 0 || type.compare(0, 8, "smallint") == 0
+			|| type.compare(0, 9, "mediumint") == 0 || type.compare(0, 3, "int") == 0 || type.compare(0, 6, "bigint") == 0)
+			types.push_back(IntColumn);
+		else
+			types.push_back(StringColumn);
+	}
+	return types;
+}
+
+CachedRow::CachedRow(const std::vector<std::string>& row, const std::vector<uint8_t>& columnTypes,
+	const std::shared_ptr<CompressionStatistics>& compression): _version(rowVersion(row)), _size(0),
+	_columnCount((uint16_t)row.size()), _refreshed(false), _compressed(false)
+{
+	uint64_t rawBytes = 0, storedBytes = 0;
+	uint32_t minCompressBytes = compression ? compression->minBytes.load(std::memory_order_relaxed) : 0;
+	std::string compressed;
+
+	size_t estimated = row.size() * 2;
+	for (auto& value: row)
+		estimated += value.length();
+
+	std::string buf;
+	buf.reserve(estimated);
+
+	for (size_t i = 0; i < row.size(); i++)
+	{
+		const std::string& value = row[i];
+		uint8_t type = i < columnTypes.size() ? columnTypes[i] : (uint8_t)StringColumn;
+		int64_t number;
+
+		if (type == UncachedColumn)
+			buf.push_back((char)UncachedColumn);
+		else if (type == IntColumn && parseInt(value, number))
+		{
+			buf.push_back((char)IntColumn);
+			appendVarint(buf, zigzag(number));
+		}
+		else if (type == DatetimeColumn && parseDatetime(value, number))
+		{
+			buf.push_back((char)DatetimeColumn);
+			appendVarint(buf, zigzag(number));
+		}
+		else if (type == DateColumn && value.length() == 10 && parseDate(value.data(), number))
+		{
+			buf.push_back((char)DateColumn);
+			appendVarint(buf, zigzag(number));
+		}
+		else
+		{
+			if (minCompressBytes && value.length() >= minCompressBytes)
+			{
+				uint64_t begin = cachedRowNowNsec();
+				RowCompressor::compress(value.data(), value.length(), compressed);
+				compression->compressNsec.fetch_add(cachedRowNowNsec() - begin, std::memory_order_relaxed);
+
+				//-- Not worth a decompression on every projection if less than 1/8 is saved.
+				if (compressed.length() < value.length() - value.length() / 8)
+				{
+					buf.push_back((char)compressedCell);
+					appendVarint(buf, value.length());
+					appendVarint(buf, compressed.length());
+					buf.append(compressed);
+
+					compression->compressedCells.fetch_add(1, std::memory_order_relaxed);
+					rawBytes += value.length();
+					storedBytes += compressed.length();
+					continue;
+				}
+				compression->skippedCells.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			buf.push_back((char)StringColumn);
+			appendVarint(buf, value.length());
+			buf.append(value);
+		}
+	}
+
+	_compressed = rawBytes > 0;
+	size_t headerBytes = _compressed ? sizeof(CompressedRowHeader) : 0;
+
+	_size = (uint32_t)(headerBytes + buf.size());
+	_data.reset(new char[_size ? _size : 1]);
+	memcpy(_data.get() + headerBytes, buf.data(), buf.size());
+
+	if (_compressed)
+	{
+		CompressedRowHeader* header = new (_data.get()) CompressedRowHeader();
+		header->compression = compression;
+		header->rawBytes = rawBytes;
+		header->storedBytes = storedBytes;
+
+		compression->rawBytes.fetch_add(rawBytes, std::memory_order_relaxed);
+		compression->storedBytes.fetch_add(storedBytes, std::memory_order_relaxed);
+	}
+}
+
+CachedRow::~CachedRow()
+{
+	if (!_compressed)
+		return;
+
+	CompressedRowHeader* header = (CompressedRowHeader*)_data.get();
+	header->compression->rawBytes.fetch_sub(header->rawBytes, std::memory_order_relaxed);
+	header->compression->storedBytes.fetch_sub(header->storedBytes, std::memory_order_relaxed);
+	header->~CompressedRowHeader();
+}
+
+const char* CachedRow::cells() const
+{
+	return _data.get() + (_compressed ? sizeof(CompressedRowHeader) : 0);
+}
+
+void CachedRow::cellOffsets(uint32_t* offsets, uint16_t count) const
+{
+	uint32_t offset = 0;
+	const char* data = cells();
+	for (uint16_t i = 0; i < count; i++)
+	{
+		offsets[i] = offset;
+		uint8_t tag = (uint8_t)data[offset++];
+		if (tag == UncachedColumn)
+			continue;
+
+		uint64_t value = readVarint(data, offset);
+		if (tag == StringColumn)
+			offset += (uint32_t)value;
+		else if (tag == compressedCell)
+			offset += (uint32_t)readVarint(data, offset);
+	}
+}
+
+void CachedRow::decodeCell(uint32_t offset, std::string& value, CompressionStatistics* compression) const
+{
+	const char* data = cells();
+	uint8_t tag = (uint8_t)data[offset++];
+	if (tag == UncachedColumn)
+	{
+		value.clear();
+		return;
+	}
+
+	uint64_t raw = readVarint(data, offset);
+	char buf[32];
+
+	switch (tag)
+	{
+		case IntColumn:
+			snprintf(buf, sizeof(buf), "%lld", (long long)unzigzag(raw));
+			value.assign(buf);
+			break;
+
+		case DatetimeColumn:
+		{
+			int64_t seconds = unzigzag(raw);
+			int64_t days = (seconds >= 0 ? seconds : seconds - 86399) / 86400;
+			int64_t rest = seconds - days * 86400;
+			formatDate(days, buf, sizeof(buf));
+			snprintf(buf + 10, sizeof(buf) - 10, " %02d:%02d:%02d", (int)(rest / 3600), (int)(rest % 3600 / 60), (int)(rest % 60));
+			value.assign(buf);
+			break;
+		}
+
+		case DateColumn:
+			formatDate(unzigzag(raw), buf, sizeof(buf));
+			value.assign(buf);
+			break;
+
+		case compressedCell:
+		{
+			uint64_t storedLength = readVarint(data, offset);
+			uint64_t begin = compression ? cachedRowNowNsec() : 0;
+
+			value.resize((size_t)raw);
+			if (!RowCompressor::decompress(data + offset, (size_t)storedLength, &value[0], (size_t)raw))
+				value.clear();
+
+			if (compression)
+			{
+				compression->decompressCount.fetch_add(1, std::memory_order_relaxed);
+				compression->decompressNsec.fetch_add(cachedRowNowNsec() - begin, std::memory_order_relaxed);
+			}
+			break;
+		}
+
+		default:
+			value.assign(data + offset, (size_t)raw);
+	}
+}
+
+std::vector<std::string> CachedRow::get_data(const std::vector<uint16_t>& indexes, CompressionStatistics* compression) const
+{
+	uint16_t needed = 0;
+	for (uint16_t index: indexes)
+		if (index < _columnCount && index >= needed)
+			needed = index + 1;
+
+	uint32_t stackOffsets[cachedRowStackColumns];
+	std::vector<uint32_t> heapOffsets;
+	uint32_t* offsets = stackOffsets;
+	if (needed > cachedRowStackColumns)
+	{
+		heapOffsets.resize(needed);
+		offsets = heapOffsets.data();
+	}
+	cellOffsets(offsets, needed);
+
+	std::vector<std::string> result(indexes.size());
+	for (size_t i = 0; i < indexes.size(); i++)
+		if (indexes[i] < _columnCount)
+			decodeCell(offsets[indexes[i]], result[i], compression);
+
+	return result;
+}
@@ -0,0 +1,149 @@
+#ifndef Cached_Row_H
+#define Cached_Row_H
+
+#include <map>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "FPWriter.h"
+#include "RowCompressor.h"
+
+using namespace fpnn;
+
+/*
+	Cached row in one packed buffer. Each cell is a tag byte followed by its value:
+
+		StringCell:     varint length, bytes
+		IntCell:        zigzag varint
+		DatetimeCell:   zigzag varint, seconds since 1970-01-01 00:00:00 (no time zone)
+		DateCell:       zigzag varint, days since 1970-01-01
+		CompressedCell: varint raw length, varint stored length, RowCompressor bytes
+		UncachedCell:   no value, the column is not hot for the table and reads as ""
+
+	Numeric & date columns are stored natively only when the DBProxy string is exactly the
+	canonical form of the value, so get_data() always returns the original strings.
+	String cells are compressed when the table enables compression, and only decompressed
+	when get_data() projects them. A row with compressed cells holds the table counters in a
+	header before its cells, and takes its bytes off them when destroyed.
+	The version is a hash of the row as selected from DBProxy, so it only changes with the data.
+*/
+class CachedRow
+{
+public:
+	//-- 4 is the compressed cell tag. UncachedColumn is only a storage type, never a desc type.
+	enum ColumnType { StringColumn = 0, IntColumn = 1, DatetimeColumn = 2, DateColumn = 3, UncachedColumn = 5 };
+
+private:
+	std::unique_ptr<char[]> _data;
+	int64_t _version;
+	uint32_t _size;
+	uint16_t _columnCount;
+	mutable std::atomic<bool> _refreshed;		//-- reloaded by refresh-ahead and not read yet. Fits in padding.
+	bool _compressed;		//-- _data starts with the compressed row header. Fits in padding.
+
+	const char* cells() const;
+	void cellOffsets(uint32_t* offsets, uint16_t count) const;
+	void decodeCell(uint32_t offset, std::string& value, CompressionStatistics* compression) const;
+
+public:
+	CachedRow(const std::vector<std::string>& row, const std::vector<uint8_t>& columnTypes,
+		const std::shared_ptr<CompressionStatistics>& compression = nullptr);
+	~CachedRow();
+
+	std::vector<std::string> get_data(const std::vector<uint16_t>& indexes, CompressionStatistics* compression = NULL) const;
+	uint16_t columnCount() const { return _columnCount; }
+	size_t memoryBytes() const { return sizeof(CachedRow) + _size; }
+	int64_t version() const { return _version; }
+
+	void markRefreshed() { _refreshed.store(true, std::memory_order_relaxed); }
+	bool takeRefreshed() const		//-- true only for the first read after a refresh-ahead reload.
+	{
+		return _refreshed.load(std::memory_order_relaxed) && _refreshed.exchange(false, std::memory_order_relaxed);
+	}
+
+	//-- column types from the rows of "desc <table>".
+	static std::vector<uint8_t> columnTypes(const std::vector<std::vector<std::string>>& descColumns);
+	static bool parseInt(const std::string& value, int64_t& result);		//-- canonical integers only.
+	static int64_t rowVersion(const std::vector<std::string>& row);		//-- 53 bits, json safe. Never 0.
+};
+typedef std::shared_ptr<CachedRow> CachedRowPtr;
+
+//-- Writes one value of a typed answer: integer columns as msgpack integers, others as strings.
+inline void writeTypedValue(FPWriter& writer, const std::string& value, uint8_t columnType)
+{
+	int64_t intValue;
+	if (columnType == CachedRow::IntColumn && CachedRow::parseInt(value, intValue))
+		writer.param(intValue);
+	else
+		writer.param(value);
+}
+
+//-- { key: [value] } with values typed by the column types of the required fields.
+template <typename K>
+void writeTypedRows(FPWriter& writer, const char* name, const std::map<K, std::vector<std::string>>& rows,
+	const std::vector<uint8_t>& requiredTypes)
+{
+	writer.paramMap(name, rows.size());
+	for (auto& rowPair: rows)
+	{
+		writer.param(rowPair.first);
+		writer.paramArray(rowPair.second.size());
+		for (size_t i = 0; i < rowPair.second.size(); i++)
+			writeTypedValue(writer, rowPair.second[i], i < requiredTypes.size() ? requiredTypes[i] : (uint8_t)CachedRow::StringColumn);
+	}
+}
+
+//-- Row versions of a fetch. With client versions, rows of the same version are answered in "unchanged" instead of "data".
+template <typename K>
+struct RowVersions
+{
+	bool enabled;
+	std::map<K, int64_t> client;
+	std::map<K, int64_t> versions;
+	std::vector<K> unchanged;
+
+	RowVersions(): enabled(false) {}
+
+	//-- true if the client has the row of this version. Otherwise records the version for the answer.
+	bool unchangedRow(const K& key, int64_t version)
+	{
+		if (!enabled)
+			return false;
+
+		auto it = client.find(key);
+		if (it != client.end() && it->second == version)
+		{
+			unchanged.push_back(key);
+			return true;
+		}
+
+		versions[key] = version;
+		return false;
+	}
+
+	int paramCount() const { return enabled ? 2 : 0; }
+	void write(FPWriter& writer) const
+	{
+		if (!enabled)
+			return;
+
+		writer.param("versions", versions);
+		writer.param("unchanged", unchanged);
+	}
+};
+
+//-- for jsonCompatible answers of integer keyed tables.
+inline void stringKeyVersions(const RowVersions<int64_t>& source, RowVersions<std::string>& target)
+{
+	target.enabled = source.enabled;
+	for (auto& versionPair: source.client)
+		target.client[std::to_string(versionPair.first)] = versionPair.second;
+	for (auto& versionPair: source.versions)
+		target.versions[std::to_string(versionPair.first)] = versionPair.second;
+	for (int64_t key: source.unchanged)
+		target.unchanged.push_back(std::to_string(key));
+}
+
+#endif
@@ -0,0 +1,331 @@
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "FPLog.h"
+#include "FPReader.h"
+#include "FPWriter.h"
+#include "ChangeFeed.h"
+#include "LatencyHistogram.h"
+
+static const int changeFeedIdleStepMsec = 10;
+static const size_t changeFeedMaxLineLength = 64 * 1024;
+
+static int64_t changeFeedNowMsec()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+//===============================================//
+//-- FileChangeFeedSource
+//===============================================//
+FileChangeFeedSource::FileChangeFeedSource(const std::string& path, bool startAtEnd):
+	_path(path), _startAtEnd(startAtEnd), _fd(-1), _inode(0), _offset(0), _badEvents(0)
+{
+}
+
+FileChangeFeedSource::~FileChangeFeedSource()
+{
+	close();
+}
+
+bool FileChangeFeedSource::open(bool seekToEnd)
+{
+	//-- Non blocking, or opening a pipe without writer blocks.
+	_fd = ::open(_path.c_str(), O_RDONLY | O_NONBLOCK);
+	if (_fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(_fd, &st) != 0)
+	{
+		close();
+		return false;
+	}
+
+	_inode = (uint64_t)st.st_ino;
+	_offset = 0;
+	_buffer.clear();
+
+	if (seekToEnd && S_ISREG(st.st_mode))
+		_offset = (int64_t)lseek(_fd, 0, SEEK_END);
+
+	LOG_INFO("Change feed file %s opened at offset %lld.", _path.c_str(), (long long)_offset);
+	return true;
+}
+
+void FileChangeFeedSource::close()
+{
+	if (_fd >= 0)
+		::close(_fd);
+
+	_fd = -1;
+}
+
+bool FileChangeFeedSource::reopenRequired()
+{
+	struct stat st;
+	if (stat(_path.c_str(), &st) != 0)
+		return false;		//-- Removed, wait for the new one.
+
+	if ((uint64_t)st.st_ino != _inode)
+		return true;		//-- Rotated.
+
+	return S_ISREG(st.st_mode) && (int64_t)st.st_size < _offset;		//-- Truncated.
+}
+
+void FileChangeFeedSource::parseLine(const std::string& line, std::vector<ChangeEvent>& events)
+{
+	std::string content(line);
+	if (content.size() && content[content.size() - 1] == '\r')
+		content.erase(content.size() - 1);
+
+	if (content.empty() || content[0] == '#')
+		return;
+
+	size_t tab = content.find('\t');
+	if (tab == std::string::npos || tab == 0 || tab + 1 == content.size())
+	{
+		_badEvents++;
+		return;
+	}
+
+	ChangeEvent event;
+	event.tableName = content.substr(0, tab);
+
+	size_t timeTab = content.find('\t', tab + 1);
+	if (timeTab == std::string::npos)
+		event.key = content.substr(tab + 1);
+	else
+	{
+		event.key = content.substr(tab + 1, timeTab - tab - 1);
+		event.eventMsec = atoll(content.c_str() + timeTab + 1);
+	}
+
+	events.push_back(event);
+}
+
+bool FileChangeFeedSource::read(std::vector<ChangeEvent>& events, size_t maxEvents, int waitMsec)
+{
+	if (_fd < 0 && !open(_startAtEnd))
+	{
+		usleep(waitMsec * 1000);
+		return false;
+	}
+
+	char buf[16 * 1024];
+	int waited = 0;
+	size_t start = 0;
+
+	while (events.size() < maxEvents)
+	{
+		size_t end = _buffer.find('\n', start);
+		if (end != std::string::npos)
+		{
+			parseLine(_buffer.substr(start, end - start), events);
+			start = end + 1;
+			continue;
+		}
+
+		_buffer.erase(0, start);
+		start = 0;
+
+		if (_buffer.size() > changeFeedMaxLineLength)
+		{
+			_badEvents++;
+			_buffer.clear();
+		}
+
+		ssize_t bytes = ::read(_fd, buf, sizeof(buf));
+		if (bytes > 0)
+		{
+			_buffer.append(buf, (size_t)bytes);
+			_offset += bytes;
+			continue;
+		}
+
+		if (bytes < 0 && errno != EAGAIN && errno != EINTR)
+		{
+			LOG_ERROR("Read change feed file %s failed, errno %d.", _path.c_str(), errno);
+			close();
+			return false;
+		}
+
+		//-- No more data.
+		if (events.size() || waited >= waitMsec)
+			break;
+
+		if (reopenRequired())
+		{
+			close();
+			if (!open(false))
+				return false;
+			continue;
+		}
+
+		usleep(changeFeedIdleStepMsec * 1000);
+		waited += changeFeedIdleStepMsec;
+	}
+
+	_buffer.erase(0, start);
+	return true;
+}
+
+//===============================================//
+//-- EndpointChangeFeedSource
+//===============================================//
+EndpointChangeFeedSource::EndpointChangeFeedSource(const std::string& endpoint, int questTimeout): _endpoint(endpoint)
+{
+	_client = TCPClient::createClient(endpoint);
+	if (_client)
+		_client->setQuestTimeout(questTimeout);
+}
+
+bool EndpointChangeFeedSource::read(std::vector<ChangeEvent>& events, size_t maxEvents, int waitMsec)
+{
+	if (!_client)
+	{
+		usleep(waitMsec * 1000);
+		return false;
+	}
+
+	FPQWriter qw(_cursor.empty() ? 1 : 2, "pullChanges");
+	if (_cursor.size())
+		qw.param("cursor", _cursor);
+	qw.param("max", (int64_t)maxEvents);
+
+	FPAnswerPtr answer = _client->sendQuest(qw.take());
+	if (!answer || answer->status())
+	{
+		usleep(waitMsec * 1000);
+		return false;
+	}
+
+	FPAReader ar(answer);
+	std::vector<std::string> tables = ar.want("tables", std::vector<std::string>());
+	std::vector<std::string> keys = ar.want("keys", std::vector<std::string>());
+	std::vector<int64_t> times = ar.get("times", std::vector<int64_t>());
+	std::string cursor = ar.getString("cursor");
+
+	if (tables.size() != keys.size())
+	{
+		LOG_ERROR("Bad pullChanges answer from %s: %d tables, %d keys.", _endpoint.c_str(), (int)tables.size(), (int)keys.size());
+		usleep(waitMsec * 1000);
+		return false;
+	}
+
+	for (size_t i = 0; i < tables.size(); i++)
+	{
+		ChangeEvent event;
+		event.tableName = tables[i];
+		event.key = keys[i];
+		if (i < times.size())
+			event.eventMsec = times[i];
+
+		events.push_back(event);
+	}
+
+	if (cursor.size())
+		_cursor = cursor;
+
+	if (events.empty())
+		usleep(waitMsec * 1000);
+
+	return true;
+}
+
+//===============================================//
+//-- ChangeFeedConsumer
+//===============================================//
+ChangeFeedSourcePtr ChangeFeedConsumer::createSource(const std::string& source, bool fileStartAtEnd, int questTimeout)
+{
+	if (source.compare(0, 5, "file:") == 0 && source.size() > 5)
+		return std::make_shared<FileChangeFeedSource>(source.substr(5), fileStartAtEnd);
+
+	if (source.compare(0, 5, "fpnn:") == 0 && source.size() > 5)
+		return std::make_shared<EndpointChangeFeedSource>(source.substr(5), questTimeout);
+
+	return nullptr;
+}
+
+ChangeFeedConsumer::ChangeFeedConsumer(ChangeFeedSourcePtr source, Applier applier, size_t batchSize, int pollIntervalMsec):
+	_source(source), _applier(applier), _batchSize(batchSize ? batchSize : 1),
+	_pollIntervalMsec(pollIntervalMsec > 0 ? pollIntervalMsec : 100), _running(true)
+{
+	_thread = std::thread(&ChangeFeedConsumer::consumeThread, this);
+}
+
+ChangeFeedConsumer::~ChangeFeedConsumer()
+{
+	stop();
+}
+
+void ChangeFeedConsumer::stop()
+{
+	_running = false;
+	if (_thread.joinable())
+		_thread.join();
+}
+
+void ChangeFeedConsumer::consumeThread()
+{
+	while (_running)
+	{
+		std::vector<ChangeEvent> events;
+		if (!_source->read(events, _batchSize, _pollIntervalMsec))
+			_statistics.sourceErrors++;
+
+		if (events.empty())
+			continue;
+
+		_applier(events);
+
+		int64_t now = changeFeedNowMsec();
+		int64_t batchLag = -1;
+		for (auto& event: events)
+		{
+			if (event.eventMsec <= 0)
+				continue;
+
+			int64_t lag = now - event.eventMsec;
+			if (lag < 0)
+				lag = 0;		//-- Clock skew between the source & this server.
+
+			LatencyRecorder::instance().record("changeFeed.lag", event.tableName, lag * 1000);
+			if (lag > batchLag)
+				batchLag = lag;
+			if (event.eventMsec > _statistics.lastEventMsec)
+				_statistics.lastEventMsec = event.eventMsec;
+		}
+
+		if (batchLag >= 0)
+		{
+			_statistics.lastLagMsec = batchLag;
+			if (batchLag > _statistics.maxLagMsec)
+				_statistics.maxLagMsec = batchLag;
+		}
+
+		_statistics.events.fetch_add(events.size());
+		_statistics.batches++;
+		_statistics.lastApplyMsec = now;
+	}
+}
+
+std::string ChangeFeedConsumer::infos()
+{
+	std::string infos("{\"source\":\"");
+	infos.append(_source->describe()).append("\"");
+	infos.append(",\"events\":").append(std::to_string(_statistics.events));
+	infos.append(",\"batches\":").append(std::to_string(_statistics.batches));
+	infos.append(",\"badEvents\":").append(std::to_string(_source->badEvents()));
+	infos.append(",\"sourceErrors\":").append(std::to_string(_statistics.sourceErrors));
+	infos.append(",\"lastApplyMsec\":").append(std::to_string(_statistics.lastApplyMsec));
+	infos.append(",\"lastEventMsec\":").append(std::to_string(_statistics.lastEventMsec));
+	infos.append(",\"lastLagMsec\":").append(std::to_string(_statistics.lastLagMsec));
+	infos.append(",\"maxLagMsec\":").append(std::to_string(_statistics.maxLagMsec));
+	infos.append("}");
+	return infos;
+}
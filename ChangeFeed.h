@@ -0,0 +1,133 @@
+#ifndef Change_Feed_H
+#define Change_Feed_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+#include "TCPClient.h"
+
+using namespace fpnn;
+
+//-- One changed row, or a whole table when key is "*".
+struct ChangeEvent
+{
+	std::string tableName;
+	std::string key;		//-- integer or string hintId as text.
+	int64_t eventMsec;		//-- wall clock time of the change at the source. 0: unknown.
+
+	ChangeEvent(): eventMsec(0) {}
+};
+
+/*
+	Source of row change events. read() returns at most maxEvents events, waiting at most
+	waitMsec when nothing is available. Implementations are only called by the consumer thread.
+*/
+class ChangeFeedSource
+{
+public:
+	virtual ~ChangeFeedSource() {}
+	virtual bool read(std::vector<ChangeEvent>& events, size_t maxEvents, int waitMsec) = 0;		//-- false: source error, retried later.
+	virtual uint64_t badEvents() const { return 0; }
+	virtual std::string describe() const = 0;
+};
+typedef std::shared_ptr<ChangeFeedSource> ChangeFeedSourcePtr;
+
+/*
+	Tails a local file or named pipe. One event per line: "table<TAB>key[<TAB>eventMsec]".
+	A truncated or replaced file is reopened from the beginning.
+*/
+class FileChangeFeedSource: public ChangeFeedSource
+{
+	std::string _path;
+	bool _startAtEnd;
+	int _fd;
+	uint64_t _inode;
+	int64_t _offset;
+	std::string _buffer;		//-- read but not parsed, ends with a partial line.
+	std::atomic<uint64_t> _badEvents;
+
+	bool open(bool seekToEnd);
+	void close();
+	bool reopenRequired();
+	void parseLine(const std::string& line, std::vector<ChangeEvent>& events);
+
+public:
+	FileChangeFeedSource(const std::string& path, bool startAtEnd);
+	~FileChangeFeedSource();
+
+	virtual bool read(std::vector<ChangeEvent>& events, size_t maxEvents, int waitMsec);
+	virtual uint64_t badEvents() const { return _badEvents; }
+	virtual std::string describe() const { return std::string("file:").append(_path); }
+};
+
+/*
+	Pulls events from an FPNN endpoint:
+		pullChanges { ?cursor:%s, max:%d } -> { tables:[%s], keys:[%s], ?times:[%d], cursor:%s }
+	An empty cursor asks the producer for the latest position. The cursor is kept in memory only.
+*/
+class EndpointChangeFeedSource: public ChangeFeedSource
+{
+	std::string _endpoint;
+	TCPClientPtr _client;
+	std::string _cursor;
+
+public:
+	EndpointChangeFeedSource(const std::string& endpoint, int questTimeout);
+
+	virtual bool read(std::vector<ChangeEvent>& events, size_t maxEvents, int waitMsec);
+	virtual std::string describe() const { return std::string("fpnn:").append(_endpoint); }
+};
+
+struct ChangeFeedStatistics
+{
+	std::atomic<uint64_t> events;
+	std::atomic<uint64_t> batches;
+	std::atomic<uint64_t> sourceErrors;
+	std::atomic<int64_t> lastApplyMsec;
+	std::atomic<int64_t> lastEventMsec;		//-- source time of the newest applied event.
+	std::atomic<int64_t> lastLagMsec;		//-- max lag of the last batch with event times.
+	std::atomic<int64_t> maxLagMsec;
+
+	ChangeFeedStatistics(): events(0), batches(0), sourceErrors(0), lastApplyMsec(0), lastEventMsec(0),
+		lastLagMsec(0), maxLagMsec(0) {}
+};
+
+/*
+	Reads change events in batches and hands each batch to the applier, which invalidates the
+	local cache and notifies the cluster. Lag is the time from the change at the source to
+	the end of its invalidation.
+*/
+class ChangeFeedConsumer
+{
+public:
+	typedef std::function<void (const std::vector<ChangeEvent>& events)> Applier;
+
+	//-- "file:<path>" or "fpnn:<host>:<port>". nullptr for an unknown source.
+	static ChangeFeedSourcePtr createSource(const std::string& source, bool fileStartAtEnd, int questTimeout);
+
+private:
+	ChangeFeedSourcePtr _source;
+	Applier _applier;
+	size_t _batchSize;
+	int _pollIntervalMsec;
+	std::atomic<bool> _running;
+	std::thread _thread;
+
+	ChangeFeedStatistics _statistics;
+
+	void consumeThread();
+
+public:
+	ChangeFeedConsumer(ChangeFeedSourcePtr source, Applier applier, size_t batchSize, int pollIntervalMsec);
+	~ChangeFeedConsumer();
+
+	void stop();
+	std::string infos();
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include "ServerInfo.h"
 #include "StringUtil.h"
 #include "ClusterNotifier.h"
+#include "LatencyHistogram.h"
 
 std::vector<std::string> ClusterNotifier::loadEndpoints(const std::string& endpoints_file)
 {
@@ -209,7 +210,7 @@ TCPClientPtr ClusterNotifier::getClient(const std::string& endpoint)
 
 ClusterNotifier::NotifyAnswerCallback::NotifyAnswerCallback(ClusterNotifierPtr clusterNotifier,
 	const std::string& endpoint, const std::string& tableName, const std::set<int64_t>& hintIds):
-	_processed(false), _endpoint(endpoint), _tableName(tableName), _hintIds(hintIds),
+	_processed(false), _sendUsec(latencyNowUsec()), _endpoint(endpoint), _tableName(tableName), _hintIds(hintIds),
 	_clusterNotifier(clusterNotifier)
 {
 }
@@ -220,8 +221,16 @@ ClusterNotifier::NotifyAnswerCallback::~NotifyAnswerCallback()
 		onException(nullptr, FPNN_EC_CORE_UNKNOWN_ERROR);
 }
 
+void ClusterNotifier::NotifyAnswerCallback::onAnswer(FPAnswerPtr)
+{
+	LatencyRecorder::instance().record("clusterNotify", _tableName, latencyNowUsec() - _sendUsec);
+	_processed = true;
+}
+
 void ClusterNotifier::NotifyAnswerCallback::onException(FPAnswerPtr answer, int errorCode)
 {
+	LatencyRecorder::instance().record("clusterNotify", _tableName, latencyNowUsec() - _sendUsec);
+
 	if (_hintIds.empty())
 		_clusterNotifier->reinvalidate(_endpoint, _tableName);
 	else
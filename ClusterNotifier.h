@@ -24,6 +24,7 @@ class ClusterNotifier: public std::enable_shared_from_this<ClusterNotifier>
 	class NotifyAnswerCallback: public AnswerCallback
 	{
 		bool _processed;
+		int64_t _sendUsec;
 		std::string _endpoint;
 		std::string _tableName;
 		std::set<int64_t> _hintIds;
@@ -33,7 +34,7 @@ class ClusterNotifier: public std::enable_shared_from_this<ClusterNotifier>
 		NotifyAnswerCallback(ClusterNotifierPtr clusterNotifier, const std::string& endpoint, const std::string& tableName, const std::set<int64_t>& hintIds);
 		~NotifyAnswerCallback();
 
-		virtual void onAnswer(FPAnswerPtr) { _processed = true; }
+		virtual void onAnswer(FPAnswerPtr);
 		virtual void onException(FPAnswerPtr answer, int errorCode);
 
 	};
@@ -0,0 +1,340 @@
+#include <chrono>
+#include <algorithm>
+#include "FPLog.h"
+#include "FPReader.h"
+#include "DBProxyPool.h"
+
+static const uint64_t hedgeWindowReads = 1000;
+static const uint64_t hedgeWindowMinReads = 100;
+static const int64_t hedgeWindowMaxUsec = 10 * 1000 * 1000;
+
+static int64_t dbproxyPoolNowMsec()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+DBProxyPool::~DBProxyPool()
+{
+	stop();
+}
+
+bool DBProxyPool::addEndpoint(const std::string& endpoint, int questTimeout)
+{
+	TCPClientPtr client = TCPClient::createClient(endpoint);
+	if (!client)
+		return false;
+
+	client->setQuestTimeout(questTimeout);
+	_endpoints.push_back(std::unique_ptr<Endpoint>(new Endpoint(endpoint, client)));
+	return true;
+}
+
+void DBProxyPool::setHealthPolicy(uint32_t maxFailures, int cooldownMsec)
+{
+	_maxFailures = maxFailures ? maxFailures : 1;
+	_cooldownMsec = cooldownMsec > 0 ? cooldownMsec : 0;
+}
+
+void DBProxyPool::enableHedging(double percentile, int minDelayMsec, double maxHedgeRatio)
+{
+	if (percentile <= 0 || percentile >= 100 || maxHedgeRatio <= 0 || _endpoints.size() < 2 || _running)
+		return;
+
+	_hedgePercentile = percentile;
+	_hedgeMinDelayUsec = (int64_t)minDelayMsec * 1000;
+	_maxHedgeRatio = maxHedgeRatio;
+	_windowStartUsec = latencyNowUsec();
+
+	_running = true;
+	_hedgeThread = std::thread(&DBProxyPool::hedgeThread, this);
+}
+
+void DBProxyPool::stop()
+{
+	{
+		std::unique_lock<std::mutex> lck(_hedgeMutex);
+		_running = false;
+		_hedges.clear();
+	}
+	_hedgeCondition.notify_all();
+
+	if (_hedgeThread.joinable())
+		_hedgeThread.join();
+}
+
+DBProxyPool::Endpoint* DBProxyPool::pick(const Endpoint* excluded)
+{
+	size_t count = _endpoints.size();
+	uint32_t start = _nextIndex.fetch_add(1, std::memory_order_relaxed);
+	int64_t now = dbproxyPoolNowMsec();
+
+	Endpoint* best = NULL;
+	bool bestHealthy = false;
+	int32_t bestOutstanding = 0;
+
+	//-- Starts at a rotating index, so ties are spread over the endpoints.
+	for (size_t i = 0; i < count; i++)
+	{
+		Endpoint* endpoint = _endpoints[(start + i) % count].get();
+		if (endpoint == excluded)
+			continue;
+
+		bool healthy = endpoint->unhealthyUntilMsec.load(std::memory_order_relaxed) <= now;
+		int32_t outstanding = endpoint->outstanding.load(std::memory_order_relaxed);
+		if (!best || (healthy && !bestHealthy) || (healthy == bestHealthy && outstanding < bestOutstanding))
+		{
+			best = endpoint;
+			bestHealthy = healthy;
+			bestOutstanding = outstanding;
+		}
+	}
+	return best;
+}
+
+void DBProxyPool::finished(Endpoint* endpoint, int errorCode)
+{
+	endpoint->outstanding--;
+
+	//-- Errors above FPNN_MAX_ERROR_CODE are answered by DBProxy or MySQL: the endpoint works.
+	if (errorCode == FPNN_EC_OK || errorCode > FPNN_MAX_ERROR_CODE)
+	{
+		if (endpoint->consecutiveFailures.load(std::memory_order_relaxed))
+			endpoint->consecutiveFailures = 0;
+		return;
+	}
+
+	endpoint->failedCount++;
+	if (endpoint->consecutiveFailures.fetch_add(1) + 1 < _maxFailures)
+		return;
+
+	int64_t now = dbproxyPoolNowMsec();
+	if (endpoint->unhealthyUntilMsec.exchange(now + _cooldownMsec) <= now)
+		LOG_WARN("DBProxy %s failed %d times in a row, skipped for %d ms.", endpoint->endpoint.c_str(),
+			(int)endpoint->consecutiveFailures.load(), _cooldownMsec);
+}
+
+bool DBProxyPool::send(Endpoint* endpoint, FPQuestPtr quest, AnswerTask task, int timeout)
+{
+	endpoint->outstanding++;
+	endpoint->questCount++;
+
+	bool sent = endpoint->client->sendQuest(quest, [this, endpoint, task](FPAnswerPtr answer, int errorCode) {
+		finished(endpoint, errorCode);
+		task(answer, errorCode);
+	}, timeout);
+
+	if (!sent)
+		finished(endpoint, FPNN_EC_CORE_UNKNOWN_ERROR);
+
+	return sent;
+}
+
+FPAnswerPtr DBProxyPool::sendQuest(FPQuestPtr quest, int timeout)
+{
+	Endpoint* endpoint = pick(NULL);
+	endpoint->outstanding++;
+	endpoint->questCount++;
+
+	FPAnswerPtr answer = endpoint->client->sendQuest(quest, timeout);
+
+	int errorCode = FPNN_EC_OK;
+	if (!answer)
+		errorCode = FPNN_EC_CORE_UNKNOWN_ERROR;
+	else if (answer->status())
+		errorCode = (int)FPAReader(answer).getInt("code", FPNN_EC_CORE_UNKNOWN_ERROR);
+
+	finished(endpoint, errorCode);
+	return answer;
+}
+
+//-- As TCPClient: the callback is deleted after it is called, and kept by the caller if the quest is not sent.
+DBProxyPool::AnswerTask DBProxyPool::callbackTask(AnswerCallback* callback)
+{
+	return [callback](FPAnswerPtr answer, int errorCode) {
+		if (errorCode == FPNN_EC_OK)
+			callback->onAnswer(answer);
+		else
+			callback->onException(answer, errorCode);
+
+		delete callback;
+	};
+}
+
+bool DBProxyPool::sendQuest(FPQuestPtr quest, AnswerCallback* callback, int timeout)
+{
+	return send(pick(NULL), quest, callbackTask(callback), timeout);
+}
+
+bool DBProxyPool::sendQuest(FPQuestPtr quest, AnswerTask task, int timeout)
+{
+	return send(pick(NULL), quest, task, timeout);
+}
+
+bool DBProxyPool::sendHedgedQuest(FPQuestPtr quest, AnswerCallback* callback)
+{
+	return sendHedgedQuest(quest, callbackTask(callback));
+}
+
+bool DBProxyPool::sendHedgedQuest(FPQuestPtr quest, AnswerTask task)
+{
+	if (_hedgePercentile <= 0)
+		return sendQuest(quest, task);
+
+	_statistics.hedgeableReads++;
+	_windowReads++;
+
+	HedgedQuestPtr hedged = std::make_shared<HedgedQuest>(quest, task);
+	Endpoint* primary = pick(NULL);
+	hedged->primary = primary;
+	hedged->sendUsec = latencyNowUsec();
+	hedged->pending = 1;
+
+	if (!send(primary, quest, [this, hedged, primary](FPAnswerPtr answer, int errorCode) {
+			hedgedAnswer(hedged, primary, answer, errorCode);
+		}, 0))
+		return false;
+
+	int64_t delayUsec = _hedgeDelayUsec;
+	if (delayUsec > 0)
+	{
+		std::unique_lock<std::mutex> lck(_hedgeMutex);
+		bool earliest = _hedges.empty() || hedged->sendUsec + delayUsec < _hedges.begin()->first;
+		_hedges.insert(std::make_pair(hedged->sendUsec + delayUsec, hedged));
+		if (earliest)
+			_hedgeCondition.notify_one();
+	}
+	return true;
+}
+
+void DBProxyPool::hedgedAnswer(HedgedQuestPtr hedged, Endpoint* endpoint, FPAnswerPtr answer, int errorCode)
+{
+	//-- Latency of single reads, so hedging does not lower its own threshold.
+	if (endpoint == hedged->primary && errorCode == FPNN_EC_OK)
+		recordReadLatency(latencyNowUsec() - hedged->sendUsec);
+
+	AnswerTask task;
+	{
+		std::unique_lock<std::mutex> lck(hedged->mutex);
+		hedged->pending -= 1;
+		if (hedged->done)
+			return;
+
+		if (errorCode != FPNN_EC_OK && hedged->pending > 0)
+			return;		//-- The other quest may still succeed.
+
+		hedged->done = true;
+		task.swap(hedged->task);
+	}
+
+	if (endpoint != hedged->primary && errorCode == FPNN_EC_OK)
+		_statistics.hedgeWins++;
+
+	task(answer, errorCode);
+}
+
+void DBProxyPool::recordReadLatency(int64_t usec)
+{
+	std::unique_lock<std::mutex> lck(_latencyMutex);
+	_latencyWindow.record(usec);
+
+	int64_t now = latencyNowUsec();
+	if (_latencyWindow.count() < hedgeWindowReads && now - _windowStartUsec < hedgeWindowMaxUsec)
+		return;
+
+	if (_latencyWindow.count() >= hedgeWindowMinReads)
+		_hedgeDelayUsec = std::max((int64_t)_latencyWindow.percentile(_hedgePercentile), _hedgeMinDelayUsec);
+
+	_latencyWindow.reset();
+	_windowStartUsec = now;
+	_windowReads = 0;
+	_windowHedges = 0;
+}
+
+void DBProxyPool::sendHedge(HedgedQuestPtr hedged)
+{
+	Endpoint* endpoint;
+	{
+		std::unique_lock<std::mutex> lck(hedged->mutex);
+		if (hedged->done || hedged->hedged)
+			return;
+
+		endpoint = pick(hedged->primary);
+		if (!endpoint || (double)_windowHedges >= (double)_windowReads * _maxHedgeRatio)
+		{
+			_statistics.hedgeSkipped++;
+			return;
+		}
+
+		hedged->hedged = true;
+		hedged->pending += 1;
+	}
+
+	_windowHedges++;
+	_statistics.hedgeSent++;
+	endpoint->hedgeCount++;
+
+	if (!send(endpoint, hedged->quest, [this, hedged, endpoint](FPAnswerPtr answer, int errorCode) {
+			hedgedAnswer(hedged, endpoint, answer, errorCode);
+		}, 0))
+		hedgedAnswer(hedged, endpoint, nullptr, FPNN_EC_CORE_UNKNOWN_ERROR);
+}
+
+void DBProxyPool::hedgeThread()
+{
+	std::unique_lock<std::mutex> lck(_hedgeMutex);
+	while (_running)
+	{
+		if (_hedges.empty())
+		{
+			_hedgeCondition.wait(lck);
+			continue;
+		}
+
+		int64_t waitUsec = _hedges.begin()->first - latencyNowUsec();
+		if (waitUsec > 0)
+		{
+			_hedgeCondition.wait_for(lck, std::chrono::microseconds(waitUsec));
+			continue;
+		}
+
+		HedgedQuestPtr hedged = _hedges.begin()->second;
+		_hedges.erase(_hedges.begin());
+
+		lck.unlock();
+		sendHedge(hedged);
+		lck.lock();
+	}
+}
+
+std::string DBProxyPool::infos()
+{
+	int64_t now = dbproxyPoolNowMsec();
+	std::string infos("{\"endpoints\":[");
+	for (size_t i = 0; i < _endpoints.size(); i++)
+	{
+		Endpoint& endpoint = *_endpoints[i];
+		if (i)
+			infos.append(",");
+
+		infos.append("{\"endpoint\":\"").append(endpoint.endpoint).append("\"");
+		infos.append(",\"healthy\":").append(endpoint.unhealthyUntilMsec <= now ? "true" : "false");
+		infos.append(",\"outstanding\":").append(std::to_string(endpoint.outstanding));
+		infos.append(",\"questCount\":").append(std::to_string(endpoint.questCount));
+		infos.append(",\"failedCount\":").append(std::to_string(endpoint.failedCount));
+		infos.append(",\"hedgeCount\":").append(std::to_string(endpoint.hedgeCount));
+		infos.append("}");
+	}
+	infos.append("]");
+
+	if (_hedgePercentile > 0)
+	{
+		infos.append(",\"hedgeDelayUsec\":").append(std::to_string(_hedgeDelayUsec));
+		infos.append(",\"hedgeableReads\":").append(std::to_string(_statistics.hedgeableReads));
+		infos.append(",\"hedgeSent\":").append(std::to_string(_statistics.hedgeSent));
+		infos.append(",\"hedgeWins\":").append(std::to_string(_statistics.hedgeWins));
+		infos.append(",\"hedgeSkipped\":").append(std::to_string(_statistics.hedgeSkipped));
+	}
+	infos.append("}");
+	return infos;
+}
@@ -0,0 +1,136 @@
+#ifndef DBProxy_Pool_H
+#define DBProxy_Pool_H
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include <stdint.h>
+#include "TCPClient.h"
+#include "LatencyHistogram.h"
+
+using namespace fpnn;
+
+#ifndef FPNN_MAX_ERROR_CODE
+#define FPNN_MAX_ERROR_CODE 29999
+#endif
+
+struct DBProxyPoolStatistics
+{
+	std::atomic<uint64_t> hedgeableReads;		//-- reads sent by sendHedgedQuest().
+	std::atomic<uint64_t> hedgeSent;
+	std::atomic<uint64_t> hedgeWins;		//-- hedge answered first.
+	std::atomic<uint64_t> hedgeSkipped;		//-- due, but over budget or no other endpoint.
+
+	DBProxyPoolStatistics(): hedgeableReads(0), hedgeSent(0), hedgeWins(0), hedgeSkipped(0) {}
+};
+
+/*
+	DBProxy endpoints behind the TCPClient interface used by TableCacheProcessor.
+	Each quest goes to the healthy endpoint with the least outstanding quests. An endpoint
+	failing maxFailures times in a row with FPNN errors (connection, timeout) is skipped for
+	cooldownMsec, unless no endpoint is healthy.
+	Hedged reads: when a read is not answered after the hedge percentile of recent read latency,
+	the same quest is sent to another endpoint, and the first successful answer is used. Hedges
+	are limited to maxHedgeRatio of reads. Only idempotent quests may be hedged.
+*/
+class DBProxyPool
+{
+public:
+	typedef std::function<void (FPAnswerPtr answer, int errorCode)> AnswerTask;
+
+private:
+	struct Endpoint
+	{
+		std::string endpoint;
+		TCPClientPtr client;
+		std::atomic<int32_t> outstanding;
+		std::atomic<uint32_t> consecutiveFailures;
+		std::atomic<int64_t> unhealthyUntilMsec;
+		std::atomic<uint64_t> questCount;
+		std::atomic<uint64_t> failedCount;
+		std::atomic<uint64_t> hedgeCount;		//-- hedges sent to this endpoint.
+
+		Endpoint(const std::string& endpoint_, TCPClientPtr client_): endpoint(endpoint_), client(client_), outstanding(0),
+			consecutiveFailures(0), unhealthyUntilMsec(0), questCount(0), failedCount(0), hedgeCount(0) {}
+	};
+
+	struct HedgedQuest
+	{
+		std::mutex mutex;
+		FPQuestPtr quest;
+		AnswerTask task;
+		Endpoint* primary;
+		int64_t sendUsec;
+		int pending;		//-- quests sent & not answered.
+		bool hedged;
+		bool done;
+
+		HedgedQuest(FPQuestPtr quest_, AnswerTask task_): quest(quest_), task(task_), primary(NULL),
+			sendUsec(0), pending(0), hedged(false), done(false) {}
+	};
+	typedef std::shared_ptr<HedgedQuest> HedgedQuestPtr;
+
+	std::vector<std::unique_ptr<Endpoint>> _endpoints;
+	std::atomic<uint32_t> _nextIndex;
+	uint32_t _maxFailures;
+	int _cooldownMsec;
+
+	//-- hedged reads
+	double _hedgePercentile;		//-- 0: disabled.
+	int64_t _hedgeMinDelayUsec;
+	double _maxHedgeRatio;
+	std::atomic<int64_t> _hedgeDelayUsec;		//-- 0 until the first latency window is complete.
+	std::mutex _latencyMutex;
+	LatencyHistogram _latencyWindow;		//-- primary read latency since the last window.
+	int64_t _windowStartUsec;
+	std::atomic<uint64_t> _windowReads;
+	std::atomic<uint64_t> _windowHedges;
+
+	std::mutex _hedgeMutex;
+	std::condition_variable _hedgeCondition;
+	std::multimap<int64_t, HedgedQuestPtr> _hedges;		//-- by hedge time, usec.
+	bool _running;
+	std::thread _hedgeThread;
+
+	DBProxyPoolStatistics _statistics;
+
+	Endpoint* pick(const Endpoint* excluded);		//-- NULL if no other endpoint.
+	bool send(Endpoint* endpoint, FPQuestPtr quest, AnswerTask task, int timeout);
+	void finished(Endpoint* endpoint, int errorCode);
+	void hedgedAnswer(HedgedQuestPtr hedged, Endpoint* endpoint, FPAnswerPtr answer, int errorCode);
+	void recordReadLatency(int64_t usec);
+	void sendHedge(HedgedQuestPtr hedged);
+	void hedgeThread();
+
+	static AnswerTask callbackTask(AnswerCallback* callback);
+
+public:
+	DBProxyPool(): _nextIndex(0), _maxFailures(3), _cooldownMsec(5000), _hedgePercentile(0), _hedgeMinDelayUsec(0),
+		_maxHedgeRatio(0), _hedgeDelayUsec(0), _windowStartUsec(0), _windowReads(0), _windowHedges(0), _running(false) {}
+	~DBProxyPool();
+
+	bool addEndpoint(const std::string& endpoint, int questTimeout);		//-- false if the endpoint is invalid.
+	size_t endpointCount() const { return _endpoints.size(); }
+	void setHealthPolicy(uint32_t maxFailures, int cooldownMsec);
+	void enableHedging(double percentile, int minDelayMsec, double maxHedgeRatio);		//-- after all endpoints are added.
+
+	FPAnswerPtr sendQuest(FPQuestPtr quest, int timeout = 0);
+	bool sendQuest(FPQuestPtr quest, AnswerCallback* callback, int timeout = 0);
+	bool sendQuest(FPQuestPtr quest, AnswerTask task, int timeout = 0);
+
+	//-- idempotent reads only. Same as sendQuest() when hedging is disabled.
+	bool sendHedgedQuest(FPQuestPtr quest, AnswerCallback* callback);
+	bool sendHedgedQuest(FPQuestPtr quest, AnswerTask task);
+
+	void stop();
+	std::string infos();
+};
+typedef std::shared_ptr<DBProxyPool> DBProxyPoolPtr;
+
+#endif
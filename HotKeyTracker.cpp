@@ -0,0 +1,208 @@
+#include <chrono>
+#include <algorithm>
+#include "HotKeyTracker.h"
+
+static int64_t hotKeyNowMsec()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void appendJsonString(std::string& buf, const std::string& value)
+{
+	buf.push_back('"');
+	for (char c: value)
+	{
+		if (c == '"' || c == '\\')
+			buf.push_back('\\');
+		else if ((unsigned char)c < 0x20)
+			c = ' ';
+
+		buf.push_back(c);
+	}
+	buf.push_back('"');
+}
+
+//===============================================//
+//-- SpaceSavingCounter
+//===============================================//
+void SpaceSavingCounter::add(const std::string& key, uint64_t count)
+{
+	auto it = _items.find(key);
+	if (it != _items.end())
+	{
+		it->second.count += count;
+		return;
+	}
+
+	if (_items.size() < _capacity)
+	{
+		Item& item = _items[key];
+		item.count = count;
+		item.error = 0;
+		return;
+	}
+
+	auto minIt = _items.begin();
+	for (auto iit = _items.begin(); iit != _items.end(); iit++)
+		if (iit->second.count < minIt->second.count)
+			minIt = iit;
+
+	Item item;
+	item.error = minIt->second.count;
+	item.count = minIt->second.count + count;
+
+	_items.erase(minIt);
+	_items[key] = item;
+}
+
+void SpaceSavingCounter::merge(const SpaceSavingCounter& other)
+{
+	for (auto& itemPair: other._items)
+		add(itemPair.first, itemPair.second.count);
+}
+
+void SpaceSavingCounter::top(size_t count, std::vector<std::pair<std::string, uint64_t>>& result) const
+{
+	result.clear();
+	for (auto& itemPair: _items)
+		result.push_back(std::make_pair(itemPair.first, itemPair.second.count));
+
+	std::sort(result.begin(), result.end(),
+		[](const std::pair<std::string, uint64_t>& a, const std::pair<std::string, uint64_t>& b) { return a.second > b.second; });
+
+	if (result.size() > count)
+		result.resize(count);
+}
+
+//===============================================//
+//-- HotKeyTracker
+//===============================================//
+HotKeyTracker::HotKeyTracker(size_t capacity, int windowSeconds, uint32_t sampleRate):
+	_capacity(capacity), _windowMsec((int64_t)windowSeconds * 1000), _windowBegin(hotKeyNowMsec()),
+	_current(0), _sampleRate(sampleRate)
+{
+}
+
+void HotKeyTracker::rotateWindow(int64_t now)
+{
+	if (now - _windowBegin < _windowMsec)
+		return;
+
+	int last = 1 - _current;
+	for (auto& tablePair: _tables)
+	{
+		tablePair.second->fetched[last].clear();
+		tablePair.second->missed[last].clear();
+	}
+
+	//-- More than two windows passed, the current window is outdated too.
+	if (now - _windowBegin >= _windowMsec * 2)
+		for (auto& tablePair: _tables)
+		{
+			tablePair.second->fetched[_current].clear();
+			tablePair.second->missed[_current].clear();
+		}
+
+	_current = last;
+	_windowBegin = now;
+}
+
+HotKeyTracker::TableTracker* HotKeyTracker::tracker(const std::string& tableName)
+{
+	auto it = _tables.find(tableName);
+	if (it != _tables.end())
+		return it->second.get();
+
+	std::shared_ptr<TableTracker> tableTracker = std::make_shared<TableTracker>(_capacity);
+	_tables[tableName] = tableTracker;
+	return tableTracker.get();
+}
+
+void HotKeyTracker::record(const std::string& tableName, const std::vector<std::string>& fetchedKeys, const std::vector<std::string>& missedKeys)
+{
+	//-- Each sampled key stands for sampleRate accesses.
+	uint64_t weight = _sampleRate.load(std::memory_order_relaxed);
+	if (weight == 0)
+		weight = 1;
+
+	std::unique_lock<std::mutex> lck(_mutex);
+	rotateWindow(hotKeyNowMsec());
+
+	TableTracker* tableTracker = tracker(tableName);
+	for (auto& key: fetchedKeys)
+		tableTracker->fetched[_current].add(key, weight);
+
+	for (auto& key: missedKeys)
+		tableTracker->missed[_current].add(key, weight);
+}
+
+void HotKeyTracker::top(const std::string& tableName, size_t count, std::map<std::string, TopKeys>& result)
+{
+	std::unique_lock<std::mutex> lck(_mutex);
+	rotateWindow(hotKeyNowMsec());
+
+	for (auto& tablePair: _tables)
+	{
+		if (tableName.size() && tablePair.first != tableName)
+			continue;
+
+		SpaceSavingCounter fetched(_capacity * 2);
+		SpaceSavingCounter missed(_capacity * 2);
+
+		for (int i = 0; i < 2; i++)
+		{
+			fetched.merge(tablePair.second->fetched[i]);
+			missed.merge(tablePair.second->missed[i]);
+		}
+
+		TopKeys& topKeys = result[tablePair.first];
+		fetched.top(count, topKeys.hot);
+		missed.top(count, topKeys.missing);
+	}
+}
+
+std::string HotKeyTracker::infos(size_t count)
+{
+	std::map<std::string, TopKeys> result;
+	top(std::string(), count, result);
+
+	std::string infos("{\"sampleRate\":");
+	infos.append(std::to_string(sampleRate())).append(",\"tables\":{");
+
+	bool needComma = false;
+	for (auto& tablePair: result)
+	{
+		if (needComma)
+			infos.append(",");
+		else
+			needComma = true;
+
+		appendJsonString(infos, tablePair.first);
+		infos.append(":{");
+
+		const char* kinds[2] = { "hot", "missing" };
+		const std::vector<std::pair<std::string, uint64_t>>* keys[2] = { &tablePair.second.hot, &tablePair.second.missing };
+		for (int i = 0; i < 2; i++)
+		{
+			if (i)
+				infos.append(",");
+
+			infos.append("\"").append(kinds[i]).append("\":[");
+			for (size_t k = 0; k < keys[i]->size(); k++)
+			{
+				if (k)
+					infos.append(",");
+
+				infos.append("[");
+				appendJsonString(infos, (*keys[i])[k].first);
+				infos.append(",").append(std::to_string((*keys[i])[k].second)).append("]");
+			}
+			infos.append("]");
+		}
+		infos.append("}");
+	}
+
+	infos.append("}}");
+	return infos;
+}
@@ -0,0 +1,89 @@
+#ifndef Hot_Key_Tracker_H
+#define Hot_Key_Tracker_H
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+/*
+	Space-saving heavy hitters summary. Keeps at most capacity counters,
+	the minimal counter is replaced when an unknown key arrives.
+*/
+class SpaceSavingCounter
+{
+	struct Item
+	{
+		uint64_t count;
+		uint64_t error;
+	};
+
+	size_t _capacity;
+	std::unordered_map<std::string, Item> _items;
+
+public:
+	explicit SpaceSavingCounter(size_t capacity): _capacity(capacity) {}
+
+	void add(const std::string& key, uint64_t count);
+	void merge(const SpaceSavingCounter& other);
+	void top(size_t count, std::vector<std::pair<std::string, uint64_t>>& result) const;
+	void clear() { _items.clear(); }
+};
+
+class HotKeyTracker
+{
+	struct TableTracker
+	{
+		SpaceSavingCounter fetched[2];
+		SpaceSavingCounter missed[2];
+
+		explicit TableTracker(size_t capacity): fetched{SpaceSavingCounter(capacity), SpaceSavingCounter(capacity)},
+			missed{SpaceSavingCounter(capacity), SpaceSavingCounter(capacity)} {}
+	};
+
+	std::mutex _mutex;
+	std::unordered_map<std::string, std::shared_ptr<TableTracker>> _tables;
+	size_t _capacity;
+	int64_t _windowMsec;
+	int64_t _windowBegin;
+	int _current;		//-- index of current window. The other one is the last completed window.
+
+	std::atomic<uint32_t> _sampleRate;
+
+	void rotateWindow(int64_t now);
+	TableTracker* tracker(const std::string& tableName);
+
+public:
+	struct TopKeys
+	{
+		std::vector<std::pair<std::string, uint64_t>> hot;
+		std::vector<std::pair<std::string, uint64_t>> missing;
+	};
+
+	HotKeyTracker(size_t capacity, int windowSeconds, uint32_t sampleRate);
+
+	//-- Cheap per key check on the fetch path. Only sampled keys are recorded.
+	inline bool sampled()
+	{
+		uint32_t rate = _sampleRate.load(std::memory_order_relaxed);
+		if (rate == 0)
+			return false;
+
+		static thread_local uint32_t counter = 0;
+		return (++counter % rate) == 0;
+	}
+
+	void record(const std::string& tableName, const std::vector<std::string>& fetchedKeys, const std::vector<std::string>& missedKeys);
+	void top(const std::string& tableName, size_t count, std::map<std::string, TopKeys>& result);
+
+	void setSampleRate(uint32_t rate) { _sampleRate = rate; }
+	uint32_t sampleRate() const { return _sampleRate; }
+
+	std::string infos(size_t count);
+};
+
+#endif
@@ -0,0 +1,375 @@
+#include <chrono>
+#include <vector>
+#include "FPWriter.h"
+#include "InvalidationPublisher.h"
+
+static int64_t publisherNowMsec()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+InvalidationPublisher::InvalidationPublisher(size_t maxSubscribers, size_t maxKeysPerSubscriber, size_t maxPendingKeys,
+	int maxLeaseSeconds, int flushIntervalMsec): _subscriberCount(0), _running(true), _maxSubscribers(maxSubscribers),
+	_maxKeysPerSubscriber(maxKeysPerSubscriber), _maxPendingKeys(maxPendingKeys ? maxPendingKeys : 1),
+	_maxLeaseSeconds(maxLeaseSeconds > 0 ? maxLeaseSeconds : 60), _flushIntervalMsec(flushIntervalMsec > 0 ? flushIntervalMsec : 50)
+{
+	_thread = std::thread(&InvalidationPublisher::flushThread, this);
+}
+
+InvalidationPublisher::~InvalidationPublisher()
+{
+	stop();
+}
+
+void InvalidationPublisher::stop()
+{
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		_running = false;
+	}
+	_condition.notify_all();
+
+	if (_thread.joinable())
+		_thread.join();
+}
+
+int InvalidationPublisher::subscribe(const ConnectionInfo& ci, QuestSenderPtr sender, const std::set<std::string>& tables,
+	const KeyMap& keys, int leaseSeconds, std::string& reason)
+{
+	if (leaseSeconds <= 0 || leaseSeconds > _maxLeaseSeconds)
+		leaseSeconds = _maxLeaseSeconds;
+
+	std::unique_lock<std::mutex> lck(_mutex);
+	auto it = _subscribers.find(ci.uniqueId());
+	if (it == _subscribers.end())
+	{
+		if (tables.empty() && keys.empty())
+		{
+			reason = "Nothing to subscribe.";
+			return 0;
+		}
+
+		if (_subscribers.size() >= _maxSubscribers)
+		{
+			reason = "Too many subscribers.";
+			return 0;
+		}
+	}
+
+	Subscriber& subscriber = _subscribers[ci.uniqueId()];
+	size_t newKeys = 0;
+	for (auto& tablePair: keys)
+	{
+		auto kit = subscriber.keys.find(tablePair.first);
+		for (auto& keyPair: tablePair.second)
+			if (kit == subscriber.keys.end() || kit->second.find(keyPair.first) == kit->second.end())
+				newKeys += 1;
+	}
+
+	if (subscriber.keyCount + newKeys > _maxKeysPerSubscriber)
+	{
+		if (subscriber.tables.empty() && subscriber.keys.empty())
+			_subscribers.erase(ci.uniqueId());
+
+		reason = "Too many subscribed keys.";
+		return 0;
+	}
+
+	subscriber.sender = sender;
+	subscriber.expireMsec = publisherNowMsec() + leaseSeconds * 1000;
+	for (auto& tableName: tables)
+		if (subscriber.tables.insert(tableName).second)
+			_tableSubscribers[tableName].insert(ci.uniqueId());
+
+	for (auto& tablePair: keys)
+	{
+		std::map<int64_t, std::string>& subscribedKeys = subscriber.keys[tablePair.first];
+		for (auto& keyPair: tablePair.second)
+			if (subscribedKeys.insert(keyPair).second)
+				_keySubscribers[tablePair.first][keyPair.first].insert(ci.uniqueId());
+	}
+	subscriber.keyCount += newKeys;
+
+	_subscriberCount = _subscribers.size();
+	return leaseSeconds;
+}
+
+void InvalidationPublisher::unsubscribe(const ConnectionInfo& ci, const std::set<std::string>& tables, const KeyMap& keys)
+{
+	std::unique_lock<std::mutex> lck(_mutex);
+	auto it = _subscribers.find(ci.uniqueId());
+	if (it == _subscribers.end())
+		return;
+
+	Subscriber& subscriber = it->second;
+	for (auto& tableName: tables)
+		if (subscriber.tables.erase(tableName))
+			unindexTable(tableName, it->first);
+
+	for (auto& tablePair: keys)
+	{
+		auto kit = subscriber.keys.find(tablePair.first);
+		if (kit == subscriber.keys.end())
+			continue;
+
+		for (auto& keyPair: tablePair.second)
+		{
+			if (kit->second.erase(keyPair.first))
+			{
+				subscriber.keyCount -= 1;
+				unindexKey(tablePair.first, keyPair.first, it->first);
+			}
+		}
+
+		if (kit->second.empty())
+			subscriber.keys.erase(kit);
+	}
+
+	if ((tables.empty() && keys.empty()) || (subscriber.tables.empty() && subscriber.keys.empty()))
+		removeSubscriber(it);
+
+	_subscriberCount = _subscribers.size();
+}
+
+void InvalidationPublisher::connectionClosed(const ConnectionInfo& ci)
+{
+	if (_subscriberCount == 0)
+		return;
+
+	std::unique_lock<std::mutex> lck(_mutex);
+	auto it = _subscribers.find(ci.uniqueId());
+	if (it != _subscribers.end())
+		removeSubscriber(it);
+
+	_subscriberCount = _subscribers.size();
+}
+
+//-- caller must hold _mutex.
+void InvalidationPublisher::unindexTable(const std::string& tableName, uint64_t subscriberId)
+{
+	auto tit = _tableSubscribers.find(tableName);
+	if (tit == _tableSubscribers.end())
+		return;
+
+	tit->second.erase(subscriberId);
+	if (tit->second.empty())
+		_tableSubscribers.erase(tit);
+}
+
+//-- caller must hold _mutex.
+void InvalidationPublisher::unindexKey(const std::string& tableName, int64_t hintId, uint64_t subscriberId)
+{
+	auto kit = _keySubscribers.find(tableName);
+	if (kit == _keySubscribers.end())
+		return;
+
+	auto hit = kit->second.find(hintId);
+	if (hit != kit->second.end())
+	{
+		hit->second.erase(subscriberId);
+		if (hit->second.empty())
+			kit->second.erase(hit);
+	}
+
+	if (kit->second.empty())
+		_keySubscribers.erase(kit);
+}
+
+//-- caller must hold _mutex.
+void InvalidationPublisher::removeSubscriber(std::map<uint64_t, Subscriber>::iterator it)
+{
+	for (auto& tableName: it->second.tables)
+		unindexTable(tableName, it->first);
+
+	for (auto& tablePair: it->second.keys)
+		for (auto& keyPair: tablePair.second)
+			unindexKey(tablePair.first, keyPair.first, it->first);
+
+	_subscribers.erase(it);
+}
+
+//-- caller must hold _mutex.
+void InvalidationPublisher::addPending(Subscriber& subscriber, const std::string& tableName, int64_t hintId, const std::string& hintString)
+{
+	PendingInvalidations& pending = subscriber.pending;
+	if (pending.tables.find(tableName) != pending.tables.end())
+		return;
+
+	if (pending.keyCount >= _maxPendingKeys)
+	{
+		//-- Slow subscriber or invalidation storm: the whole table is cheaper for both sides.
+		pending.replaceByTable(tableName);
+		_statistics.overflowTables++;
+		return;
+	}
+
+	bool inserted = hintString.empty() ? pending.hintIds[tableName].insert(hintId).second
+		: pending.hintStrings[tableName].insert(hintString).second;
+	if (inserted)
+		pending.keyCount += 1;
+}
+
+void InvalidationPublisher::invalidate(const std::string& tableName, int64_t hintId)
+{
+	if (_subscriberCount == 0)
+		return;
+
+	std::unique_lock<std::mutex> lck(_mutex);
+	invalidateKey(tableName, hintId);
+}
+
+void InvalidationPublisher::invalidate(const std::string& tableName, const std::set<int64_t>& hintIds)
+{
+	if (_subscriberCount == 0)
+		return;
+
+	std::unique_lock<std::mutex> lck(_mutex);
+	for (int64_t hintId: hintIds)
+		invalidateKey(tableName, hintId);
+}
+
+//-- caller must hold _mutex.
+void InvalidationPublisher::invalidateKey(const std::string& tableName, int64_t hintId)
+{
+	auto tit = _tableSubscribers.find(tableName);
+	if (tit != _tableSubscribers.end())
+		for (uint64_t subscriberId: tit->second)
+			addPending(_subscribers[subscriberId], tableName, hintId, std::string());
+
+	auto kit = _keySubscribers.find(tableName);
+	if (kit == _keySubscribers.end())
+		return;
+
+	auto hit = kit->second.find(hintId);
+	if (hit == kit->second.end())
+		return;
+
+	for (uint64_t subscriberId: hit->second)
+	{
+		Subscriber& subscriber = _subscribers[subscriberId];
+		if (subscriber.tables.find(tableName) != subscriber.tables.end())
+			continue;		//-- Added by the whole table.
+
+		addPending(subscriber, tableName, hintId, subscriber.keys[tableName][hintId]);
+	}
+}
+
+void InvalidationPublisher::invalidateTable(const std::string& tableName)
+{
+	if (_subscriberCount == 0)
+		return;
+
+	std::unique_lock<std::mutex> lck(_mutex);
+	for (auto& subscriberPair: _subscribers)
+	{
+		Subscriber& subscriber = subscriberPair.second;
+		if (subscriber.tables.find(tableName) == subscriber.tables.end() && subscriber.keys.find(tableName) == subscriber.keys.end())
+			continue;
+
+		subscriber.pending.replaceByTable(tableName);
+	}
+}
+
+void InvalidationPublisher::PendingInvalidations::replaceByTable(const std::string& tableName)
+{
+	auto iit = hintIds.find(tableName);
+	if (iit != hintIds.end())
+	{
+		keyCount -= iit->second.size();
+		hintIds.erase(iit);
+	}
+
+	auto sit = hintStrings.find(tableName);
+	if (sit != hintStrings.end())
+	{
+		keyCount -= sit->second.size();
+		hintStrings.erase(sit);
+	}
+
+	tables.insert(tableName);
+}
+
+FPQuestPtr InvalidationPublisher::invalidatedQuest(const PendingInvalidations& pending, bool expired)
+{
+	FPQWriter qw(4, "invalidated", true);
+	qw.param("tables", pending.tables);
+	qw.param("hintIds", pending.hintIds);
+	qw.param("hintStrings", pending.hintStrings);
+	qw.param("expired", expired);
+	return qw.take();
+}
+
+void InvalidationPublisher::flushThread()
+{
+	std::unique_lock<std::mutex> lck(_mutex);
+	while (_running)
+	{
+		_condition.wait_for(lck, std::chrono::milliseconds(_flushIntervalMsec));
+		if (!_running)
+			break;
+
+		int64_t now = publisherNowMsec();
+		std::vector<std::pair<QuestSenderPtr, FPQuestPtr>> quests;
+
+		for (auto it = _subscribers.begin(); it != _subscribers.end(); )
+		{
+			Subscriber& subscriber = it->second;
+			bool expired = subscriber.expireMsec <= now;
+			if (expired || subscriber.pending.tables.size() || subscriber.pending.keyCount)
+			{
+				quests.push_back(std::make_pair(subscriber.sender, invalidatedQuest(subscriber.pending, expired)));
+
+				_statistics.pushCount++;
+				_statistics.pushedKeys.fetch_add(subscriber.pending.keyCount);
+				_statistics.pushedTables.fetch_add(subscriber.pending.tables.size());
+				subscriber.pending = PendingInvalidations();
+			}
+
+			if (expired)
+			{
+				_statistics.expiredSubscribers++;
+				removeSubscriber(it++);
+			}
+			else
+				++it;
+		}
+		_subscriberCount = _subscribers.size();
+
+		if (quests.empty())
+			continue;
+
+		lck.unlock();
+		for (auto& questPair: quests)
+			questPair.first->sendQuest(questPair.second);
+		lck.lock();
+	}
+}
+
+std::string InvalidationPublisher::infos()
+{
+	size_t subscribers, tables = 0, keys = 0, pendingKeys = 0;
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		subscribers = _subscribers.size();
+		for (auto& subscriberPair: _subscribers)
+		{
+			tables += subscriberPair.second.tables.size();
+			keys += subscriberPair.second.keyCount;
+			pendingKeys += subscriberPair.second.pending.keyCount;
+		}
+	}
+
+	std::string infos("{\"subscribers\":");
+	infos.append(std::to_string(subscribers));
+	infos.append(",\"subscribedTables\":").append(std::to_string(tables));
+	infos.append(",\"subscribedKeys\":").append(std::to_string(keys));
+	infos.append(",\"pendingKeys\":").append(std::to_string(pendingKeys));
+	infos.append(",\"pushCount\":").append(std::to_string(_statistics.pushCount));
+	infos.append(",\"pushedKeys\":").append(std::to_string(_statistics.pushedKeys));
+	infos.append(",\"pushedTables\":").append(std::to_string(_statistics.pushedTables));
+	infos.append(",\"overflowTables\":").append(std::to_string(_statistics.overflowTables));
+	infos.append(",\"expiredSubscribers\":").append(std::to_string(_statistics.expiredSubscribers));
+	infos.append("}");
+	return infos;
+}
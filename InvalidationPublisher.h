@@ -0,0 +1,109 @@
+#ifndef Invalidation_Publisher_H
+#define Invalidation_Publisher_H
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <condition_variable>
+#include <stdint.h>
+#include "IQuestProcessor.h"
+
+using namespace fpnn;
+
+struct InvalidationPublisherStatistics
+{
+	std::atomic<uint64_t> pushCount;		//-- invalidated quests sent.
+	std::atomic<uint64_t> pushedKeys;
+	std::atomic<uint64_t> pushedTables;
+	std::atomic<uint64_t> overflowTables;		//-- too many pending keys, degraded to a table invalidation.
+	std::atomic<uint64_t> expiredSubscribers;
+
+	InvalidationPublisherStatistics(): pushCount(0), pushedKeys(0), pushedTables(0), overflowTables(0), expiredSubscribers(0) {}
+};
+
+/*
+	Invalidation push for client near caches. A connection subscribes to whole tables, or to
+	keys of tables, for a lease. Invalidations are collected per subscriber and pushed in
+	batches every flush interval as one way "invalidated" quests. Subscribers are removed when
+	their connection closes or their lease expires without renewal.
+	Subscriptions are also indexed by table & key, so an invalidation only visits its subscribers.
+*/
+class InvalidationPublisher
+{
+public:
+	typedef std::map<std::string, std::map<int64_t, std::string>> KeyMap;		//-- table, hintId: hintString (empty for integer keys).
+
+private:
+	struct PendingInvalidations
+	{
+		std::set<std::string> tables;
+		std::map<std::string, std::set<int64_t>> hintIds;
+		std::map<std::string, std::set<std::string>> hintStrings;
+		size_t keyCount;
+
+		PendingInvalidations(): keyCount(0) {}
+		void replaceByTable(const std::string& tableName);		//-- drops pending keys of the table.
+	};
+
+	struct Subscriber
+	{
+		QuestSenderPtr sender;
+		int64_t expireMsec;
+		std::set<std::string> tables;		//-- whole tables, integer keyed only.
+		KeyMap keys;
+		size_t keyCount;
+		PendingInvalidations pending;
+
+		Subscriber(): expireMsec(0), keyCount(0) {}
+	};
+
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	std::map<uint64_t, Subscriber> _subscribers;		//-- by connection unique id.
+	std::map<std::string, std::set<uint64_t>> _tableSubscribers;		//-- reverse index: table: subscribers of the whole table.
+	std::map<std::string, std::map<int64_t, std::set<uint64_t>>> _keySubscribers;		//-- reverse index: table, hintId: subscribers.
+	std::atomic<size_t> _subscriberCount;		//-- read without the lock on the invalidation paths.
+	bool _running;
+	std::thread _thread;
+
+	size_t _maxSubscribers;
+	size_t _maxKeysPerSubscriber;
+	size_t _maxPendingKeys;
+	int _maxLeaseSeconds;
+	int _flushIntervalMsec;
+
+	InvalidationPublisherStatistics _statistics;
+
+	void flushThread();
+	void addPending(Subscriber& subscriber, const std::string& tableName, int64_t hintId, const std::string& hintString);
+	void invalidateKey(const std::string& tableName, int64_t hintId);		//-- caller must hold _mutex.
+	void unindexKey(const std::string& tableName, int64_t hintId, uint64_t subscriberId);		//-- caller must hold _mutex.
+	void unindexTable(const std::string& tableName, uint64_t subscriberId);		//-- caller must hold _mutex.
+	void removeSubscriber(std::map<uint64_t, Subscriber>::iterator it);		//-- caller must hold _mutex.
+	static FPQuestPtr invalidatedQuest(const PendingInvalidations& pending, bool expired);
+
+public:
+	InvalidationPublisher(size_t maxSubscribers, size_t maxKeysPerSubscriber, size_t maxPendingKeys,
+		int maxLeaseSeconds, int flushIntervalMsec);
+	~InvalidationPublisher();
+
+	//-- adds subscriptions & renews the lease. Returns the granted lease seconds, or 0 with reason set when refused.
+	int subscribe(const ConnectionInfo& ci, QuestSenderPtr sender, const std::set<std::string>& tables,
+		const KeyMap& keys, int leaseSeconds, std::string& reason);
+	//-- nothing to remove means all subscriptions of the connection.
+	void unsubscribe(const ConnectionInfo& ci, const std::set<std::string>& tables, const KeyMap& keys);
+	void connectionClosed(const ConnectionInfo& ci);
+
+	//-- hintIds of string keyed tables are stringHintId() values.
+	void invalidate(const std::string& tableName, int64_t hintId);
+	void invalidate(const std::string& tableName, const std::set<int64_t>& hintIds);
+	void invalidateTable(const std::string& tableName);
+
+	void stop();
+	std::string infos();
+};
+
+#endif
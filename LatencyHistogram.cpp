@@ -0,0 +1,194 @@
+#include <string.h>
+#include "LatencyHistogram.h"
+
+//===============================================//
+//-- LatencyHistogram
+//===============================================//
+int LatencyHistogram::bucketIndex(uint64_t value)
+{
+	if (value < SubBucketCount)
+		return (int)value;
+
+	int exponent = 63 - __builtin_clzll(value);
+	if (exponent > MaxExponent)
+		return BucketCount - 1;
+
+	int subBucket = (int)((value >> (exponent - SubBucketBits)) & (SubBucketCount - 1));
+	return SubBucketCount + (exponent - SubBucketBits) * SubBucketCount + subBucket;
+}
+
+uint64_t LatencyHistogram::bucketValue(int index)
+{
+	if (index < SubBucketCount)
+		return (uint64_t)index;
+
+	int exponent = (index - SubBucketCount) / SubBucketCount + SubBucketBits;
+	uint64_t subBucket = (uint64_t)((index - SubBucketCount) % SubBucketCount);
+	uint64_t base = (uint64_t)1 << exponent;
+	uint64_t step = (uint64_t)1 << (exponent - SubBucketBits);
+	return base + subBucket * step + step - 1;
+}
+
+void LatencyHistogram::record(int64_t usec)
+{
+	uint64_t value = usec > 0 ? (uint64_t)usec : 0;
+
+	_buckets[bucketIndex(value)]++;
+	_count++;
+	_sum += value;
+	if (value > _max)
+		_max = value;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+	for (int i = 0; i < BucketCount; i++)
+		_buckets[i] += other._buckets[i];
+
+	_count += other._count;
+	_sum += other._sum;
+	if (other._max > _max)
+		_max = other._max;
+}
+
+void LatencyHistogram::reset()
+{
+	memset(_buckets, 0, sizeof(_buckets));
+	_count = 0;
+	_sum = 0;
+	_max = 0;
+}
+
+uint64_t LatencyHistogram::percentile(double percent) const
+{
+	if (_count == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t)(_count * percent / 100.0);
+	if (rank >= _count)
+		rank = _count - 1;
+
+	uint64_t seen = 0;
+	for (int i = 0; i < BucketCount; i++)
+	{
+		seen += _buckets[i];
+		if (seen > rank)
+		{
+			uint64_t value = bucketValue(i);
+			return value < _max ? value : _max;
+		}
+	}
+	return _max;
+}
+
+//===============================================//
+//-- LatencyRecorder
+//===============================================//
+LatencyRecorder& LatencyRecorder::instance()
+{
+	static LatencyRecorder recorder;
+	return recorder;
+}
+
+LatencyRecorder::ThreadHistograms* LatencyRecorder::threadHistograms()
+{
+	static thread_local ThreadHistograms* histograms = NULL;
+	if (histograms)
+		return histograms;
+
+	//-- Kept by the registry after the thread exits, so recorded data is not lost.
+	ThreadHistogramsPtr threadHistograms = std::make_shared<ThreadHistograms>();
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		_threads.push_back(threadHistograms);
+	}
+
+	histograms = threadHistograms.get();
+	return histograms;
+}
+
+void LatencyRecorder::record(const std::string& method, const std::string& tableName, int64_t usec)
+{
+	ThreadHistograms* histograms = threadHistograms();
+
+	std::unique_lock<std::mutex> lck(histograms->mutex);
+	histograms->histograms[method][tableName].record(usec);
+}
+
+void LatencyRecorder::merge(std::map<std::string, std::map<std::string, LatencyHistogram>>& result)
+{
+	std::vector<ThreadHistogramsPtr> threads;
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		threads = _threads;
+	}
+
+	for (auto& histograms: threads)
+	{
+		std::unique_lock<std::mutex> lck(histograms->mutex);
+		for (auto& methodPair: histograms->histograms)
+			for (auto& tablePair: methodPair.second)
+				result[methodPair.first][tablePair.first].merge(tablePair.second);
+	}
+}
+
+void LatencyRecorder::reset()
+{
+	std::vector<ThreadHistogramsPtr> threads;
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		threads = _threads;
+	}
+
+	for (auto& histograms: threads)
+	{
+		std::unique_lock<std::mutex> lck(histograms->mutex);
+		histograms->histograms.clear();
+	}
+}
+
+std::string LatencyRecorder::infos()
+{
+	std::map<std::string, std::map<std::string, LatencyHistogram>> histograms;
+	merge(histograms);
+
+	std::string infos("{");
+	bool needComma = false;
+	for (auto& methodPair: histograms)
+	{
+		if (needComma)
+			infos.append(",");
+		else
+			needComma = true;
+
+		LatencyHistogram total;
+		infos.append("\"").append(methodPair.first).append("\":{");
+		for (auto& tablePair: methodPair.second)
+			total.merge(tablePair.second);
+
+		methodPair.second["*"] = total;
+
+		bool needTableComma = false;
+		for (auto& tablePair: methodPair.second)
+		{
+			if (needTableComma)
+				infos.append(",");
+			else
+				needTableComma = true;
+
+			const LatencyHistogram& histogram = tablePair.second;
+			infos.append("\"").append(tablePair.first).append("\":{");
+			infos.append("\"count\":").append(std::to_string(histogram.count()));
+			infos.append(",\"mean\":").append(std::to_string(histogram.mean()));
+			infos.append(",\"p50\":").append(std::to_string(histogram.percentile(50)));
+			infos.append(",\"p90\":").append(std::to_string(histogram.percentile(90)));
+			infos.append(",\"p99\":").append(std::to_string(histogram.percentile(99)));
+			infos.append(",\"p999\":").append(std::to_string(histogram.percentile(99.9)));
+			infos.append(",\"max\":").append(std::to_string(histogram.max()));
+			infos.append("}");
+		}
+		infos.append("}");
+	}
+	infos.append("}");
+	return infos;
+}
@@ -0,0 +1,79 @@
+#ifndef Latency_Histogram_H
+#define Latency_Histogram_H
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+inline int64_t latencyNowUsec()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+	Log-linear histogram of microseconds, HDR style.
+	Values below 16 are exact, larger values keep 4 significant bits (relative error < 6.25%).
+*/
+class LatencyHistogram
+{
+	enum { SubBucketBits = 4, SubBucketCount = 1 << SubBucketBits, MaxExponent = 40,
+		BucketCount = SubBucketCount + (MaxExponent - SubBucketBits + 1) * SubBucketCount };
+
+	uint64_t _buckets[BucketCount];
+	uint64_t _count;
+	uint64_t _sum;
+	uint64_t _max;
+
+	static int bucketIndex(uint64_t value);
+	static uint64_t bucketValue(int index);		//-- upper bound of the bucket.
+
+public:
+	LatencyHistogram() { reset(); }
+
+	void record(int64_t usec);
+	void merge(const LatencyHistogram& other);
+	void reset();
+
+	uint64_t count() const { return _count; }
+	uint64_t max() const { return _max; }
+	uint64_t mean() const { return _count ? _sum / _count : 0; }
+	uint64_t percentile(double percent) const;
+};
+
+/*
+	Per-thread histograms keyed by method & table. Recording only locks the
+	recording thread's own (uncontended) mutex; all threads are merged on demand.
+*/
+class LatencyRecorder
+{
+	typedef std::unordered_map<std::string, std::unordered_map<std::string, LatencyHistogram>> HistogramMap;
+
+	struct ThreadHistograms
+	{
+		std::mutex mutex;
+		HistogramMap histograms;
+	};
+	typedef std::shared_ptr<ThreadHistograms> ThreadHistogramsPtr;
+
+	std::mutex _mutex;
+	std::vector<ThreadHistogramsPtr> _threads;
+
+	ThreadHistograms* threadHistograms();
+
+public:
+	static LatencyRecorder& instance();
+
+	void record(const std::string& method, const std::string& tableName, int64_t usec);
+	void merge(std::map<std::string, std::map<std::string, LatencyHistogram>>& result);
+	void reset();
+
+	std::string infos();
+};
+
+#endif
@@ -0,0 +1,144 @@
+#include <new>
+#include <stdlib.h>
+#include "LockProfiler.h"
+
+//===============================================//
+//-- Global operator new replacement: counts heap allocations per thread.
+//===============================================//
+static thread_local uint64_t gt_allocationCount = 0;
+
+static inline void* countedAllocate(size_t size)
+{
+	gt_allocationCount++;
+	while (true)
+	{
+		void* ptr = malloc(size ? size : 1);
+		if (ptr)
+			return ptr;
+
+		std::new_handler handler = std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+
+		handler();
+	}
+}
+
+void* operator new(size_t size) { return countedAllocate(size); }
+void* operator new[](size_t size) { return countedAllocate(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	try { return countedAllocate(size); }
+	catch (...) { return NULL; }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	try { return countedAllocate(size); }
+	catch (...) { return NULL; }
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+
+//===============================================//
+//-- LockProfiler
+//===============================================//
+static const char* const lockSiteNames[LockProfiler::LockSiteCount] = {
+	"real_fetch", "addRows", "cleanCache", "invalidate", "invalidateTable", "infos", "tableScheme", "snapshot", "refreshAhead", "writeBehind", "rehash" };
+
+static const char* const requestKindNames[LockProfiler::RequestKindCount] = { "fetch", "modify", "delete" };
+
+uint64_t LockProfiler::threadAllocationCount()
+{
+	return gt_allocationCount;
+}
+
+void LockProfiler::updateMax(std::atomic<uint64_t>& maxValue, uint64_t value)
+{
+	uint64_t current = maxValue.load(std::memory_order_relaxed);
+	while (value > current && !maxValue.compare_exchange_weak(current, value, std::memory_order_relaxed))
+		;
+}
+
+void LockProfiler::recordLock(LockSite site, int64_t waitUsec, int64_t holdUsec)
+{
+	SiteStatistics& statistics = _sites[site];
+	statistics.acquireCount.fetch_add(1, std::memory_order_relaxed);
+	statistics.waitUsec.fetch_add((uint64_t)waitUsec, std::memory_order_relaxed);
+	statistics.holdUsec.fetch_add((uint64_t)holdUsec, std::memory_order_relaxed);
+	updateMax(statistics.maxWaitUsec, (uint64_t)waitUsec);
+	updateMax(statistics.maxHoldUsec, (uint64_t)holdUsec);
+}
+
+void LockProfiler::recordAllocations(RequestKind kind, uint64_t allocationCount)
+{
+	_allocations[kind].requestCount.fetch_add(1, std::memory_order_relaxed);
+	_allocations[kind].allocationCount.fetch_add(allocationCount, std::memory_order_relaxed);
+}
+
+void LockProfiler::reset()
+{
+	for (int i = 0; i < LockSiteCount; i++)
+	{
+		_sites[i].acquireCount = 0;
+		_sites[i].waitUsec = 0;
+		_sites[i].holdUsec = 0;
+		_sites[i].maxWaitUsec = 0;
+		_sites[i].maxHoldUsec = 0;
+	}
+
+	for (int i = 0; i < RequestKindCount; i++)
+	{
+		_allocations[i].requestCount = 0;
+		_allocations[i].allocationCount = 0;
+	}
+}
+
+std::string LockProfiler::infos()
+{
+	std::string infos("{\"enabled\":");
+	infos.append(enabled() ? "true" : "false").append(",\"lockSites\":{");
+
+	for (int i = 0; i < LockSiteCount; i++)
+	{
+		uint64_t count = _sites[i].acquireCount;
+		uint64_t waitUsec = _sites[i].waitUsec;
+		uint64_t holdUsec = _sites[i].holdUsec;
+
+		if (i)
+			infos.append(",");
+
+		infos.append("\"").append(lockSiteNames[i]).append("\":{");
+		infos.append("\"acquireCount\":").append(std::to_string(count));
+		infos.append(",\"waitUsec\":").append(std::to_string(waitUsec));
+		infos.append(",\"holdUsec\":").append(std::to_string(holdUsec));
+		infos.append(",\"avgWaitUsec\":").append(std::to_string(count ? waitUsec / count : 0));
+		infos.append(",\"avgHoldUsec\":").append(std::to_string(count ? holdUsec / count : 0));
+		infos.append(",\"maxWaitUsec\":").append(std::to_string(_sites[i].maxWaitUsec));
+		infos.append(",\"maxHoldUsec\":").append(std::to_string(_sites[i].maxHoldUsec));
+		infos.append("}");
+	}
+
+	infos.append("},\"allocations\":{");
+	for (int i = 0; i < RequestKindCount; i++)
+	{
+		uint64_t requests = _allocations[i].requestCount;
+		uint64_t allocations = _allocations[i].allocationCount;
+
+		if (i)
+			infos.append(",");
+
+		infos.append("\"").append(requestKindNames[i]).append("\":{");
+		infos.append("\"requestCount\":").append(std::to_string(requests));
+		infos.append(",\"allocationCount\":").append(std::to_string(allocations));
+		infos.append(",\"perRequest\":").append(std::to_string(requests ? allocations / requests : 0));
+		infos.append("}");
+	}
+
+	infos.append("}}");
+	return infos;
+}
@@ -0,0 +1,130 @@
+#ifndef Lock_Profiler_H
+#define Lock_Profiler_H
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include "RWLocker.hpp"
+#include "LatencyHistogram.h"
+
+using namespace fpnn;
+
+/*
+	Wait & hold time of the cache lock per call site, and heap allocations per request.
+	When disabled, the keepers cost one relaxed atomic load besides the lock itself.
+*/
+class LockProfiler
+{
+public:
+	enum LockSite
+	{
+		RealFetch,
+		AddRows,
+		CleanCache,
+		Invalidate,
+		InvalidateTable,
+		Infos,
+		TableScheme,
+		Snapshot,
+		RefreshAhead,
+		WriteBehind,
+		Rehash,
+		LockSiteCount
+	};
+
+	enum RequestKind
+	{
+		FetchRequest,
+		ModifyRequest,
+		DeleteRequest,
+		RequestKindCount
+	};
+
+private:
+	struct SiteStatistics
+	{
+		std::atomic<uint64_t> acquireCount;
+		std::atomic<uint64_t> waitUsec;
+		std::atomic<uint64_t> holdUsec;
+		std::atomic<uint64_t> maxWaitUsec;
+		std::atomic<uint64_t> maxHoldUsec;
+
+		SiteStatistics(): acquireCount(0), waitUsec(0), holdUsec(0), maxWaitUsec(0), maxHoldUsec(0) {}
+	};
+
+	struct AllocationStatistics
+	{
+		std::atomic<uint64_t> requestCount;
+		std::atomic<uint64_t> allocationCount;
+
+		AllocationStatistics(): requestCount(0), allocationCount(0) {}
+	};
+
+	std::atomic<bool> _enabled;
+	SiteStatistics _sites[LockSiteCount];
+	AllocationStatistics _allocations[RequestKindCount];
+
+	static void updateMax(std::atomic<uint64_t>& maxValue, uint64_t value);
+
+public:
+	LockProfiler(): _enabled(false) {}
+
+	//-- Heap allocations done by current thread. Counted by the replaced global operator new.
+	static uint64_t threadAllocationCount();
+
+	inline bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+	void enable(bool enabled) { _enabled = enabled; }
+	void reset();
+
+	void recordLock(LockSite site, int64_t waitUsec, int64_t holdUsec);
+	void recordAllocations(RequestKind kind, uint64_t allocationCount);
+
+	std::string infos();
+};
+
+template <typename Keeper>
+class ProfiledKeeper
+{
+	LockProfiler& _profiler;
+	LockProfiler::LockSite _site;
+	bool _enabled;
+	int64_t _begin;
+	Keeper _keeper;		//-- must be declared after _begin: locks after the begin time is taken.
+	int64_t _acquired;
+
+public:
+	ProfiledKeeper(RWLocker* locker, LockProfiler& profiler, LockProfiler::LockSite site):
+		_profiler(profiler), _site(site), _enabled(profiler.enabled()),
+		_begin(_enabled ? latencyNowUsec() : 0), _keeper(locker),
+		_acquired(_enabled ? latencyNowUsec() : 0) {}
+
+	~ProfiledKeeper()
+	{
+		if (_enabled)
+			_profiler.recordLock(_site, _acquired - _begin, latencyNowUsec() - _acquired);
+	}
+};
+
+typedef ProfiledKeeper<RKeeper> ProfiledRKeeper;
+typedef ProfiledKeeper<WKeeper> ProfiledWKeeper;
+
+class AllocationKeeper
+{
+	LockProfiler& _profiler;
+	LockProfiler::RequestKind _kind;
+	bool _enabled;
+	uint64_t _begin;
+
+public:
+	AllocationKeeper(LockProfiler& profiler, LockProfiler::RequestKind kind):
+		_profiler(profiler), _kind(kind), _enabled(profiler.enabled()),
+		_begin(_enabled ? LockProfiler::threadAllocationCount() : 0) {}
+
+	~AllocationKeeper()
+	{
+		if (_enabled)
+			_profiler.recordAllocations(_kind, LockProfiler::threadAllocationCount() - _begin);
+	}
+};
+
+#endif
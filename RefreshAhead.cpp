@@ -0,0 +1,227 @@
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include "RefreshAhead.h"
+
+static const int refreshAheadTicksPerSecond = 10;
+
+//===============================================//
+//-- FrequencySketch
+//===============================================//
+FrequencySketch::FrequencySketch(size_t width): _additions(0)
+{
+	size_t size = 1024;
+	while (size < width && size < ((size_t)1 << 24))
+		size <<= 1;
+
+	_widthMask = size - 1;
+	_agingThreshold = (uint64_t)size * 10;
+	_counters.reset(new std::atomic<uint8_t>[size * depth]);
+	for (size_t i = 0; i < size * depth; i++)
+		_counters[i].store(0, std::memory_order_relaxed);
+}
+
+void FrequencySketch::increase(uint64_t hash)
+{
+	for (int row = 0; row < depth; row++)
+	{
+		std::atomic<uint8_t>& counter = _counters[slot(hash, row)];
+		uint8_t value = counter.load(std::memory_order_relaxed);
+		if (value < 255)
+			counter.store(value + 1, std::memory_order_relaxed);
+	}
+	_additions.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint32_t FrequencySketch::estimate(uint64_t hash) const
+{
+	uint32_t result = 255;
+	for (int row = 0; row < depth; row++)
+	{
+		uint32_t value = _counters[slot(hash, row)].load(std::memory_order_relaxed);
+		if (value < result)
+			result = value;
+	}
+	return result;
+}
+
+void FrequencySketch::age()
+{
+	size_t count = (_widthMask + 1) * depth;
+	for (size_t i = 0; i < count; i++)
+		_counters[i].store(_counters[i].load(std::memory_order_relaxed) >> 1, std::memory_order_relaxed);
+
+	_additions.store(0, std::memory_order_relaxed);
+}
+
+//===============================================//
+//-- RefreshAheadScheduler
+//===============================================//
+RefreshAheadScheduler::RefreshAheadScheduler(Reloader reloader, size_t sketchWidth, uint32_t minFrequency,
+	uint32_t maxRowsPerSecond, size_t batchSize, uint32_t maxInflight, size_t queueSize):
+	_sketch(sketchWidth), _reloader(reloader), _pendingCount(0), _queueSize(queueSize), _batchSize(batchSize ? batchSize : 1),
+	_minFrequency(minFrequency), _maxRowsPerSecond(maxRowsPerSecond), _maxInflight(maxInflight ? maxInflight : 1),
+	_inflight(0), _running(true)
+{
+	_thread = std::thread(&RefreshAheadScheduler::workThread, this);
+}
+
+RefreshAheadScheduler::~RefreshAheadScheduler()
+{
+	stop();
+}
+
+void RefreshAheadScheduler::stop()
+{
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		_running = false;
+	}
+	_condition.notify_all();
+
+	if (_thread.joinable())
+		_thread.join();
+}
+
+void RefreshAheadScheduler::invalidated(const std::string& tableName, int64_t hintId, const std::string& hintString)
+{
+	uint32_t tableHash = jenkins_hash(tableName.data(), tableName.length(), 0);
+	if (_sketch.estimate(FrequencySketch::keyHash(tableHash, hintId)) < _minFrequency.load(std::memory_order_relaxed))
+	{
+		_statistics.infrequentRows.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lck(_mutex);
+	if (_pendingCount >= _queueSize)
+	{
+		_statistics.droppedRows.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	PendingRows& pending = _pending[tableName];
+	bool inserted = hintString.empty() ? pending.hintIds.insert(hintId).second : pending.hintStrings.insert(hintString).second;
+	if (inserted)
+	{
+		_pendingCount += 1;
+		_statistics.scheduledRows.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void RefreshAheadScheduler::finished(size_t reloadedRows, bool succeed)
+{
+	if (!succeed)
+		_statistics.failedBatches.fetch_add(1, std::memory_order_relaxed);
+
+	_statistics.reloadedRows.fetch_add(reloadedRows, std::memory_order_relaxed);
+	_inflight.fetch_sub(1);
+	_condition.notify_all();
+}
+
+//-- caller must hold _mutex.
+size_t RefreshAheadScheduler::takeBatch(size_t maxRows, std::string& tableName, std::set<int64_t>& hintIds, std::set<std::string>& hintStrings)
+{
+	auto it = _pending.begin();
+	tableName = it->first;
+	PendingRows& pending = it->second;
+
+	while (pending.hintIds.size() && hintIds.size() < maxRows)
+	{
+		hintIds.insert(*pending.hintIds.begin());
+		pending.hintIds.erase(pending.hintIds.begin());
+	}
+
+	//-- A table is keyed either by integers or by strings, never mixed in one batch.
+	while (hintIds.empty() && pending.hintStrings.size() && hintStrings.size() < maxRows)
+	{
+		hintStrings.insert(*pending.hintStrings.begin());
+		pending.hintStrings.erase(pending.hintStrings.begin());
+	}
+
+	if (pending.hintIds.empty() && pending.hintStrings.empty())
+		_pending.erase(it);
+
+	size_t count = hintIds.size() + hintStrings.size();
+	_pendingCount -= count;
+	return count;
+}
+
+void RefreshAheadScheduler::workThread()
+{
+	double tokens = 0;
+	std::unique_lock<std::mutex> lck(_mutex);
+	while (_running)
+	{
+		_condition.wait_for(lck, std::chrono::milliseconds(1000 / refreshAheadTicksPerSecond));
+		if (!_running)
+			break;
+
+		if (_sketch.agingRequired())
+		{
+			lck.unlock();
+			_sketch.age();
+			lck.lock();
+		}
+
+		//-- Token bucket, at most one second of burst.
+		double rate = _maxRowsPerSecond.load(std::memory_order_relaxed);
+		tokens += rate / refreshAheadTicksPerSecond;
+		if (tokens > rate)
+			tokens = rate;
+
+		while (_running && _pending.size() && tokens >= 1 && _inflight < _maxInflight)
+		{
+			std::string tableName;
+			std::set<int64_t> hintIds;
+			std::set<std::string> hintStrings;
+			size_t count = takeBatch(std::min(_batchSize, (size_t)tokens), tableName, hintIds, hintStrings);
+
+			tokens -= count;
+			_inflight.fetch_add(1);
+			_statistics.batchCount.fetch_add(1, std::memory_order_relaxed);
+			_statistics.requestedRows.fetch_add(count, std::memory_order_relaxed);
+
+			lck.unlock();
+			bool sent = _reloader(tableName, hintIds, hintStrings);
+			lck.lock();
+
+			if (!sent)
+			{
+				_inflight.fetch_sub(1);
+				_statistics.failedBatches.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+	}
+}
+
+std::string RefreshAheadScheduler::infos()
+{
+	size_t pendingCount;
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		pendingCount = _pendingCount;
+	}
+
+	uint64_t reloaded = _statistics.reloadedRows;
+	uint64_t hits = _statistics.hitRows;
+
+	char ratio[32];
+	snprintf(ratio, sizeof(ratio), "%.4f", reloaded ? (double)hits / reloaded : 0.0);
+
+	std::string infos("{\"minFrequency\":");
+	infos.append(std::to_string(_minFrequency));
+	infos.append(",\"maxRowsPerSecond\":").append(std::to_string(_maxRowsPerSecond));
+	infos.append(",\"pendingRows\":").append(std::to_string(pendingCount));
+	infos.append(",\"inflightBatches\":").append(std::to_string(_inflight));
+	infos.append(",\"scheduledRows\":").append(std::to_string(_statistics.scheduledRows));
+	infos.append(",\"infrequentRows\":").append(std::to_string(_statistics.infrequentRows));
+	infos.append(",\"droppedRows\":").append(std::to_string(_statistics.droppedRows));
+	infos.append(",\"batchCount\":").append(std::to_string(_statistics.batchCount));
+	infos.append(",\"failedBatches\":").append(std::to_string(_statistics.failedBatches));
+	infos.append(",\"requestedRows\":").append(std::to_string(_statistics.requestedRows));
+	infos.append(",\"reloadedRows\":").append(std::to_string(reloaded));
+	infos.append(",\"hitRows\":").append(std::to_string(hits));
+	infos.append(",\"hitRatio\":").append(ratio);
+	infos.append("}");
+	return infos;
+}
@@ -0,0 +1,142 @@
+#ifndef Refresh_Ahead_H
+#define Refresh_Ahead_H
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include <stdint.h>
+#include "jenkins.h"
+
+using namespace fpnn;
+
+/*
+	Count-min sketch of row accesses with 8 bits saturating counters. Counters are halved
+	every 10 * width additions, so the estimate follows recent frequency.
+	Increments are relaxed load & store: concurrent increments may be lost, which is fine
+	for a frequency estimate.
+*/
+class FrequencySketch
+{
+	static const int depth = 4;
+
+	size_t _widthMask;
+	std::unique_ptr<std::atomic<uint8_t>[]> _counters;		//-- depth * width
+	std::atomic<uint64_t> _additions;
+	uint64_t _agingThreshold;
+
+	inline size_t slot(uint64_t hash, int row) const
+	{
+		uint32_t part = (uint32_t)(hash >> (row * 16)) ^ (uint32_t)(hash >> 32) * (uint32_t)(2 * row + 1);
+		return (size_t)row * (_widthMask + 1) + (part & _widthMask);
+	}
+
+public:
+	explicit FrequencySketch(size_t width);
+
+	static inline uint64_t keyHash(uint32_t tableHash, int64_t hintId)
+	{
+		uint64_t x = (uint64_t)hintId * 0x9E3779B97F4A7C15ULL ^ ((uint64_t)tableHash << 32);
+		x ^= x >> 30;
+		x *= 0xBF58476D1CE4E5B9ULL;
+		x ^= x >> 27;
+		x *= 0x94D049BB133111EBULL;
+		x ^= x >> 31;
+		return x;
+	}
+
+	void increase(uint64_t hash);
+	uint32_t estimate(uint64_t hash) const;
+	bool agingRequired() const { return _additions.load(std::memory_order_relaxed) >= _agingThreshold; }
+	void age();		//-- halves all counters. Called by one thread.
+};
+
+struct RefreshAheadStatistics
+{
+	std::atomic<uint64_t> scheduledRows;		//-- frequently read rows queued after invalidation.
+	std::atomic<uint64_t> infrequentRows;		//-- invalidated rows not frequent enough to refresh.
+	std::atomic<uint64_t> droppedRows;		//-- queue full.
+	std::atomic<uint64_t> batchCount;
+	std::atomic<uint64_t> failedBatches;
+	std::atomic<uint64_t> requestedRows;
+	std::atomic<uint64_t> reloadedRows;		//-- rows returned by DBProxy and cached.
+	std::atomic<uint64_t> hitRows;		//-- reloaded rows later served from cache.
+
+	RefreshAheadStatistics(): scheduledRows(0), infrequentRows(0), droppedRows(0), batchCount(0),
+		failedBatches(0), requestedRows(0), reloadedRows(0), hitRows(0) {}
+};
+
+/*
+	Reloads frequently read rows in background after they are invalidated, so the first readers
+	after a write do not pay the DBProxy round trip. Rows are grouped per table into batches,
+	and sent at most maxRowsPerSecond rows per second with at most maxInflight batches waiting
+	for DBProxy.
+*/
+class RefreshAheadScheduler
+{
+public:
+	//-- sends one batch. Returns false if not sent. finished() must be called for every sent batch.
+	typedef std::function<bool (const std::string& tableName, const std::set<int64_t>& hintIds,
+		const std::set<std::string>& hintStrings)> Reloader;
+
+private:
+	struct PendingRows
+	{
+		std::set<int64_t> hintIds;
+		std::set<std::string> hintStrings;
+	};
+
+	FrequencySketch _sketch;
+	Reloader _reloader;
+
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	std::map<std::string, PendingRows> _pending;
+	size_t _pendingCount;
+	size_t _queueSize;
+	size_t _batchSize;
+
+	std::atomic<uint32_t> _minFrequency;
+	std::atomic<uint32_t> _maxRowsPerSecond;
+	std::atomic<uint32_t> _maxInflight;
+	std::atomic<uint32_t> _inflight;
+	bool _running;
+	std::thread _thread;
+
+	RefreshAheadStatistics _statistics;
+
+	void workThread();
+	size_t takeBatch(size_t maxRows, std::string& tableName, std::set<int64_t>& hintIds, std::set<std::string>& hintStrings);
+
+public:
+	RefreshAheadScheduler(Reloader reloader, size_t sketchWidth, uint32_t minFrequency, uint32_t maxRowsPerSecond,
+		size_t batchSize, uint32_t maxInflight, size_t queueSize);
+	~RefreshAheadScheduler();
+
+	template <typename Container>
+	void access(const std::string& tableName, const Container& hintIds)
+	{
+		uint32_t tableHash = jenkins_hash(tableName.data(), tableName.length(), 0);
+		for (int64_t hintId: hintIds)
+			_sketch.increase(FrequencySketch::keyHash(tableHash, hintId));
+	}
+
+	//-- called for every cached row removed by an invalidation. hintString is empty for integer keys.
+	void invalidated(const std::string& tableName, int64_t hintId, const std::string& hintString);
+	void finished(size_t reloadedRows, bool succeed);
+	void hit() { _statistics.hitRows.fetch_add(1, std::memory_order_relaxed); }
+	void stop();
+
+	void setMinFrequency(uint32_t minFrequency) { _minFrequency = minFrequency; }
+	void setMaxRowsPerSecond(uint32_t maxRowsPerSecond) { _maxRowsPerSecond = maxRowsPerSecond; }
+
+	std::string infos();
+};
+
+#endif
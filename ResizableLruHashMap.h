@@ -0,0 +1,448 @@
+#ifndef Resizable_Lru_Hash_Map_H
+#define Resizable_Lru_Hash_Map_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include "CacheArena.h"
+
+struct HashChainStatistics
+{
+	size_t sampledBuckets;
+	size_t emptyBuckets;
+	size_t sampledNodes;
+	size_t maxChain;
+
+	HashChainStatistics(): sampledBuckets(0), emptyBuckets(0), sampledNodes(0), maxChain(0) {}
+
+	double averageChain() const { return sampledBuckets > emptyBuckets ? (double)sampledNodes / (sampledBuckets - emptyBuckets) : 0; }
+};
+
+/*
+	LruHashMap with the interface of fpnn::LruHashMap, and online resizing of the bucket array.
+	resize() allocates the new bucket array and moves the nodes a few buckets at a time: each
+	find / insert / remove moves one bucket, and rehash_step() moves more. While rehashing, a key
+	is in the old bucket if that bucket is not moved yet, else in the new one, so lookups still
+	check one chain only. Nodes never move in memory: node pointers stay valid across resizing.
+	With load factors set, insert() grows the array 2 times when count > slots * maxLoadFactor,
+	and remove shrinks it by half when count < slots * minLoadFactor, not below minSlotSize.
+	The resize listener is called by every resize() that starts, under the caller's lock.
+	use_arena() moves the nodes & bucket arrays of an empty map to a CacheArena (huge pages, NUMA).
+	Like fpnn::LruHashMap, not thread safe. find() also moves buckets: callers must hold an
+	exclusive lock for every call but the const ones.
+*/
+template <typename KeyType, typename DataType>
+class ResizableLruHashMap
+{
+public:
+	struct node_type
+	{
+		const KeyType key;
+		DataType data;
+
+	private:
+		friend class ResizableLruHashMap;
+
+		node_type* hashNext;
+		node_type* lruPrev;		//-- to the stale end.
+		node_type* lruNext;		//-- to the fresh end.
+		unsigned int hash;
+
+		node_type(const KeyType& key_, const DataType& data_, unsigned int hash_): key(key_), data(data_),
+			hashNext(NULL), lruPrev(NULL), lruNext(NULL), hash(hash_) {}
+	};
+
+private:
+	struct BucketArray
+	{
+		node_type** buckets;
+		size_t mask;
+	};
+
+	BucketArray _tables[2];		//-- [1] is the new array while rehashing.
+	bool _rehashing;
+	size_t _rehashIndex;		//-- buckets of _tables[0] before it are moved.
+
+	node_type* _lruHead;		//-- most stale.
+	node_type* _lruTail;		//-- most fresh.
+	size_t _count;
+	size_t _maxSize;		//-- 0: unlimited.
+
+	double _maxLoadFactor;		//-- 0: no automatic growing.
+	double _minLoadFactor;		//-- 0: no automatic shrinking.
+	size_t _minSlotSize;
+	std::function<void ()> _resizeListener;
+	size_t _resizeCount;
+
+	std::unique_ptr<CacheArena> _arena;		//-- NULL: malloc heap.
+
+	static size_t roundSlotSize(size_t slotSize)
+	{
+		size_t size = 16;
+		while (size < slotSize && size < ((size_t)1 << 40))
+			size <<= 1;
+		return size;
+	}
+
+	bool allocate(BucketArray& table, size_t slotSize)
+	{
+		//-- calloc() & the arena map zero pages lazily: large arrays cost little until used.
+		if (_arena)
+			table.buckets = (node_type**)_arena->allocateArray(slotSize * sizeof(node_type*));
+		else
+			table.buckets = (node_type**)calloc(slotSize, sizeof(node_type*));
+		table.mask = slotSize - 1;
+		return table.buckets != NULL;
+	}
+
+	void release(BucketArray& table)
+	{
+		if (_arena)
+			_arena->deallocateArray(table.buckets);
+		else
+			free(table.buckets);
+
+		table.buckets = NULL;
+		table.mask = 0;
+	}
+
+	node_type* newNode(const KeyType& key, const DataType& data, unsigned int hash)
+	{
+		if (!_arena)
+			return new node_type(key, data, hash);
+
+		void* block = _arena->allocate();
+		try
+		{
+			return new (block) node_type(key, data, hash);
+		}
+		catch (...)
+		{
+			_arena->deallocate(block);
+			throw;
+		}
+	}
+
+	void deleteNode(node_type* node)
+	{
+		if (!_arena)
+		{
+			delete node;
+			return;
+		}
+
+		node->~node_type();
+		_arena->deallocate(node);
+	}
+
+	inline node_type** chain(unsigned int hash)
+	{
+		size_t index = (size_t)hash & _tables[0].mask;
+		if (_rehashing && index < _rehashIndex)
+			return &_tables[1].buckets[(size_t)hash & _tables[1].mask];
+
+		return &_tables[0].buckets[index];
+	}
+
+	void moveBucket()
+	{
+		node_type* node = _tables[0].buckets[_rehashIndex];
+		_tables[0].buckets[_rehashIndex] = NULL;
+		while (node)
+		{
+			node_type* next = node->hashNext;
+			node_type** target = &_tables[1].buckets[(size_t)node->hash & _tables[1].mask];
+			node->hashNext = *target;
+			*target = node;
+			node = next;
+		}
+
+		_rehashIndex += 1;
+		if (_rehashIndex > _tables[0].mask)
+		{
+			release(_tables[0]);
+			_tables[0] = _tables[1];
+			_tables[1].buckets = NULL;
+			_tables[1].mask = 0;
+			_rehashing = false;
+			_rehashIndex = 0;
+		}
+	}
+
+	//-- moves one non empty bucket, visiting at most 10 empty ones.
+	inline void step()
+	{
+		for (int empty = 0; _rehashing && empty < 10; empty++)
+		{
+			bool moved = _tables[0].buckets[_rehashIndex] != NULL;
+			moveBucket();
+			if (moved)
+				break;
+		}
+	}
+
+	void unlinkLru(node_type* node)
+	{
+		if (node->lruPrev)
+			node->lruPrev->lruNext = node->lruNext;
+		else
+			_lruHead = node->lruNext;
+
+		if (node->lruNext)
+			node->lruNext->lruPrev = node->lruPrev;
+		else
+			_lruTail = node->lruPrev;
+
+		node->lruPrev = NULL;
+		node->lruNext = NULL;
+	}
+
+	void appendLru(node_type* node)
+	{
+		node->lruPrev = _lruTail;
+		node->lruNext = NULL;
+		if (_lruTail)
+			_lruTail->lruNext = node;
+		else
+			_lruHead = node;
+		_lruTail = node;
+	}
+
+	void sampleArray(const BucketArray& table, size_t begin, size_t samples, HashChainStatistics& statistics) const
+	{
+		size_t slotSize = table.mask + 1;
+		if (begin >= slotSize || samples == 0)
+			return;
+
+		size_t stride = std::max<size_t>((slotSize - begin) / samples, 1);
+		for (size_t index = begin; index < slotSize && samples; index += stride, samples--)
+		{
+			size_t length = 0;
+			for (node_type* node = table.buckets[index]; node; node = node->hashNext)
+				length += 1;
+
+			statistics.sampledBuckets += 1;
+			statistics.sampledNodes += length;
+			if (length == 0)
+				statistics.emptyBuckets += 1;
+			statistics.maxChain = std::max(statistics.maxChain, length);
+		}
+	}
+
+	ResizableLruHashMap(const ResizableLruHashMap&);
+	ResizableLruHashMap& operator = (const ResizableLruHashMap&);
+
+public:
+	ResizableLruHashMap(size_t slot_size, size_t max_size = 0): _rehashing(false), _rehashIndex(0), _lruHead(NULL),
+		_lruTail(NULL), _count(0), _maxSize(max_size), _maxLoadFactor(0), _minLoadFactor(0), _minSlotSize(16), _resizeCount(0)
+	{
+		if (!allocate(_tables[0], roundSlotSize(slot_size)))
+			throw std::bad_alloc();
+
+		_tables[1].buckets = NULL;
+		_tables[1].mask = 0;
+	}
+
+	~ResizableLruHashMap()
+	{
+		node_type* node = _lruHead;
+		while (node)
+		{
+			node_type* next = node->lruNext;
+			deleteNode(node);
+			node = next;
+		}
+
+		release(_tables[0]);
+		if (_tables[1].buckets)
+			release(_tables[1]);
+	}
+
+	//-- false if the map is not empty, or the bucket array cannot be mapped.
+	bool use_arena(CacheArena::HugePageMode mode, const std::vector<int>& numaNodes)
+	{
+		if (_count || _rehashing || _arena)
+			return false;
+
+		size_t slotSize = _tables[0].mask + 1;
+		BucketArray heapTable = _tables[0];
+		_arena.reset(new CacheArena(sizeof(node_type), mode, numaNodes));
+		if (!allocate(_tables[0], slotSize))
+		{
+			_arena.reset();
+			_tables[0] = heapTable;
+			return false;
+		}
+
+		free(heapTable.buckets);
+		return true;
+	}
+
+	const CacheArena* arena() const { return _arena.get(); }
+
+	void set_load_factors(double maxLoadFactor, double minLoadFactor, size_t minSlotSize)
+	{
+		_maxLoadFactor = maxLoadFactor > 0 ? maxLoadFactor : 0;
+		_minLoadFactor = minLoadFactor > 0 ? minLoadFactor : 0;
+		_minSlotSize = roundSlotSize(minSlotSize);
+	}
+
+	void set_resize_listener(std::function<void ()> listener) { _resizeListener = listener; }
+
+	node_type* find(const KeyType& key)
+	{
+		if (_rehashing)
+			step();
+
+		unsigned int hash = key.hash();
+		for (node_type* node = *chain(hash); node; node = node->hashNext)
+			if (node->hash == hash && const_cast<KeyType&>(node->key) == key)
+				return node;
+
+		return NULL;
+	}
+
+	//-- NULL if the key exists, or max_size is reached. The new node is the most fresh.
+	node_type* insert(const KeyType& key, const DataType& data)
+	{
+		if (_rehashing)
+			step();
+
+		unsigned int hash = key.hash();
+		node_type** head = chain(hash);
+		for (node_type* node = *head; node; node = node->hashNext)
+			if (node->hash == hash && const_cast<KeyType&>(node->key) == key)
+				return NULL;
+
+		if (_maxSize && _count >= _maxSize)
+			return NULL;
+
+		node_type* node = newNode(key, data, hash);
+		node->hashNext = *head;
+		*head = node;
+		appendLru(node);
+		_count += 1;
+
+		if (_maxLoadFactor > 0 && !_rehashing && (double)_count > (double)slot_size() * _maxLoadFactor)
+			resize(slot_size() * 2);
+
+		return node;
+	}
+
+	void remove_node(node_type* node)
+	{
+		if (_rehashing)
+			step();
+
+		node_type** link = chain(node->hash);
+		while (*link && *link != node)
+			link = &(*link)->hashNext;
+
+		if (*link)
+			*link = node->hashNext;
+
+		unlinkLru(node);
+		deleteNode(node);
+		_count -= 1;
+
+		if (_minLoadFactor > 0 && !_rehashing && slot_size() / 2 >= _minSlotSize
+			&& (double)_count < (double)slot_size() * _minLoadFactor)
+			resize(slot_size() / 2);
+	}
+
+	bool remove(const KeyType& key)
+	{
+		node_type* node = find(key);
+		if (!node)
+			return false;
+
+		remove_node(node);
+		return true;
+	}
+
+	void fresh_node(node_type* node)
+	{
+		if (node != _lruTail)
+		{
+			unlinkLru(node);
+			appendLru(node);
+		}
+	}
+
+	void stale_node(node_type* node)
+	{
+		if (node != _lruHead)
+		{
+			unlinkLru(node);
+			node->lruNext = _lruHead;
+			_lruHead->lruPrev = node;
+			_lruHead = node;
+		}
+	}
+
+	node_type* most_stale() const { return _lruHead; }
+	node_type* most_fresh() const { return _lruTail; }
+	node_type* next_fresh(node_type* node) const { return node->lruNext; }
+	node_type* next_stale(node_type* node) const { return node->lruPrev; }
+
+	size_t count() const { return _count; }
+	size_t max_size() const { return _maxSize; }
+	//-- target size while rehashing.
+	size_t slot_size() const { return (_rehashing ? _tables[1].mask : _tables[0].mask) + 1; }
+
+	/*
+		Starts moving the nodes to a new array of slot_size buckets, rounded up to a power of 2.
+		false if rehashing already, the size is not changed, or the array cannot be allocated.
+	*/
+	bool resize(size_t slot_size)
+	{
+		size_t slotSize = roundSlotSize(slot_size);
+		if (_rehashing || slotSize == _tables[0].mask + 1)
+			return false;
+
+		if (!allocate(_tables[1], slotSize))
+			return false;
+
+		_rehashing = true;
+		_rehashIndex = 0;
+		_resizeCount += 1;
+
+		if (_resizeListener)
+			_resizeListener();
+		return true;
+	}
+
+	//-- moves up to buckets buckets. Returns true if still rehashing.
+	bool rehash_step(size_t buckets)
+	{
+		for (size_t i = 0; i < buckets && _rehashing; i++)
+			moveBucket();
+
+		return _rehashing;
+	}
+
+	bool is_rehashing() const { return _rehashing; }
+	size_t rehash_progress() const { return _rehashIndex; }		//-- buckets of the old array moved.
+	size_t old_slot_size() const { return _rehashing ? _tables[0].mask + 1 : 0; }
+	size_t resize_count() const { return _resizeCount; }
+
+	//-- chain lengths of about samples evenly spaced buckets. Read only.
+	HashChainStatistics sample_chains(size_t samples) const
+	{
+		HashChainStatistics statistics;
+		if (!_rehashing)
+			sampleArray(_tables[0], 0, samples, statistics);
+		else
+		{
+			sampleArray(_tables[0], _rehashIndex, samples / 2, statistics);
+			sampleArray(_tables[1], 0, samples - samples / 2, statistics);
+		}
+		return statistics;
+	}
+};
+
+#endif
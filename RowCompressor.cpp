@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <string.h>
+#include "RowCompressor.h"
+
+static const int lzMinMatch = 4;
+static const size_t lzLastLiterals = 5;
+static const size_t lzMatchSafeDistance = 12;		//-- no match starts in the last 12 bytes.
+static const int lzHashBits = 12;
+static const size_t lzMaxOffset = 65535;
+
+static inline uint32_t readUint32(const char* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t lzHash(uint32_t sequence)
+{
+	return (sequence * 2654435761U) >> (32 - lzHashBits);
+}
+
+static void appendLength(std::string& out, size_t length)
+{
+	while (length >= 255)
+	{
+		out.push_back((char)255);
+		length -= 255;
+	}
+	out.push_back((char)length);
+}
+
+static void appendSequence(std::string& out, const char* literals, size_t literalLength, size_t offset, size_t matchLength)
+{
+	uint8_t token = (uint8_t)((literalLength >= 15 ? 15 : literalLength) << 4);
+	if (matchLength)
+		token |= (uint8_t)(matchLength - lzMinMatch >= 15 ? 15 : matchLength - lzMinMatch);
+
+	out.push_back((char)token);
+	if (literalLength >= 15)
+		appendLength(out, literalLength - 15);
+
+	out.append(literals, literalLength);
+	if (matchLength == 0)
+		return;
+
+	out.push_back((char)(offset & 0xFF));
+	out.push_back((char)(offset >> 8));
+	if (matchLength - lzMinMatch >= 15)
+		appendLength(out, matchLength - lzMinMatch - 15);
+}
+
+void RowCompressor::compress(const char* src, size_t length, std::string& out)
+{
+	out.clear();
+	out.reserve(length + length / 255 + 16);
+
+	size_t anchor = 0;
+	if (length > lzMatchSafeDistance)
+	{
+		uint32_t table[1 << lzHashBits];
+		for (auto& position: table)
+			position = UINT32_MAX;
+
+		size_t limit = length - lzMatchSafeDistance;
+		size_t pos = 0;
+		while (pos < limit)
+		{
+			uint32_t sequence = readUint32(src + pos);
+			uint32_t hash = lzHash(sequence);
+			uint32_t candidate = table[hash];
+			table[hash] = (uint32_t)pos;
+
+			if (candidate == UINT32_MAX || pos - candidate > lzMaxOffset || readUint32(src + candidate) != sequence)
+			{
+				pos++;
+				continue;
+			}
+
+			size_t matchLength = lzMinMatch;
+			size_t matchLimit = length - lzLastLiterals;
+			while (pos + matchLength < matchLimit && src[candidate + matchLength] == src[pos + matchLength])
+				matchLength++;
+
+			appendSequence(out, src + anchor, pos - anchor, pos - candidate, matchLength);
+			pos += matchLength;
+			anchor = pos;
+		}
+	}
+
+	appendSequence(out, src + anchor, length - anchor, 0, 0);
+}
+
+static bool readLength(const uint8_t*& p, const uint8_t* end, size_t& length)
+{
+	uint8_t byte;
+	do
+	{
+		if (p >= end)
+			return false;
+
+		byte = *p++;
+		length += byte;
+	} while (byte == 255);
+
+	return true;
+}
+
+bool RowCompressor::decompress(const char* src, size_t length, char* dest, size_t rawLength)
+{
+	const uint8_t* p = (const uint8_t*)src;
+	const uint8_t* end = p + length;
+	size_t written = 0;
+
+	while (p < end)
+	{
+		uint8_t token = *p++;
+		size_t literalLength = token >> 4;
+		if (literalLength == 15 && !readLength(p, end, literalLength))
+			return false;
+
+		if (literalLength > (size_t)(end - p) || literalLength > rawLength - written)
+			return false;
+
+		if (literalLength)
+			memcpy(dest + written, p, literalLength);
+		p += literalLength;
+		written += literalLength;
+
+		if (p == end)
+			break;		//-- the last sequence has literals only.
+
+		if (end - p < 2)
+			return false;
+
+		size_t offset = p[0] | ((size_t)p[1] << 8);
+		p += 2;
+
+		size_t matchLength = token & 0x0F;
+		if (matchLength == 15 && !readLength(p, end, matchLength))
+			return false;
+		matchLength += lzMinMatch;
+
+		if (offset == 0 || offset > written || matchLength > rawLength - written)
+			return false;
+
+		const char* match = dest + written - offset;
+		if (offset >= matchLength)
+			memcpy(dest + written, match, matchLength);
+		else
+		{
+			//-- Byte by byte: the match overlaps the bytes it produces.
+			for (size_t i = 0; i < matchLength; i++)
+				dest[written + i] = match[i];
+		}
+		written += matchLength;
+	}
+
+	return written == rawLength;
+}
+
+std::string CompressionStatistics::infos() const
+{
+	uint64_t raw = rawBytes;
+	uint64_t stored = storedBytes;
+	uint64_t decompressions = decompressCount;
+
+	char ratio[32];
+	snprintf(ratio, sizeof(ratio), "%.3f", raw ? (double)stored / raw : 1.0);
+
+	std::string infos("{\"minBytes\":");
+	infos.append(std::to_string(minBytes));
+	infos.append(",\"compressedCells\":").append(std::to_string(compressedCells));
+	infos.append(",\"skippedCells\":").append(std::to_string(skippedCells));
+	infos.append(",\"rawBytes\":").append(std::to_string(raw));
+	infos.append(",\"storedBytes\":").append(std::to_string(stored));
+	infos.append(",\"savedBytes\":").append(std::to_string(raw > stored ? raw - stored : 0));
+	infos.append(",\"ratio\":").append(ratio);
+	infos.append(",\"compressUsec\":").append(std::to_string(compressNsec / 1000));
+	infos.append(",\"decompressCount\":").append(std::to_string(decompressions));
+	infos.append(",\"decompressUsec\":").append(std::to_string(decompressNsec / 1000));
+	infos.append("}");
+	return infos;
+}
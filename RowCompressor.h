@@ -0,0 +1,38 @@
+#ifndef Row_Compressor_H
+#define Row_Compressor_H
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+/*
+	LZ4 block format compressor for cached cell values. No framing, no checksum: the raw
+	length is kept by the caller. Fast single pass with a 4K entries hash table.
+*/
+class RowCompressor
+{
+public:
+	static void compress(const char* src, size_t length, std::string& out);
+	static bool decompress(const char* src, size_t length, char* dest, size_t rawLength);		//-- false on corrupted data.
+};
+
+//-- Per table compression setting & counters. Shared by all cached rows of the table.
+struct CompressionStatistics
+{
+	std::atomic<uint32_t> minBytes;		//-- cells shorter than minBytes are not compressed.
+
+	std::atomic<uint64_t> compressedCells;
+	std::atomic<uint64_t> skippedCells;		//-- not compressible enough, stored raw.
+	std::atomic<uint64_t> rawBytes;		//-- of the compressed cells in cached rows now.
+	std::atomic<uint64_t> storedBytes;
+	std::atomic<uint64_t> compressNsec;
+	std::atomic<uint64_t> decompressCount;
+	std::atomic<uint64_t> decompressNsec;
+
+	explicit CompressionStatistics(uint32_t minBytes_): minBytes(minBytes_), compressedCells(0), skippedCells(0),
+		rawBytes(0), storedBytes(0), compressNsec(0), decompressCount(0), decompressNsec(0) {}
+
+	std::string infos() const;
+};
+
+#endif
@@ -0,0 +1,445 @@
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "FPLog.h"
+#include "jenkins.h"
+#include "hashint.h"
+#include "ShmRowStore.h"
+
+static const char* const shmMagic = "TCSHM001";
+static const uint32_t shmLayoutVersion = 2;
+static const int shmMaxTables = 1024;
+static const int shmTableNameSize = 120;
+
+enum ShmState
+{
+	ShmDetached = 0,
+	ShmAttached = 1,
+};
+
+enum ShmEntryFlag
+{
+	ShmEntryDeleted = 0x1,
+};
+
+struct ShmRowStore::TableEntry
+{
+	char name[shmTableNameSize];
+	uint32_t used;
+	uint32_t epoch;
+	uint64_t schemeDigest;
+};
+
+struct ShmRowStore::Header
+{
+	char magic[8];
+	uint32_t layoutVersion;
+	uint32_t slotCount;
+	uint64_t regionSize;
+	uint64_t arenaSize;
+	uint64_t generation;
+	uint32_t state;
+	int32_t ownerPid;
+	uint64_t head;				//-- logical arena position of next entry.
+	uint64_t appendedCount;
+	int64_t detachMsec;			//-- wall clock, survives reboots when the region file is on disk.
+	TableEntry tables[shmMaxTables];
+};
+
+struct ShmRowStore::Entry
+{
+	uint32_t size;				//-- total size, includes the entry header, aligned to 8 bytes.
+	uint16_t tableId;
+	uint16_t flags;
+	uint32_t tableEpoch;
+	uint32_t payloadSize;
+	int64_t hintId;
+	uint64_t next;				//-- logical position + 1 of the older entry in the chain, 0 means chain end.
+};
+
+static int64_t shmNowMsec()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static inline uint64_t align8(uint64_t size)
+{
+	return (size + 7) & ~(uint64_t)7;
+}
+
+ShmRowStore::ShmRowStore(): _fd(-1), _region(NULL), _regionSize(0), _reused(false),
+	_header(NULL), _slots(NULL), _arena(NULL), _hitCount(0), _missCount(0)
+{
+}
+
+ShmRowStore::~ShmRowStore()
+{
+	//-- Not detached cleanly: the region will be discarded by next process.
+	if (_region)
+		munmap(_region, _regionSize);
+	if (_fd >= 0)
+		close(_fd);
+}
+
+bool ShmRowStore::validRegion(uint32_t slotCount)
+{
+	return memcmp(_header->magic, shmMagic, sizeof(_header->magic)) == 0
+		&& _header->layoutVersion == shmLayoutVersion
+		&& _header->slotCount == slotCount
+		&& _header->regionSize == (uint64_t)_regionSize;
+}
+
+void ShmRowStore::initRegion(uint32_t slotCount)
+{
+	uint64_t generation = 0;
+	if (memcmp(_header->magic, shmMagic, sizeof(_header->magic)) == 0)
+		generation = _header->generation;
+
+	memset(_header, 0, sizeof(Header));
+	memset(_slots, 0, sizeof(uint64_t) * slotCount);
+
+	memcpy(_header->magic, shmMagic, sizeof(_header->magic));
+	_header->layoutVersion = shmLayoutVersion;
+	_header->slotCount = slotCount;
+	_header->regionSize = (uint64_t)_regionSize;
+	_header->arenaSize = (uint64_t)(((char*)_region + _regionSize) - _arena);
+	_header->generation = generation + 1;
+	_header->state = ShmDetached;
+}
+
+bool ShmRowStore::attach(const std::string& path, size_t regionSize, uint32_t slotCount, int64_t maxDownMsec)
+{
+	size_t arenaOffset = align8(sizeof(Header)) + align8(sizeof(uint64_t) * slotCount);
+	if (regionSize < arenaOffset + 1024 * 1024)
+	{
+		LOG_ERROR("Shared memory region %s is too small. At least %llu bytes are required.",
+			path.c_str(), (unsigned long long)(arenaOffset + 1024 * 1024));
+		return false;
+	}
+
+	_fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+	if (_fd < 0)
+	{
+		LOG_ERROR("Open shared memory region %s failed. errno: %d", path.c_str(), errno);
+		return false;
+	}
+
+	struct stat st;
+	bool resized = false;
+	if (fstat(_fd, &st) != 0 || (size_t)st.st_size != regionSize)
+	{
+		if (ftruncate(_fd, (off_t)regionSize) != 0)
+		{
+			LOG_ERROR("Resize shared memory region %s failed. errno: %d", path.c_str(), errno);
+			close(_fd);
+			_fd = -1;
+			return false;
+		}
+		resized = true;
+	}
+
+	_region = mmap(NULL, regionSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (_region == MAP_FAILED)
+	{
+		LOG_ERROR("Map shared memory region %s failed. errno: %d", path.c_str(), errno);
+		_region = NULL;
+		close(_fd);
+		_fd = -1;
+		return false;
+	}
+
+	_path = path;
+	_regionSize = regionSize;
+	_header = (Header*)_region;
+	_slots = (uint64_t*)((char*)_region + align8(sizeof(Header)));
+	_arena = (char*)_region + arenaOffset;
+
+	if (resized || !validRegion(slotCount))
+	{
+		LOG_INFO("Shared memory region %s has incompatible layout. Reinitialized.", path.c_str());
+		initRegion(slotCount);
+	}
+	else if (_header->state == ShmAttached)
+	{
+		pid_t owner = (pid_t)_header->ownerPid;
+		if (owner != getpid() && (kill(owner, 0) == 0 || errno == EPERM))
+		{
+			LOG_ERROR("Shared memory region %s is still attached by process %d.", path.c_str(), (int)owner);
+			munmap(_region, _regionSize);
+			close(_fd);
+			_region = NULL;
+			_header = NULL;
+			_fd = -1;
+			return false;
+		}
+
+		LOG_WARN("Shared memory region %s was not detached cleanly (crashed?). Discarded.", path.c_str());
+		initRegion(slotCount);
+	}
+	else if (maxDownMsec > 0 && (_header->detachMsec <= 0 || shmNowMsec() - _header->detachMsec > maxDownMsec))
+	{
+		//-- Invalidations from the cluster are lost while no process is attached.
+		LOG_WARN("Shared memory region %s was detached %lld seconds ago, more than %lld seconds. Discarded.", path.c_str(),
+			(long long)((shmNowMsec() - _header->detachMsec) / 1000), (long long)(maxDownMsec / 1000));
+		initRegion(slotCount);
+	}
+	else
+		_reused = true;
+
+	_header->state = ShmAttached;
+	_header->ownerPid = (int32_t)getpid();
+
+	for (int i = 0; i < shmMaxTables; i++)
+		if (_header->tables[i].used)
+			_tableIds[std::string(_header->tables[i].name)] = i;
+
+	LOG_INFO("Shared memory region %s attached. Generation: %llu, reused: %s.", path.c_str(),
+		(unsigned long long)_header->generation, _reused ? "true" : "false");
+	return true;
+}
+
+void ShmRowStore::detach()
+{
+	if (!_region)
+		return;
+
+	_header->state = ShmDetached;
+	_header->ownerPid = 0;
+	_header->detachMsec = shmNowMsec();
+	msync(_region, _regionSize, MS_ASYNC);
+	munmap(_region, _regionSize);
+	close(_fd);
+
+	_fd = -1;
+	_region = NULL;
+	_header = NULL;
+	_slots = NULL;
+	_arena = NULL;
+}
+
+uint64_t ShmRowStore::schemeDigest(const std::string& splitHint, const std::vector<std::vector<std::string>>& desc)
+{
+	std::string buf(splitHint);
+	for (auto& descRow: desc)
+	{
+		buf.append("\n");
+		for (auto& item: descRow)
+			buf.append(item).append("\t");
+	}
+
+	uint64_t high = jenkins_hash(buf.data(), buf.length(), 0);
+	uint64_t low = jenkins_hash(buf.data(), buf.length(), 0x9E3779B9);
+	return (high << 32) | low;
+}
+
+bool ShmRowStore::bindTable(const std::string& tableName, uint64_t schemeDigest)
+{
+	if (!_header)
+		return false;
+
+	auto it = _tableIds.find(tableName);
+	if (it != _tableIds.end())
+	{
+		TableEntry& table = _header->tables[it->second];
+		if (table.schemeDigest != schemeDigest)
+		{
+			LOG_INFO("Scheme of table %s changed. Rows in shared memory are discarded.", tableName.c_str());
+			table.epoch++;
+			table.schemeDigest = schemeDigest;
+		}
+		return true;
+	}
+
+	if (tableName.length() >= (size_t)shmTableNameSize)
+		return false;
+
+	for (int i = 0; i < shmMaxTables; i++)
+	{
+		TableEntry& table = _header->tables[i];
+		if (table.used)
+			continue;
+
+		memset(table.name, 0, sizeof(table.name));
+		memcpy(table.name, tableName.data(), tableName.length());
+		table.epoch++;
+		table.schemeDigest = schemeDigest;
+		table.used = 1;
+
+		_tableIds[tableName] = i;
+		return true;
+	}
+
+	LOG_WARN("Shared memory table directory is full. Table %s is not stored.", tableName.c_str());
+	return false;
+}
+
+void ShmRowStore::invalidateTable(const std::string& tableName)
+{
+	int id = tableId(tableName);
+	if (id >= 0)
+		_header->tables[id].epoch++;
+}
+
+int ShmRowStore::tableId(const std::string& tableName)
+{
+	if (!_header)
+		return -1;
+
+	auto it = _tableIds.find(tableName);
+	if (it == _tableIds.end())
+		return -1;
+
+	return it->second;
+}
+
+ShmRowStore::Entry* ShmRowStore::entryAt(uint64_t position)
+{
+	return (Entry*)(_arena + position % _header->arenaSize);
+}
+
+bool ShmRowStore::positionAlive(uint64_t position)
+{
+	return _header->head - position <= _header->arenaSize;
+}
+
+uint64_t* ShmRowStore::slotOf(int tableId, int64_t hintId)
+{
+	uint32_t hash = hash32_uint64((uint64_t)hintId) ^ ((uint32_t)tableId * 0x9E3779B9u);
+	return _slots + (hash % _header->slotCount);
+}
+
+ShmRowStore::Entry* ShmRowStore::findEntry(int tableId, int64_t hintId)
+{
+	uint32_t epoch = _header->tables[tableId].epoch;
+	uint64_t link = *slotOf(tableId, hintId);
+
+	while (link && positionAlive(link - 1))
+	{
+		Entry* entry = entryAt(link - 1);
+		if (entry->tableId == (uint16_t)tableId && entry->hintId == hintId)
+		{
+			//-- The newest entry of the key decides. Older entries are shadowed.
+			if (entry->tableEpoch != epoch || (entry->flags & ShmEntryDeleted))
+				return NULL;
+			return entry;
+		}
+		link = entry->next;
+	}
+	return NULL;
+}
+
+void ShmRowStore::insert(const std::string& tableName, int64_t hintId, const std::vector<std::string>& row)
+{
+	int id = tableId(tableName);
+	if (id < 0)
+		return;
+
+	uint64_t payloadSize = 4;
+	for (auto& item: row)
+		payloadSize += 4 + item.length();
+
+	uint64_t size = align8(sizeof(Entry) + payloadSize);
+	if (size > _header->arenaSize / 16)
+		return;
+
+	uint64_t offset = _header->head % _header->arenaSize;
+	if (offset + size > _header->arenaSize)
+		_header->head += _header->arenaSize - offset;		//-- entries never wrap around the arena end.
+
+	uint64_t position = _header->head;
+	uint64_t* slot = slotOf(id, hintId);
+	uint64_t next = *slot;
+
+	_header->head += size;
+	if (next && !positionAlive(next - 1))
+		next = 0;
+
+	Entry* entry = entryAt(position);
+	entry->size = (uint32_t)size;
+	entry->tableId = (uint16_t)id;
+	entry->flags = 0;
+	entry->tableEpoch = _header->tables[id].epoch;
+	entry->payloadSize = (uint32_t)payloadSize;
+	entry->hintId = hintId;
+	entry->next = next;
+
+	char* payload = (char*)(entry + 1);
+	uint32_t count = (uint32_t)row.size();
+	memcpy(payload, &count, 4);
+	payload += 4;
+	for (auto& item: row)
+	{
+		uint32_t len = (uint32_t)item.length();
+		memcpy(payload, &len, 4);
+		memcpy(payload + 4, item.data(), len);
+		payload += 4 + len;
+	}
+
+	*slot = position + 1;
+	_header->appendedCount++;
+}
+
+bool ShmRowStore::find(const std::string& tableName, int64_t hintId, std::vector<std::string>& row)
+{
+	int id = tableId(tableName);
+	Entry* entry = (id < 0) ? NULL : findEntry(id, hintId);
+	if (!entry)
+	{
+		_missCount++;
+		return false;
+	}
+
+	const char* payload = (const char*)(entry + 1);
+	uint32_t count;
+	memcpy(&count, payload, 4);
+	payload += 4;
+
+	row.clear();
+	row.reserve(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t len;
+		memcpy(&len, payload, 4);
+		row.push_back(std::string(payload + 4, len));
+		payload += 4 + len;
+	}
+
+	_hitCount++;
+	return true;
+}
+
+void ShmRowStore::remove(const std::string& tableName, int64_t hintId)
+{
+	int id = tableId(tableName);
+	if (id < 0)
+		return;
+
+	Entry* entry = findEntry(id, hintId);
+	if (entry)
+		entry->flags |= ShmEntryDeleted;
+}
+
+std::string ShmRowStore::infos()
+{
+	std::string infos("{\"attached\":");
+	infos.append(_header ? "true" : "false");
+	infos.append(",\"reused\":").append(_reused ? "true" : "false");
+	if (_header)
+	{
+		infos.append(",\"generation\":").append(std::to_string(_header->generation));
+		infos.append(",\"arenaSize\":").append(std::to_string(_header->arenaSize));
+		infos.append(",\"head\":").append(std::to_string(_header->head));
+		infos.append(",\"appendedCount\":").append(std::to_string(_header->appendedCount));
+		infos.append(",\"tableCount\":").append(std::to_string(_tableIds.size()));
+	}
+	infos.append(",\"hitCount\":").append(std::to_string(_hitCount));
+	infos.append(",\"missCount\":").append(std::to_string(_missCount));
+	infos.append("}");
+	return infos;
+}
@@ -0,0 +1,74 @@
+#ifndef Shm_Row_Store_H
+#define Shm_Row_Store_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+/*
+	Log-structured row store living in a named shared-memory (mmap) region.
+
+	The region holds a header (with generation & validation fields), a table directory,
+	a hash index and a ring arena. All references inside the region are logical arena
+	positions instead of pointers, so a new process can attach to the region and serve
+	the rows directly.
+
+	Entries are appended at the arena head and overwrite the oldest entries when the
+	arena wraps. Each hash chain links from the newest to the oldest entry, so a chain
+	walk stops at the first entry which has been overwritten.
+
+	Not thread safe. Caller must hold the cache write lock.
+*/
+class ShmRowStore
+{
+	struct Header;
+	struct TableEntry;
+	struct Entry;
+
+	int _fd;
+	void* _region;
+	size_t _regionSize;
+	std::string _path;
+	bool _reused;
+
+	Header* _header;
+	uint64_t* _slots;
+	char* _arena;
+
+	std::unordered_map<std::string, int> _tableIds;
+
+	uint64_t _hitCount;
+	uint64_t _missCount;
+
+	void initRegion(uint32_t slotCount);
+	bool validRegion(uint32_t slotCount);
+	Entry* entryAt(uint64_t position);
+	bool positionAlive(uint64_t position);
+	uint64_t* slotOf(int tableId, int64_t hintId);
+	int tableId(const std::string& tableName);
+	Entry* findEntry(int tableId, int64_t hintId);
+
+public:
+	ShmRowStore();
+	~ShmRowStore();
+
+	//-- A region detached more than maxDownMsec ago is discarded. 0: no limit.
+	bool attach(const std::string& path, size_t regionSize, uint32_t slotCount, int64_t maxDownMsec);
+	void detach();		//-- mark the region cleanly detached, so next process can reuse it.
+
+	//-- Returns false if the table has no room in the directory.
+	//-- Rows of the table are discarded if schemeDigest changed.
+	bool bindTable(const std::string& tableName, uint64_t schemeDigest);
+	void invalidateTable(const std::string& tableName);
+
+	void insert(const std::string& tableName, int64_t hintId, const std::vector<std::string>& row);
+	bool find(const std::string& tableName, int64_t hintId, std::vector<std::string>& row);
+	void remove(const std::string& tableName, int64_t hintId);
+
+	static uint64_t schemeDigest(const std::string& splitHint, const std::vector<std::vector<std::string>>& desc);
+
+	std::string infos();
+};
+
+#endif
@@ -1,14 +1,20 @@
 #ifndef Table_Cache_Callbacks_h
 #define Table_Cache_Callbacks_h
 
+#include <deque>
+#include <mutex>
 #include <set>
 #include <string>
 #include <vector>
 #include "TableRow.h"
+#include "CachedRow.h"
 #include "IQuestProcessor.h"
 #include "TableCacheErrorInfo.h"
+#include "LatencyHistogram.h"
 
+#ifndef FPNN_MAX_ERROR_CODE
 #define FPNN_MAX_ERROR_CODE 29999
+#endif
 
 inline FPAnswerPtr dumpErrorAnswer(IAsyncAnswerPtr async, FPAnswerPtr answer)
 {
@@ -25,35 +31,40 @@ class FetchRowCallback: public AnswerCallback
 {
 private:
 	int _retryTimes;
+	bool _cacheRows;
+	int64_t _sendUsec;
 	TABLEPtr _scheme;
 	FPQuestPtr _dbQuest;
 	IAsyncAnswerPtr _async;
 	TableCacheProcessorPtr _processor;
 	std::vector<uint16_t> _requiredIndex;
+	std::vector<uint8_t> _requiredTypes;		//-- empty: untyped answer.
 	std::map<TYPE, std::vector<std::string>> _cachedResult;
+	RowVersions<TYPE> _rowVersions;
+	AdmissionTicketPtr _admission;		//-- released when the last try is answered.
 
-	void addRowDataToResult(const std::string& key, int64_t&, const std::vector<std::string>& row)
-	{
-		_cachedResult[(int64_t)atoll(key.c_str())] = row;
-	}
-	void addRowDataToResult(const std::string& key, const std::string&, const std::vector<std::string>& row)
-	{
-		_cachedResult[key] = row;
-	}
+	static void rowKey(const std::string& value, int64_t& key) { key = (int64_t)atoll(value.c_str()); }
+	static void rowKey(const std::string& value, std::string& key) { key = value; }
 
 public:
 	FetchRowCallback(IAsyncAnswerPtr async, TableCacheProcessorPtr processor, FPQuestPtr dbQuest,
 		TABLEPtr scheme, std::vector<uint16_t>& requiredIndex, 
 		std::map<TYPE, std::vector<std::string>>& cachedResult):
-		_retryTimes(0), _scheme(scheme), _dbQuest(dbQuest), _async(async), _processor(processor)
+		_retryTimes(0), _cacheRows(true), _sendUsec(latencyNowUsec()), _scheme(scheme), _dbQuest(dbQuest), _async(async), _processor(processor)
 		{
 			_requiredIndex.swap(requiredIndex);
 			_cachedResult.swap(cachedResult);
 		}
 
+	void typedAnswer(const std::vector<uint8_t>& requiredTypes) { _requiredTypes = requiredTypes; }
+	void cacheRows(bool cache) { _cacheRows = cache; }		//-- false: rows selected with non hot columns only answer the fetch.
+	void rowVersions(RowVersions<TYPE>& rowVersions) { _rowVersions = std::move(rowVersions); }		//-- versions of the cached part.
+	void admission(AdmissionTicketPtr ticket) { _admission = ticket; }
+
 	virtual void onAnswer(FPAnswerPtr answer)
 	{
-		TYPE kindSign;
+		LatencyRecorder::instance().record("dbproxy.fetch", _scheme->get_table_name(), latencyNowUsec() - _sendUsec);
+
 		std::string keyCloumn = _scheme->get_key_name();
 		std::vector<uint16_t> index = _scheme->get_fields_index(std::vector<std::string>{keyCloumn});
 
@@ -61,23 +72,32 @@ public:
 		std::vector<std::vector<std::string>> rows = ar.want("rows", std::vector<std::vector<std::string>>());
 		for (const auto& rowData: rows)
 		{
+			TYPE key;
+			rowKey(rowData[index[0]], key);
+			if (_rowVersions.enabled && _rowVersions.unchangedRow(key, CachedRow::rowVersion(rowData)))
+				continue;
+
 			std::vector<std::string> result;
 			result.reserve(_requiredIndex.size());
 
 			for (size_t i = 0; i < _requiredIndex.size(); i++)
 				result.push_back(rowData[_requiredIndex[i]]);
 
-			const std::string& hintValue = rowData[index[0]];
-
-			addRowDataToResult(hintValue, kindSign, result);
+			_cachedResult[key].swap(result);
 		}
 
-		FPAWriter aw(1, _async->getQuest());
-		aw.param("data", _cachedResult);
+		FPAWriter aw(1 + _rowVersions.paramCount(), _async->getQuest());
+		if (_requiredTypes.size())
+			writeTypedRows(aw, "data", _cachedResult, _requiredTypes);
+		else
+			aw.param("data", _cachedResult);
+		_rowVersions.write(aw);
 		answer = aw.take();
+		_processor->_statistics.unchangedItemCount.fetch_add((uint64_t)_rowVersions.unchanged.size());
 		_async->sendAnswer(answer);
 
-		_processor->addRows(_scheme, rows);
+		if (_cacheRows)
+			_processor->addRows(_scheme, rows);
 	}
 
 	virtual void onException(FPAnswerPtr answer, int errorCode)
@@ -89,8 +109,13 @@ public:
 				FetchRowCallback* callback = new FetchRowCallback(
 					_async, _processor, _dbQuest, _scheme, _requiredIndex, _cachedResult);
 				callback->_retryTimes = 1;
+				callback->_sendUsec = _sendUsec;
+				callback->_requiredTypes = _requiredTypes;
+				callback->_cacheRows = _cacheRows;
+				callback->_rowVersions = std::move(_rowVersions);
+				callback->_admission = _admission;
 
-				if (_processor->_dbproxy->sendQuest(_dbQuest, callback))
+				if (_processor->_dbproxy->sendHedgedQuest(_dbQuest, callback))
 					return;
 
 				delete callback;
@@ -98,6 +123,8 @@ public:
 			}
 		}
 
+		LatencyRecorder::instance().record("dbproxy.fetch", _scheme->get_table_name(), latencyNowUsec() - _sendUsec);
+
 		if (!answer)
 			answer = ErrorInfo::queryDBProxyFailedAnswer(_async->getQuest());
 		else
@@ -108,22 +135,259 @@ public:
 	}
 };
 
+/*
+	Streaming fetch: DBProxy batches of at most chunkRows keys, at most maxInflight of them
+	in flight. Each answer is pushed to the client as a fetchChunk as soon as it arrives, then
+	the last finished batch pushes the completion marker.
+*/
+template <typename TYPE>
+class FetchStream: public std::enable_shared_from_this<FetchStream<TYPE>>
+{
+	int64_t _streamId;
+	QuestSenderPtr _sender;
+	TableCacheProcessorPtr _processor;
+	TABLEPtr _scheme;
+	std::vector<uint16_t> _requiredIndex;
+	std::vector<uint8_t> _requiredTypes;		//-- empty: untyped chunks.
+	std::string _selectString;
+	bool _cacheRows;
+	bool _jsonCompatible;
+	uint32_t _maxInflight;
+
+	std::mutex _mutex;
+	std::deque<std::set<TYPE>> _batches;
+	uint32_t _inflight;
+	std::string _error;
+	AdmissionTicketPtr _admission;		//-- released with the stream.
+
+	static std::string keyString(int64_t key) { return std::to_string(key); }
+	static const std::string& keyString(const std::string& key) { return key; }
+	static void parseKey(const std::string& value, int64_t& key) { key = atoll(value.c_str()); }
+	static void parseKey(const std::string& value, std::string& key) { key = value; }
+
+	template <typename K>
+	void writeData(FPWriter& writer, const std::map<K, std::vector<std::string>>& rows)
+	{
+		if (_requiredTypes.size())
+			writeTypedRows(writer, "data", rows, _requiredTypes);
+		else
+			writer.param("data", rows);
+	}
+
+	void sendBatch(const std::set<TYPE>& keys, int retryTimes)
+	{
+		std::shared_ptr<FetchStream<TYPE>> self = this->shared_from_this();
+		FPQuestPtr dbQuest = _processor->selectQuest(_scheme->get_table_name(), _scheme, _selectString, keys);
+		int64_t sendUsec = latencyNowUsec();
+
+		bool sent = _processor->_dbproxy->sendHedgedQuest(dbQuest, [self, keys, retryTimes, sendUsec](FPAnswerPtr answer, int errorCode) {
+			LatencyRecorder::instance().record("dbproxy.fetch", self->_scheme->get_table_name(), latencyNowUsec() - sendUsec);
+			self->batchFinished(answer, errorCode, keys, retryTimes);
+		});
+
+		if (!sent)
+			batchFinished(nullptr, FPNN_EC_CORE_UNKNOWN_ERROR, keys, 1);
+	}
+
+	//-- caller must hold _mutex.
+	void sendBatches(std::vector<std::set<TYPE>>& toSend)
+	{
+		while (_batches.size() && _inflight < _maxInflight)
+		{
+			toSend.push_back(std::set<TYPE>());
+			toSend.back().swap(_batches.front());
+			_batches.pop_front();
+			_inflight += 1;
+		}
+	}
+
+	void batchFinished(FPAnswerPtr answer, int errorCode, const std::set<TYPE>& keys, int retryTimes)
+	{
+		if (errorCode != FPNN_EC_OK)
+		{
+			if (retryTimes == 0 && errorCode <= FPNN_MAX_ERROR_CODE)
+			{
+				sendBatch(keys, 1);
+				return;
+			}
+
+			std::unique_lock<std::mutex> lck(_mutex);
+			if (_error.empty())
+				_error = answer ? FPAReader(answer).wantString("ex") : std::string("Query DBProxy Failed.");
+		}
+		else
+		{
+			FPAReader ar(answer);
+			std::vector<std::vector<std::string>> rows = ar.want("rows", std::vector<std::vector<std::string>>());
+			std::vector<uint16_t> keyIndex = _scheme->get_fields_index(std::vector<std::string>{_scheme->get_key_name()});
+
+			std::map<TYPE, std::vector<std::string>> chunk;
+			for (const auto& rowData: rows)
+			{
+				std::vector<std::string> result;
+				result.reserve(_requiredIndex.size());
+				for (size_t i = 0; i < _requiredIndex.size(); i++)
+					result.push_back(rowData[_requiredIndex[i]]);
+
+				TYPE key;
+				parseKey(rowData[keyIndex[0]], key);
+				chunk[key].swap(result);
+			}
+
+			if (chunk.size())
+				push(chunk, false);
+
+			if (_cacheRows)
+				_processor->addRows(_scheme, rows);
+		}
+
+		std::vector<std::set<TYPE>> toSend;
+		bool done;
+		{
+			std::unique_lock<std::mutex> lck(_mutex);
+			_inflight -= 1;
+			sendBatches(toSend);
+			done = (_inflight == 0 && _batches.empty());
+		}
+
+		for (auto& batch: toSend)
+			sendBatch(batch, 0);
+
+		if (done)
+			push(std::map<TYPE, std::vector<std::string>>(), true);
+	}
+
+public:
+	FetchStream(int64_t streamId, QuestSenderPtr sender, TableCacheProcessorPtr processor, TABLEPtr scheme,
+		const std::vector<uint16_t>& requiredIndex, const std::vector<uint8_t>& requiredTypes, const std::string& selectString,
+		bool cacheRows, bool jsonCompatible, uint32_t maxInflight):
+		_streamId(streamId), _sender(sender), _processor(processor), _scheme(scheme), _requiredIndex(requiredIndex),
+		_requiredTypes(requiredTypes), _selectString(selectString), _cacheRows(cacheRows), _jsonCompatible(jsonCompatible),
+		_maxInflight(maxInflight ? maxInflight : 1), _inflight(0) {}
+
+	int64_t streamId() const { return _streamId; }
+	void addBatch(std::set<TYPE>& keys)
+	{
+		_batches.push_back(std::set<TYPE>());
+		_batches.back().swap(keys);
+	}
+	void admission(AdmissionTicketPtr ticket) { _admission = ticket; }
+	void fail(const std::string& error) { _error = error; }		//-- before start(). Reported by the completion marker.
+
+	//-- fetchChunk { streamId, data, done, ?error }. One way quest, in the order of sending.
+	void push(const std::map<TYPE, std::vector<std::string>>& rows, bool done)
+	{
+		std::string error;
+		if (done)
+		{
+			std::unique_lock<std::mutex> lck(_mutex);
+			error = _error;
+		}
+
+		FPQWriter qw(error.empty() ? 3 : 4, "fetchChunk", true);
+		qw.param("streamId", _streamId);
+		if (_jsonCompatible)
+		{
+			std::map<std::string, std::vector<std::string>> skeyRows;
+			for (auto& rowPair: rows)
+				skeyRows[keyString(rowPair.first)] = rowPair.second;
+			writeData(qw, skeyRows);
+		}
+		else
+			writeData(qw, rows);
+		qw.param("done", done);
+		if (error.size())
+			qw.param("error", error);
+
+		_sender->sendQuest(qw.take());
+		_processor->_statistics.streamChunkCount++;
+	}
+
+	//-- first answer of the stream: { streamId, data, done }.
+	FPAnswerPtr answer(const FPQuestPtr quest, const std::map<TYPE, std::vector<std::string>>& rows, bool done)
+	{
+		FPAWriter aw(3, quest);
+		aw.param("streamId", _streamId);
+		if (_jsonCompatible)
+		{
+			std::map<std::string, std::vector<std::string>> skeyRows;
+			for (auto& rowPair: rows)
+				skeyRows[keyString(rowPair.first)] = rowPair.second;
+			writeData(aw, skeyRows);
+		}
+		else
+			writeData(aw, rows);
+		aw.param("done", done);
+		return aw.take();
+	}
+
+	//-- after the first answer is sent. Pushes the completion marker if there is nothing to load.
+	void start()
+	{
+		std::vector<std::set<TYPE>> toSend;
+		bool done;
+		{
+			std::unique_lock<std::mutex> lck(_mutex);
+			sendBatches(toSend);
+			done = toSend.empty();
+		}
+
+		for (auto& batch: toSend)
+			sendBatch(batch, 0);
+
+		if (done)
+			push(std::map<TYPE, std::vector<std::string>>(), true);
+	}
+};
+
+//-- Refresh-ahead batch. Nobody waits for the answer, so no retry.
+class RefreshRowsCallback: public AnswerCallback
+{
+	int64_t _sendUsec;
+	TABLEPtr _scheme;
+	TableCacheProcessorPtr _processor;
+
+public:
+	RefreshRowsCallback(TableCacheProcessorPtr processor, TABLEPtr scheme):
+		_sendUsec(latencyNowUsec()), _scheme(scheme), _processor(processor) {}
+
+	virtual void onAnswer(FPAnswerPtr answer)
+	{
+		LatencyRecorder::instance().record("dbproxy.refresh", _scheme->get_table_name(), latencyNowUsec() - _sendUsec);
+
+		FPAReader ar(answer);
+		std::vector<std::vector<std::string>> rows = ar.want("rows", std::vector<std::vector<std::string>>());
+		size_t count = _processor->addRows(_scheme, rows, true);
+		_processor->_refreshAhead->finished(count, true);
+	}
+
+	virtual void onException(FPAnswerPtr answer, int errorCode)
+	{
+		LatencyRecorder::instance().record("dbproxy.refresh", _scheme->get_table_name(), latencyNowUsec() - _sendUsec);
+		_processor->_refreshAhead->finished(0, false);
+	}
+};
+
 class WriteCallback: public AnswerCallback
 {
 private: 
 	int _retryTimes;
+	int64_t _sendUsec;
+	std::string _method;
 	FPQuestPtr _dbQuest;
-	TCPClientPtr _dbproxy;
+	DBProxyPoolPtr _dbproxy;
 	IAsyncAnswerPtr _async;
 	int64_t _hintId;
 	std::string _tableName;
 	TableCacheProcessorPtr _processor;
+	AdmissionTicketPtr _admission;
 
 	void cleanCache();
 
 public:
-	WriteCallback(IAsyncAnswerPtr async, TCPClientPtr dbproxy, FPQuestPtr dbQuest):
-		_retryTimes(0), _dbQuest(dbQuest), _dbproxy(dbproxy), _async(async), _processor(nullptr) {}
+	WriteCallback(IAsyncAnswerPtr async, DBProxyPoolPtr dbproxy, FPQuestPtr dbQuest, const std::string& method):
+		_retryTimes(0), _sendUsec(latencyNowUsec()), _method(method), _dbQuest(dbQuest), _dbproxy(dbproxy),
+		_async(async), _processor(nullptr) {}
 
 	virtual void onAnswer(FPAnswerPtr answer);
 	virtual void onException(FPAnswerPtr answer, int errorCode);
@@ -131,10 +395,13 @@ public:
 	{
 		_hintId = hintId; _tableName = tableName; _processor = processor;
 	}
+	void admission(AdmissionTicketPtr ticket) { _admission = ticket; }
 };
 
 void WriteCallback::onAnswer(FPAnswerPtr)
 {
+	LatencyRecorder::instance().record(_method, _tableName, latencyNowUsec() - _sendUsec);
+
 	cleanCache();
 	FPAnswerPtr answer = FPAWriter::emptyAnswer(_async->getQuest());
 	_async->sendAnswer(answer);
@@ -146,8 +413,11 @@ void WriteCallback::onException(FPAnswerPtr answer, int errorCode)
 	{
 		if (errorCode <= FPNN_MAX_ERROR_CODE)
 		{
-			WriteCallback* callback = new WriteCallback(_async, _dbproxy, _dbQuest);
+			WriteCallback* callback = new WriteCallback(_async, _dbproxy, _dbQuest, _method);
 			callback->_retryTimes = 1;
+			callback->_sendUsec = _sendUsec;
+			callback->cleanCacheAfterGotResponse(_hintId, _tableName, _processor);
+			callback->admission(_admission);
 
 			if (_dbproxy->sendQuest(_dbQuest, callback))
 				return;
@@ -157,6 +427,8 @@ void WriteCallback::onException(FPAnswerPtr answer, int errorCode)
 		}
 	}
 
+	LatencyRecorder::instance().record(_method, _tableName, latencyNowUsec() - _sendUsec);
+
 	if (!answer)
 		answer = ErrorInfo::queryDBProxyFailedAnswer(_async->getQuest());
 	else
@@ -170,7 +442,11 @@ void WriteCallback::onException(FPAnswerPtr answer, int errorCode)
 void WriteCallback::cleanCache()
 {
 	if (_processor)
+	{
 		_processor->cleanCache(_tableName, _hintId);
+		if (_method == "delete")
+			_processor->unfenceWriteBehind(_tableName, _hintId);
+	}
 }
 
 #endif
\ No newline at end of file
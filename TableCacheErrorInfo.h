@@ -16,7 +16,7 @@ namespace ErrorInfo
 	//const int internalErrorCode = errorBase + 500;
 	//const int MySQLExceptionCode = errorBase + 502;
 	//const int unconfiguredCode = errorBase + 503;
-	//const int serverBusyCode = errorBase + 513;
+	const int serverBusyCode = errorBase + 513;
 
 	const char* const raiser_TableCache = "TableCache";
 
@@ -40,6 +40,11 @@ namespace ErrorInfo
 		return FPAWriter::errorAnswer(quest, notFoundCode, "Table not found.", raiser_TableCache);
 	}
 
+	inline FPAnswerPtr serverBusyAnswer(FPQuestPtr quest, const char* reason)
+	{
+		return FPAWriter::errorAnswer(quest, serverBusyCode, reason, raiser_TableCache);
+	}
+
 	/*inline FPAnswerPtr genericErrorAnswer(FPQuestPtr quest, int errorCode, const char* errorInfo)
 	{
 		return FPAWriter::errorAnswer(quest, errorCode, errorInfo, raiser_TableCache);
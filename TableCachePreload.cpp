@@ -0,0 +1,303 @@
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include "FPLog.h"
+#include "Setting.h"
+#include "StringUtil.h"
+#include "TableCacheErrorInfo.h"
+#include "TableCacheProcessor.h"
+
+static int64_t preloadNowMsec()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+//-- Estimated cache memory of a row: packed cells, CachedRow, shared_ptr control block & map node.
+static int64_t preloadRowBytes(const std::vector<std::string>& row)
+{
+	int64_t bytes = (int64_t)(sizeof(CachedRow) + 64 + row.size() * 2);
+	for (auto& value: row)
+		bytes += (int64_t)value.length();
+	return bytes;
+}
+
+void TableCacheProcessor::configurePreload()
+{
+	_preloadBatchSize = (int)Setting::getInt("TableCache.preload.batchSize", 1000);
+	if (_preloadBatchSize < 1)
+		_preloadBatchSize = 1;
+
+	_preloadMaxEmptyBatches = (int)Setting::getInt("TableCache.preload.maxEmptyBatches", 10);
+	_preloadMaxMemory = Setting::getInt("TableCache.preload.maxMemoryMB", 1024) * 1024 * 1024;
+	_preloadMaxIdsPerSecond = (uint32_t)Setting::getInt("TableCache.preload.maxIdsPerSecond", 20000);
+
+	//-- table[:fromId[-toId]], comma separated.
+	std::vector<std::string> items;
+	StringUtil::split(Setting::getString("TableCache.preload.tables"), ", ", items);
+	if (items.empty())
+		return;
+
+	for (auto& item: items)
+	{
+		std::string tableName = item;
+		int64_t fromId = 1;
+		int64_t toId = 0;
+
+		size_t pos = item.find(':');
+		if (pos != std::string::npos)
+		{
+			tableName = item.substr(0, pos);
+			std::string range = item.substr(pos + 1);
+			size_t dash = range.find('-', 1);
+			fromId = atoll(range.substr(0, dash).c_str());
+			if (dash != std::string::npos)
+				toId = atoll(range.substr(dash + 1).c_str());
+		}
+
+		if (!startPreload(tableName, fromId, toId))
+			LOG_ERROR("Preload table %s at startup failed.", tableName.c_str());
+	}
+
+	if (!Setting::getBool("TableCache.preload.waitAtStartup", false))
+		return;
+
+	//-- Before the server accepts traffic.
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lck(_preloadMutex);
+			bool busy = false;
+			for (auto& taskPair: _preloadTasks)
+				if (taskPair.second->state == "waiting" || taskPair.second->state == "running")
+					busy = true;
+
+			if (!busy)
+				break;
+		}
+		usleep(100 * 1000);
+	}
+	LOG_INFO("Startup preload finished.");
+}
+
+bool TableCacheProcessor::startPreload(const std::string& tableName, int64_t fromId, int64_t toId)
+{
+	std::unique_lock<std::mutex> lck(_preloadMutex);
+	auto it = _preloadTasks.find(tableName);
+	if (it != _preloadTasks.end() && (it->second->state == "waiting" || it->second->state == "running"))
+		return false;
+
+	std::shared_ptr<PreloadTask> task = std::make_shared<PreloadTask>(tableName, fromId, toId);
+	_preloadTasks[tableName] = task;
+	_preloadQueue.push_back(task);
+
+	if (!_preloadThread.joinable())
+		_preloadThread = std::thread(&TableCacheProcessor::preloadThread, this);
+
+	_preloadCondition.notify_one();
+	return true;
+}
+
+void TableCacheProcessor::preloadThread()
+{
+	while (_running)
+	{
+		std::shared_ptr<PreloadTask> task;
+		{
+			std::unique_lock<std::mutex> lck(_preloadMutex);
+			if (_preloadQueue.empty())
+			{
+				_preloadCondition.wait_for(lck, std::chrono::seconds(1));
+				continue;
+			}
+
+			task = _preloadQueue.front();
+			_preloadQueue.pop_front();
+			if (task->cancelled)
+			{
+				task->state = "cancelled";
+				task->finishMsec = preloadNowMsec();
+				continue;
+			}
+
+			task->state = "running";
+			task->startMsec = preloadNowMsec();
+		}
+
+		const char* state = runPreload(task);
+		{
+			std::unique_lock<std::mutex> lck(_preloadMutex);
+			task->state = state;
+			task->finishMsec = preloadNowMsec();
+		}
+
+		LOG_INFO("Preload table %s %s: %lld rows, ids %lld - %lld, cost %lld ms.", task->tableName.c_str(), state,
+			(long long)task->loadedRows, (long long)task->fromId, (long long)task->nextId - 1,
+			(long long)(task->finishMsec - task->startMsec));
+	}
+}
+
+const char* TableCacheProcessor::runPreload(std::shared_ptr<PreloadTask> task)
+{
+	TABLEPtr scheme = getTableScheme(task->tableName);
+	if (!scheme || scheme->isStringField(scheme->get_key_name()))
+		return "failed";
+
+	auto begin = std::chrono::steady_clock::now();
+	int64_t scannedIds = 0;
+	int emptyBatches = 0;
+
+	while (true)
+	{
+		if (!_running || task->cancelled)
+			return "cancelled";
+
+		int64_t nextId = task->nextId;
+		if (task->toId ? nextId > task->toId : emptyBatches >= _preloadMaxEmptyBatches)
+			return "finished";
+
+		if (task->memoryBytes >= _preloadMaxMemory)
+			return "memoryLimited";
+
+		std::set<int64_t> hintIds;
+		for (int64_t id = nextId; (int)hintIds.size() < _preloadBatchSize && (!task->toId || id <= task->toId); id++)
+			hintIds.insert(id);
+
+		std::string selectString;
+		{
+			ProfiledRKeeper rlock(&_rwlocker, _lockProfiler, LockProfiler::TableScheme);
+			auto it = _tableInfo.find(task->tableName);
+			if (it == _tableInfo.end() || it->second.get() != scheme.get())
+				return "invalidated";
+
+			bool cacheRows;
+			selectString = fetchSelectString(task->tableName, scheme, std::vector<uint16_t>(), cacheRows);
+		}
+
+		FPQuestPtr dbQuest = selectQuest(task->tableName, scheme, selectString, hintIds);
+		FPAnswerPtr answer = _dbproxy->sendQuest(dbQuest);
+		if (!answer || answer->status())
+			answer = _dbproxy->sendQuest(dbQuest);
+
+		if (!answer || answer->status())
+			return "failed";
+
+		FPAReader ar(answer);
+		std::vector<std::vector<std::string>> rows = ar.want("rows", std::vector<std::vector<std::string>>());
+
+		int64_t bytes = 0;
+		for (auto& row: rows)
+			bytes += preloadRowBytes(row);
+
+		addRows(scheme, rows);
+		task->loadedRows += (int64_t)rows.size();
+		task->memoryBytes += bytes;
+		task->nextId = *hintIds.rbegin() + 1;
+		emptyBatches = rows.empty() ? emptyBatches + 1 : 0;
+
+		//-- Rate limit on ids sent to DBProxy. Sleeps in short steps to stay cancellable.
+		scannedIds += (int64_t)hintIds.size();
+		while (_running && !task->cancelled)
+		{
+			uint32_t rate = _preloadMaxIdsPerSecond;
+			if (rate == 0)
+				break;
+
+			int64_t expectedMsec = scannedIds * 1000 / rate;
+			int64_t elapsedMsec = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+			if (elapsedMsec >= expectedMsec)
+				break;
+
+			usleep((useconds_t)std::min<int64_t>(expectedMsec - elapsedMsec, 100) * 1000);
+		}
+	}
+}
+
+void TableCacheProcessor::stopPreload()
+{
+	{
+		std::unique_lock<std::mutex> lck(_preloadMutex);
+		for (auto& taskPair: _preloadTasks)
+			taskPair.second->cancelled = true;
+	}
+	_preloadCondition.notify_all();
+
+	if (_preloadThread.joinable())
+		_preloadThread.join();
+}
+
+std::string TableCacheProcessor::preloadInfos()
+{
+	std::unique_lock<std::mutex> lck(_preloadMutex);
+	if (_preloadTasks.empty())
+		return std::string();
+
+	std::string infos("{");
+	bool needComma = false;
+	for (auto& taskPair: _preloadTasks)
+	{
+		PreloadTask& task = *taskPair.second;
+		if (needComma)
+			infos.append(",");
+		else
+			needComma = true;
+
+		int64_t cost = 0;
+		if (task.startMsec)
+			cost = (task.finishMsec ? task.finishMsec : preloadNowMsec()) - task.startMsec;
+
+		infos.append("\"").append(taskPair.first).append("\":{");
+		infos.append("\"state\":\"").append(task.state).append("\"");
+		infos.append(",\"fromId\":").append(std::to_string(task.fromId));
+		infos.append(",\"toId\":").append(std::to_string(task.toId));
+		infos.append(",\"nextId\":").append(std::to_string(task.nextId));
+		infos.append(",\"loadedRows\":").append(std::to_string(task.loadedRows));
+		infos.append(",\"memoryBytes\":").append(std::to_string(task.memoryBytes));
+		infos.append(",\"cost\":").append(std::to_string(cost));
+		infos.append("}");
+	}
+	infos.append("}");
+	return infos;
+}
+
+FPAnswerPtr TableCacheProcessor::preloadTable(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+{
+	std::string tableName = args->wantString("table");
+	TABLEPtr scheme = getTableScheme(tableName);
+	if (!scheme)
+		return ErrorInfo::tableNotFoundAnswer(quest);
+
+	if (scheme->isStringField(scheme->get_key_name()))
+		return ErrorInfo::disabledAnswer(quest, "Preload only supports tables with integer hintId.");
+
+	int64_t fromId = args->getInt("fromId", 1);
+	int64_t toId = args->getInt("toId", 0);
+	if (toId && toId < fromId)
+		return ErrorInfo::disabledAnswer(quest, "toId is less than fromId.");
+
+	bool started = startPreload(tableName, fromId, toId);
+
+	FPAWriter aw(1, quest);
+	aw.param("started", started);
+	return aw.take();
+}
+
+FPAnswerPtr TableCacheProcessor::cancelPreload(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+{
+	std::string tableName = args->getString("table");
+	int cancelled = 0;
+	{
+		std::unique_lock<std::mutex> lck(_preloadMutex);
+		for (auto& taskPair: _preloadTasks)
+		{
+			PreloadTask& task = *taskPair.second;
+			if ((tableName.empty() || taskPair.first == tableName) && (task.state == "waiting" || task.state == "running")
+				&& !task.cancelled.exchange(true))
+				cancelled += 1;
+		}
+	}
+
+	FPAWriter aw(1, quest);
+	aw.param("cancelled", cancelled);
+	return aw.take();
+}
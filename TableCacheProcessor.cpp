@@ -1,10 +1,14 @@
 #include <stdlib.h>
+#include <algorithm>
 #include <stdexcept>
+#include <type_traits>
 #include "FPLog.h"
 #include "Setting.h"
+#include "StringUtil.h"
 #include "FPZKClient.h"
 #include "TableCacheErrorInfo.h"
 #include "TableCacheProcessor.h"
+#include "LatencyHistogram.h"
 #include "TableCacheCallbacks.inc.cpp"
 
 FPZKClientPtr gc_fpzk;
@@ -26,26 +30,188 @@ void enableFPZK()
 void TableCacheProcessor::configure()
 {
 	_clusterNotifier = ClusterNotifier::create();
-	std::string dbproxyEndpoint = Setting::getString("TableCache.dbproxy.endpoint");
-	_dbproxy = TCPClient::createClient(dbproxyEndpoint);
-	if (!_dbproxy)
+	std::vector<std::string> dbproxyEndpoints;
+	StringUtil::split(Setting::getString("TableCache.dbproxy.endpoints"), ", ", dbproxyEndpoints);
+	if (dbproxyEndpoints.empty())
+		dbproxyEndpoints.push_back(Setting::getString("TableCache.dbproxy.endpoint"));
+
+	int timeout = Setting::getInt("TableCache.dbproxy.questTimeout", 15);
+	_dbproxy = std::make_shared<DBProxyPool>();
+	for (auto& dbproxyEndpoint: dbproxyEndpoints)
 	{
-		LOG_FATAL("Invalid dbproxy endpoint: %s", dbproxyEndpoint.c_str());
-		exit(1);
+		if (!_dbproxy->addEndpoint(dbproxyEndpoint, timeout))
+		{
+			LOG_FATAL("Invalid dbproxy endpoint: %s", dbproxyEndpoint.c_str());
+			exit(1);
+		}
 	}
 
-	int timeout = Setting::getInt("TableCache.dbproxy.questTimeout", 15);
-	_dbproxy->setQuestTimeout(timeout);
+	_dbproxy->setHealthPolicy((uint32_t)Setting::getInt("TableCache.dbproxy.maxFailures", 3),
+		(int)Setting::getInt("TableCache.dbproxy.cooldownSeconds", 5) * 1000);
+	_dbproxy->enableHedging(Setting::getReal("TableCache.dbproxy.hedge.percentile", 0),
+		(int)Setting::getInt("TableCache.dbproxy.hedge.minDelayMsec", 5),
+		Setting::getReal("TableCache.dbproxy.hedge.maxRatio", 0.1));
 
 	//-- _cachaMap
 	int64_t hash_size = Setting::getInt("TableCache.cache.hashSize", 1024*1024*64);
 	if (hash_size < 1024)
 		hash_size = 1024;
 	_cachaMap.reset(new CacheMap(hash_size));
+	_cachaMap->set_load_factors(Setting::getReal("TableCache.cache.maxLoadFactor", 4),
+		Setting::getReal("TableCache.cache.minLoadFactor", 0), (size_t)hash_size);
+	_cachaMap->set_resize_listener([this]() { rehashStarted(); });
+	configureCacheMemory(Setting::getString("TableCache.cache.hugePages"), Setting::getString("TableCache.cache.numaNodes"));
+	_rehashThread = std::thread(&TableCacheProcessor::rehashThread, this);
+
+	_hotKeyTracker = std::make_shared<HotKeyTracker>(
+		(size_t)Setting::getInt("TableCache.hotKeys.capacity", 64),
+		(int)Setting::getInt("TableCache.hotKeys.windowSeconds", 60),
+		(uint32_t)Setting::getInt("TableCache.hotKeys.sampleRate", 16));
+
+	_lockProfiler.enable(Setting::getBool("TableCache.profile.enable", false));
+
+	configureCompression(Setting::getString("TableCache.compression.tables"),
+		(uint32_t)Setting::getInt("TableCache.compression.minBytes", 1024));
+
+	//-- online miss ratio curve
+	double mrcSampleRatio = Setting::getReal("TableCache.mrc.sampleRatio", 0);
+	if (mrcSampleRatio > 0)
+	{
+		std::vector<std::string> factors;
+		StringUtil::split(Setting::getString("TableCache.mrc.capacityFactors", "0.125,0.25,0.5,1,2,4"), ",", factors);
+
+		std::vector<size_t> capacities;
+		for (auto& factor: factors)
+		{
+			double value = atof(factor.c_str());
+			if (value > 0)
+				capacities.push_back((size_t)(value * hash_size));
+		}
+
+		if (capacities.size())
+			_missRatioEstimator = std::make_shared<MissRatioEstimator>(mrcSampleRatio, capacities);
+	}
+
+	//-- shared memory row store
+	std::string shmFile = Setting::getString("TableCache.cache.shm.file");
+	if (!shmFile.empty())
+	{
+		int64_t shmSize = Setting::getInt("TableCache.cache.shm.sizeMB", 1024) * 1024 * 1024;
+		uint32_t slotCount = (uint32_t)std::min<int64_t>(hash_size, 0x7FFFFFFF);
+
+		_shmStore = std::make_shared<ShmRowStore>();
+		int64_t maxDownMsec = Setting::getInt("TableCache.cache.shm.maxDownSeconds", 60) * 1000;
+		if (!_shmStore->attach(shmFile, (size_t)shmSize, slotCount, maxDownMsec))
+		{
+			LOG_ERROR("Shared memory row store is disabled.");
+			_shmStore = nullptr;
+		}
+	}
+
+	startTrafficCapture(Setting::getString("TableCache.capture.file"));
 
+	_streamChunkRows = (uint32_t)Setting::getInt("TableCache.stream.chunkRows", 1000);
+	if (_streamChunkRows == 0)
+		_streamChunkRows = 1;
+	_streamMaxInflightBatches = (uint32_t)Setting::getInt("TableCache.stream.maxInflightBatches", 2);
+
+	configureSnapshot();
+	configureRefreshAhead(hash_size);
+	configureSubscription();
+	configureChangeFeed();
+	configureWriteBehind();
+	configureAdmission();
+	configurePreload();
 	enableFPZK();
 }
 
+void TableCacheProcessor::configureRefreshAhead(int64_t hashSize)
+{
+	if (!Setting::getBool("TableCache.refreshAhead.enable", false))
+		return;
+
+	TableCacheProcessor* self = this;
+	_refreshAhead = std::make_shared<RefreshAheadScheduler>(
+		[self](const std::string& tableName, const std::set<int64_t>& hintIds, const std::set<std::string>& hintStrings) {
+			return self->refreshRows(tableName, hintIds, hintStrings);
+		},
+		(size_t)(hashSize / 4),
+		(uint32_t)Setting::getInt("TableCache.refreshAhead.minFrequency", 8),
+		(uint32_t)Setting::getInt("TableCache.refreshAhead.maxRowsPerSecond", 1000),
+		(size_t)Setting::getInt("TableCache.refreshAhead.batchSize", 100),
+		(uint32_t)Setting::getInt("TableCache.refreshAhead.maxInflightBatches", 4),
+		(size_t)Setting::getInt("TableCache.refreshAhead.queueSize", 100000));
+}
+
+void TableCacheProcessor::configureSubscription()
+{
+	if (!Setting::getBool("TableCache.subscribe.enable", false))
+		return;
+
+	_invalidationPublisher = std::make_shared<InvalidationPublisher>(
+		(size_t)Setting::getInt("TableCache.subscribe.maxSubscribers", 1000),
+		(size_t)Setting::getInt("TableCache.subscribe.maxKeysPerSubscriber", 100000),
+		(size_t)Setting::getInt("TableCache.subscribe.maxPendingKeys", 10000),
+		(int)Setting::getInt("TableCache.subscribe.maxLeaseSeconds", 300),
+		(int)Setting::getInt("TableCache.subscribe.flushIntervalMsec", 50));
+}
+
+void TableCacheProcessor::configureChangeFeed()
+{
+	std::string source = Setting::getString("TableCache.changeFeed.source");
+	if (source.empty())
+		return;
+
+	ChangeFeedSourcePtr feedSource = ChangeFeedConsumer::createSource(source,
+		Setting::getBool("TableCache.changeFeed.file.startAtEnd", true),
+		(int)Setting::getInt("TableCache.changeFeed.questTimeout", 5));
+	if (!feedSource)
+	{
+		LOG_ERROR("Invalid change feed source: %s. Change feed is disabled.", source.c_str());
+		return;
+	}
+
+	_changeFeedNotifyCluster = Setting::getBool("TableCache.changeFeed.notifyCluster", true);
+
+	TableCacheProcessor* self = this;
+	_changeFeed = std::make_shared<ChangeFeedConsumer>(feedSource,
+		[self](const std::vector<ChangeEvent>& events) {
+			self->applyChanges(events);
+		},
+		(size_t)Setting::getInt("TableCache.changeFeed.batchSize", 1000),
+		(int)Setting::getInt("TableCache.changeFeed.pollIntervalMsec", 100));
+}
+
+void TableCacheProcessor::configureAdmission()
+{
+	int32_t maxOutstanding = (int32_t)Setting::getInt("TableCache.admission.maxOutstanding", 0);
+	int32_t maxTableOutstanding = (int32_t)Setting::getInt("TableCache.admission.maxTableOutstanding", 0);
+	double clientQPS = Setting::getReal("TableCache.admission.clientQPS", 0);
+
+	//-- Always created, so limits of 0 (unlimited) can be tuned on during an overload.
+	_admission = std::make_shared<AdmissionController>(maxOutstanding, maxTableOutstanding,
+		Setting::getBool("TableCache.admission.hitsOnly", true), clientQPS,
+		Setting::getReal("TableCache.admission.clientBurst", 0));
+}
+
+void TableCacheProcessor::startTrafficCapture(const std::string& file)
+{
+	if (file.empty())
+	{
+		_trafficRecorder.stop();
+		return;
+	}
+
+	uint32_t sampleRate = (uint32_t)Setting::getInt("TableCache.capture.sampleRate", 1);
+	uint32_t maxRecordsPerSecond = (uint32_t)Setting::getInt("TableCache.capture.maxRecordsPerSecond", 10000);
+	int64_t maxFileSize = Setting::getInt("TableCache.capture.maxFileSizeMB", 1024) * 1024 * 1024;
+
+	if (_trafficRecorder.start(file, sampleRate, maxRecordsPerSecond, maxFileSize))
+		LOG_INFO("Traffic capture to %s started.", file.c_str());
+	else
+		LOG_ERROR("Open traffic capture file %s failed.", file.c_str());
+}
+
 bool TableCacheProcessor::loadTableScheme(const std::string& tableName, std::vector<std::vector<std::string>>& scheme)
 {
 	FPQWriter qw(2, "query");
@@ -94,67 +260,300 @@ std::string TableCacheProcessor::loadSplitColumn(const std::string& tableName)
 	return ar.wantString("splitHint");
 }
 
-TABLEPtr TableCacheProcessor::loadTableInfo(const std::string& tableName)
+bool TableCacheProcessor::loadTableDescription(const std::string& tableName, TableDescription& desc)
 {
-	std::vector<std::vector<std::string>> scheme;
-	if (!loadTableScheme(tableName, scheme))
+	int64_t begin = latencyNowUsec();
+	if (!loadTableScheme(tableName, desc.columns))
 	{
-		if (!loadTableScheme(tableName, scheme))
-			return nullptr;
+		if (!loadTableScheme(tableName, desc.columns))
+			return false;
 	}
 
-	std::string splitHint = loadSplitColumn(tableName);
-	if (splitHint.empty())
+	desc.splitHint = loadSplitColumn(tableName);
+	LatencyRecorder::instance().record("schemeLoad", tableName, latencyNowUsec() - begin);
+	if (desc.splitHint.empty())
 	{
 		LOG_FATAL("Table %s has invalid configure (empty value) for hint_field", tableName.c_str());
-		return nullptr;
+		return false;
 	}
-	return std::make_shared<TABLE>(tableName, splitHint, scheme);
+	return true;
+}
+
+TABLEPtr TableCacheProcessor::loadTableInfo(const std::string& tableName, TableDescription& desc)
+{
+	if (!loadTableDescription(tableName, desc))
+		return nullptr;
+
+	return std::make_shared<TABLE>(tableName, desc.splitHint, desc.columns);
 }
 
 TABLEPtr TableCacheProcessor::getTableScheme(const std::string& tableName)
 {
 	{
-		RKeeper rlock(&_rwlocker);
+		ProfiledRKeeper rlock(&_rwlocker, _lockProfiler, LockProfiler::TableScheme);
 		auto it = _tableInfo.find(tableName);
 		if (it != _tableInfo.end())
 			return it->second;
 	}
 
-	TABLEPtr scheme = loadTableInfo(tableName);
+	TableDescription desc;
+	TABLEPtr scheme = loadTableInfo(tableName, desc);
 	if (scheme)
 	{
-		WKeeper wlock(&_rwlocker);
+		ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::TableScheme);
 		auto it = _tableInfo.find(tableName);
 		if (it != _tableInfo.end())
 			return it->second;
 		else
-			_tableInfo[tableName] = scheme;
+			registerTable(tableName, scheme, desc);
 	}
 	return scheme;
 }
 
+void TableCacheProcessor::registerTable(const std::string& tableName, TABLEPtr scheme, const TableDescription& desc)
+{
+	_tableInfo[tableName] = scheme;
+	_tableDescs[tableName] = desc;
+	TableDescription& current = _tableDescs[tableName];
+	current.columnTypes = CachedRow::columnTypes(desc.columns);
+	applyHotColumns(tableName, current);
+	applyCompressionSetting(tableName, current);
+
+	//-- Shared rows hold '' for non hot columns, so processes with other hot columns must not share them.
+	if (_shmStore)
+		_shmStore->bindTable(tableName, ShmRowStore::schemeDigest(desc.splitHint + current.hotSelectString, desc.columns));
+}
+
+void TableCacheProcessor::applyHotColumns(const std::string& tableName, TableDescription& desc)
+{
+	desc.storageTypes = desc.columnTypes;
+	desc.hotSelectString.clear();
+
+	std::string setting;
+	auto it = _tunedHotColumns.find(tableName);
+	if (it != _tunedHotColumns.end())
+		setting = it->second;
+	else
+		setting = Setting::getString(std::string("TableCache.hotColumns.").append(tableName));
+
+	std::vector<std::string> names;
+	StringUtil::split(setting, ", ", names);
+	if (names.empty())
+		return;
+
+	std::set<std::string> hotColumns(names.begin(), names.end());
+	hotColumns.insert(desc.splitHint);		//-- The key column is always hot.
+
+	std::string selectString;
+	size_t coldCount = 0;
+	for (size_t i = 0; i < desc.columns.size(); i++)
+	{
+		if (i)
+			selectString.append(",");
+
+		const std::string& column = desc.columns[i][0];
+		if (hotColumns.erase(column))
+			selectString.append(column);
+		else
+		{
+			selectString.append("''");
+			desc.storageTypes[i] = CachedRow::UncachedColumn;
+			coldCount += 1;
+		}
+	}
+
+	for (auto& column: hotColumns)
+		LOG_WARN("Hot column %s is not a column of table %s.", column.c_str(), tableName.c_str());
+
+	if (coldCount)
+		desc.hotSelectString.swap(selectString);
+}
+
+std::string TableCacheProcessor::fetchSelectString(const std::string& tableName, TABLEPtr scheme,
+	const std::vector<uint16_t>& indexes, bool& cacheRows)
+{
+	cacheRows = true;
+	auto it = _tableDescs.find(tableName);
+	if (it == _tableDescs.end() || it->second.hotSelectString.empty())
+		return scheme->get_select_string();
+
+	const TableDescription& desc = it->second;
+	std::vector<bool> selected(desc.columns.size(), false);
+	for (uint16_t index: indexes)
+		if (index < selected.size())
+		{
+			selected[index] = true;
+			if (desc.storageTypes[index] == CachedRow::UncachedColumn)
+				cacheRows = false;
+		}
+
+	if (cacheRows)
+		return desc.hotSelectString;
+
+	//-- Cold fetch: only the required columns & the key, the row keeps the full column layout.
+	std::vector<uint16_t> keyIndex = scheme->get_fields_index(std::vector<std::string>{scheme->get_key_name()});
+	selected[keyIndex[0]] = true;
+
+	std::string selectString;
+	for (size_t i = 0; i < desc.columns.size(); i++)
+	{
+		if (i)
+			selectString.append(",");
+
+		selectString.append(selected[i] ? desc.columns[i][0] : std::string("''"));
+	}
+	return selectString;
+}
+
+void TableCacheProcessor::configureCompression(const std::string& tables, uint32_t minBytes)
+{
+	std::vector<std::string> tableNames;
+	StringUtil::split(tables, ", ", tableNames);
+
+	ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::TableScheme);
+	_compressionTables.clear();
+	_compressionTables.insert(tableNames.begin(), tableNames.end());
+	_compressionMinBytes = minBytes;
+
+	for (auto& descPair: _tableDescs)
+		applyCompressionSetting(descPair.first, descPair.second);
+}
+
+void TableCacheProcessor::applyCompressionSetting(const std::string& tableName, TableDescription& desc)
+{
+	bool enabled = _compressionMinBytes > 0 && (_compressionTables.find("*") != _compressionTables.end()
+		|| _compressionTables.find(tableName) != _compressionTables.end());
+
+	std::shared_ptr<CompressionStatistics>& compression = _compressionStatistics[tableName];
+	if (!compression)
+	{
+		if (!enabled)
+		{
+			_compressionStatistics.erase(tableName);
+			return;
+		}
+		compression = std::make_shared<CompressionStatistics>(_compressionMinBytes);
+	}
+
+	//-- Rows compressed before stay compressed, minBytes 0 only stops compressing new rows.
+	compression->minBytes = enabled ? _compressionMinBytes : 0;
+	desc.compression = compression;
+}
+
+std::shared_ptr<CompressionStatistics> TableCacheProcessor::tableCompression(const std::string& tableName)
+{
+	if (_compressionStatistics.empty())
+		return nullptr;
+
+	auto it = _tableDescs.find(tableName);
+	if (it == _tableDescs.end())
+		return nullptr;
+
+	return it->second.compression;
+}
+
 void TableCacheProcessor::cleanCache(const std::string& tableName, int64_t hintId)
 {	
 	_clusterNotifier->invalidate(tableName, hintId);
+	if (_missRatioEstimator)
+		_missRatioEstimator->invalidate(tableName, hintId);
+
+	{
+		ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::CleanCache);
+		removeCachedRow(tableName, hintId);
+
+		//-- Timed after the row is removed: a snapshot that may still hold the row is created before, and replays the entry.
+		if (_invalidationJournal)
+			_invalidationJournal->invalidate(tableName, hintId);
+	}
+
+	//-- After the row is removed, so subscribers reloading on the push get the new data.
+	if (_invalidationPublisher)
+		_invalidationPublisher->invalidate(tableName, hintId);
+}
 
+void TableCacheProcessor::removeCachedRow(const std::string& tableName, int64_t hintId)
+{
 	TableKey key;
 	key.hintId = hintId;
 	key.tableName = tableName;
 
-	WKeeper wlock(&_rwlocker);
-	CacheMap::node_type* node = _cachaMap->find(key);
-	if (node)
+	//-- More than one string key may share the hintId.
+	while (CacheMap::node_type* node = _cachaMap->find(key))
 	{
+		if (_refreshAhead)
+			_refreshAhead->invalidated(tableName, hintId, node->key.hintString);
+
 		_tableDataIndexes[tableName].erase(node);
 		if (_tableDataIndexes[tableName].empty())
 			_tableDataIndexes.erase(tableName);
 
 		_cachaMap->remove_node(node);
 	}
+
+	if (_shmStore)
+		_shmStore->remove(tableName, hintId);
+}
+
+CachedRowPtr TableCacheProcessor::fetchSharedRow(const TableKey& key)
+{
+	std::vector<std::string> rowData;
+	if (!_shmStore || !_shmStore->find(key.tableName, key.hintId, rowData))
+		return nullptr;
+
+	if (key.hintString.size())
+	{
+		auto it = _tableInfo.find(key.tableName);
+		if (it == _tableInfo.end())
+			return nullptr;
+
+		TABLEPtr scheme = it->second;
+		std::vector<uint16_t> index = scheme->get_fields_index(std::vector<std::string>{scheme->get_key_name()});
+		if (index[0] >= rowData.size() || rowData[index[0]] != key.hintString)
+			return nullptr;		//-- Shared row of another string key with the same hintId.
+	}
+
+	const TableDescription& desc = _tableDescs[key.tableName];
+	CachedRowPtr rowptr = std::make_shared<CachedRow>(rowData, desc.storageTypes, desc.compression);
+	CacheMap::node_type* node = _cachaMap->insert(key, rowptr);
+	if (node)
+		_tableDataIndexes[key.tableName].insert(node);
+
+	return rowptr;
+}
+
+CachedRowPtr TableCacheProcessor::cachedRow(const std::string& tableName, int64_t hintId)
+{
+	TableKey key;
+	key.hintId = hintId;
+	key.tableName = tableName;
+
+	CacheMap::node_type* node = _cachaMap->find(key);
+	if (node)
+	{
+		_cachaMap->fresh_node(node);
+		return node->data;
+	}
+	return fetchSharedRow(key);
+}
+
+CachedRowPtr TableCacheProcessor::cachedRow(const std::string& tableName, const std::string& hintString)
+{
+	TableKey key;
+	key.hintId = stringHintId(hintString);
+	key.tableName = tableName;
+	key.hintString = hintString;
+
+	CacheMap::node_type* node = _cachaMap->find(key);
+	if (node)
+	{
+		_cachaMap->fresh_node(node);
+		return node->data;
+	}
+	return fetchSharedRow(key);
 }
 
-void TableCacheProcessor::addRows(TABLEPtr orginalScheme, const std::vector<std::vector<std::string>>& data)
+size_t TableCacheProcessor::addRows(TABLEPtr orginalScheme, const std::vector<std::vector<std::string>>& data, bool refreshed)
 {
 	std::string tableName = orginalScheme->get_table_name();
 	std::string keyCloumn = orginalScheme->get_key_name();
@@ -168,62 +567,80 @@ void TableCacheProcessor::addRows(TABLEPtr orginalScheme, const std::vector<std:
 	{
 		int64_t hintId;
 		if (stringKey)
-			hintId = (int64_t)jenkins_hash(data[i][index[0]].c_str(), data[i][index[0]].length(), 0);
+			hintId = stringHintId(data[i][index[0]]);
 		else
 			hintId = atoll(data[i][index[0]].c_str());
 
 		hintIds.push_back(hintId);
 	}
 
-	WKeeper wlock(&_rwlocker);
+	std::vector<uint8_t> columnTypes;
+	std::shared_ptr<CompressionStatistics> compression;
+	{
+		ProfiledRKeeper rlock(&_rwlocker, _lockProfiler, LockProfiler::AddRows);
+		auto it = _tableDescs.find(tableName);
+		if (it == _tableDescs.end())
+			return 0;		//-- Table invalidated.
+
+		columnTypes = it->second.storageTypes;
+		compression = it->second.compression;
+	}
+
+	//-- Packing & compression are done before taking the write lock.
+	std::vector<CachedRowPtr> rows;
+	rows.reserve(data.size());
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		rows.push_back(std::make_shared<CachedRow>(data[i], columnTypes, compression));
+		if (refreshed)
+			rows.back()->markRefreshed();
+	}
+
+	size_t addedCount = 0;
+	ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::AddRows);
 	auto it = _tableInfo.find(tableName);
 	if (it == _tableInfo.end())
-		return;		//-- Table invalidated.
+		return 0;		//-- Table invalidated.
 
 	TABLEPtr scheme = it->second;
 	if (scheme.get() != orginalScheme.get())
-		return;		//-- Table invalidated.
+		return 0;		//-- Table invalidated.
 
+	bool writeBehindTable = _writeBehind && _writeBehind->enabled(tableName);
 	for (size_t i = 0; i < data.size(); i++)
 	{
 		TableKey key;
 		key.hintId = hintIds[i];
 		key.tableName = tableName;
+		if (stringKey)
+			key.hintString = data[i][index[0]];
 
 		CacheMap::node_type* node = _cachaMap->find(key);
 		if (node)
 			continue;
 
-		ROWPtr rowptr = std::make_shared<ROW>(data[i]);
-		node = _cachaMap->insert(key, rowptr);
+		if (writeBehindTable && _writeBehind->pending(tableName, hintIds[i]))
+			continue;		//-- The database does not have the queued modifies yet.
+
+		node = _cachaMap->insert(key, rows[i]);
 		if (node)
+		{
 			_tableDataIndexes[tableName].insert(node);
+			addedCount += 1;
+		}
+
+		if (_shmStore)
+			_shmStore->insert(tableName, hintIds[i], data[i]);
 	}
+	return addedCount;
 }
 
-FPAnswerPtr TableCacheProcessor::modify(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+//-- insert ... on duplicate key update. Fields of kvpairs must have been checked.
+FPQuestPtr TableCacheProcessor::modifyQuest(const std::string& tableName, TABLEPtr scheme, int64_t hintId,
+	const std::string& hintString, const std::map<std::string, std::string>& kvpairs)
 {
-	std::string tableName = args->wantString("table");
-	TABLEPtr scheme = getTableScheme(tableName);
-	if (!scheme)
-		return ErrorInfo::tableNotFoundAnswer(quest);
-
-	std::map<std::string, std::string> kvpairs = args->want("values", std::map<std::string, std::string>());
-
-	int64_t hintId;
-	std::string hintStr;
 	std::string keyName = scheme->get_key_name();
 	bool strKey = scheme->isStringField(keyName);
-	if (!strKey)
-		hintId = args->wantInt("hintId");
-	else
-	{
-		hintStr = args->wantString("hintId");
-		hintId = (int64_t)jenkins_hash(hintStr.c_str(), hintStr.length(), 0);
-	}
-
-	if (kvpairs.find(keyName) != kvpairs.end())
-		return ErrorInfo::disabledAnswer(quest, std::string("Hint/split field ").append(keyName).append(" will be processed by inferface function, it cannot be set in values parameter.").c_str());
 
 	//-- build sql
 	std::vector<std::string> fields;
@@ -235,7 +652,7 @@ FPAnswerPtr TableCacheProcessor::modify(const FPReaderPtr args, const FPQuestPtr
 	if (!strKey)
 		values.push_back(std::to_string(hintId));
 	else
-		values.push_back(hintStr);
+		values.push_back(hintString);
 
 	for (auto& kvpair: kvpairs)
 	{
@@ -273,20 +690,12 @@ FPAnswerPtr TableCacheProcessor::modify(const FPReaderPtr args, const FPQuestPtr
 		values.push_back(values[i+1]);
 	}
 
-	//-- additional check for SQL Injection
-	try {
-		scheme->get_fields_index(fields);
-	}
-	catch (const std::out_of_range& oor) {
-		return ErrorInfo::disabledAnswer(quest, "Found invalid filed(s) in inputted params.");
-	}
-
 	//-- build quest
 	FPQuestPtr dbQuest;
 	if (strKey)
 	{
 		FPQWriter qw(4, "sQuery");
-		qw.param("hintIds", std::vector<std::string>{hintStr});
+		qw.param("hintIds", std::vector<std::string>{hintString});
 		qw.param("sql", sql);
 		qw.param("params", values);
 		qw.param("tableName", tableName);
@@ -302,10 +711,82 @@ FPAnswerPtr TableCacheProcessor::modify(const FPReaderPtr args, const FPQuestPtr
 		dbQuest = qw.take();
 	}
 
+	return dbQuest;
+}
+
+FPAnswerPtr TableCacheProcessor::modify(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+{
+	AllocationKeeper allocationKeeper(_lockProfiler, LockProfiler::ModifyRequest);
+	if (!_admission->allowClient(ci.ip))
+		return ErrorInfo::serverBusyAnswer(quest, "Client request rate limited.");
+
+	std::string tableName = args->wantString("table");
+	TABLEPtr scheme = getTableScheme(tableName);
+	if (!scheme)
+		return ErrorInfo::tableNotFoundAnswer(quest);
+
+	std::map<std::string, std::string> kvpairs = args->want("values", std::map<std::string, std::string>());
+
+	int64_t hintId;
+	std::string hintStr;
+	std::string keyName = scheme->get_key_name();
+	bool strKey = scheme->isStringField(keyName);
+	if (!strKey)
+		hintId = args->wantInt("hintId");
+	else
+	{
+		hintStr = args->wantString("hintId");
+		hintId = stringHintId(hintStr);
+	}
+
+	if (kvpairs.find(keyName) != kvpairs.end())
+		return ErrorInfo::disabledAnswer(quest, std::string("Hint/split field ").append(keyName).append(" will be processed by inferface function, it cannot be set in values parameter.").c_str());
+
+	if (_trafficRecorder.sampled())
+	{
+		TrafficRecord record;
+		record.kind = TrafficRecord::Modify;
+		record.tableName = tableName;
+		record.stringKey = strKey;
+		if (strKey)
+			record.hintStrings.push_back(hintStr);
+		else
+			record.hintIds.push_back(hintId);
+
+		for (auto& kvpair: kvpairs)
+		{
+			record.fields.push_back(kvpair.first);
+			record.valueLengths.push_back((uint32_t)kvpair.second.length());
+		}
+		_trafficRecorder.record(record);
+	}
+
+	//-- additional check for SQL Injection
+	std::vector<std::string> fields;
+	for (auto& kvpair: kvpairs)
+		fields.push_back(kvpair.first);
+
+	try {
+		scheme->get_fields_index(fields);
+	}
+	catch (const std::out_of_range& oor) {
+		return ErrorInfo::disabledAnswer(quest, "Found invalid filed(s) in inputted params.");
+	}
+
+	if (_writeBehind && _writeBehind->enabled(tableName) && queueModify(tableName, scheme, hintId, hintStr, kvpairs))
+		return FPAWriter::emptyAnswer(quest);
+
+	AdmissionTicketPtr admission;
+	if (!(admission = _admission->acquire(tableName, AdmissionController::Write)))
+		return ErrorInfo::serverBusyAnswer(quest, "Too many outstanding DBProxy requests.");
+
+	FPQuestPtr dbQuest = modifyQuest(tableName, scheme, hintId, hintStr, kvpairs);
+
 	//-- send insert on duplicate key update sql to DBProxy
 	std::shared_ptr<IAsyncAnswer> async = genAsyncAnswer(quest);
-	WriteCallback* callback = new WriteCallback(async, _dbproxy, dbQuest);
+	WriteCallback* callback = new WriteCallback(async, _dbproxy, dbQuest, "modify");
 	callback->cleanCacheAfterGotResponse(hintId, tableName, shared_from_this());
+	callback->admission(admission);
 
 	if (_dbproxy->sendQuest(dbQuest, callback) == false)
 	{
@@ -323,6 +804,10 @@ FPAnswerPtr TableCacheProcessor::modify(const FPReaderPtr args, const FPQuestPtr
 
 FPAnswerPtr TableCacheProcessor::fetch(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
 {
+	AllocationKeeper allocationKeeper(_lockProfiler, LockProfiler::FetchRequest);
+	if (!_admission->allowClient(ci.ip))
+		return ErrorInfo::serverBusyAnswer(quest, "Client request rate limited.");
+
 	std::string tableName = args->wantString("table");
 	TABLEPtr scheme = getTableScheme(tableName);
 	if (!scheme)
@@ -330,38 +815,266 @@ FPAnswerPtr TableCacheProcessor::fetch(const FPReaderPtr args, const FPQuestPtr
 
 	std::vector<std::string> fields = args->want("fields", std::vector<std::string>());
 
+	bool stream = args->getBool("stream", false);
+	bool withVersions = args->getBool("withVersions", false);
+
+	FPAnswerPtr answer;
+	int64_t begin = latencyNowUsec();
 	std::string keyName = scheme->get_key_name();
 	bool strKey = scheme->isStringField(keyName);
 	if (!strKey)
 	{
-		std::set<int64_t> hintIds = args->get("hintIds", std::set<int64_t>());
-		if (hintIds.empty())
+		//-- Conditional fetch: { hintId: version } of the rows the client has. Json has only string keys.
+		RowVersions<int64_t> rowVersions;
+		if (args->getBool("jsonCompatible", false))
 		{
-			int64_t hintId = args->wantInt("hintId");
+			std::map<std::string, int64_t> versions = args->get("versions", std::map<std::string, int64_t>());
+			for (auto& versionPair: versions)
+				rowVersions.client[(int64_t)atoll(versionPair.first.c_str())] = versionPair.second;
+		}
+		else
+			rowVersions.client = args->get("versions", std::map<int64_t, int64_t>());
+		rowVersions.enabled = withVersions || rowVersions.client.size();
+
+		if (stream && rowVersions.enabled)
+			return ErrorInfo::disabledAnswer(quest, "Stream fetch does not support row versions.");
+
+		std::set<int64_t> hintIds = args->get("hintIds", std::set<int64_t>());
+		for (auto& versionPair: rowVersions.client)
+			hintIds.insert(versionPair.first);
+
+		if (hintIds.empty())
+		{
+			int64_t hintId = args->wantInt("hintId");
 			hintIds.insert(hintId);
 		}
 
-		return real_fetch(quest, tableName, scheme, fields, hintIds);
+		if (_trafficRecorder.sampled())
+		{
+			TrafficRecord record;
+			record.kind = TrafficRecord::Fetch;
+			record.tableName = tableName;
+			record.hintIds.assign(hintIds.begin(), hintIds.end());
+			record.fields = fields;
+			_trafficRecorder.record(record);
+		}
+
+		if (rowVersions.client.size())
+			_statistics.conditionalFetchCount++;
+
+		if (stream)
+			answer = streamFetch(quest, ci, tableName, scheme, fields, hintIds);
+		else
+			answer = real_fetch(quest, tableName, scheme, fields, hintIds, &rowVersions);
 	}
 	else
 	{
+		RowVersions<std::string> rowVersions;
+		rowVersions.client = args->get("versions", std::map<std::string, int64_t>());
+		rowVersions.enabled = withVersions || rowVersions.client.size();
+
+		if (stream && rowVersions.enabled)
+			return ErrorInfo::disabledAnswer(quest, "Stream fetch does not support row versions.");
+
 		std::set<std::string> hintStrings = args->get("hintIds", std::set<std::string>());
+		for (auto& versionPair: rowVersions.client)
+			hintStrings.insert(versionPair.first);
+
 		if (hintStrings.empty())
 		{
 			std::string hintStr = args->wantString("hintId");
 			hintStrings.insert(hintStr);
 		}
 
-		return real_fetch(quest, tableName, scheme, fields, hintStrings);
+		if (_trafficRecorder.sampled())
+		{
+			TrafficRecord record;
+			record.kind = TrafficRecord::Fetch;
+			record.tableName = tableName;
+			record.stringKey = true;
+			record.hintStrings.assign(hintStrings.begin(), hintStrings.end());
+			record.fields = fields;
+			_trafficRecorder.record(record);
+		}
+
+		if (rowVersions.client.size())
+			_statistics.conditionalFetchCount++;
+
+		if (stream)
+			answer = streamFetch(quest, ci, tableName, scheme, fields, hintStrings);
+		else
+			answer = real_fetch(quest, tableName, scheme, fields, hintStrings, &rowVersions);
 	}
+
+	LatencyRecorder::instance().record("fetch", tableName, latencyNowUsec() - begin);
+	return answer;
 }
 
-FPAnswerPtr TableCacheProcessor::real_fetch_from_database(const FPQuestPtr quest,
-	const std::string& tableName, TABLEPtr scheme, std::vector<uint16_t>& fieldIndexes,
-	const std::set<int64_t>& lackedHintIds, std::map<int64_t, std::vector<std::string>>& result, bool jsonCompatible)
+static inline int64_t streamKeyHintId(int64_t hintId) { return hintId; }
+static inline int64_t streamKeyHintId(const std::string& hintString) { return stringHintId(hintString); }
+static inline std::string streamKeyString(int64_t hintId) { return std::to_string(hintId); }
+static inline const std::string& streamKeyString(const std::string& hintString) { return hintString; }
+
+/*
+	Hits are answered in chunks of at most chunkRows rows: the first chunk in the answer, the
+	others pushed as fetchChunk. Missed keys are loaded from DBProxy in batches of chunkRows,
+	each batch pushed when it arrives. The last push has done = true.
+*/
+template <typename TYPE>
+FPAnswerPtr TableCacheProcessor::streamFetch(const FPQuestPtr quest, const ConnectionInfo& ci, const std::string& tableName,
+	TABLEPtr scheme, const std::vector<std::string>& fields, const std::set<TYPE>& hintKeys)
+{
+	FPQReader qr(quest);
+	bool jsonCompatible = qr.getBool("jsonCompatible", false);
+	bool typed = qr.getBool("typed", false);
+	uint32_t chunkRows = (uint32_t)qr.getInt("chunkRows", _streamChunkRows);
+	if (chunkRows == 0 || chunkRows > _streamChunkRows)
+		chunkRows = _streamChunkRows;
+
+	std::vector<uint16_t> indexes = scheme->get_fields_index(fields);
+	std::vector<uint8_t> requiredTypes;
+	std::vector<std::pair<TYPE, CachedRowPtr>> hitRows;
+	std::vector<int64_t> hintIds;
+	std::shared_ptr<CompressionStatistics> compression;
+	std::string selectString;
+	bool cacheRows;
+
+	std::set<TYPE> lackedKeys;
+	std::vector<std::set<TYPE>> lackedBatches;
+	{
+		ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::RealFetch);
+		if (typed)
+			requiredTypes = requiredColumnTypes(tableName, indexes);
+		compression = tableCompression(tableName);
+		selectString = fetchSelectString(tableName, scheme, indexes, cacheRows);
+
+		for (auto& hintKey: hintKeys)
+		{
+			hintIds.push_back(streamKeyHintId(hintKey));
+
+			//-- Cold fetches bypass the cache.
+			CachedRowPtr row;
+			if (cacheRows)
+				row = cachedRow(tableName, hintKey);
+
+			if (row)
+				hitRows.push_back(std::make_pair(hintKey, row));
+			else
+			{
+				lackedKeys.insert(hintKey);
+				if (lackedKeys.size() >= chunkRows)
+				{
+					lackedBatches.push_back(std::set<TYPE>());
+					lackedBatches.back().swap(lackedKeys);
+				}
+			}
+		}
+	}
+
+	if (lackedKeys.size())
+	{
+		lackedBatches.push_back(std::set<TYPE>());
+		lackedBatches.back().swap(lackedKeys);
+	}
+
+	size_t lackedCount = hintKeys.size() - hitRows.size();
+
+	AdmissionTicketPtr admission;
+	bool unloaded = false;
+	if (lackedCount && !(admission = _admission->acquire(tableName, AdmissionController::Fetch)))
+	{
+		if (!_admission->hitsOnly())
+			return ErrorInfo::serverBusyAnswer(quest, "Too many outstanding DBProxy requests.");
+
+		_admission->unloaded(lackedCount);
+		unloaded = true;
+	}
+
+	_statistics.fetchCount++;
+	_statistics.streamFetchCount++;
+	_statistics.itemFetchCount.fetch_add((uint64_t)hintKeys.size());
+	_statistics.itemHitCount.fetch_add((uint64_t)hitRows.size());
+	if (lackedCount == 0)
+		_statistics.fullHitCount++;
+	else if (hitRows.size())
+		_statistics.partHitCount++;
+
+	{
+		std::set<TYPE> hitKeys;
+		for (auto& hitRow: hitRows)
+			hitKeys.insert(hitRow.first);
+
+		std::vector<std::string> sampledKeys, sampledMissedKeys;
+		for (auto& hintKey: hintKeys)
+			if (_hotKeyTracker->sampled())
+			{
+				sampledKeys.push_back(streamKeyString(hintKey));
+				if (hitKeys.find(hintKey) == hitKeys.end())
+					sampledMissedKeys.push_back(sampledKeys.back());
+			}
+
+		if (sampledKeys.size())
+			_hotKeyTracker->record(tableName, sampledKeys, sampledMissedKeys);
+	}
+
+	if (!cacheRows)
+	{
+		_statistics.coldFetchCount++;
+		_statistics.coldItemFetchCount.fetch_add((uint64_t)hintKeys.size());
+	}
+	else if (_missRatioEstimator)
+		_missRatioEstimator->access(tableName, hintIds);
+
+	if (_refreshAhead)
+		_refreshAhead->access(tableName, hintIds);
+
+	std::shared_ptr<FetchStream<TYPE>> stream = std::make_shared<FetchStream<TYPE>>(++_nextStreamId, genQuestSender(ci),
+		shared_from_this(), scheme, indexes, requiredTypes, selectString, cacheRows,
+		jsonCompatible && std::is_same<TYPE, int64_t>::value, _streamMaxInflightBatches);
+
+	if (unloaded)
+		stream->fail("Too many outstanding DBProxy requests, missed rows are not loaded.");
+	else
+	{
+		stream->admission(admission);
+		for (auto& batch: lackedBatches)
+			stream->addBatch(batch);
+	}
+
+	//-- Rows are immutable, projected (and decompressed) outside the lock, one chunk at a time.
+	std::shared_ptr<IAsyncAnswer> async = genAsyncAnswer(quest);
+	size_t hitIndex = 0;
+	do
+	{
+		std::map<TYPE, std::vector<std::string>> chunk;
+		for (; hitIndex < hitRows.size() && chunk.size() < chunkRows; hitIndex++)
+		{
+			chunk[hitRows[hitIndex].first] = hitRows[hitIndex].second->get_data(indexes, compression.get());
+			if (_refreshAhead && hitRows[hitIndex].second->takeRefreshed())
+				_refreshAhead->hit();
+		}
+
+		bool done = (hitIndex == hitRows.size() && lackedCount == 0);
+		if (async)
+		{
+			async->sendAnswer(stream->answer(quest, chunk, done));
+			async = nullptr;
+		}
+		else
+			stream->push(chunk, done);
+	} while (hitIndex < hitRows.size());
+
+	if (lackedCount)
+		stream->start();
+
+	return nullptr;
+}
+
+FPQuestPtr TableCacheProcessor::selectQuest(const std::string& tableName, TABLEPtr scheme,
+	const std::string& selectString, const std::set<int64_t>& lackedHintIds)
 {
 	std::string sql("select ");
-	sql.append(scheme->get_select_string()).append(" from ").append(tableName);
+	sql.append(selectString).append(" from ").append(tableName);
 	sql.append(" where ").append(scheme->get_key_name()).append(" in (");
 	int needComna = false;
 	for (int64_t hintId: lackedHintIds)
@@ -380,25 +1093,78 @@ FPAnswerPtr TableCacheProcessor::real_fetch_from_database(const FPQuestPtr quest
 	qw.param("sql", sql);
 	qw.param("tableName", tableName);
 	FPQuestPtr dbQuest = qw.take();
+	return dbQuest;
+}
+
+FPQuestPtr TableCacheProcessor::selectQuest(const std::string& tableName, TABLEPtr scheme,
+	const std::string& selectString, const std::set<std::string>& lackedHintStrings)
+{
+	std::string sql("select ");
+	sql.append(selectString).append(" from ").append(tableName);
+	sql.append(" where ").append(scheme->get_key_name()).append(" in (");
+	int needComna = false;
+	//for (const std::string& hintString: lackedHintStrings)
+	for (int i = 0; i < (int)lackedHintStrings.size(); i++)
+	{
+		if (needComna)
+			sql.append(",");
+		else
+			needComna = true;
+
+		sql.append("'?'");
+	}
+	sql.append(")");
+
+	FPQWriter qw(4, "sQuery");
+	qw.param("hintIds", lackedHintStrings);
+	qw.param("sql", sql);
+	qw.param("tableName", tableName);
+	qw.param("params", lackedHintStrings);
+	FPQuestPtr dbQuest = qw.take();
+	return dbQuest;
+}
+
+FPAnswerPtr TableCacheProcessor::real_fetch_from_database(const FPQuestPtr quest,
+	const std::string& tableName, TABLEPtr scheme, std::vector<uint16_t>& fieldIndexes,
+	const std::set<int64_t>& lackedHintIds, std::map<int64_t, std::vector<std::string>>& result, bool jsonCompatible,
+	const std::vector<uint8_t>& requiredTypes, const std::string& selectString, bool cacheRows,
+	RowVersions<int64_t>& rowVersions, AdmissionTicketPtr admission)
+{
+	FPQuestPtr dbQuest = selectQuest(tableName, scheme, selectString, lackedHintIds);
 
 	std::shared_ptr<IAsyncAnswer> async = genAsyncAnswer(quest);
 	AnswerCallback * callback = NULL;
 	if (!jsonCompatible)
-		callback = new FetchRowCallback<int64_t>(
+	{
+		FetchRowCallback<int64_t>* fetchCallback = new FetchRowCallback<int64_t>(
 			async, shared_from_this(), dbQuest, scheme, fieldIndexes, result);
+		fetchCallback->typedAnswer(requiredTypes);
+		fetchCallback->cacheRows(cacheRows);
+		fetchCallback->rowVersions(rowVersions);
+		fetchCallback->admission(admission);
+		callback = fetchCallback;
+	}
 	else
 	{
 		std::map<std::string, std::vector<std::string>> skeyResult;
 		for (auto& resultPair: result)
 			skeyResult[std::to_string(resultPair.first)] = resultPair.second;
 
-		callback = new FetchRowCallback<std::string>(
+		RowVersions<std::string> skeyVersions;
+		stringKeyVersions(rowVersions, skeyVersions);
+
+		FetchRowCallback<std::string>* fetchCallback = new FetchRowCallback<std::string>(
 			async, shared_from_this(), dbQuest, scheme, fieldIndexes, skeyResult);
+		fetchCallback->typedAnswer(requiredTypes);
+		fetchCallback->cacheRows(cacheRows);
+		fetchCallback->rowVersions(skeyVersions);
+		fetchCallback->admission(admission);
+		callback = fetchCallback;
 	}
 
-	if (_dbproxy->sendQuest(dbQuest, callback) == false)
+	if (_dbproxy->sendHedgedQuest(dbQuest, callback) == false)
 	{
-		if (_dbproxy->sendQuest(dbQuest, callback) == false)
+		if (_dbproxy->sendHedgedQuest(dbQuest, callback) == false)
 		{
 			delete callback;
 			FPAnswerPtr answer = ErrorInfo::queryDBProxyFailedAnswer(quest);
@@ -410,38 +1176,23 @@ FPAnswerPtr TableCacheProcessor::real_fetch_from_database(const FPQuestPtr quest
 
 FPAnswerPtr TableCacheProcessor::real_fetch_from_database(const FPQuestPtr quest,
 	const std::string& tableName, TABLEPtr scheme, std::vector<uint16_t>& fieldIndexes,
-	const std::set<std::string>& lackedHintStrings, std::map<std::string, std::vector<std::string>>& result)
+	const std::set<std::string>& lackedHintStrings, std::map<std::string, std::vector<std::string>>& result,
+	const std::vector<uint8_t>& requiredTypes, const std::string& selectString, bool cacheRows,
+	RowVersions<std::string>& rowVersions, AdmissionTicketPtr admission)
 {
-	std::string sql("select ");
-	sql.append(scheme->get_select_string()).append(" from ").append(tableName);
-	sql.append(" where ").append(scheme->get_key_name()).append(" in (");
-	int needComna = false;
-	//for (const std::string& hintString: lackedHintStrings)
-	for (int i = 0; i < (int)lackedHintStrings.size(); i++)
-	{
-		if (needComna)
-			sql.append(",");
-		else
-			needComna = true;
-
-		sql.append("'?'");
-	}
-	sql.append(")");
-
-	FPQWriter qw(4, "sQuery");
-	qw.param("hintIds", lackedHintStrings);
-	qw.param("sql", sql);
-	qw.param("tableName", tableName);
-	qw.param("params", lackedHintStrings);
-	FPQuestPtr dbQuest = qw.take();
+	FPQuestPtr dbQuest = selectQuest(tableName, scheme, selectString, lackedHintStrings);
 
 	std::shared_ptr<IAsyncAnswer> async = genAsyncAnswer(quest);
 	FetchRowCallback<std::string>* callback = new FetchRowCallback<std::string>(
 		async, shared_from_this(), dbQuest, scheme, fieldIndexes, result);
+	callback->typedAnswer(requiredTypes);
+	callback->cacheRows(cacheRows);
+	callback->rowVersions(rowVersions);
+	callback->admission(admission);
 
-	if (_dbproxy->sendQuest(dbQuest, callback) == false)
+	if (_dbproxy->sendHedgedQuest(dbQuest, callback) == false)
 	{
-		if (_dbproxy->sendQuest(dbQuest, callback) == false)
+		if (_dbproxy->sendHedgedQuest(dbQuest, callback) == false)
 		{
 			delete callback;
 			FPAnswerPtr answer = ErrorInfo::queryDBProxyFailedAnswer(quest);
@@ -451,71 +1202,225 @@ FPAnswerPtr TableCacheProcessor::real_fetch_from_database(const FPQuestPtr quest
 	return nullptr;
 }
 
+bool TableCacheProcessor::refreshRows(const std::string& tableName, const std::set<int64_t>& hintIds,
+	const std::set<std::string>& hintStrings)
+{
+	TABLEPtr scheme;
+	std::string selectString;
+	{
+		ProfiledRKeeper rlock(&_rwlocker, _lockProfiler, LockProfiler::RefreshAhead);
+		auto it = _tableInfo.find(tableName);
+		if (it == _tableInfo.end())
+			return false;		//-- Table invalidated.
+
+		scheme = it->second;
+		auto dit = _tableDescs.find(tableName);
+		if (dit != _tableDescs.end() && dit->second.hotSelectString.size())
+			selectString = dit->second.hotSelectString;
+		else
+			selectString = scheme->get_select_string();
+	}
+
+	FPQuestPtr dbQuest;
+	if (hintStrings.size())
+		dbQuest = selectQuest(tableName, scheme, selectString, hintStrings);
+	else
+		dbQuest = selectQuest(tableName, scheme, selectString, hintIds);
+
+	RefreshRowsCallback* callback = new RefreshRowsCallback(shared_from_this(), scheme);
+	if (_dbproxy->sendQuest(dbQuest, callback) == false)
+	{
+		delete callback;
+		return false;
+	}
+	return true;
+}
+
+std::vector<uint8_t> TableCacheProcessor::requiredColumnTypes(const std::string& tableName, const std::vector<uint16_t>& indexes)
+{
+	std::vector<uint8_t> requiredTypes;
+	auto it = _tableDescs.find(tableName);
+	if (it == _tableDescs.end())
+		return requiredTypes;
+
+	const std::vector<uint8_t>& columnTypes = it->second.columnTypes;
+	for (uint16_t index: indexes)
+		requiredTypes.push_back(index < columnTypes.size() ? columnTypes[index] : (uint8_t)CachedRow::StringColumn);
+
+	return requiredTypes;
+}
+
 FPAnswerPtr TableCacheProcessor::real_fetch(const FPQuestPtr quest, const std::string& tableName,
-	TABLEPtr scheme, const std::vector<std::string>& fields, const std::set<int64_t>& hintIds)
+	TABLEPtr scheme, const std::vector<std::string>& fields, const std::set<int64_t>& hintIds, RowVersions<int64_t>* rowVersions)
 {
+	RowVersions<int64_t> noVersions;
+	if (!rowVersions)
+		rowVersions = &noVersions;
+
 	FPQReader qr(quest);
 	bool jsonCompatible = qr.getBool("jsonCompatible", false);
+	bool typed = qr.getBool("typed", false);
 
 	std::set<int64_t> lackedIds;
 	std::map<int64_t, std::vector<std::string>> result;
 	std::vector<uint16_t> indexes = scheme->get_fields_index(fields);
+	std::vector<uint8_t> requiredTypes;
+	std::vector<std::pair<int64_t, CachedRowPtr>> hitRows;
+	std::shared_ptr<CompressionStatistics> compression;
+	std::string selectString;
+	bool cacheRows;
 	{
-		WKeeper wlock(&_rwlocker);
-
-		for (int64_t hintId: hintIds)
-		{
-			TableKey key;
-			key.hintId = hintId;
-			key.tableName = tableName;
-
-			CacheMap::node_type* node = _cachaMap->find(key);
-			if (node)
+		ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::RealFetch);
+		if (typed)
+			requiredTypes = requiredColumnTypes(tableName, indexes);
+		compression = tableCompression(tableName);
+		selectString = fetchSelectString(tableName, scheme, indexes, cacheRows);
+
+		//-- Cold fetches bypass the cache.
+		if (!cacheRows)
+			lackedIds = hintIds;
+		else
+			for (int64_t hintId: hintIds)
 			{
-				_cachaMap->fresh_node(node);
+				TableKey key;
+				key.hintId = hintId;
+				key.tableName = tableName;
 
-				ROWPtr row = node->data;
-				result[hintId] = row->get_data(indexes);
+				CacheMap::node_type* node = _cachaMap->find(key);
+				if (node)
+				{
+					_cachaMap->fresh_node(node);
+
+					hitRows.push_back(std::make_pair(hintId, node->data));
+				}
+				else if (CachedRowPtr row = fetchSharedRow(key))
+					hitRows.push_back(std::make_pair(hintId, row));
+				else
+					lackedIds.insert(hintId);
 			}
-			else
-				lackedIds.insert(hintId);
-		}
+	}
+
+	//-- Rows are immutable, projected (and decompressed) outside the lock.
+	for (auto& hitRow: hitRows)
+	{
+		if (_refreshAhead && hitRow.second->takeRefreshed())
+			_refreshAhead->hit();
+
+		//-- Unchanged rows are neither decoded nor sent.
+		if (!rowVersions->unchangedRow(hitRow.first, hitRow.second->version()))
+			result[hitRow.first] = hitRow.second->get_data(indexes, compression.get());
 	}
 
 	_statistics.fetchCount++;
 	_statistics.itemFetchCount.fetch_add((uint64_t)hintIds.size());
 	_statistics.itemHitCount.fetch_add((uint64_t)(hintIds.size() - lackedIds.size()));
 
+	{
+		std::vector<std::string> sampledKeys, sampledMissedKeys;
+		for (int64_t hintId: hintIds)
+			if (_hotKeyTracker->sampled())
+			{
+				sampledKeys.push_back(std::to_string(hintId));
+				if (lackedIds.find(hintId) != lackedIds.end())
+					sampledMissedKeys.push_back(sampledKeys.back());
+			}
+
+		if (sampledKeys.size())
+			_hotKeyTracker->record(tableName, sampledKeys, sampledMissedKeys);
+	}
+
+	if (!cacheRows)
+	{
+		_statistics.coldFetchCount++;
+		_statistics.coldItemFetchCount.fetch_add((uint64_t)hintIds.size());
+	}
+	else if (_missRatioEstimator)
+		_missRatioEstimator->access(tableName, hintIds);
+
+	if (_refreshAhead)
+		_refreshAhead->access(tableName, hintIds);
+
+	//-- Over the admission limit: rejected, or answered with the cached rows & the unloaded keys.
+	AdmissionTicketPtr admission;
+	std::set<int64_t> unloadedIds;
+	if (lackedIds.size() && !(admission = _admission->acquire(tableName, AdmissionController::Fetch)))
+	{
+		if (!_admission->hitsOnly())
+			return ErrorInfo::serverBusyAnswer(quest, "Too many outstanding DBProxy requests.");
+
+		_admission->unloaded(lackedIds.size());
+		unloadedIds.swap(lackedIds);
+	}
+
 	if (lackedIds.empty())
 	{
-		_statistics.fullHitCount++;
+		if (unloadedIds.empty())
+			_statistics.fullHitCount++;
+		else if (hitRows.size())
+			_statistics.partHitCount++;
+		_statistics.unchangedItemCount.fetch_add((uint64_t)rowVersions->unchanged.size());
 
-		FPAWriter aw(1, quest);
+		FPAWriter aw(1 + rowVersions->paramCount() + (unloadedIds.size() ? 1 : 0), quest);
 		if (!jsonCompatible)
-			aw.param("data", result);
+		{
+			if (typed)
+				writeTypedRows(aw, "data", result, requiredTypes);
+			else
+				aw.param("data", result);
+
+			rowVersions->write(aw);
+			if (unloadedIds.size())
+				aw.param("unloaded", unloadedIds);
+		}
 		else
 		{
 			std::map<std::string, std::vector<std::string>> skeyResult;
 			for (auto& resultPair: result)
 				skeyResult[std::to_string(resultPair.first)] = resultPair.second;
 
-			aw.param("data", skeyResult);
+			if (typed)
+				writeTypedRows(aw, "data", skeyResult, requiredTypes);
+			else
+				aw.param("data", skeyResult);
+
+			RowVersions<std::string> skeyVersions;
+			stringKeyVersions(*rowVersions, skeyVersions);
+			skeyVersions.write(aw);
+
+			if (unloadedIds.size())
+			{
+				std::vector<std::string> unloadedKeys;
+				for (int64_t hintId: unloadedIds)
+					unloadedKeys.push_back(std::to_string(hintId));
+				aw.param("unloaded", unloadedKeys);
+			}
 		}
 		return aw.take();
 	}
 
-	if (result.size())
+	if (hitRows.size())
 		_statistics.partHitCount++;
 
-	return real_fetch_from_database(quest, tableName, scheme, indexes, lackedIds, result, jsonCompatible);
+	return real_fetch_from_database(quest, tableName, scheme, indexes, lackedIds, result, jsonCompatible,
+		requiredTypes, selectString, cacheRows, *rowVersions, admission);
 }
 
 FPAnswerPtr TableCacheProcessor::real_fetch(const FPQuestPtr quest, const std::string& tableName,
-	TABLEPtr scheme, const std::vector<std::string>& fields, const std::set<std::string>& hintStrings)
+	TABLEPtr scheme, const std::vector<std::string>& fields, const std::set<std::string>& hintStrings, RowVersions<std::string>* rowVersions)
 {
+	RowVersions<std::string> noVersions;
+	if (!rowVersions)
+		rowVersions = &noVersions;
+
+	FPQReader qr(quest);
+	bool typed = qr.getBool("typed", false);
+
 	std::set<std::string> lackedIds;
 	std::map<std::string, std::vector<std::string>> result;
 	std::vector<uint16_t> indexes = scheme->get_fields_index(fields);
+	std::vector<uint8_t> requiredTypes;
+	std::vector<std::pair<size_t, CachedRowPtr>> hitRows;
+	std::shared_ptr<CompressionStatistics> compression;
 
 	std::vector<int64_t> hintIds;
 	std::vector<std::string> hintStrs;
@@ -525,54 +1430,125 @@ FPAnswerPtr TableCacheProcessor::real_fetch(const FPQuestPtr quest, const std::s
 
 	for (auto& hintString: hintStrings)
 	{
-		int64_t hintId = (int64_t)jenkins_hash(hintString.c_str(), hintString.length(), 0);
-		hintIds.push_back(hintId);
+		hintIds.push_back(stringHintId(hintString));
 		hintStrs.push_back(hintString);
 	}
 
+	std::string selectString;
+	bool cacheRows;
 	{
-		WKeeper wlock(&_rwlocker);
-
-		for (size_t i = 0; i < hintIds.size(); i++)
-		{
-			TableKey key;
-			key.hintId = hintIds[i];
-			key.tableName = tableName;
-
-			CacheMap::node_type* node = _cachaMap->find(key);
-			if (node)
+		ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::RealFetch);
+		if (typed)
+			requiredTypes = requiredColumnTypes(tableName, indexes);
+		compression = tableCompression(tableName);
+		selectString = fetchSelectString(tableName, scheme, indexes, cacheRows);
+
+		//-- Cold fetches bypass the cache.
+		if (!cacheRows)
+			lackedIds = hintStrings;
+		else
+			for (size_t i = 0; i < hintIds.size(); i++)
 			{
-				_cachaMap->fresh_node(node);
+				TableKey key;
+				key.hintId = hintIds[i];
+				key.tableName = tableName;
+				key.hintString = hintStrs[i];
 
-				ROWPtr row = node->data;
-				result[hintStrs[i]] = row->get_data(indexes);
+				CacheMap::node_type* node = _cachaMap->find(key);
+				if (node)
+				{
+					_cachaMap->fresh_node(node);
+
+					hitRows.push_back(std::make_pair(i, node->data));
+				}
+				else if (CachedRowPtr row = fetchSharedRow(key))
+					hitRows.push_back(std::make_pair(i, row));
+				else
+					lackedIds.insert(hintStrs[i]);
 			}
-			else
-				lackedIds.insert(hintStrs[i]);
-		}
+	}
+
+	for (auto& hitRow: hitRows)
+	{
+		if (_refreshAhead && hitRow.second->takeRefreshed())
+			_refreshAhead->hit();
+
+		if (!rowVersions->unchangedRow(hintStrs[hitRow.first], hitRow.second->version()))
+			result[hintStrs[hitRow.first]] = hitRow.second->get_data(indexes, compression.get());
 	}
 
 	_statistics.fetchCount++;
 	_statistics.itemFetchCount.fetch_add((uint64_t)hintStrings.size());
 	_statistics.itemHitCount.fetch_add((uint64_t)(hintStrings.size() - lackedIds.size()));
 
-	if (lackedIds.empty())
 	{
-		FPAWriter aw(1, quest);
-		aw.param("data", result);
+		std::vector<std::string> sampledKeys, sampledMissedKeys;
+		for (auto& hintString: hintStrings)
+			if (_hotKeyTracker->sampled())
+			{
+				sampledKeys.push_back(hintString);
+				if (lackedIds.find(hintString) != lackedIds.end())
+					sampledMissedKeys.push_back(hintString);
+			}
 
-		_statistics.fullHitCount++;
+		if (sampledKeys.size())
+			_hotKeyTracker->record(tableName, sampledKeys, sampledMissedKeys);
+	}
+
+	if (!cacheRows)
+	{
+		_statistics.coldFetchCount++;
+		_statistics.coldItemFetchCount.fetch_add((uint64_t)hintStrings.size());
+	}
+	else if (_missRatioEstimator)
+		_missRatioEstimator->access(tableName, hintIds);
+
+	if (_refreshAhead)
+		_refreshAhead->access(tableName, hintIds);
+
+	AdmissionTicketPtr admission;
+	std::set<std::string> unloadedIds;
+	if (lackedIds.size() && !(admission = _admission->acquire(tableName, AdmissionController::Fetch)))
+	{
+		if (!_admission->hitsOnly())
+			return ErrorInfo::serverBusyAnswer(quest, "Too many outstanding DBProxy requests.");
+
+		_admission->unloaded(lackedIds.size());
+		unloadedIds.swap(lackedIds);
+	}
+
+	if (lackedIds.empty())
+	{
+		FPAWriter aw(1 + rowVersions->paramCount() + (unloadedIds.size() ? 1 : 0), quest);
+		if (typed)
+			writeTypedRows(aw, "data", result, requiredTypes);
+		else
+			aw.param("data", result);
+		rowVersions->write(aw);
+		if (unloadedIds.size())
+			aw.param("unloaded", unloadedIds);
+
+		if (unloadedIds.empty())
+			_statistics.fullHitCount++;
+		else if (hitRows.size())
+			_statistics.partHitCount++;
+		_statistics.unchangedItemCount.fetch_add((uint64_t)rowVersions->unchanged.size());
 		return aw.take();
 	}
 
-	if (result.size())
+	if (hitRows.size())
 		_statistics.partHitCount++;
 
-	return real_fetch_from_database(quest, tableName, scheme, indexes, lackedIds, result);
+	return real_fetch_from_database(quest, tableName, scheme, indexes, lackedIds, result, requiredTypes,
+		selectString, cacheRows, *rowVersions, admission);
 }
 
 FPAnswerPtr TableCacheProcessor::deleteData(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
 {
+	AllocationKeeper allocationKeeper(_lockProfiler, LockProfiler::DeleteRequest);
+	if (!_admission->allowClient(ci.ip))
+		return ErrorInfo::serverBusyAnswer(quest, "Client request rate limited.");
+
 	std::string tableName = args->wantString("table");
 	TABLEPtr scheme = getTableScheme(tableName);
 	if (!scheme)
@@ -603,7 +1579,7 @@ FPAnswerPtr TableCacheProcessor::deleteData(const FPReaderPtr args, const FPQues
 	else
 	{
 		hintString = args->wantString("hintId");
-		hintId = (int64_t)jenkins_hash(hintString.c_str(), hintString.length(), 0);
+		hintId = stringHintId(hintString);
 
 		delete_sql.append("'?'");
 
@@ -615,20 +1591,47 @@ FPAnswerPtr TableCacheProcessor::deleteData(const FPReaderPtr args, const FPQues
 		dbQuest = qw.take();
 	}
 
-	std::shared_ptr<IAsyncAnswer> async = genAsyncAnswer(quest);
-	WriteCallback* callback = new WriteCallback(async, _dbproxy, dbQuest);
-	callback->cleanCacheAfterGotResponse(hintId, tableName, shared_from_this());
+	if (_trafficRecorder.sampled())
+	{
+		TrafficRecord record;
+		record.kind = TrafficRecord::Delete;
+		record.tableName = tableName;
+		record.stringKey = strKey;
+		if (strKey)
+			record.hintStrings.push_back(hintString);
+		else
+			record.hintIds.push_back(hintId);
 
-	if (_dbproxy->sendQuest(dbQuest, callback) == false)
+		_trafficRecorder.record(record);
+	}
+
+	AdmissionTicketPtr admission;
+	if (!(admission = _admission->acquire(tableName, AdmissionController::Write)))
+		return ErrorInfo::serverBusyAnswer(quest, "Too many outstanding DBProxy requests.");
+
+	std::shared_ptr<IAsyncAnswer> async = genAsyncAnswer(quest);
+	TableCacheProcessorPtr self = shared_from_this();
+	std::function<void ()> sendDelete = [self, quest, async, dbQuest, tableName, hintId, admission]()
 	{
-		if (_dbproxy->sendQuest(dbQuest, callback) == false)
+		WriteCallback* callback = new WriteCallback(async, self->_dbproxy, dbQuest, "delete");
+		callback->cleanCacheAfterGotResponse(hintId, tableName, self);
+		callback->admission(admission);
+
+		if (self->_dbproxy->sendQuest(dbQuest, callback) == false)
 		{
-			delete callback;
-			FPAnswerPtr answer = ErrorInfo::queryDBProxyFailedAnswer(quest);
-			async->sendAnswer(answer);
+			if (self->_dbproxy->sendQuest(dbQuest, callback) == false)
+			{
+				delete callback;
+				self->unfenceWriteBehind(tableName, hintId);
+				FPAnswerPtr answer = ErrorInfo::queryDBProxyFailedAnswer(quest);
+				async->sendAnswer(answer);
+			}
 		}
-	}
+	};
 
+	//-- Queued modifies of the row are discarded, and not written after the delete.
+	//-- Sent at once, or after the running write of the row.
+	fenceWriteBehind(tableName, hintId, sendDelete);
 	return nullptr;
 }
 
@@ -638,20 +1641,37 @@ FPAnswerPtr TableCacheProcessor::invalidateTable(const FPReaderPtr args, const F
 	if (!args->getBool("internal", false))
 		_clusterNotifier->invalidateTable(tableName);
 
+	if (_trafficRecorder.sampled())
 	{
-		WKeeper wlock(&_rwlocker);
-		_tableInfo.erase(tableName);
-
-		std::set<CacheMap::node_type *> nodes;
-		nodes.swap(_tableDataIndexes[tableName]);
-		_tableDataIndexes.erase(tableName);
-
-		for (auto node: nodes)
-			_cachaMap->remove_node(node);
+		TrafficRecord record;
+		record.kind = TrafficRecord::InvalidateTable;
+		record.tableName = tableName;
+		_trafficRecorder.record(record);
 	}
+
+	invalidateWholeTable(tableName);
 	return FPAWriter::emptyAnswer(quest);
 }
 
+void TableCacheProcessor::dropTable(const std::string& tableName, bool journaled)
+{
+	ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::InvalidateTable);
+	if (journaled && _invalidationJournal)
+		_invalidationJournal->invalidateTable(tableName);		//-- Timed under the lock, as cleanCache().
+
+	_tableInfo.erase(tableName);
+	_tableDescs.erase(tableName);
+	if (_shmStore)
+		_shmStore->invalidateTable(tableName);
+
+	std::set<CacheMap::node_type *> nodes;
+	nodes.swap(_tableDataIndexes[tableName]);
+	_tableDataIndexes.erase(tableName);
+
+	for (auto node: nodes)
+		_cachaMap->remove_node(node);
+}
+
 FPAnswerPtr TableCacheProcessor::refreshCluster(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
 {
 	_clusterNotifier->refreshCluster();
@@ -661,34 +1681,277 @@ FPAnswerPtr TableCacheProcessor::refreshCluster(const FPReaderPtr args, const FP
 FPAnswerPtr TableCacheProcessor::invalidate(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
 {
 	std::string tableName = args->wantString("table");
-	std::set<int64_t> hintIds = args->want("hintIds", std::set<int64_t>());
+	std::set<int64_t> hintIds = args->get("hintIds", std::set<int64_t>());
+	std::set<std::string> hintStrings = args->get("hintStrings", std::set<std::string>());
+	for (auto& hintString: hintStrings)
+		hintIds.insert(stringHintId(hintString));
+
+	if (_trafficRecorder.sampled())
 	{
-		WKeeper wlock(&_rwlocker);
-		auto it = _tableDataIndexes.find(tableName);
-		if (it != _tableDataIndexes.end())
-		{
+		TrafficRecord record;
+		record.kind = TrafficRecord::Invalidate;
+		record.tableName = tableName;
+		record.hintIds.assign(hintIds.begin(), hintIds.end());
+		_trafficRecorder.record(record);
+	}
+
+	invalidateRows(tableName, hintIds);
+	return FPAWriter::emptyAnswer(quest);
+}
+
+void TableCacheProcessor::invalidateRows(const std::string& tableName, const std::set<int64_t>& hintIds)
+{
+	if (_missRatioEstimator)
+		for (int64_t hintId: hintIds)
+			_missRatioEstimator->invalidate(tableName, hintId);
+
+	{
+		ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::Invalidate);
+		for (int64_t hintId: hintIds)
+			removeCachedRow(tableName, hintId);
+
+		if (_invalidationJournal)
 			for (int64_t hintId: hintIds)
-			{
-				TableKey key;
-				key.hintId = hintId;
-				key.tableName = tableName;
+				_invalidationJournal->invalidate(tableName, hintId);
+	}
 
-				CacheMap::node_type* node = _cachaMap->find(key);
-				if (node)
-				{
-					it->second.erase(node);
-					if (it->second.empty())
-						_tableDataIndexes.erase(it);
+	if (_invalidationPublisher)
+		_invalidationPublisher->invalidate(tableName, hintIds);
+}
 
-					_cachaMap->remove_node(node);
-				}
-			}
-		}
+void TableCacheProcessor::invalidateWholeTable(const std::string& tableName)
+{
+	dropTable(tableName, true);
+	if (_invalidationPublisher)
+		_invalidationPublisher->invalidateTable(tableName);
+}
+
+enum ChangeFeedKeyType
+{
+	ChangeFeedUnknownTable,
+	ChangeFeedIntegerKey,
+	ChangeFeedStringKey,
+	ChangeFeedUnregisteredIntegerKey,		//-- nothing cached here, other nodes are notified only.
+	ChangeFeedUnregisteredStringKey,
+};
+
+static const size_t changeFeedMaxKeyTypes = 10000;
+static const int64_t changeFeedDescRetryUsec = 1000 * 1000;
+
+//-- Never registers a table: tables not served here have nothing cached.
+int TableCacheProcessor::changeFeedKeyType(const std::string& tableName)
+{
+	{
+		ProfiledRKeeper rlock(&_rwlocker, _lockProfiler, LockProfiler::TableScheme);
+		auto it = _tableInfo.find(tableName);
+		if (it != _tableInfo.end())
+			return it->second->isStringField(it->second->get_key_name()) ? ChangeFeedStringKey : ChangeFeedIntegerKey;
+	}
+
+	if (!_changeFeedNotifyCluster)
+		return ChangeFeedUnknownTable;
+
+	//-- Key type for the cluster notification. Only loaded schemes are kept.
+	auto it = _changeFeedKeyTypes.find(tableName);
+	if (it != _changeFeedKeyTypes.end())
+		return it->second;
+
+	//-- A failed desc may be a DBProxy timeout, or a table created later: retried after a short while.
+	int64_t now = latencyNowUsec();
+	auto rit = _changeFeedDescRetryUsec.find(tableName);
+	if (rit != _changeFeedDescRetryUsec.end() && now < rit->second)
+		return ChangeFeedUnknownTable;
+
+	TableDescription desc;
+	TABLEPtr scheme = loadTableInfo(tableName, desc);
+	if (!scheme)
+	{
+		if (_changeFeedDescRetryUsec.size() >= changeFeedMaxKeyTypes)
+			_changeFeedDescRetryUsec.clear();
+
+		LOG_WARN("Change feed: load scheme of table %s failed. Its changes are not notified to the cluster until it is loaded.",
+			tableName.c_str());
+		_changeFeedDescRetryUsec[tableName] = now + changeFeedDescRetryUsec;
+		return ChangeFeedUnknownTable;
 	}
 
+	if (rit != _changeFeedDescRetryUsec.end())
+		_changeFeedDescRetryUsec.erase(rit);
+
+	if (_changeFeedKeyTypes.size() >= changeFeedMaxKeyTypes)
+		_changeFeedKeyTypes.clear();
+
+	int keyType = scheme->isStringField(scheme->get_key_name()) ? ChangeFeedUnregisteredStringKey : ChangeFeedUnregisteredIntegerKey;
+	_changeFeedKeyTypes[tableName] = keyType;
+	return keyType;
+}
+
+//-- Changes made by writers bypassing TableCache. Key type follows the table scheme.
+void TableCacheProcessor::applyChanges(const std::vector<ChangeEvent>& events)
+{
+	std::set<std::string> wholeTables;
+	std::map<std::string, std::set<int64_t>> tableHintIds;
+	std::map<std::string, int> keyTypes;
+
+	for (auto& event: events)
+		if (event.key == "*")
+			wholeTables.insert(event.tableName);
+
+	for (auto& event: events)
+	{
+		if (wholeTables.find(event.tableName) != wholeTables.end())
+			continue;
+
+		auto it = keyTypes.find(event.tableName);
+		if (it == keyTypes.end())
+			it = keyTypes.insert(std::make_pair(event.tableName, changeFeedKeyType(event.tableName))).first;
+
+		if (it->second == ChangeFeedUnknownTable)
+			continue;
+
+		if (it->second == ChangeFeedStringKey || it->second == ChangeFeedUnregisteredStringKey)
+			tableHintIds[event.tableName].insert(stringHintId(event.key));
+		else
+			tableHintIds[event.tableName].insert(atoll(event.key.c_str()));
+	}
+
+	for (auto& tableName: wholeTables)
+	{
+		if (_changeFeedNotifyCluster)
+			_clusterNotifier->invalidateTable(tableName);
+
+		invalidateWholeTable(tableName);
+	}
+
+	for (auto& tablePair: tableHintIds)
+	{
+		if (_changeFeedNotifyCluster)
+			for (int64_t hintId: tablePair.second)
+				_clusterNotifier->invalidate(tablePair.first, hintId);
+
+		int keyType = keyTypes[tablePair.first];
+		if (keyType == ChangeFeedIntegerKey || keyType == ChangeFeedStringKey)
+			invalidateRows(tablePair.first, tablePair.second);
+	}
+}
+
+FPAnswerPtr TableCacheProcessor::readSubscription(const FPReaderPtr args, const FPQuestPtr quest, std::set<std::string>& tables,
+	InvalidationPublisher::KeyMap& keys)
+{
+	tables = args->get("tables", std::set<std::string>());
+	std::map<std::string, std::set<int64_t>> hintIds = args->get("hintIds", std::map<std::string, std::set<int64_t>>());
+	std::map<std::string, std::set<std::string>> hintStrings = args->get("hintStrings", std::map<std::string, std::set<std::string>>());
+
+	for (auto& tableName: tables)
+	{
+		TABLEPtr scheme = getTableScheme(tableName);
+		if (!scheme)
+			return ErrorInfo::tableNotFoundAnswer(quest);
+
+		if (scheme->isStringField(scheme->get_key_name()))
+			return ErrorInfo::disabledAnswer(quest, "Tables with string hintId can only be subscribed by hintStrings.");
+	}
+
+	for (auto& tablePair: hintIds)
+	{
+		TABLEPtr scheme = getTableScheme(tablePair.first);
+		if (!scheme)
+			return ErrorInfo::tableNotFoundAnswer(quest);
+
+		if (scheme->isStringField(scheme->get_key_name()))
+			return ErrorInfo::disabledAnswer(quest, "Tables with string hintId can only be subscribed by hintStrings.");
+
+		auto& tableKeys = keys[tablePair.first];
+		for (int64_t hintId: tablePair.second)
+			tableKeys[hintId] = std::string();
+	}
+
+	for (auto& tablePair: hintStrings)
+	{
+		TABLEPtr scheme = getTableScheme(tablePair.first);
+		if (!scheme)
+			return ErrorInfo::tableNotFoundAnswer(quest);
+
+		if (!scheme->isStringField(scheme->get_key_name()))
+			return ErrorInfo::disabledAnswer(quest, "Tables with integer hintId can only be subscribed by hintIds.");
+
+		auto& tableKeys = keys[tablePair.first];
+		for (auto& hintString: tablePair.second)
+			tableKeys[stringHintId(hintString)] = hintString;
+	}
+
+	return nullptr;
+}
+
+FPAnswerPtr TableCacheProcessor::subscribe(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+{
+	if (!_invalidationPublisher)
+		return ErrorInfo::disabledAnswer(quest, "Subscription is disabled.");
+
+	std::set<std::string> tables;
+	InvalidationPublisher::KeyMap keys;
+	FPAnswerPtr errorAnswer = readSubscription(args, quest, tables, keys);
+	if (errorAnswer)
+		return errorAnswer;
+
+	std::string reason;
+	int leaseSeconds = _invalidationPublisher->subscribe(ci, genQuestSender(ci), tables, keys,
+		(int)args->getInt("leaseSeconds", 0), reason);
+	if (leaseSeconds == 0)
+		return ErrorInfo::disabledAnswer(quest, reason.c_str());
+
+	FPAWriter aw(1, quest);
+	aw.param("leaseSeconds", leaseSeconds);
+	return aw.take();
+}
+
+FPAnswerPtr TableCacheProcessor::unsubscribe(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+{
+	if (!_invalidationPublisher)
+		return ErrorInfo::disabledAnswer(quest, "Subscription is disabled.");
+
+	std::set<std::string> tables;
+	InvalidationPublisher::KeyMap keys;
+	FPAnswerPtr errorAnswer = readSubscription(args, quest, tables, keys);
+	if (errorAnswer)
+		return errorAnswer;
+
+	_invalidationPublisher->unsubscribe(ci, tables, keys);
 	return FPAWriter::emptyAnswer(quest);
 }
 
+void TableCacheProcessor::connectionWillClose(const ConnectionInfo& connInfo, bool closeByError)
+{
+	if (_invalidationPublisher)
+		_invalidationPublisher->connectionClosed(connInfo);
+}
+
+FPAnswerPtr TableCacheProcessor::hotKeys(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+{
+	std::string tableName = args->getString("table");
+	int top = (int)args->getInt("top", 10);
+	if (top <= 0)
+		top = 10;
+
+	std::map<std::string, HotKeyTracker::TopKeys> topKeys;
+	_hotKeyTracker->top(tableName, (size_t)top, topKeys);
+
+	std::map<std::string, std::map<std::string, std::map<std::string, uint64_t>>> tables;
+	for (auto& tablePair: topKeys)
+	{
+		auto& table = tables[tablePair.first];
+		for (auto& keyPair: tablePair.second.hot)
+			table["hot"][keyPair.first] = keyPair.second;
+		for (auto& keyPair: tablePair.second.missing)
+			table["missing"][keyPair.first] = keyPair.second;
+	}
+
+	FPAWriter aw(2, quest);
+	aw.param("sampleRate", _hotKeyTracker->sampleRate());
+	aw.param("tables", tables);
+	return aw.take();
+}
+
 std::string TableCacheProcessor::infos()
 {
 	std::string infos("{\"fetchStatus\":{");
@@ -697,21 +1960,37 @@ std::string TableCacheProcessor::infos()
 	infos.append(",\"fullHitCount\":").append(std::to_string(_statistics.fullHitCount));
 	infos.append(",\"itemFetchCount\":").append(std::to_string(_statistics.itemFetchCount));
 	infos.append(",\"itemHitCount\":").append(std::to_string(_statistics.itemHitCount));
+	infos.append(",\"coldFetchCount\":").append(std::to_string(_statistics.coldFetchCount));
+	infos.append(",\"coldItemFetchCount\":").append(std::to_string(_statistics.coldItemFetchCount));
+	infos.append(",\"streamFetchCount\":").append(std::to_string(_statistics.streamFetchCount));
+	infos.append(",\"streamChunkCount\":").append(std::to_string(_statistics.streamChunkCount));
+	infos.append(",\"conditionalFetchCount\":").append(std::to_string(_statistics.conditionalFetchCount));
+	infos.append(",\"unchangedItemCount\":").append(std::to_string(_statistics.unchangedItemCount));
 
 	infos.append("},\"cacheStatus\":{");
 
 	int64_t globalItemCount = 0;
 	std::map<std::string, int64_t> tableItemCount;
+	std::string shmInfos;
+	std::map<std::string, std::string> compressionInfos;
+	std::string cacheMapStatus;
 
 	{
-		RKeeper rlock(&_rwlocker);
+		ProfiledRKeeper rlock(&_rwlocker, _lockProfiler, LockProfiler::Infos);
 		globalItemCount = (int64_t)_cachaMap->count();
+		cacheMapStatus = cacheMapInfos();
+		if (_shmStore)
+			shmInfos = _shmStore->infos();
+
+		for (const auto& compressionPair: _compressionStatistics)
+			compressionInfos[compressionPair.first] = compressionPair.second->infos();
 
 		for (const auto& tablePair: _tableDataIndexes)
 			tableItemCount[tablePair.first] = (int64_t)tablePair.second.size();
 	}
 
 	infos.append("\"totalCachedItems\":").append(std::to_string(globalItemCount));
+	infos.append(",\"hashTable\":").append(cacheMapStatus);
 	infos.append(",\"cachedTableItems\":{");
 
 	bool needComma = false;
@@ -725,6 +2004,133 @@ std::string TableCacheProcessor::infos()
 		infos.append("\"").append(stPair.first).append("\":").append(std::to_string(stPair.second));
 	}
 
-	infos.append("}}}");
+	infos.append("}},\"snapshotStatus\":{");
+	infos.append("\"dumping\":").append(_snapshotStatistics.dumping ? "true" : "false");
+	infos.append(",\"dumpCount\":").append(std::to_string(_snapshotStatistics.dumpCount));
+	infos.append(",\"failedCount\":").append(std::to_string(_snapshotStatistics.failedCount));
+	infos.append(",\"lastDumpTime\":").append(std::to_string(_snapshotStatistics.lastDumpMsec));
+	infos.append(",\"lastDumpRows\":").append(std::to_string(_snapshotStatistics.lastDumpRows));
+	infos.append(",\"lastDumpCost\":").append(std::to_string(_snapshotStatistics.lastDumpCost));
+	infos.append(",\"loadedRows\":").append(std::to_string(_snapshotStatistics.loadedRows));
+	infos.append(",\"loadCost\":").append(std::to_string(_snapshotStatistics.loadCost));
+
+	infos.append("}");
+	infos.append(",\"hotKeys\":").append(_hotKeyTracker->infos(10));
+	infos.append(",\"latency\":").append(LatencyRecorder::instance().infos());
+	infos.append(",\"lockProfile\":").append(_lockProfiler.infos());
+	infos.append(",\"captureStatus\":").append(_trafficRecorder.infos());
+	if (shmInfos.size())
+		infos.append(",\"shmStatus\":").append(shmInfos);
+	if (_missRatioEstimator)
+		infos.append(",\"missRatioCurve\":").append(_missRatioEstimator->infos());
+	if (_refreshAhead)
+		infos.append(",\"refreshAhead\":").append(_refreshAhead->infos());
+	if (_invalidationPublisher)
+		infos.append(",\"subscriptions\":").append(_invalidationPublisher->infos());
+	if (_changeFeed)
+		infos.append(",\"changeFeed\":").append(_changeFeed->infos());
+	infos.append(",\"dbproxy\":").append(_dbproxy->infos());
+	if (_writeBehind)
+		infos.append(",\"writeBehind\":").append(_writeBehind->infos());
+	infos.append(",\"admission\":").append(_admission->infos());
+
+	std::string preloadStatus = preloadInfos();
+	if (preloadStatus.size())
+		infos.append(",\"preloadStatus\":").append(preloadStatus);
+
+	if (compressionInfos.size())
+	{
+		infos.append(",\"compressionStatus\":{");
+		needComma = false;
+		for (auto& compressionPair: compressionInfos)
+		{
+			if (needComma)
+				infos.append(",");
+			else
+				needComma = true;
+
+			infos.append("\"").append(compressionPair.first).append("\":").append(compressionPair.second);
+		}
+		infos.append("}");
+	}
+
+	infos.append("}");
 	return infos;
-}
\ No newline at end of file
+}
+
+void TableCacheProcessor::serverStopped()
+{
+	if (_shmStore)
+	{
+		WKeeper wlock(&_rwlocker);
+		_shmStore->detach();
+	}
+}
+
+void TableCacheProcessor::tune(const std::string& key, std::string& value)
+{
+	if (key == "TableCache.hotKeys.sampleRate")
+		_hotKeyTracker->setSampleRate((uint32_t)atoi(value.c_str()));
+	else if (key == "TableCache.latency.reset")
+		LatencyRecorder::instance().reset();
+	else if (key == "TableCache.profile.enable")
+		_lockProfiler.enable(value == "true" || value == "1");
+	else if (key == "TableCache.profile.reset")
+		_lockProfiler.reset();
+	else if (key == "TableCache.mrc.reset")
+	{
+		if (_missRatioEstimator)
+			_missRatioEstimator->reset();
+	}
+	else if (key == "TableCache.compression.tables" || key == "TableCache.compression.minBytes")
+	{
+		std::string tables;
+		uint32_t minBytes;
+		{
+			ProfiledRKeeper rlock(&_rwlocker, _lockProfiler, LockProfiler::TableScheme);
+			for (auto& table: _compressionTables)
+				tables.append(table).append(",");
+			minBytes = _compressionMinBytes;
+		}
+
+		if (key == "TableCache.compression.tables")
+			configureCompression(value, minBytes);
+		else
+			configureCompression(tables, (uint32_t)atoi(value.c_str()));
+	}
+	else if (key.compare(0, 22, "TableCache.hotColumns.") == 0 && key.length() > 22)
+	{
+		std::string tableName = key.substr(22);
+		{
+			ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::TableScheme);
+			_tunedHotColumns[tableName] = value;
+		}
+		dropTable(tableName);		//-- Cached rows lack the new hot columns. Reloaded on demand.
+	}
+	else if (key == "TableCache.refreshAhead.minFrequency")
+	{
+		if (_refreshAhead)
+			_refreshAhead->setMinFrequency((uint32_t)atoi(value.c_str()));
+	}
+	else if (key == "TableCache.refreshAhead.maxRowsPerSecond")
+	{
+		if (_refreshAhead)
+			_refreshAhead->setMaxRowsPerSecond((uint32_t)atoi(value.c_str()));
+	}
+	else if (key == "TableCache.admission.maxOutstanding")
+		_admission->setMaxOutstanding((int32_t)atoi(value.c_str()));
+	else if (key == "TableCache.admission.maxTableOutstanding")
+		_admission->setMaxTableOutstanding((int32_t)atoi(value.c_str()));
+	else if (key == "TableCache.admission.clientQPS")
+		_admission->setClientQPS(atof(value.c_str()));
+	else if (key == "TableCache.admission.clientBurst")
+		_admission->setClientBurst(atof(value.c_str()));
+	else if (key == "TableCache.preload.maxIdsPerSecond")
+		_preloadMaxIdsPerSecond = (uint32_t)atoi(value.c_str());
+	else if (key == "TableCache.capture.file")
+		startTrafficCapture(value);
+	else if (key == "TableCache.capture.sampleRate")
+		_trafficRecorder.setSampleRate((uint32_t)atoi(value.c_str()));
+	else if (key == "TableCache.capture.maxRecordsPerSecond")
+		_trafficRecorder.setMaxRecordsPerSecond((uint32_t)atoi(value.c_str()));
+}
@@ -1,33 +1,66 @@
 #ifndef Table_Cache_Processor_H
 #define Table_Cache_Processor_H
 
+#include <deque>
+#include <mutex>
 #include <atomic>
+#include <thread>
+#include <condition_variable>
 #include <unordered_map>
 #include "jenkins.h"
 #include "hashint.h"
 #include "TableRow.h"
-#include "LruHashMap.h"
+#include "CachedRow.h"
+#include "ResizableLruHashMap.h"
 #include "RWLocker.hpp"
 #include "IQuestProcessor.h"
 #include "ClusterNotifier.h"
+#include "CacheSnapshot.h"
+#include "ShmRowStore.h"
+#include "HotKeyTracker.h"
+#include "LockProfiler.h"
+#include "TrafficCapture.h"
+#include "CacheSimulator.h"
+#include "RefreshAhead.h"
+#include "InvalidationPublisher.h"
+#include "ChangeFeed.h"
+#include "WriteBehind.h"
+#include "DBProxyPool.h"
+#include "AdmissionControl.h"
 
 using namespace fpnn;
 
+//-- hintId of string keyed tables. Only used for hashing & invalidation, lookups also compare the string.
+inline int64_t stringHintId(const std::string& hintString)
+{
+	uint64_t high = jenkins_hash(hintString.data(), hintString.length(), 0);
+	uint64_t low = jenkins_hash(hintString.data(), hintString.length(), 0x9E3779B9);
+	return (int64_t)((high << 32) | low);
+}
+
 struct TableKey
 {
 	int64_t hintId;
 	std::string tableName;
+	std::string hintString;		//-- string keyed tables only. hintId is stringHintId(hintString).
 
+	/*
+		A key without hintString matches by hintId: invalidations (cluster notification, journal,
+		invalidate interface) only carry hintIds, and have to remove every row under the hintId.
+	*/
 	bool operator == (const struct TableKey& key)
 	{
-		return this->hintId == key.hintId && this->tableName == key.tableName;
+		return this->hintId == key.hintId && this->tableName == key.tableName
+			&& (this->hintString.empty() || key.hintString.empty() || this->hintString == key.hintString);
 	}
 
 	bool operator < (const struct TableKey& right) const
 	{
 		if(this->hintId != right.hintId) 
 			return this->hintId < right.hintId;
-		return this->tableName < right.tableName;
+		if (this->tableName != right.tableName)
+			return this->tableName < right.tableName;
+		return this->hintString < right.hintString;
 	}
 
 	unsigned int hash() const
@@ -38,8 +71,11 @@ struct TableKey
 };
 
 class WriteCallback;
+class RefreshRowsCallback;
 template<typename TYPE>
 class FetchRowCallback;
+template<typename TYPE>
+class FetchStream;
 
 struct FetchStatistics
 {
@@ -50,7 +86,62 @@ struct FetchStatistics
 	std::atomic<uint64_t> itemFetchCount;
 	std::atomic<uint64_t> itemHitCount;
 
-	FetchStatistics(): fetchCount(0), partHitCount(0), fullHitCount(0), itemFetchCount(0), itemHitCount(0) {}
+	std::atomic<uint64_t> coldFetchCount;		//-- fetches requiring non hot columns, served by DBProxy only.
+	std::atomic<uint64_t> coldItemFetchCount;
+
+	std::atomic<uint64_t> streamFetchCount;		//-- fetches answered in chunks.
+	std::atomic<uint64_t> streamChunkCount;		//-- fetchChunk pushes.
+
+	std::atomic<uint64_t> conditionalFetchCount;		//-- fetches with client row versions.
+	std::atomic<uint64_t> unchangedItemCount;		//-- rows not sent, the client has the same version.
+
+	FetchStatistics(): fetchCount(0), partHitCount(0), fullHitCount(0), itemFetchCount(0), itemHitCount(0),
+		coldFetchCount(0), coldItemFetchCount(0), streamFetchCount(0), streamChunkCount(0),
+		conditionalFetchCount(0), unchangedItemCount(0) {}
+};
+
+struct TableDescription
+{
+	std::string splitHint;
+	std::vector<std::vector<std::string>> columns;		//-- rows of "desc <table>"
+	std::vector<uint8_t> columnTypes;		//-- CachedRow::ColumnType of columns, set by registerTable().
+	std::vector<uint8_t> storageTypes;		//-- columnTypes, with CachedRow::UncachedColumn for non hot columns.
+	std::string hotSelectString;		//-- select list with '' for non hot columns. Empty if all columns are hot.
+	std::shared_ptr<CompressionStatistics> compression;		//-- null if compression was never enabled for the table.
+};
+
+struct SnapshotStatistics
+{
+	std::atomic<bool> dumping;
+	std::atomic<uint64_t> dumpCount;
+	std::atomic<uint64_t> failedCount;
+	std::atomic<int64_t> lastDumpMsec;
+	std::atomic<int64_t> lastDumpRows;
+	std::atomic<int64_t> lastDumpCost;
+	std::atomic<int64_t> loadedRows;
+	std::atomic<int64_t> loadCost;
+
+	SnapshotStatistics(): dumping(false), dumpCount(0), failedCount(0), lastDumpMsec(0),
+		lastDumpRows(0), lastDumpCost(0), loadedRows(0), loadCost(0) {}
+};
+
+struct PreloadTask
+{
+	std::string tableName;
+	int64_t fromId;
+	int64_t toId;		//-- inclusive. 0: until maxEmptyBatches empty batches in a row.
+	std::atomic<bool> cancelled;
+	std::atomic<int64_t> nextId;
+	std::atomic<int64_t> loadedRows;
+	std::atomic<int64_t> memoryBytes;		//-- estimated.
+
+	//-- guarded by _preloadMutex.
+	std::string state;		//-- waiting, running, finished, cancelled, failed, invalidated, memoryLimited.
+	int64_t startMsec;
+	int64_t finishMsec;
+
+	PreloadTask(const std::string& tableName_, int64_t fromId_, int64_t toId_): tableName(tableName_), fromId(fromId_),
+		toId(toId_), cancelled(false), nextId(fromId_), loadedRows(0), memoryBytes(0), state("waiting"), startMsec(0), finishMsec(0) {}
 };
 
 class TableCacheProcessor: virtual public IQuestProcessor, virtual public std::enable_shared_from_this<TableCacheProcessor>
@@ -58,43 +149,171 @@ class TableCacheProcessor: virtual public IQuestProcessor, virtual public std::e
 	QuestProcessorClassPrivateFields(TableCacheProcessor)
 
 	ClusterNotifierPtr _clusterNotifier;
-	TCPClientPtr _dbproxy;
+	DBProxyPoolPtr _dbproxy;
 
 	RWLocker _rwlocker;
 	std::unordered_map<std::string, TABLEPtr> _tableInfo;
+	std::unordered_map<std::string, TableDescription> _tableDescs;
 
-	typedef LruHashMap<TableKey, ROWPtr> CacheMap;
+	typedef ResizableLruHashMap<TableKey, CachedRowPtr> CacheMap;
 	typedef std::shared_ptr<CacheMap> CacheMapPtr;
 	CacheMapPtr _cachaMap;
 
 	std::unordered_map<std::string, std::set<CacheMap::node_type*>> _tableDataIndexes;
+	std::shared_ptr<ShmRowStore> _shmStore;		//-- optional. Guarded by _rwlocker.
+
+	//-- row compression. Guarded by _rwlocker.
+	std::set<std::string> _compressionTables;		//-- "*" means all tables.
+	uint32_t _compressionMinBytes;
+	std::unordered_map<std::string, std::shared_ptr<CompressionStatistics>> _compressionStatistics;
+
+	//-- hot columns set by tune, override TableCache.hotColumns.<table>. Guarded by _rwlocker.
+	std::unordered_map<std::string, std::string> _tunedHotColumns;
 
 	FetchStatistics _statistics;
+	std::shared_ptr<HotKeyTracker> _hotKeyTracker;
+	std::shared_ptr<MissRatioEstimator> _missRatioEstimator;		//-- optional.
+	std::shared_ptr<RefreshAheadScheduler> _refreshAhead;		//-- optional.
+	std::shared_ptr<InvalidationPublisher> _invalidationPublisher;		//-- optional.
+	std::shared_ptr<ChangeFeedConsumer> _changeFeed;		//-- optional.
+	bool _changeFeedNotifyCluster;
+	std::unordered_map<std::string, int> _changeFeedKeyTypes;		//-- ChangeFeedKeyType of tables not registered here. Change feed thread only.
+	std::unordered_map<std::string, int64_t> _changeFeedDescRetryUsec;		//-- tables whose desc failed, and when to retry. Change feed thread only.
+	std::shared_ptr<WriteBehindQueue> _writeBehind;		//-- optional.
+	int _writeBehindShutdownFlushSeconds;
+	std::shared_ptr<AdmissionController> _admission;		//-- always created, limits of 0 are unlimited.
+	LockProfiler _lockProfiler;
+	TrafficRecorder _trafficRecorder;
+
+	//-- snapshot
+	std::string _snapshotFile;
+	int _snapshotInterval;
+	bool _snapshotAtShutdown;
+	std::shared_ptr<InvalidationJournal> _invalidationJournal;
+	SnapshotStatistics _snapshotStatistics;
+	std::atomic<bool> _running;
+	std::thread _snapshotThread;
+
+	//-- preload
+	std::mutex _preloadMutex;
+	std::condition_variable _preloadCondition;
+	std::deque<std::shared_ptr<PreloadTask>> _preloadQueue;
+	std::map<std::string, std::shared_ptr<PreloadTask>> _preloadTasks;		//-- latest task of each table.
+	std::thread _preloadThread;
+	int _preloadBatchSize;
+	int _preloadMaxEmptyBatches;
+	int64_t _preloadMaxMemory;
+	std::atomic<uint32_t> _preloadMaxIdsPerSecond;
+
+	//-- cache map resizing
+	std::mutex _rehashMutex;
+	std::condition_variable _rehashCondition;
+	std::atomic<bool> _rehashPending;		//-- changed under the write lock only.
+	std::thread _rehashThread;
+
+	//-- streaming fetch
+	uint32_t _streamChunkRows;
+	uint32_t _streamMaxInflightBatches;
+	std::atomic<int64_t> _nextStreamId;
 
 	void configure();
+	void configureRefreshAhead(int64_t hashSize);
+	void configureSubscription();
+	void configureChangeFeed();
+	void configureAdmission();
+	void applyChanges(const std::vector<ChangeEvent>& events);
+	int changeFeedKeyType(const std::string& tableName);
+	void startTrafficCapture(const std::string& file);		//-- empty file stops capturing.
 	bool loadTableScheme(const std::string& tableName, std::vector<std::vector<std::string>>& scheme);
 	std::string loadSplitColumn(const std::string& tableName);
-	TABLEPtr loadTableInfo(const std::string& tableName);
+	bool loadTableDescription(const std::string& tableName, TableDescription& desc);
+	TABLEPtr loadTableInfo(const std::string& tableName, TableDescription& desc);
 	TABLEPtr getTableScheme(const std::string& tableName);
+	void registerTable(const std::string& tableName, TABLEPtr scheme, const TableDescription& desc);	//-- caller must hold the write lock.
+	void configureCompression(const std::string& tables, uint32_t minBytes);
+	void applyCompressionSetting(const std::string& tableName, TableDescription& desc);		//-- caller must hold the write lock.
+	std::shared_ptr<CompressionStatistics> tableCompression(const std::string& tableName);		//-- caller must hold the lock.
+	void applyHotColumns(const std::string& tableName, TableDescription& desc);		//-- caller must hold the write lock.
+	std::string fetchSelectString(const std::string& tableName, TABLEPtr scheme,
+		const std::vector<uint16_t>& indexes, bool& cacheRows);		//-- caller must hold the lock.
 	void cleanCache(const std::string& tableName, int64_t hintId);
+	void invalidateRows(const std::string& tableName, const std::set<int64_t>& hintIds);		//-- local only.
+	void invalidateWholeTable(const std::string& tableName);		//-- local only.
+	void removeCachedRow(const std::string& tableName, int64_t hintId);		//-- removes all rows under the hintId. Caller must hold the write lock.
+	CachedRowPtr fetchSharedRow(const TableKey& key);		//-- caller must hold the write lock.
+	void dropTable(const std::string& tableName, bool journaled = false);		//-- drops scheme & cached rows of the table.
+
+	void configureSnapshot();
+	void loadSnapshot();
+	bool dumpSnapshotFile();
+	void startSnapshotDumping();
+	void snapshotThread();
+
+	void rehashThread();
+	void rehashStarted();		//-- resize listener of the cache map. Caller holds the write lock.
+	void stopRehashing();
+	std::string cacheMapInfos();		//-- caller must hold the lock.
+	void configureCacheMemory(const std::string& hugePages, const std::string& numaNodes);
+
+	void configurePreload();
+	bool startPreload(const std::string& tableName, int64_t fromId, int64_t toId);		//-- false if the table is preloading.
+	void preloadThread();
+	const char* runPreload(std::shared_ptr<PreloadTask> task);		//-- returns the final state.
+	void stopPreload();
+	std::string preloadInfos();
+
+	void configureWriteBehind();
+	bool queueModify(const std::string& tableName, TABLEPtr scheme, int64_t hintId,
+		const std::string& hintString, const std::map<std::string, std::string>& values);		//-- false: write through.
+	void applyModify(const std::string& tableName, TABLEPtr scheme, int64_t hintId,
+		const std::string& hintString, const std::map<std::string, std::string>& values);		//-- caller must hold the write lock.
+	bool flushWriteBehindRow(const WriteBehindRow& row);
+	void writeBehindFlushed(const WriteBehindRow& row, bool succeed);
+	void fenceWriteBehind(const std::string& tableName, int64_t hintId, std::function<void ()> sendDelete);		//-- before a delete.
+	void unfenceWriteBehind(const std::string& tableName, int64_t hintId);		//-- after the delete answered.
+	void drainWriteBehind();
+	FPQuestPtr modifyQuest(const std::string& tableName, TABLEPtr scheme, int64_t hintId,
+		const std::string& hintString, const std::map<std::string, std::string>& kvpairs);
 
 	FPAnswerPtr real_fetch(const FPQuestPtr quest, const std::string& tableName, TABLEPtr scheme,
-		const std::vector<std::string>& fields, const std::set<int64_t>& hintIds);
+		const std::vector<std::string>& fields, const std::set<int64_t>& hintIds, RowVersions<int64_t>* rowVersions = NULL);
 	FPAnswerPtr real_fetch(const FPQuestPtr quest, const std::string& tableName, TABLEPtr scheme,
-		const std::vector<std::string>& fields, const std::set<std::string>& hintStrings);
+		const std::vector<std::string>& fields, const std::set<std::string>& hintStrings, RowVersions<std::string>* rowVersions = NULL);
 
 	FPAnswerPtr real_fetch_from_database(const FPQuestPtr quest,
 		const std::string& tableName, TABLEPtr scheme, std::vector<uint16_t>& fieldIndexes,
-		const std::set<int64_t>& lackedHintIds, std::map<int64_t, std::vector<std::string>>& result, bool jsonCompatible);
+		const std::set<int64_t>& lackedHintIds, std::map<int64_t, std::vector<std::string>>& result, bool jsonCompatible,
+		const std::vector<uint8_t>& requiredTypes, const std::string& selectString, bool cacheRows,
+		RowVersions<int64_t>& rowVersions, AdmissionTicketPtr admission);
 	FPAnswerPtr real_fetch_from_database(const FPQuestPtr quest,
 		const std::string& tableName, TABLEPtr scheme, std::vector<uint16_t>& fieldIndexes,
-		const std::set<std::string>& lackedHintStrings, std::map<std::string, std::vector<std::string>>& result);
+		const std::set<std::string>& lackedHintStrings, std::map<std::string, std::vector<std::string>>& result,
+		const std::vector<uint8_t>& requiredTypes, const std::string& selectString, bool cacheRows,
+		RowVersions<std::string>& rowVersions, AdmissionTicketPtr admission);
+	FPQuestPtr selectQuest(const std::string& tableName, TABLEPtr scheme, const std::string& selectString,
+		const std::set<int64_t>& lackedHintIds);
+	FPQuestPtr selectQuest(const std::string& tableName, TABLEPtr scheme, const std::string& selectString,
+		const std::set<std::string>& lackedHintStrings);
+	bool refreshRows(const std::string& tableName, const std::set<int64_t>& hintIds,
+		const std::set<std::string>& hintStrings);		//-- sends one refresh-ahead batch.
+	template <typename TYPE>
+	FPAnswerPtr streamFetch(const FPQuestPtr quest, const ConnectionInfo& ci, const std::string& tableName,
+		TABLEPtr scheme, const std::vector<std::string>& fields, const std::set<TYPE>& hintKeys);
+	CachedRowPtr cachedRow(const std::string& tableName, int64_t hintId);		//-- caller must hold the write lock.
+	CachedRowPtr cachedRow(const std::string& tableName, const std::string& hintString);		//-- caller must hold the write lock.
+	FPAnswerPtr readSubscription(const FPReaderPtr args, const FPQuestPtr quest, std::set<std::string>& tables,
+		InvalidationPublisher::KeyMap& keys);		//-- returns an error answer, or nullptr.
+	std::vector<uint8_t> requiredColumnTypes(const std::string& tableName, const std::vector<uint16_t>& indexes);		//-- caller must hold the lock.
 
 	friend class WriteCallback;
+	friend class RefreshRowsCallback;
 	friend class FetchRowCallback<int64_t>;
 	friend class FetchRowCallback<std::string>;
+	friend class FetchStream<int64_t>;
+	friend class FetchStream<std::string>;
+	friend class ProcessorBench;
 
-	void addRows(TABLEPtr orginalScheme, const std::vector<std::vector<std::string>>& data);
+	size_t addRows(TABLEPtr orginalScheme, const std::vector<std::vector<std::string>>& data, bool refreshed = false);		//-- returns rows cached.
 
 public:
 	FPAnswerPtr modify(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
@@ -103,10 +322,23 @@ public:
 	FPAnswerPtr invalidateTable(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
 	FPAnswerPtr refreshCluster(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
 	FPAnswerPtr invalidate(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
+	FPAnswerPtr dumpSnapshot(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
+	FPAnswerPtr hotKeys(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
+	FPAnswerPtr preloadTable(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
+	FPAnswerPtr cancelPreload(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
+	FPAnswerPtr subscribe(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
+	FPAnswerPtr unsubscribe(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
+	FPAnswerPtr resizeCache(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
 
 	virtual std::string infos();
+	virtual void tune(const std::string& key, std::string& value);
+	virtual void serverWillStop();
+	virtual void serverStopped();
+	virtual void connectionWillClose(const ConnectionInfo& connInfo, bool closeByError);
 
-	TableCacheProcessor()
+	TableCacheProcessor(): _compressionMinBytes(0), _changeFeedNotifyCluster(true), _writeBehindShutdownFlushSeconds(10), _snapshotInterval(0), _snapshotAtShutdown(false), _running(true),
+		_preloadBatchSize(1000), _preloadMaxEmptyBatches(10), _preloadMaxMemory(0), _preloadMaxIdsPerSecond(0), _rehashPending(false),
+		_streamChunkRows(1000), _streamMaxInflightBatches(2), _nextStreamId(0)
 	{
 		registerMethod("modify", &TableCacheProcessor::modify);
 		registerMethod("fetch", &TableCacheProcessor::fetch);
@@ -114,9 +346,17 @@ public:
 		registerMethod("invalidateTable", &TableCacheProcessor::invalidateTable);
 		registerMethod("refreshCluster", &TableCacheProcessor::refreshCluster);
 		registerMethod("invalidate", &TableCacheProcessor::invalidate);
+		registerMethod("dumpSnapshot", &TableCacheProcessor::dumpSnapshot);
+		registerMethod("hotKeys", &TableCacheProcessor::hotKeys);
+		registerMethod("preloadTable", &TableCacheProcessor::preloadTable);
+		registerMethod("cancelPreload", &TableCacheProcessor::cancelPreload);
+		registerMethod("subscribe", &TableCacheProcessor::subscribe);
+		registerMethod("unsubscribe", &TableCacheProcessor::unsubscribe);
+		registerMethod("resizeCache", &TableCacheProcessor::resizeCache);
 
 		configure();
 	}
+	~TableCacheProcessor();
 
 	QuestProcessorClassBasicPublicFuncs
 };
@@ -0,0 +1,128 @@
+#include <chrono>
+#include "FPLog.h"
+#include "TableCacheErrorInfo.h"
+#include "TableCacheProcessor.h"
+
+static const size_t rehashBucketsPerLock = 4096;
+static const size_t chainSampleBuckets = 1024;
+
+//-- Finishes resizing when few requests move buckets. The lock is released between steps,
+//-- and never taken while no resize is running.
+void TableCacheProcessor::rehashThread()
+{
+	std::unique_lock<std::mutex> lck(_rehashMutex);
+	while (_running)
+	{
+		if (!_rehashPending)
+		{
+			_rehashCondition.wait(lck);
+			continue;
+		}
+
+		lck.unlock();
+		{
+			ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::Rehash);
+			if (!_cachaMap->rehash_step(rehashBucketsPerLock))
+				_rehashPending = false;		//-- Under the lock: a resize started later sets it again.
+		}
+		lck.lock();
+
+		if (_running && _rehashPending)
+			_rehashCondition.wait_for(lck, std::chrono::milliseconds(1));
+	}
+}
+
+void TableCacheProcessor::rehashStarted()
+{
+	_rehashPending = true;
+
+	std::unique_lock<std::mutex> lck(_rehashMutex);
+	_rehashCondition.notify_all();
+}
+
+void TableCacheProcessor::stopRehashing()
+{
+	{
+		std::unique_lock<std::mutex> lck(_rehashMutex);
+		_rehashCondition.notify_all();
+	}
+
+	if (_rehashThread.joinable())
+		_rehashThread.join();
+}
+
+//-- Before any row is cached: the map moves to the arena only when empty.
+void TableCacheProcessor::configureCacheMemory(const std::string& hugePages, const std::string& numaNodes)
+{
+	CacheArena::HugePageMode mode;
+	if (!CacheArena::parseHugePageMode(hugePages, mode))
+	{
+		LOG_ERROR("Invalid TableCache.cache.hugePages: %s. Cache memory uses the malloc heap.", hugePages.c_str());
+		return;
+	}
+
+	std::vector<int> nodes;
+	if (!CacheArena::parseNumaNodes(numaNodes, nodes))
+	{
+		LOG_ERROR("Invalid TableCache.cache.numaNodes: %s. Cache memory uses the malloc heap.", numaNodes.c_str());
+		return;
+	}
+
+	if (mode == CacheArena::NoHugePage && nodes.empty())
+		return;
+
+	if (!_cachaMap->use_arena(mode, nodes))
+		LOG_ERROR("Map cache memory failed. Cache memory uses the malloc heap.");
+	else
+		LOG_INFO("Cache nodes & hash table are in huge page mode %s, on %d NUMA nodes.",
+			hugePages.empty() ? "none" : hugePages.c_str(), (int)nodes.size());
+}
+
+//-- caller must hold the lock.
+std::string TableCacheProcessor::cacheMapInfos()
+{
+	HashChainStatistics chains = _cachaMap->sample_chains(chainSampleBuckets);
+	size_t slotSize = _cachaMap->slot_size();
+
+	std::string infos("{\"slotSize\":");
+	infos.append(std::to_string(slotSize));
+	infos.append(",\"loadFactor\":").append(std::to_string((double)_cachaMap->count() / slotSize));
+	infos.append(",\"rehashing\":").append(_cachaMap->is_rehashing() ? "true" : "false");
+	if (_cachaMap->is_rehashing())
+	{
+		infos.append(",\"oldSlotSize\":").append(std::to_string(_cachaMap->old_slot_size()));
+		infos.append(",\"movedSlots\":").append(std::to_string(_cachaMap->rehash_progress()));
+	}
+	infos.append(",\"resizeCount\":").append(std::to_string(_cachaMap->resize_count()));
+	infos.append(",\"sampledSlots\":").append(std::to_string(chains.sampledBuckets));
+	infos.append(",\"emptySlotRatio\":").append(std::to_string(chains.sampledBuckets ? (double)chains.emptyBuckets / chains.sampledBuckets : 0));
+	infos.append(",\"avgChain\":").append(std::to_string(chains.averageChain()));
+	infos.append(",\"maxChain\":").append(std::to_string(chains.maxChain));
+	if (_cachaMap->arena())
+		infos.append(",\"arena\":").append(_cachaMap->arena()->infos());
+	infos.append("}");
+	return infos;
+}
+
+FPAnswerPtr TableCacheProcessor::resizeCache(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+{
+	int64_t hashSize = args->wantInt("hashSize");
+	if (hashSize < 1024)
+		return ErrorInfo::disabledAnswer(quest, "hashSize must be at least 1024.");
+
+	bool started;
+	size_t slotSize;
+	{
+		ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::Rehash);
+		started = _cachaMap->resize((size_t)hashSize);
+		slotSize = _cachaMap->slot_size();
+	}
+
+	if (started)
+		LOG_INFO("Cache hash table is resizing to %llu slots.", (unsigned long long)slotSize);		//-- The rehash thread is woken by rehashStarted().
+
+	FPAWriter aw(2, quest);
+	aw.param("started", started);
+	aw.param("slotSize", (int64_t)slotSize);
+	return aw.take();
+}
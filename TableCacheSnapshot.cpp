@@ -0,0 +1,374 @@
+#include <chrono>
+#include <unistd.h>
+#include "FPLog.h"
+#include "Setting.h"
+#include "TableCacheErrorInfo.h"
+#include "TableCacheProcessor.h"
+
+static const size_t snapshotRowsPerLock = 4096;
+static const char* snapshotUncachedMark = "#uncached";		//-- appended to desc rows of non hot columns.
+
+static int64_t snapshotNowMsec()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void TableCacheProcessor::configureSnapshot()
+{
+	_snapshotFile = Setting::getString("TableCache.snapshot.file");
+	if (_snapshotFile.empty())
+		return;
+
+	_snapshotInterval = (int)Setting::getInt("TableCache.snapshot.interval", 0);
+	_snapshotAtShutdown = Setting::getBool("TableCache.snapshot.dumpAtShutdown", true);
+
+	//-- Load before the journal is opened for appending, and before the server accepts traffic.
+	if (Setting::getBool("TableCache.snapshot.loadAtStartup", true))
+		loadSnapshot();
+
+	_invalidationJournal = std::make_shared<InvalidationJournal>();
+	if (!_invalidationJournal->open(_snapshotFile + ".journal",
+		(size_t)Setting::getInt("TableCache.snapshot.journalMaxMB", 64) * 1024 * 1024,
+		Setting::getInt("TableCache.snapshot.maxAgeSeconds", 300) * 1000,
+		(int)Setting::getInt("TableCache.snapshot.journalFlushMsec", 100)))
+	{
+		LOG_ERROR("Snapshot is disabled because invalidation journal cannot be opened.");
+		_invalidationJournal = nullptr;
+		_snapshotFile.clear();
+		return;
+	}
+
+	if (_snapshotInterval > 0)
+		_snapshotThread = std::thread(&TableCacheProcessor::snapshotThread, this);
+}
+
+TableCacheProcessor::~TableCacheProcessor()
+{
+	if (_writeBehind)
+		_writeBehind->stop();
+	if (_refreshAhead)
+		_refreshAhead->stop();
+	if (_changeFeed)
+		_changeFeed->stop();
+	if (_invalidationPublisher)
+		_invalidationPublisher->stop();
+
+	_running = false;
+	stopPreload();
+	stopRehashing();
+	if (_snapshotThread.joinable())
+		_snapshotThread.join();
+}
+
+void TableCacheProcessor::loadSnapshot()
+{
+	auto begin = std::chrono::steady_clock::now();
+
+	SnapshotFileReader reader;
+	if (!reader.open(_snapshotFile))
+	{
+		LOG_INFO("Snapshot file %s is not loaded. TableCache starts with empty cache.", _snapshotFile.c_str());
+		return;
+	}
+
+	//-- The journal misses writes routed to other nodes while this one is down, and rows have no TTL.
+	int64_t maxAgeMsec = Setting::getInt("TableCache.snapshot.maxAgeSeconds", 300) * 1000;
+	int64_t ageMsec = snapshotNowMsec() - reader.createMsec();
+	if (maxAgeMsec > 0 && ageMsec > maxAgeMsec)
+	{
+		LOG_WARN("Snapshot file %s was dumped %lld seconds ago, more than %lld seconds. TableCache starts with empty cache.",
+			_snapshotFile.c_str(), (long long)(ageMsec / 1000), (long long)(maxAgeMsec / 1000));
+		return;
+	}
+
+	//-- Invalidations happened after the snapshot was taken.
+	std::set<std::string> invalidatedTables;
+	std::vector<InvalidationJournal::Entry> journalEntries;
+	InvalidationJournal::LoadResult journalResult = InvalidationJournal::load(_snapshotFile + ".journal",
+		reader.createMsec(), journalEntries);
+	if (journalResult == InvalidationJournal::Overflowed)
+	{
+		LOG_WARN("Invalidation journal of snapshot %s overflowed after dumping. TableCache starts with empty cache.",
+			_snapshotFile.c_str());
+		return;
+	}
+	if (journalResult == InvalidationJournal::NotClosed)
+	{
+		LOG_WARN("Invalidation journal of snapshot %s was not closed, the last invalidations may be lost. TableCache starts with empty cache.",
+			_snapshotFile.c_str());
+		return;
+	}
+	for (auto& entry: journalEntries)
+		if (entry.wholeTable)
+			invalidatedTables.insert(entry.tableName);
+
+	int64_t loadedRows = 0;
+	int loadedTables = 0;
+	bool completed = false;
+
+	TABLEPtr scheme;
+	std::string tableName;
+	TableDescription desc;
+	std::vector<std::vector<std::string>> rows;
+
+	while (!completed)
+	{
+		SnapshotFileReader::BlockType block = reader.nextBlock();
+		if (block == SnapshotFileReader::TableBlock)
+		{
+			scheme = nullptr;
+			if (!reader.readTableHeader(tableName, desc.splitHint, desc.columns))
+				break;
+
+			std::set<size_t> uncachedColumns;
+			for (size_t i = 0; i < desc.columns.size(); i++)
+				if (desc.columns[i].size() && desc.columns[i].back() == snapshotUncachedMark)
+				{
+					desc.columns[i].pop_back();
+					uncachedColumns.insert(i);
+				}
+
+			if (invalidatedTables.find(tableName) != invalidatedTables.end())
+			{
+				LOG_INFO("Table %s in snapshot was invalidated after dumping. Skipped.", tableName.c_str());
+				continue;
+			}
+
+			TableDescription current;
+			if (!loadTableDescription(tableName, current)
+				|| current.splitHint != desc.splitHint || current.columns != desc.columns)
+			{
+				LOG_WARN("Scheme of table %s changed or cannot be loaded. Snapshot data of the table is discarded.", tableName.c_str());
+				continue;
+			}
+
+			scheme = std::make_shared<TABLE>(tableName, desc.splitHint, desc.columns);
+			{
+				ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::Snapshot);
+				registerTable(tableName, scheme, desc);
+
+				//-- Snapshot rows hold '' for columns not hot at dumping.
+				const std::vector<uint8_t>& storageTypes = _tableDescs[tableName].storageTypes;
+				for (size_t index: uncachedColumns)
+					if (storageTypes[index] != CachedRow::UncachedColumn)
+					{
+						LOG_WARN("Hot columns of table %s changed. Snapshot data of the table is discarded.", tableName.c_str());
+						scheme = nullptr;
+						break;
+					}
+			}
+
+			if (!scheme)
+				continue;
+
+			loadedTables += 1;
+		}
+		else if (block == SnapshotFileReader::RowsBlock)
+		{
+			if (!reader.readRows(desc.columns.size(), rows))
+				break;
+
+			if (scheme)
+			{
+				addRows(scheme, rows);
+				loadedRows += (int64_t)rows.size();
+			}
+		}
+		else if (block == SnapshotFileReader::TableEndBlock)
+			scheme = nullptr;
+		else if (block == SnapshotFileReader::FileEnd)
+		{
+			int64_t totalRows;
+			completed = reader.readFileEnd(totalRows);
+		}
+		else
+			break;
+	}
+
+	if (!completed)
+		LOG_ERROR("Snapshot file %s is truncated or corrupted. Only the rows before the damage are loaded.", _snapshotFile.c_str());
+
+	{
+		ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::Snapshot);
+		for (auto& entry: journalEntries)
+			if (!entry.wholeTable)
+				removeCachedRow(entry.tableName, entry.hintId);
+	}
+
+	int64_t cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+	_snapshotStatistics.loadedRows = loadedRows;
+	_snapshotStatistics.loadCost = cost;
+
+	LOG_INFO("Snapshot %s loaded: %d tables, %lld rows, %lld journal entries, cost %lld ms (%lld rows/sec).",
+		_snapshotFile.c_str(), loadedTables, (long long)loadedRows, (long long)journalEntries.size(),
+		(long long)cost, (long long)(cost ? loadedRows * 1000 / cost : loadedRows));
+}
+
+bool TableCacheProcessor::dumpSnapshotFile()
+{
+	auto begin = std::chrono::steady_clock::now();
+	int64_t createMsec = snapshotNowMsec();
+
+	std::map<std::string, std::pair<TABLEPtr, TableDescription>> tables;
+	{
+		ProfiledRKeeper rlock(&_rwlocker, _lockProfiler, LockProfiler::Snapshot);
+		for (auto& indexPair: _tableDataIndexes)
+		{
+			auto it = _tableInfo.find(indexPair.first);
+			auto dit = _tableDescs.find(indexPair.first);
+			if (it != _tableInfo.end() && dit != _tableDescs.end())
+				tables[indexPair.first] = std::make_pair(it->second, dit->second);
+		}
+	}
+
+	SnapshotFileWriter writer;
+	if (!writer.open(_snapshotFile, createMsec))
+		return false;
+
+	for (auto& tablePair: tables)
+	{
+		const std::string& tableName = tablePair.first;
+		TABLEPtr scheme = tablePair.second.first;
+		TableDescription& desc = tablePair.second.second;
+
+		std::vector<uint16_t> allIndexes;
+		for (size_t i = 0; i < desc.columns.size(); i++)
+			allIndexes.push_back((uint16_t)i);
+
+		std::vector<std::vector<std::string>> columns = desc.columns;
+		for (size_t i = 0; i < columns.size(); i++)
+			if (i < desc.storageTypes.size() && desc.storageTypes[i] == CachedRow::UncachedColumn)
+				columns[i].push_back(snapshotUncachedMark);
+
+		writer.beginTable(tableName, desc.splitHint, columns);
+
+		//-- Copy row pointers in small batches, so fetches are only blocked for a short while.
+		CacheMap::node_type* cursor = NULL;
+		std::vector<CachedRowPtr> batch;
+		std::vector<std::vector<std::string>> rows;
+		while (true)
+		{
+			batch.clear();
+			{
+				ProfiledRKeeper rlock(&_rwlocker, _lockProfiler, LockProfiler::Snapshot);
+				auto it = _tableInfo.find(tableName);
+				if (it == _tableInfo.end() || it->second.get() != scheme.get())
+					break;		//-- Table invalidated, recorded in journal.
+
+				auto iit = _tableDataIndexes.find(tableName);
+				if (iit == _tableDataIndexes.end())
+					break;
+
+				auto nit = cursor ? iit->second.upper_bound(cursor) : iit->second.begin();
+				for (; nit != iit->second.end() && batch.size() < snapshotRowsPerLock; nit++)
+				{
+					cursor = *nit;
+					batch.push_back((*nit)->data);
+				}
+			}
+
+			if (batch.empty())
+				break;
+
+			rows.clear();
+			rows.reserve(batch.size());
+			for (auto& row: batch)
+				rows.push_back(row->get_data(allIndexes));
+
+			writer.writeRows(rows);
+		}
+
+		writer.endTable();
+	}
+
+	if (!writer.commit())
+		return false;
+
+	_invalidationJournal->compact(createMsec);
+
+	int64_t cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+	_snapshotStatistics.lastDumpMsec = createMsec;
+	_snapshotStatistics.lastDumpRows = writer.totalRows();
+	_snapshotStatistics.lastDumpCost = cost;
+
+	LOG_INFO("Snapshot %s dumped: %d tables, %lld rows, cost %lld ms.", _snapshotFile.c_str(),
+		(int)tables.size(), (long long)writer.totalRows(), (long long)cost);
+	return true;
+}
+
+void TableCacheProcessor::startSnapshotDumping()
+{
+	TableCacheProcessorPtr self = shared_from_this();
+	std::thread([self]() {
+		if (self->dumpSnapshotFile())
+			self->_snapshotStatistics.dumpCount++;
+		else
+			self->_snapshotStatistics.failedCount++;
+
+		self->_snapshotStatistics.dumping = false;
+	}).detach();
+}
+
+void TableCacheProcessor::snapshotThread()
+{
+	int64_t lastDump = snapshotNowMsec();
+	while (_running)
+	{
+		sleep(1);
+
+		int64_t now = snapshotNowMsec();
+		if (now - lastDump < (int64_t)_snapshotInterval * 1000)
+			continue;
+
+		lastDump = now;
+		if (_snapshotStatistics.dumping.exchange(true) == false)
+			startSnapshotDumping();
+	}
+}
+
+void TableCacheProcessor::serverWillStop()
+{
+	//-- First, while DBProxy is still reachable and before the snapshot is dumped.
+	drainWriteBehind();
+
+	if (_refreshAhead)
+		_refreshAhead->stop();
+	if (_changeFeed)
+		_changeFeed->stop();
+	if (_invalidationPublisher)
+		_invalidationPublisher->stop();
+
+	_running = false;
+	stopPreload();
+	stopRehashing();
+	if (_snapshotThread.joinable())
+		_snapshotThread.join();
+
+	if (_snapshotFile.empty() || !_snapshotAtShutdown)
+		return;
+
+	while (_snapshotStatistics.dumping.exchange(true))
+		usleep(10 * 1000);
+
+	if (dumpSnapshotFile())
+		_snapshotStatistics.dumpCount++;
+	else
+		_snapshotStatistics.failedCount++;
+
+	_snapshotStatistics.dumping = false;
+}
+
+FPAnswerPtr TableCacheProcessor::dumpSnapshot(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+{
+	if (_snapshotFile.empty())
+		return ErrorInfo::disabledAnswer(quest, "Snapshot file is not configured.");
+
+	bool started = (_snapshotStatistics.dumping.exchange(true) == false);
+	if (started)
+		startSnapshotDumping();
+
+	FPAWriter aw(1, quest);
+	aw.param("started", started);
+	return aw.take();
+}
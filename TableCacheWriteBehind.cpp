@@ -0,0 +1,146 @@
+#include <chrono>
+#include "FPLog.h"
+#include "Setting.h"
+#include "StringUtil.h"
+#include "TableCacheProcessor.h"
+#include "LatencyHistogram.h"
+
+void TableCacheProcessor::configureWriteBehind()
+{
+	std::vector<std::string> tables;
+	StringUtil::split(Setting::getString("TableCache.writeBehind.tables"), ", ", tables);
+	if (tables.empty())
+		return;
+
+	_writeBehindShutdownFlushSeconds = (int)Setting::getInt("TableCache.writeBehind.shutdownFlushSeconds", 10);
+
+	TableCacheProcessor* self = this;
+	_writeBehind = std::make_shared<WriteBehindQueue>(
+		[self](const WriteBehindRow& row) {
+			return self->flushWriteBehindRow(row);
+		},
+		std::set<std::string>(tables.begin(), tables.end()),
+		(size_t)Setting::getInt("TableCache.writeBehind.maxPendingRows", 100000),
+		(size_t)Setting::getInt("TableCache.writeBehind.maxInflightRows", 1000),
+		(int)Setting::getInt("TableCache.writeBehind.delayMsec", 100),
+		(int)Setting::getInt("TableCache.writeBehind.maxRetries", 3));
+}
+
+//-- Returns false if the queue is full, the modify has to be written through.
+bool TableCacheProcessor::queueModify(const std::string& tableName, TABLEPtr scheme, int64_t hintId,
+	const std::string& hintString, const std::map<std::string, std::string>& values)
+{
+	{
+		//-- Queue & cached row are updated together, so the cache ends with the values of the last queued modify.
+		ProfiledWKeeper wlock(&_rwlocker, _lockProfiler, LockProfiler::WriteBehind);
+		if (!_writeBehind->add(tableName, hintId, hintString, values))
+			return false;
+
+		applyModify(tableName, scheme, hintId, hintString, values);
+
+		//-- A snapshot must not bring back values lost with the queue. Timed after the cached row is updated.
+		if (_invalidationJournal)
+			_invalidationJournal->invalidate(tableName, hintId);
+	}
+
+	if (_invalidationPublisher)
+		_invalidationPublisher->invalidate(tableName, hintId);
+
+	return true;
+}
+
+void TableCacheProcessor::applyModify(const std::string& tableName, TABLEPtr scheme, int64_t hintId,
+	const std::string& hintString, const std::map<std::string, std::string>& values)
+{
+	//-- Shared memory rows outlive the process, and the queue does not.
+	if (_shmStore)
+		_shmStore->remove(tableName, hintId);
+
+	TableKey key;
+	key.hintId = hintId;
+	key.tableName = tableName;
+	key.hintString = hintString;
+
+	CacheMap::node_type* node = _cachaMap->find(key);
+	if (!node)
+		return;		//-- Not cached. addRows() skips the row until it is written.
+
+	auto it = _tableDescs.find(tableName);
+	if (it == _tableDescs.end())
+		return;
+
+	const TableDescription& desc = it->second;
+	std::vector<uint16_t> allIndexes;
+	for (size_t i = 0; i < desc.columns.size(); i++)
+		allIndexes.push_back((uint16_t)i);
+
+	std::vector<std::string> fields;
+	for (auto& valuePair: values)
+		fields.push_back(valuePair.first);
+
+	std::vector<uint16_t> indexes = scheme->get_fields_index(fields);
+	std::vector<std::string> row = node->data->get_data(allIndexes, desc.compression.get());
+
+	size_t i = 0;
+	for (auto& valuePair: values)
+	{
+		if (indexes[i] < row.size())
+			row[indexes[i]] = valuePair.second;
+		i += 1;
+	}
+
+	node->data = std::make_shared<CachedRow>(row, desc.storageTypes, desc.compression);
+}
+
+bool TableCacheProcessor::flushWriteBehindRow(const WriteBehindRow& row)
+{
+	TABLEPtr scheme = getTableScheme(row.tableName);
+	if (!scheme)
+		return false;
+
+	FPQuestPtr dbQuest = modifyQuest(row.tableName, scheme, row.hintId, row.hintString, row.values);
+	TableCacheProcessorPtr self = shared_from_this();
+	int64_t sendUsec = latencyNowUsec();
+
+	return _dbproxy->sendQuest(dbQuest, [self, row, sendUsec](FPAnswerPtr answer, int errorCode) {
+		LatencyRecorder::instance().record("writeBehind.flush", row.tableName, latencyNowUsec() - sendUsec);
+		self->writeBehindFlushed(row, errorCode == FPNN_EC_OK);
+	});
+}
+
+void TableCacheProcessor::writeBehindFlushed(const WriteBehindRow& row, bool succeed)
+{
+	bool dropped = _writeBehind->flushed(row, succeed);
+	if (succeed)
+	{
+		//-- The local row has the values already. Other nodes reload from the database.
+		_clusterNotifier->invalidate(row.tableName, row.hintId);
+	}
+	else if (dropped)
+		cleanCache(row.tableName, row.hintId);		//-- The cached values never reached the database.
+}
+
+void TableCacheProcessor::fenceWriteBehind(const std::string& tableName, int64_t hintId, std::function<void ()> sendDelete)
+{
+	if (_writeBehind && _writeBehind->enabled(tableName))
+		_writeBehind->fence(tableName, hintId, sendDelete);
+	else
+		sendDelete();
+}
+
+void TableCacheProcessor::unfenceWriteBehind(const std::string& tableName, int64_t hintId)
+{
+	if (_writeBehind && _writeBehind->enabled(tableName))
+		_writeBehind->unfence(tableName, hintId);
+}
+
+void TableCacheProcessor::drainWriteBehind()
+{
+	if (!_writeBehind)
+		return;
+
+	if (!_writeBehind->drain(_writeBehindShutdownFlushSeconds * 1000))
+		LOG_ERROR("Write-behind rows are not all written in %d seconds at shutdown.", _writeBehindShutdownFlushSeconds);
+
+	_writeBehind->stop();
+}
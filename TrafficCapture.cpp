@@ -0,0 +1,328 @@
+#include <chrono>
+#include <string.h>
+#include <sys/time.h>
+#include "TrafficCapture.h"
+
+static const char* const trafficMagic = "TCTRAF01";
+static const size_t trafficMagicLength = 8;
+static const size_t trafficFlushSize = 64 * 1024;
+static const uint64_t trafficMaxItemLength = 16 * 1024 * 1024;
+static const uint64_t trafficMaxItems = 1024 * 1024;
+
+static int64_t trafficNowUsec()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void appendVarint(std::string& buf, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		buf.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+	buf.push_back((char)value);
+}
+
+static void appendString(std::string& buf, const std::string& value)
+{
+	appendVarint(buf, value.length());
+	buf.append(value);
+}
+
+const char* TrafficRecord::kindName(uint8_t kind)
+{
+	switch (kind)
+	{
+		case Fetch: return "fetch";
+		case Modify: return "modify";
+		case Delete: return "delete";
+		case Invalidate: return "invalidate";
+		case InvalidateTable: return "invalidateTable";
+		default: return "unknown";
+	}
+}
+
+//===============================================//
+//-- TrafficRecorder
+//===============================================//
+bool TrafficRecorder::start(const std::string& path, uint32_t sampleRate, uint32_t maxRecordsPerSecond, int64_t maxFileSize)
+{
+	std::unique_lock<std::mutex> lck(_mutex);
+	closeFile();
+
+	_fp = fopen(path.c_str(), "wb");
+	if (!_fp)
+		return false;
+
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	uint64_t startMsec = (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+
+	std::string header(trafficMagic, trafficMagicLength);
+	for (int i = 0; i < 8; i++)
+		header.push_back((char)((startMsec >> (i * 8)) & 0xFF));
+
+	if (fwrite(header.data(), 1, header.size(), _fp) != header.size())
+	{
+		fclose(_fp);
+		_fp = NULL;
+		return false;
+	}
+
+	_path = path;
+	_startUsec = trafficNowUsec();
+	_fileSize = (int64_t)header.size();
+	_maxFileSize = maxFileSize;
+	_currentSecond = 0;
+	_currentSecondCount = 0;
+	_recordCount = 0;
+	_rateLimitedCount = 0;
+	_sampleRate = sampleRate;
+	_maxRecordsPerSecond = maxRecordsPerSecond;
+	_capturing = true;
+	return true;
+}
+
+void TrafficRecorder::closeFile()
+{
+	_capturing = false;
+	if (_fp)
+	{
+		if (_buffer.size())
+			fwrite(_buffer.data(), 1, _buffer.size(), _fp);
+
+		fclose(_fp);
+		_fp = NULL;
+	}
+	_buffer.clear();
+}
+
+void TrafficRecorder::stop()
+{
+	std::unique_lock<std::mutex> lck(_mutex);
+	closeFile();
+}
+
+void TrafficRecorder::record(TrafficRecord& record)
+{
+	int64_t now = trafficNowUsec();
+
+	std::unique_lock<std::mutex> lck(_mutex);
+	if (!_fp)
+		return;
+
+	record.offsetUsec = now - _startUsec;
+
+	uint32_t limit = _maxRecordsPerSecond.load(std::memory_order_relaxed);
+	if (limit)
+	{
+		int64_t second = record.offsetUsec / 1000000;
+		if (second != _currentSecond)
+		{
+			_currentSecond = second;
+			_currentSecondCount = 0;
+		}
+
+		if (_currentSecondCount >= limit)
+		{
+			_rateLimitedCount++;
+			return;
+		}
+		_currentSecondCount++;
+	}
+
+	size_t oldSize = _buffer.size();
+	_buffer.push_back((char)record.kind);
+	appendVarint(_buffer, (uint64_t)record.offsetUsec);
+	appendString(_buffer, record.tableName);
+	_buffer.push_back(record.stringKey ? 1 : 0);
+
+	if (record.stringKey)
+	{
+		appendVarint(_buffer, record.hintStrings.size());
+		for (auto& hintString: record.hintStrings)
+			appendString(_buffer, hintString);
+	}
+	else
+	{
+		appendVarint(_buffer, record.hintIds.size());
+		for (int64_t hintId: record.hintIds)
+			appendVarint(_buffer, ((uint64_t)hintId << 1) ^ (uint64_t)(hintId >> 63));
+	}
+
+	appendVarint(_buffer, record.fields.size());
+	for (auto& field: record.fields)
+		appendString(_buffer, field);
+
+	appendVarint(_buffer, record.valueLengths.size());
+	for (uint32_t length: record.valueLengths)
+		appendVarint(_buffer, length);
+
+	_fileSize += (int64_t)(_buffer.size() - oldSize);
+	_recordCount++;
+
+	if (_buffer.size() >= trafficFlushSize)
+	{
+		fwrite(_buffer.data(), 1, _buffer.size(), _fp);
+		_buffer.clear();
+	}
+
+	if (_maxFileSize > 0 && _fileSize >= _maxFileSize)
+		closeFile();
+}
+
+std::string TrafficRecorder::infos()
+{
+	std::string path;
+	int64_t fileSize;
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		path = _path;
+		fileSize = _fileSize;
+	}
+
+	std::string infos("{\"capturing\":");
+	infos.append(_capturing ? "true" : "false");
+	infos.append(",\"file\":\"").append(path).append("\"");
+	infos.append(",\"sampleRate\":").append(std::to_string(_sampleRate));
+	infos.append(",\"maxRecordsPerSecond\":").append(std::to_string(_maxRecordsPerSecond));
+	infos.append(",\"recordCount\":").append(std::to_string(_recordCount));
+	infos.append(",\"rateLimitedCount\":").append(std::to_string(_rateLimitedCount));
+	infos.append(",\"fileSize\":").append(std::to_string(fileSize));
+	infos.append("}");
+	return infos;
+}
+
+//===============================================//
+//-- TrafficReader
+//===============================================//
+TrafficReader::~TrafficReader()
+{
+	if (_fp)
+		fclose(_fp);
+}
+
+bool TrafficReader::open(const std::string& path)
+{
+	_fp = fopen(path.c_str(), "rb");
+	if (!_fp)
+		return false;
+
+	unsigned char header[16];
+	if (fread(header, 1, 16, _fp) != 16 || memcmp(header, trafficMagic, trafficMagicLength) != 0)
+	{
+		fclose(_fp);
+		_fp = NULL;
+		return false;
+	}
+
+	uint64_t startMsec = 0;
+	for (int i = 0; i < 8; i++)
+		startMsec |= ((uint64_t)header[trafficMagicLength + i]) << (i * 8);
+
+	_startMsec = (int64_t)startMsec;
+	return true;
+}
+
+bool TrafficReader::readVarint(uint64_t& value)
+{
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		int c = fgetc(_fp);
+		if (c == EOF)
+			return false;
+
+		value |= ((uint64_t)(c & 0x7F)) << shift;
+		if ((c & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+bool TrafficReader::readString(std::string& value)
+{
+	uint64_t length;
+	if (!readVarint(length) || length > trafficMaxItemLength)
+		return false;
+
+	value.resize((size_t)length);
+	if (length == 0)
+		return true;
+
+	return fread(&value[0], 1, (size_t)length, _fp) == length;
+}
+
+bool TrafficReader::next(TrafficRecord& record)
+{
+	if (!_fp)
+		return false;
+
+	int kind = fgetc(_fp);
+	if (kind == EOF)
+		return false;
+
+	uint64_t value, count;
+	record.kind = (uint8_t)kind;
+	record.hintIds.clear();
+	record.hintStrings.clear();
+	record.fields.clear();
+	record.valueLengths.clear();
+
+	if (!readVarint(value))
+		return false;
+	record.offsetUsec = (int64_t)value;
+
+	if (!readString(record.tableName))
+		return false;
+
+	int stringKey = fgetc(_fp);
+	if (stringKey == EOF)
+		return false;
+	record.stringKey = (stringKey != 0);
+
+	if (!readVarint(count) || count > trafficMaxItems)
+		return false;
+
+	for (uint64_t i = 0; i < count; i++)
+	{
+		if (record.stringKey)
+		{
+			std::string hintString;
+			if (!readString(hintString))
+				return false;
+			record.hintStrings.push_back(hintString);
+		}
+		else
+		{
+			if (!readVarint(value))
+				return false;
+			record.hintIds.push_back((int64_t)(value >> 1) ^ -(int64_t)(value & 1));
+		}
+	}
+
+	if (!readVarint(count) || count > trafficMaxItems)
+		return false;
+
+	for (uint64_t i = 0; i < count; i++)
+	{
+		std::string field;
+		if (!readString(field))
+			return false;
+		record.fields.push_back(field);
+	}
+
+	if (!readVarint(count) || count > trafficMaxItems)
+		return false;
+
+	for (uint64_t i = 0; i < count; i++)
+	{
+		if (!readVarint(value))
+			return false;
+		record.valueLengths.push_back((uint32_t)value);
+	}
+
+	return true;
+}
@@ -0,0 +1,106 @@
+#ifndef Traffic_Capture_H
+#define Traffic_Capture_H
+
+#include <stdio.h>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*
+	Capture file layout (integers are varints, strings are varint length + bytes):
+
+		magic[8] "TCTRAF01", startMsec:int64 (little-endian)
+		{ kind:uint8, offsetUsec, tableName, stringKey:uint8,
+			keyCount, { hintId:zigzag varint | hintString } * keyCount,
+			fieldCount, { field } * fieldCount,
+			valueCount, { valueLength } * valueCount } *
+
+	Modified values are not captured, only their lengths.
+*/
+struct TrafficRecord
+{
+	enum Kind { Fetch = 1, Modify = 2, Delete = 3, Invalidate = 4, InvalidateTable = 5 };
+
+	uint8_t kind;
+	int64_t offsetUsec;		//-- since capture started.
+	std::string tableName;
+	bool stringKey;
+	std::vector<int64_t> hintIds;
+	std::vector<std::string> hintStrings;
+	std::vector<std::string> fields;		//-- fetch: required fields; modify: modified fields.
+	std::vector<uint32_t> valueLengths;		//-- modify only.
+
+	TrafficRecord(): kind(Fetch), offsetUsec(0), stringKey(false) {}
+
+	static const char* kindName(uint8_t kind);
+};
+
+class TrafficRecorder
+{
+	std::mutex _mutex;
+	FILE* _fp;
+	std::string _path;
+	int64_t _startUsec;
+	int64_t _fileSize;
+	int64_t _maxFileSize;
+	int64_t _currentSecond;
+	uint32_t _currentSecondCount;
+	std::string _buffer;
+
+	std::atomic<bool> _capturing;
+	std::atomic<uint32_t> _sampleRate;
+	std::atomic<uint32_t> _maxRecordsPerSecond;
+	std::atomic<uint64_t> _recordCount;
+	std::atomic<uint64_t> _rateLimitedCount;
+
+	void closeFile();
+
+public:
+	TrafficRecorder(): _fp(NULL), _startUsec(0), _fileSize(0), _maxFileSize(0), _currentSecond(0), _currentSecondCount(0),
+		_capturing(false), _sampleRate(1), _maxRecordsPerSecond(0), _recordCount(0), _rateLimitedCount(0) {}
+	~TrafficRecorder() { stop(); }
+
+	bool start(const std::string& path, uint32_t sampleRate, uint32_t maxRecordsPerSecond, int64_t maxFileSize);
+	void stop();
+
+	//-- Cheap per request check. Only sampled requests build & record a TrafficRecord.
+	inline bool sampled()
+	{
+		if (!_capturing.load(std::memory_order_relaxed))
+			return false;
+
+		uint32_t rate = _sampleRate.load(std::memory_order_relaxed);
+		if (rate <= 1)
+			return true;
+
+		static thread_local uint32_t counter = 0;
+		return (++counter % rate) == 0;
+	}
+
+	void record(TrafficRecord& record);
+	void setSampleRate(uint32_t sampleRate) { _sampleRate = sampleRate; }
+	void setMaxRecordsPerSecond(uint32_t maxRecordsPerSecond) { _maxRecordsPerSecond = maxRecordsPerSecond; }
+
+	std::string infos();
+};
+
+class TrafficReader
+{
+	FILE* _fp;
+	int64_t _startMsec;
+
+	bool readVarint(uint64_t& value);
+	bool readString(std::string& value);
+
+public:
+	TrafficReader(): _fp(NULL), _startMsec(0) {}
+	~TrafficReader();
+
+	bool open(const std::string& path);
+	int64_t startMsec() const { return _startMsec; }
+	bool next(TrafficRecord& record);		//-- false at file end or on a truncated record.
+};
+
+#endif
@@ -0,0 +1,355 @@
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "FPLog.h"
+#include "WriteBehind.h"
+#include "LatencyHistogram.h"
+
+static int64_t writeBehindNowMsec()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+WriteBehindQueue::WriteBehindQueue(Flusher flusher, const std::set<std::string>& tables, size_t maxPendingRows,
+	size_t maxInflightRows, int delayMsec, int maxRetries): _flusher(flusher), _tables(tables), _pendingRows(0),
+	_inflightRows(0), _draining(false), _running(true), _maxPendingRows(maxPendingRows),
+	_maxInflightRows(maxInflightRows ? maxInflightRows : 1), _delayMsec(delayMsec > 0 ? delayMsec : 100),
+	_maxRetries(maxRetries > 0 ? maxRetries : 0)
+{
+	_thread = std::thread(&WriteBehindQueue::flushThread, this);
+}
+
+WriteBehindQueue::~WriteBehindQueue()
+{
+	stop();
+}
+
+void WriteBehindQueue::stop()
+{
+	size_t pendingRows;
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		if (!_running)
+			return;
+
+		_running = false;
+		pendingRows = _pendingRows;
+	}
+	_condition.notify_all();
+
+	if (_thread.joinable())
+		_thread.join();
+
+	if (pendingRows)
+		LOG_ERROR("Write-behind stopped with %d rows not written to database.", (int)pendingRows);
+}
+
+//-- caller must hold _mutex.
+void WriteBehindQueue::schedule(const RowKey& key, Entry& entry, int64_t dueMsec)
+{
+	_due.insert(std::make_pair(dueMsec, key));
+	entry.queued = true;
+}
+
+//-- caller must hold _mutex.
+void WriteBehindQueue::releaseEntry(std::map<RowKey, Entry>::iterator it)
+{
+	Entry& entry = it->second;
+	if (entry.pending.values.empty() && !entry.inflight && !entry.fences)
+		_entries.erase(it);		//-- a stale _due item is skipped by flushThread().
+}
+
+bool WriteBehindQueue::pending(const std::string& tableName, int64_t hintId)
+{
+	std::unique_lock<std::mutex> lck(_mutex);
+	auto it = _entries.find(RowKey(tableName, hintId));
+	return it != _entries.end() && (it->second.pending.values.size() || it->second.inflight);
+}
+
+bool WriteBehindQueue::add(const std::string& tableName, int64_t hintId, const std::string& hintString,
+	const std::map<std::string, std::string>& values)
+{
+	RowKey key(tableName, hintId);
+	std::unique_lock<std::mutex> lck(_mutex);
+	auto it = _entries.find(key);
+
+	//-- A row being written or deleted stays in the queue, or a write through could overtake it.
+	if (it == _entries.end())
+	{
+		if (_pendingRows >= _maxPendingRows)
+		{
+			_statistics.writeThroughModifies++;
+			return false;
+		}
+
+		it = _entries.insert(std::make_pair(key, Entry())).first;
+	}
+
+	Entry& entry = it->second;
+	WriteBehindRow& row = entry.pending;
+	if (row.values.empty())
+	{
+		row.tableName = tableName;
+		row.hintId = hintId;
+		row.hintString = hintString;
+		row.firstModifyMsec = writeBehindNowMsec();
+		row.modifies = 0;
+		row.retries = 0;
+		_pendingRows += 1;
+	}
+	else
+		_statistics.coalescedModifies++;
+
+	for (auto& valuePair: values)
+		row.values[valuePair.first] = valuePair.second;
+
+	row.modifies += 1;
+	_statistics.modifies++;
+
+	if (!entry.queued && !entry.inflight && !entry.fences)
+		schedule(key, entry, row.firstModifyMsec + _delayMsec);
+
+	return true;
+}
+
+bool WriteBehindQueue::flushed(const WriteBehindRow& row, bool succeed)
+{
+	int64_t now = writeBehindNowMsec();
+	if (succeed)
+	{
+		_statistics.flushedRows++;
+		LatencyRecorder::instance().record("writeBehind.delay", row.tableName, (now - row.firstModifyMsec) * 1000);
+	}
+	else
+		_statistics.failedFlushes++;
+
+	RowKey key(row.tableName, row.hintId);
+	bool dropped = false;
+	std::vector<std::function<void ()>> fencedDeletes;
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		dropped = flushedRow(key, row, succeed, now, fencedDeletes);
+	}
+
+	//-- Sent out of the lock: a failed send unfences the row.
+	for (auto& sendDelete: fencedDeletes)
+		sendDelete();
+
+	return dropped;
+}
+
+//-- caller must hold _mutex.
+bool WriteBehindQueue::flushedRow(const RowKey& key, const WriteBehindRow& row, bool succeed, int64_t now,
+	std::vector<std::function<void ()>>& fencedDeletes)
+{
+	bool dropped = false;
+	_inflightRows -= 1;
+
+	auto it = _entries.find(key);
+	if (it == _entries.end())
+		return false;
+
+	Entry& entry = it->second;
+	entry.inflight = false;
+	fencedDeletes.swap(entry.fencedDeletes);
+	int64_t dueMsec = now;
+
+	if (!succeed)
+	{
+		if (row.retries >= _maxRetries)
+		{
+			_statistics.droppedRows++;
+			dropped = true;
+			LOG_ERROR("Write-behind row of table %s, hintId %lld failed %d times, %d modifies are dropped.",
+				row.tableName.c_str(), (long long)row.hintId, row.retries + 1, (int)row.modifies);
+		}
+		else if (!entry.fences)
+		{
+			//-- Merge back under the modifies arrived since, newer values win.
+			WriteBehindRow& pending = entry.pending;
+			if (pending.values.empty())
+			{
+				pending = row;
+				_pendingRows += 1;
+			}
+			else
+			{
+				pending.values.insert(row.values.begin(), row.values.end());
+				pending.firstModifyMsec = row.firstModifyMsec;
+				pending.modifies += row.modifies;
+			}
+
+			pending.retries = row.retries + 1;
+			dueMsec = now + ((int64_t)_delayMsec << std::min(pending.retries, 6));
+		}
+	}
+
+	if (entry.pending.values.size())
+	{
+		if (!entry.queued && !entry.fences)
+			schedule(key, entry, std::max(dueMsec, entry.pending.firstModifyMsec + _delayMsec));
+	}
+	else
+		releaseEntry(it);
+
+	_flushedCondition.notify_all();
+	return dropped;
+}
+
+void WriteBehindQueue::fence(const std::string& tableName, int64_t hintId, std::function<void ()> sendDelete)
+{
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		Entry& entry = _entries[RowKey(tableName, hintId)];
+		if (entry.pending.values.size())
+		{
+			entry.pending = WriteBehindRow();
+			_pendingRows -= 1;
+			_statistics.discardedRows++;
+		}
+
+		entry.fences += 1;
+		if (entry.inflight)
+		{
+			//-- The write must not overtake the delete: sent by flushed().
+			entry.fencedDeletes.push_back(sendDelete);
+			_statistics.delayedDeletes++;
+			return;
+		}
+	}
+
+	sendDelete();
+}
+
+void WriteBehindQueue::unfence(const std::string& tableName, int64_t hintId)
+{
+	RowKey key(tableName, hintId);
+	std::unique_lock<std::mutex> lck(_mutex);
+	auto it = _entries.find(key);
+	if (it == _entries.end())
+		return;
+
+	Entry& entry = it->second;
+	if (entry.fences)
+		entry.fences -= 1;
+	if (entry.fences)
+		return;
+
+	if (entry.pending.values.size())
+	{
+		if (!entry.queued && !entry.inflight)
+			schedule(key, entry, entry.pending.firstModifyMsec + _delayMsec);
+	}
+	else
+		releaseEntry(it);
+}
+
+bool WriteBehindQueue::drain(int waitMsec)
+{
+	std::unique_lock<std::mutex> lck(_mutex);
+	_draining = true;
+	_condition.notify_all();
+
+	bool drained = _flushedCondition.wait_for(lck, std::chrono::milliseconds(waitMsec),
+		[this]{ return _pendingRows == 0 && _inflightRows == 0; });
+
+	_draining = false;
+	return drained;
+}
+
+void WriteBehindQueue::flushThread()
+{
+	int tickMsec = std::max(_delayMsec / 4, 5);
+	std::unique_lock<std::mutex> lck(_mutex);
+	while (_running)
+	{
+		_condition.wait_for(lck, std::chrono::milliseconds(tickMsec));
+		if (!_running)
+			break;
+
+		int64_t now = writeBehindNowMsec();
+		std::vector<WriteBehindRow> rows;
+
+		while (_due.size() && _inflightRows < _maxInflightRows)
+		{
+			auto dit = _due.begin();
+			if (dit->first > now && !_draining)
+				break;
+
+			auto it = _entries.find(dit->second);
+			_due.erase(dit);
+			if (it == _entries.end())
+				continue;
+
+			Entry& entry = it->second;
+			entry.queued = false;
+			if (entry.inflight || entry.fences)
+				continue;		//-- rescheduled by flushed() or unfence().
+
+			if (entry.pending.values.empty())
+			{
+				releaseEntry(it);
+				continue;
+			}
+
+			rows.push_back(entry.pending);
+			entry.pending = WriteBehindRow();
+			entry.inflight = true;
+			_pendingRows -= 1;
+			_inflightRows += 1;
+		}
+
+		if (rows.empty())
+			continue;
+
+		lck.unlock();
+		for (auto& row: rows)
+			if (!_flusher(row))
+				flushed(row, false);
+		lck.lock();
+	}
+}
+
+std::string WriteBehindQueue::infos()
+{
+	size_t pendingRows, inflightRows;
+	int64_t oldestPendingMsec = 0;
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		pendingRows = _pendingRows;
+		inflightRows = _inflightRows;
+
+		int64_t now = writeBehindNowMsec();
+		for (auto& entryPair: _entries)
+			if (entryPair.second.pending.values.size())
+				oldestPendingMsec = std::max(oldestPendingMsec, now - entryPair.second.pending.firstModifyMsec);
+	}
+
+	std::string infos("{\"tables\":[");
+	bool needComma = false;
+	for (auto& tableName: _tables)
+	{
+		if (needComma)
+			infos.append(",");
+		else
+			needComma = true;
+
+		infos.append("\"").append(tableName).append("\"");
+	}
+	infos.append("]");
+	infos.append(",\"delayMsec\":").append(std::to_string(_delayMsec));
+	infos.append(",\"pendingRows\":").append(std::to_string(pendingRows));
+	infos.append(",\"inflightRows\":").append(std::to_string(inflightRows));
+	infos.append(",\"oldestPendingMsec\":").append(std::to_string(oldestPendingMsec));
+	infos.append(",\"modifies\":").append(std::to_string(_statistics.modifies));
+	infos.append(",\"coalescedModifies\":").append(std::to_string(_statistics.coalescedModifies));
+	infos.append(",\"writeThroughModifies\":").append(std::to_string(_statistics.writeThroughModifies));
+	infos.append(",\"flushedRows\":").append(std::to_string(_statistics.flushedRows));
+	infos.append(",\"failedFlushes\":").append(std::to_string(_statistics.failedFlushes));
+	infos.append(",\"droppedRows\":").append(std::to_string(_statistics.droppedRows));
+	infos.append(",\"discardedRows\":").append(std::to_string(_statistics.discardedRows));
+	infos.append(",\"delayedDeletes\":").append(std::to_string(_statistics.delayedDeletes));
+	infos.append("}");
+	return infos;
+}
@@ -0,0 +1,123 @@
+#ifndef Write_Behind_H
+#define Write_Behind_H
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <condition_variable>
+#include <stdint.h>
+
+//-- Modifies of one row waiting to be written to the database.
+struct WriteBehindRow
+{
+	std::string tableName;
+	int64_t hintId;		//-- stringHintId() of hintString for string keyed tables.
+	std::string hintString;		//-- string keyed tables only.
+	std::map<std::string, std::string> values;		//-- latest value of each modified column.
+	int64_t firstModifyMsec;		//-- oldest modify not yet in the database.
+	uint32_t modifies;		//-- modify requests coalesced into values.
+	int retries;
+
+	WriteBehindRow(): hintId(0), firstModifyMsec(0), modifies(0), retries(0) {}
+};
+
+struct WriteBehindStatistics
+{
+	std::atomic<uint64_t> modifies;		//-- modifies queued.
+	std::atomic<uint64_t> coalescedModifies;		//-- modifies merged into a pending row.
+	std::atomic<uint64_t> writeThroughModifies;		//-- queue full, written through.
+	std::atomic<uint64_t> flushedRows;
+	std::atomic<uint64_t> failedFlushes;
+	std::atomic<uint64_t> droppedRows;		//-- failed maxRetries times, the modifies are lost.
+	std::atomic<uint64_t> discardedRows;		//-- pending rows superseded by a delete.
+	std::atomic<uint64_t> delayedDeletes;		//-- deletes sent after the running write of the row.
+
+	WriteBehindStatistics(): modifies(0), coalescedModifies(0), writeThroughModifies(0), flushedRows(0),
+		failedFlushes(0), droppedRows(0), discardedRows(0), delayedDeletes(0) {}
+};
+
+/*
+	Write-behind queue of opt-in tables. Modifies of the same row are coalesced by column, latest
+	value wins, and written as one row at most delayMsec after the first of them. A row is never
+	written twice at the same time, so writes of a row reach the database in order.
+	Pending rows only live in memory: they are flushed at graceful shutdown, and lost if the
+	process crashes.
+*/
+class WriteBehindQueue
+{
+public:
+	//-- sends one row. Returns false if not sent. flushed() must be called for every sent row.
+	typedef std::function<bool (const WriteBehindRow& row)> Flusher;
+
+private:
+	typedef std::pair<std::string, int64_t> RowKey;
+
+	struct Entry
+	{
+		WriteBehindRow pending;		//-- no values: nothing pending.
+		bool queued;		//-- in _due.
+		bool inflight;
+		int fences;		//-- deletes of the row running, flushes are held.
+		std::vector<std::function<void ()>> fencedDeletes;		//-- waiting for the running write.
+
+		Entry(): queued(false), inflight(false), fences(0) {}
+	};
+
+	Flusher _flusher;
+	std::set<std::string> _tables;		//-- fixed after construction.
+
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	std::condition_variable _flushedCondition;
+	std::map<RowKey, Entry> _entries;
+	std::multimap<int64_t, RowKey> _due;		//-- flush time, may refer to rows discarded since.
+	size_t _pendingRows;
+	size_t _inflightRows;
+	bool _draining;
+	bool _running;
+	std::thread _thread;
+
+	size_t _maxPendingRows;
+	size_t _maxInflightRows;
+	int _delayMsec;
+	int _maxRetries;
+
+	WriteBehindStatistics _statistics;
+
+	void flushThread();
+	void schedule(const RowKey& key, Entry& entry, int64_t dueMsec);		//-- caller must hold _mutex.
+	void releaseEntry(std::map<RowKey, Entry>::iterator it);		//-- caller must hold _mutex.
+	bool flushedRow(const RowKey& key, const WriteBehindRow& row, bool succeed, int64_t now,
+		std::vector<std::function<void ()>>& fencedDeletes);		//-- caller must hold _mutex.
+
+public:
+	WriteBehindQueue(Flusher flusher, const std::set<std::string>& tables, size_t maxPendingRows,
+		size_t maxInflightRows, int delayMsec, int maxRetries);
+	~WriteBehindQueue();
+
+	bool enabled(const std::string& tableName) const { return _tables.find(tableName) != _tables.end(); }
+	bool pending(const std::string& tableName, int64_t hintId);		//-- pending or being written.
+
+	//-- false if the queue is full and the row is not in it: the caller writes through.
+	bool add(const std::string& tableName, int64_t hintId, const std::string& hintString,
+		const std::map<std::string, std::string>& values);
+	//-- returns true if the row failed for the last time and was dropped.
+	bool flushed(const WriteBehindRow& row, bool succeed);
+
+	//-- discards pending values of the row, and holds its flushes until unfence(). sendDelete is called
+	//-- at once, or by flushed() when the running write of the row is finished. Never blocks.
+	void fence(const std::string& tableName, int64_t hintId, std::function<void ()> sendDelete);
+	void unfence(const std::string& tableName, int64_t hintId);
+
+	bool drain(int waitMsec);		//-- flushes all pending rows now. false if rows are left after waitMsec.
+	void stop();
+	std::string infos();
+};
+
+#endif
@@ -0,0 +1,853 @@
+#include <iostream>
+#include <random>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unordered_set>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "Setting.h"
+#include "TableCacheProcessor.h"
+
+using namespace fpnn;
+
+/*
+	Microbenchmarks of the cache core: LruHashMap, cache memory (huge pages), TableKey::hash, string keys,
+	ROW & CachedRow, and the processor paths addRows, real_fetch (hits only), cleanCache, dropTable, infos()
+	and snapshot dump & load.
+	DBProxy is never contacted: tables are registered directly and every fetch is a cache hit.
+*/
+static volatile uint64_t gc_sink = 0;
+
+struct BenchOptions
+{
+	std::vector<int64_t> cacheSizes;
+	std::vector<int> threadCounts;
+	int columnCount;
+	int valueSize;
+};
+
+static int64_t nowNsec()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const std::string& name, int threads, uint64_t ops, int64_t nsec)
+{
+	double seconds = nsec / 1e9;
+	printf("%-48s threads %2d  ops %10llu  %10.1f ns/op  %9.3f Mops/s\n", name.c_str(), threads,
+		(unsigned long long)ops, ops ? (double)nsec * threads / ops : 0.0, seconds > 0 ? ops / seconds / 1e6 : 0.0);
+	fflush(stdout);
+}
+
+//-- Runs func(threadIndex) on threads, all released together. Returns wall time in nanoseconds.
+template <typename FUNC>
+static int64_t runThreads(int threadCount, FUNC func)
+{
+	std::atomic<int> ready(0);
+	std::atomic<bool> go(false);
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < threadCount; i++)
+		threads.push_back(std::thread([&, i]() {
+			ready++;
+			while (!go)
+				std::this_thread::yield();
+			func(i);
+		}));
+
+	while (ready < threadCount)
+		std::this_thread::yield();
+
+	int64_t begin = nowNsec();
+	go = true;
+	for (auto& thread: threads)
+		thread.join();
+
+	return nowNsec() - begin;
+}
+
+static std::vector<std::vector<std::string>> buildColumns(int columnCount)
+{
+	std::vector<std::vector<std::string>> columns;
+	columns.push_back(std::vector<std::string>{ "hintId", "bigint(20)", "NO", "PRI", "", "" });
+	for (int i = 1; i <= columnCount; i++)
+		columns.push_back(std::vector<std::string>{ std::string("field").append(std::to_string(i)), "varchar(255)", "YES", "", "", "" });
+
+	return columns;
+}
+
+static std::vector<std::string> buildRowData(int64_t hintId, int columnCount, int valueSize)
+{
+	std::vector<std::string> row;
+	row.push_back(std::to_string(hintId));
+	for (int i = 1; i <= columnCount; i++)
+		row.push_back(std::string(valueSize, 'a' + (char)((hintId + i) % 26)));
+
+	return row;
+}
+
+//===============================================//
+//-- LruHashMap, TableKey::hash, ROW & CachedRow
+//===============================================//
+typedef ResizableLruHashMap<TableKey, CachedRowPtr> BenchCacheMap;
+
+static void benchLruHashMap(const BenchOptions& options)
+{
+	CachedRowPtr row = std::make_shared<CachedRow>(buildRowData(0, options.columnCount, options.valueSize),
+		CachedRow::columnTypes(buildColumns(options.columnCount)));
+
+	for (int64_t cacheSize: options.cacheSizes)
+	{
+		std::string suffix = std::string(" [").append(std::to_string(cacheSize)).append("]");
+		std::vector<TableKey> keys((size_t)cacheSize);
+		for (int64_t i = 0; i < cacheSize; i++)
+		{
+			keys[i].hintId = i;
+			keys[i].tableName = "bench_table";
+		}
+
+		std::vector<uint32_t> order((size_t)cacheSize);
+		std::mt19937_64 random(cacheSize);
+		for (auto& index: order)
+			index = (uint32_t)(random() % (uint64_t)cacheSize);
+
+		BenchCacheMap map((size_t)cacheSize);
+
+		int64_t begin = nowNsec();
+		for (auto& key: keys)
+			map.insert(key, row);
+		report("LruHashMap insert" + suffix, 1, keys.size(), nowNsec() - begin);
+
+		uint64_t found = 0;
+		begin = nowNsec();
+		for (uint32_t index: order)
+			found += map.find(keys[index]) ? 1 : 0;
+		report("LruHashMap find (hit)" + suffix, 1, order.size(), nowNsec() - begin);
+
+		TableKey missKey;
+		missKey.tableName = "bench_table";
+		begin = nowNsec();
+		for (uint32_t index: order)
+		{
+			missKey.hintId = cacheSize + index;
+			found += map.find(missKey) ? 1 : 0;
+		}
+		report("LruHashMap find (miss)" + suffix, 1, order.size(), nowNsec() - begin);
+
+		begin = nowNsec();
+		for (uint32_t index: order)
+		{
+			BenchCacheMap::node_type* node = map.find(keys[index]);
+			if (node)
+				map.fresh_node(node);
+		}
+		report("LruHashMap find + fresh" + suffix, 1, order.size(), nowNsec() - begin);
+
+		begin = nowNsec();
+		for (uint32_t index: order)
+		{
+			BenchCacheMap::node_type* node = map.find(keys[index]);
+			if (node)
+				map.remove_node(node);
+			map.insert(keys[index], row);
+		}
+		report("LruHashMap remove + insert" + suffix, 1, order.size(), nowNsec() - begin);
+
+		//-- Lookups while the bucket array doubles, each moving a bucket.
+		map.resize(map.slot_size() * 2);
+		begin = nowNsec();
+		for (uint32_t index: order)
+		{
+			BenchCacheMap::node_type* node = map.find(keys[index]);
+			if (node)
+				map.fresh_node(node);
+		}
+		report("LruHashMap find + fresh, rehashing" + suffix, 1, order.size(), nowNsec() - begin);
+
+		begin = nowNsec();
+		size_t oldSlots = map.old_slot_size() - map.rehash_progress();
+		while (map.rehash_step(4096))
+			continue;
+		report("LruHashMap rehash, per slot" + suffix, 1, oldSlots, nowNsec() - begin);
+
+		//-- The processor serializes map access with its RWLocker.
+		for (int threads: options.threadCounts)
+		{
+			RWLocker locker;
+			uint64_t opsPerThread = order.size() / threads;
+			int64_t nsec = runThreads(threads, [&](int threadIndex) {
+				uint64_t localFound = 0;
+				for (uint64_t i = 0; i < opsPerThread; i++)
+				{
+					WKeeper wlock(&locker);
+					BenchCacheMap::node_type* node = map.find(keys[order[(threadIndex * opsPerThread + i) % order.size()]]);
+					if (node)
+					{
+						map.fresh_node(node);
+						localFound++;
+					}
+				}
+				gc_sink += localFound;
+			});
+			report("LruHashMap find + fresh, write locked" + suffix, threads, opsPerThread * threads, nsec);
+		}
+
+		gc_sink += found;
+	}
+}
+
+//-- dTLB load misses of this thread, by perf_event_open(). Unavailable in most containers & VMs.
+class TlbMissCounter
+{
+	int _fd;
+
+public:
+	TlbMissCounter()
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	~TlbMissCounter() { if (_fd >= 0) close(_fd); }
+
+	bool available() const { return _fd >= 0; }
+	void start()
+	{
+		if (_fd >= 0)
+		{
+			ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+	uint64_t stop()
+	{
+		uint64_t count = 0;
+		if (_fd >= 0)
+		{
+			ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(_fd, &count, sizeof(count)) != sizeof(count))
+				count = 0;
+		}
+		return count;
+	}
+};
+
+//-- Hits on nodes & bucket arrays from the malloc heap, against the CacheArena huge page modes.
+static void benchCacheMemory(const BenchOptions& options)
+{
+	CachedRowPtr row = std::make_shared<CachedRow>(buildRowData(0, options.columnCount, options.valueSize),
+		CachedRow::columnTypes(buildColumns(options.columnCount)));
+
+	const char* modeNames[] = { "none", "transparent", "explicit" };
+	TlbMissCounter tlbMisses;
+	if (!tlbMisses.available())
+		printf("dTLB load misses are unavailable (perf_event_open). Only latencies are reported.\n");
+
+	for (int64_t cacheSize: options.cacheSizes)
+	{
+		std::string suffix = std::string(" [").append(std::to_string(cacheSize)).append("]");
+		std::vector<TableKey> keys((size_t)cacheSize);
+		for (int64_t i = 0; i < cacheSize; i++)
+		{
+			keys[i].hintId = i;
+			keys[i].tableName = "bench_table";
+		}
+
+		std::vector<uint32_t> order((size_t)cacheSize);
+		std::mt19937_64 random(cacheSize);
+		for (auto& index: order)
+			index = (uint32_t)(random() % (uint64_t)cacheSize);
+
+		//-- -1: malloc heap.
+		for (int mode = -1; mode <= (int)CacheArena::ExplicitHugePage; mode++)
+		{
+			std::string name = std::string("cache memory ").append(mode < 0 ? "malloc" : modeNames[mode]);
+			BenchCacheMap map((size_t)cacheSize);
+			if (mode >= 0 && !map.use_arena((CacheArena::HugePageMode)mode, std::vector<int>()))
+			{
+				printf("%-48s unavailable\n", (name + suffix).c_str());
+				continue;
+			}
+
+			//-- Inserted in random order, as rows arrive, so neighbour keys are not neighbour nodes.
+			for (uint32_t index: order)
+				map.insert(keys[index], row);
+			for (auto& key: keys)
+				map.insert(key, row);
+
+			if (map.arena() && map.arena()->statistics().hugeTlbFallbacks)
+				name.append(" (fallback)");
+
+			uint64_t found = 0;
+			tlbMisses.start();
+			int64_t begin = nowNsec();
+			for (uint32_t index: order)
+			{
+				BenchCacheMap::node_type* node = map.find(keys[index]);
+				if (node)
+				{
+					map.fresh_node(node);
+					found++;
+				}
+			}
+			int64_t nsec = nowNsec() - begin;
+			uint64_t misses = tlbMisses.stop();
+
+			report(name + ", find + fresh" + suffix, 1, order.size(), nsec);
+			if (tlbMisses.available())
+				printf("%-48s dTLB load misses %8.3f /op\n", "", (double)misses / order.size());
+
+			gc_sink += found;
+		}
+	}
+}
+
+static void benchTableKeyHash()
+{
+	const char* tableNames[] = { "t", "user_profile", "a_rather_long_table_name_for_hash_benchmark" };
+	const uint64_t count = 10000000;
+
+	for (const char* tableName: tableNames)
+	{
+		TableKey key;
+		key.tableName = tableName;
+
+		uint64_t sum = 0;
+		int64_t begin = nowNsec();
+		for (uint64_t i = 0; i < count; i++)
+		{
+			key.hintId = (int64_t)i;
+			sum += key.hash();
+		}
+		report(std::string("TableKey::hash, table name length ").append(std::to_string(strlen(tableName))), 1, count, nowNsec() - begin);
+		gc_sink += sum;
+	}
+}
+
+//-- String keys: 64 bits hintId + exact hintString compare, against the former 32 bits hash only key.
+static void benchStringKeys(const BenchOptions& options)
+{
+	CachedRowPtr row = std::make_shared<CachedRow>(buildRowData(0, options.columnCount, options.valueSize),
+		CachedRow::columnTypes(buildColumns(options.columnCount)));
+
+	for (int64_t cacheSize: options.cacheSizes)
+	{
+		std::string suffix = std::string(" [").append(std::to_string(cacheSize)).append("]");
+		std::vector<std::string> hintStrings((size_t)cacheSize);
+		for (int64_t i = 0; i < cacheSize; i++)
+			hintStrings[i] = std::string("user_session_").append(std::to_string(i * 7919));
+
+		std::vector<uint32_t> order((size_t)cacheSize);
+		std::mt19937_64 random(cacheSize);
+		for (auto& index: order)
+			index = (uint32_t)(random() % (uint64_t)cacheSize);
+
+		for (int exact = 0; exact < 2; exact++)
+		{
+			const char* scheme = exact ? "exact" : "hash32";
+			BenchCacheMap map((size_t)cacheSize);
+			TableKey key;
+			key.tableName = "bench_table";
+
+			int64_t begin = nowNsec();
+			for (auto& hintString: hintStrings)
+			{
+				if (exact)
+				{
+					key.hintId = stringHintId(hintString);
+					key.hintString = hintString;
+				}
+				else
+					key.hintId = (int64_t)jenkins_hash(hintString.data(), hintString.length(), 0);
+
+				map.insert(key, row);
+			}
+			report(std::string("string key insert, ").append(scheme).append(suffix), 1, hintStrings.size(), nowNsec() - begin);
+
+			uint64_t found = 0;
+			begin = nowNsec();
+			for (uint32_t index: order)
+			{
+				const std::string& hintString = hintStrings[index];
+				if (exact)
+				{
+					key.hintId = stringHintId(hintString);
+					key.hintString = hintString;
+				}
+				else
+					key.hintId = (int64_t)jenkins_hash(hintString.data(), hintString.length(), 0);
+
+				BenchCacheMap::node_type* node = map.find(key);
+				if (node)
+				{
+					map.fresh_node(node);
+					found++;
+				}
+			}
+			report(std::string("string key find + fresh, ").append(scheme).append(suffix), 1, order.size(), nowNsec() - begin);
+			gc_sink += found;
+		}
+
+		//-- With hash32, every colliding key would be answered with another key's row.
+		std::unordered_set<uint32_t> hashes;
+		size_t heapBytes = 0;
+		size_t inplaceCapacity = std::string().capacity();
+		for (auto& hintString: hintStrings)
+		{
+			hashes.insert(jenkins_hash(hintString.data(), hintString.length(), 0));
+
+			std::string copy(hintString);
+			if (copy.capacity() > inplaceCapacity)
+				heapBytes += copy.capacity() + 1;
+		}
+
+		printf("%-48s hash32 colliding keys %zu\n", (std::string("string key collisions").append(suffix)).c_str(),
+			hintStrings.size() - hashes.size());
+		printf("%-48s hash32 %zu bytes, exact %zu + %.1f heap bytes per key\n", (std::string("string key memory").append(suffix)).c_str(),
+			sizeof(TableKey) - sizeof(std::string), sizeof(TableKey), (double)heapBytes / hintStrings.size());
+		fflush(stdout);
+	}
+}
+
+//-- Approximate heap usage of the former all-string row: vector of std::string.
+static size_t stringRowBytes(const std::vector<std::string>& rowData)
+{
+	size_t bytes = sizeof(ROW) + rowData.size() * sizeof(std::string);
+	size_t inplaceCapacity = std::string().capacity();
+	for (auto& value: rowData)
+		if (value.length() > inplaceCapacity)
+			bytes += value.length() + 1;
+
+	return bytes;
+}
+
+template <typename RowType>
+static void benchRowGetData(const char* name, const RowType& row, int columnCount)
+{
+	const uint64_t count = 2000000;
+	std::vector<size_t> projections{ 1, 4, (size_t)columnCount + 1 };
+	for (size_t width: projections)
+	{
+		if (width > (size_t)columnCount + 1)
+			continue;
+
+		std::vector<uint16_t> indexes;
+		for (size_t i = 0; i < width; i++)
+			indexes.push_back((uint16_t)i);
+
+		uint64_t sum = 0;
+		int64_t begin = nowNsec();
+		for (uint64_t i = 0; i < count; i++)
+			sum += row.get_data(indexes).size();
+
+		report(std::string(name).append("::get_data, ").append(std::to_string(width)).append(" of ")
+			.append(std::to_string(columnCount + 1)).append(" columns"), 1, count, nowNsec() - begin);
+		gc_sink += sum;
+	}
+}
+
+static void benchRowProjection(const BenchOptions& options)
+{
+	std::vector<std::string> rowData = buildRowData(12345, options.columnCount, options.valueSize);
+	std::vector<uint8_t> columnTypes = CachedRow::columnTypes(buildColumns(options.columnCount));
+
+	ROW row(rowData);
+	CachedRow cachedRow(rowData, columnTypes);
+	benchRowGetData("ROW", row, options.columnCount);
+	benchRowGetData("CachedRow", cachedRow, options.columnCount);
+
+	//-- Numeric heavy row: bigint key, int columns and a datetime.
+	std::vector<std::vector<std::string>> numericColumns;
+	std::vector<std::string> numericRow;
+	numericColumns.push_back(std::vector<std::string>{ "hintId", "bigint(20)", "NO", "PRI", "", "" });
+	numericRow.push_back("1234567890123");
+	for (int i = 1; i < options.columnCount; i++)
+	{
+		numericColumns.push_back(std::vector<std::string>{ std::string("field").append(std::to_string(i)), "int(11)", "YES", "", "", "" });
+		numericRow.push_back(std::to_string(1000000 + i * 7919));
+	}
+	numericColumns.push_back(std::vector<std::string>{ "updated", "datetime", "YES", "", "", "" });
+	numericRow.push_back("2024-06-01 12:30:45");
+
+	CachedRow numericCachedRow(numericRow, CachedRow::columnTypes(numericColumns));
+	benchRowGetData("CachedRow (numeric)", numericCachedRow, options.columnCount);
+
+	printf("%-48s ROW %zu bytes, CachedRow %zu bytes\n", "row memory, string columns", stringRowBytes(rowData), cachedRow.memoryBytes());
+	printf("%-48s ROW %zu bytes, CachedRow %zu bytes\n", "row memory, numeric columns", stringRowBytes(numericRow), numericCachedRow.memoryBytes());
+	fflush(stdout);
+}
+
+//-- A multi-KB JSON column, stored raw and compressed.
+static void benchRowCompression()
+{
+	std::string document("[");
+	for (int i = 0; i < 64; i++)
+		document.append("{\"id\":").append(std::to_string(100000 + i * 37)).append(",\"name\":\"user_").append(std::to_string(i * 7919 % 1000))
+			.append("\",\"tags\":[\"vip\",\"beta\"],\"score\":").append(std::to_string(i * 13 % 100)).append(",\"active\":true},");
+	document.back() = ']';
+
+	std::vector<std::vector<std::string>> columns;
+	columns.push_back(std::vector<std::string>{ "hintId", "bigint(20)", "NO", "PRI", "", "" });
+	columns.push_back(std::vector<std::string>{ "profile", "text", "YES", "", "", "" });
+	columns.push_back(std::vector<std::string>{ "name", "varchar(64)", "YES", "", "", "" });
+	std::vector<uint8_t> columnTypes = CachedRow::columnTypes(columns);
+	std::vector<std::string> rowData{ "12345", document, "user_12345" };
+
+	const uint64_t count = 100000;
+	std::shared_ptr<CompressionStatistics> compression = std::make_shared<CompressionStatistics>(1024);
+
+	int64_t begin = nowNsec();
+	for (uint64_t i = 0; i < count; i++)
+	{
+		CachedRow row(rowData, columnTypes, compression);
+		gc_sink += row.memoryBytes();
+	}
+	report(std::string("CachedRow build, compressed ").append(std::to_string(document.length())).append(" bytes"), 1, count, nowNsec() - begin);
+
+	CachedRow plainRow(rowData, columnTypes);
+	CachedRow compressedRow(rowData, columnTypes, compression);
+	std::vector<uint16_t> textIndexes{ 1 }, otherIndexes{ 0, 2 };
+
+	const char* names[] = { "raw", "compressed" };
+	const CachedRow* testRows[] = { &plainRow, &compressedRow };
+	for (int i = 0; i < 2; i++)
+	{
+		begin = nowNsec();
+		for (uint64_t k = 0; k < count; k++)
+			gc_sink += testRows[i]->get_data(textIndexes)[0].length();
+		report(std::string("CachedRow::get_data text column, ").append(names[i]), 1, count, nowNsec() - begin);
+
+		begin = nowNsec();
+		for (uint64_t k = 0; k < count; k++)
+			gc_sink += testRows[i]->get_data(otherIndexes).size();
+		report(std::string("CachedRow::get_data other columns, ").append(names[i]), 1, count, nowNsec() - begin);
+	}
+
+	printf("%-48s raw %zu bytes, compressed %zu bytes\n", "row memory, text column", plainRow.memoryBytes(), compressedRow.memoryBytes());
+	fflush(stdout);
+}
+
+//===============================================//
+//-- Processor paths
+//===============================================//
+class ProcessorBench
+{
+	TableCacheProcessorPtr _processor;
+	const BenchOptions& _options;
+	FPQuestPtr _fetchQuest;
+
+public:
+	ProcessorBench(const BenchOptions& options): _options(options)
+	{
+		_processor = std::make_shared<TableCacheProcessor>();
+		_fetchQuest = FPQWriter::emptyQuest("fetch");
+	}
+
+	void resetCache(int64_t cacheSize)
+	{
+		WKeeper wlock(&_processor->_rwlocker);
+		_processor->_cachaMap.reset(new TableCacheProcessor::CacheMap((size_t)cacheSize));
+		_processor->_tableDataIndexes.clear();
+	}
+
+	TABLEPtr registerTable(const std::string& tableName)
+	{
+		TableDescription desc;
+		desc.splitHint = "hintId";
+		desc.columns = buildColumns(_options.columnCount);
+		TABLEPtr scheme = std::make_shared<TABLE>(tableName, desc.splitHint, desc.columns);
+
+		WKeeper wlock(&_processor->_rwlocker);
+		_processor->registerTable(tableName, scheme, desc);
+		return scheme;
+	}
+
+	void addRows(TABLEPtr scheme, int64_t from, int64_t to)
+	{
+		const int64_t batchSize = 100;
+		std::vector<std::vector<std::string>> rows;
+		for (int64_t hintId = from; hintId < to; hintId++)
+		{
+			rows.push_back(buildRowData(hintId, _options.columnCount, _options.valueSize));
+			if ((int64_t)rows.size() == batchSize)
+			{
+				_processor->addRows(scheme, rows);
+				rows.clear();
+			}
+		}
+		if (rows.size())
+			_processor->addRows(scheme, rows);
+	}
+
+	void benchAddRows(int64_t cacheSize, const std::string& suffix)
+	{
+		for (int threads: _options.threadCounts)
+		{
+			resetCache(cacheSize);
+			TABLEPtr scheme = registerTable("bench_table");
+			int64_t rowsPerThread = cacheSize / threads;
+
+			//-- Row building is inside the timed section, as FetchRowCallback builds its rows too.
+			int64_t nsec = runThreads(threads, [&](int threadIndex) {
+				addRows(scheme, threadIndex * rowsPerThread, (threadIndex + 1) * rowsPerThread);
+			});
+			report("addRows, batch 100" + suffix, threads, rowsPerThread * threads, nsec);
+		}
+	}
+
+	void benchFetch(int64_t cacheSize, const std::string& suffix)
+	{
+		resetCache(cacheSize);
+		TABLEPtr scheme = registerTable("bench_table");
+		addRows(scheme, 0, cacheSize);
+
+		std::vector<std::string> fields{ "field1", "field2" };
+		uint32_t sampleRates[] = { 0, 16 };
+		int batches[] = { 1, 16 };
+
+		for (uint32_t sampleRate: sampleRates)
+		{
+			_processor->_hotKeyTracker->setSampleRate(sampleRate);
+			for (int batch: batches)
+				for (int threads: _options.threadCounts)
+				{
+					uint64_t fetchesPerThread = 200000 / batch;
+					int64_t nsec = runThreads(threads, [&](int threadIndex) {
+						std::mt19937_64 random(threadIndex + 1);
+						for (uint64_t i = 0; i < fetchesPerThread; i++)
+						{
+							std::set<int64_t> hintIds;
+							for (int k = 0; k < batch; k++)
+								hintIds.insert((int64_t)(random() % (uint64_t)cacheSize));
+
+							FPAnswerPtr answer = _processor->real_fetch(_fetchQuest, "bench_table", scheme, fields, hintIds);
+							gc_sink += answer ? 1 : 0;
+						}
+					});
+
+					report(std::string("real_fetch hit, batch ").append(std::to_string(batch))
+						.append(", hotKeys sampleRate ").append(std::to_string(sampleRate)) + suffix,
+						threads, fetchesPerThread * threads, nsec);
+				}
+		}
+		_processor->_hotKeyTracker->setSampleRate((uint32_t)Setting::getInt("TableCache.hotKeys.sampleRate", 16));
+	}
+
+	void benchInvalidation(int64_t cacheSize, const std::string& suffix)
+	{
+		for (int threads: _options.threadCounts)
+		{
+			resetCache(cacheSize);
+			TABLEPtr scheme = registerTable("bench_table");
+			addRows(scheme, 0, cacheSize);
+
+			int64_t rowsPerThread = cacheSize / threads;
+			int64_t nsec = runThreads(threads, [&](int threadIndex) {
+				for (int64_t hintId = threadIndex * rowsPerThread; hintId < (threadIndex + 1) * rowsPerThread; hintId++)
+					_processor->cleanCache("bench_table", hintId);
+			});
+			report("cleanCache, per row" + suffix, threads, rowsPerThread * threads, nsec);
+		}
+
+		//-- Other tables stay cached, as the per-table index is what dropTable walks.
+		resetCache(cacheSize * 2);
+		TABLEPtr other = registerTable("bench_other");
+		addRows(other, 0, cacheSize);
+
+		TABLEPtr scheme = registerTable("bench_table");
+		addRows(scheme, 0, cacheSize);
+
+		int64_t begin = nowNsec();
+		_processor->dropTable("bench_table");
+		report("dropTable, per cached row" + suffix, 1, cacheSize, nowNsec() - begin);
+	}
+
+	//-- Warm restart: dumpSnapshotFile(), then the load loop of loadSnapshot() without the desc check against DBProxy.
+	void benchSnapshot(int64_t rowCount, const std::string& path)
+	{
+		std::string suffix = std::string(" [").append(std::to_string(rowCount)).append("]");
+		resetCache(rowCount);
+		TABLEPtr scheme = registerTable("bench_table");
+		addRows(scheme, 0, rowCount);
+
+		_processor->_snapshotFile = path;
+		_processor->_invalidationJournal = std::make_shared<InvalidationJournal>();
+		_processor->_invalidationJournal->open(path + ".journal", 0, 0, 100);
+
+		int64_t begin = nowNsec();
+		bool dumped = _processor->dumpSnapshotFile();
+		int64_t nsec = nowNsec() - begin;
+		if (!dumped)
+		{
+			printf("snapshot dump to %s failed.\n", path.c_str());
+			return;
+		}
+		report("snapshot dump" + suffix, 1, (uint64_t)rowCount, nsec);
+
+		struct stat st;
+		if (stat(path.c_str(), &st) == 0)
+			printf("%-48s %.1f MB, %.1f bytes/row\n", "", st.st_size / 1048576.0, (double)st.st_size / rowCount);
+
+		resetCache(rowCount);
+		scheme = registerTable("bench_table");
+
+		begin = nowNsec();
+		SnapshotFileReader reader;
+		int64_t loadedRows = 0;
+		std::string tableName, splitHint;
+		std::vector<std::vector<std::string>> desc, rows;
+		bool completed = false;
+		if (reader.open(path))
+		{
+			while (!completed)
+			{
+				SnapshotFileReader::BlockType block = reader.nextBlock();
+				if (block == SnapshotFileReader::TableBlock)
+				{
+					if (!reader.readTableHeader(tableName, splitHint, desc))
+						break;
+				}
+				else if (block == SnapshotFileReader::RowsBlock)
+				{
+					if (!reader.readRows(desc.size(), rows))
+						break;
+
+					_processor->addRows(scheme, rows);
+					loadedRows += (int64_t)rows.size();
+				}
+				else if (block == SnapshotFileReader::FileEnd)
+				{
+					int64_t totalRows;
+					completed = reader.readFileEnd(totalRows);
+				}
+				else if (block != SnapshotFileReader::TableEndBlock)
+					break;
+			}
+		}
+		nsec = nowNsec() - begin;
+		if (!completed)
+			printf("snapshot %s is not loaded completely.\n", path.c_str());
+		report("snapshot load" + suffix, 1, (uint64_t)loadedRows, nsec);
+
+		_processor->_invalidationJournal = nullptr;
+		_processor->_snapshotFile.clear();
+		unlink(path.c_str());
+		unlink((path + ".journal").c_str());
+		resetCache(1024);
+	}
+
+	void benchInfos(int64_t cacheSize, const std::string& suffix)
+	{
+		resetCache(cacheSize);
+		TABLEPtr scheme = registerTable("bench_table");
+		addRows(scheme, 0, cacheSize);
+
+		std::vector<std::string> fields{ "field1" };
+		for (int threads: _options.threadCounts)
+		{
+			std::atomic<bool> running(true);
+			std::atomic<uint64_t> fetchCount(0);
+			uint64_t infosCount = 0;
+			int64_t infosNsec = 0;
+
+			int64_t nsec = runThreads(threads + 1, [&](int threadIndex) {
+				if (threadIndex == threads)
+				{
+					int64_t end = nowNsec() + 1000000000LL;
+					while (nowNsec() < end)
+					{
+						int64_t begin = nowNsec();
+						gc_sink += _processor->infos().size();
+						infosNsec += nowNsec() - begin;
+						infosCount++;
+					}
+					running = false;
+					return;
+				}
+
+				std::mt19937_64 random(threadIndex + 1);
+				uint64_t count = 0;
+				while (running)
+				{
+					std::set<int64_t> hintIds{ (int64_t)(random() % (uint64_t)cacheSize) };
+					_processor->real_fetch(_fetchQuest, "bench_table", scheme, fields, hintIds);
+					count++;
+				}
+				fetchCount += count;
+			});
+
+			report("infos() with concurrent fetches" + suffix, 1, infosCount, infosCount ? infosNsec : 0);
+			report("  real_fetch during infos()" + suffix, threads, fetchCount, nsec);
+		}
+	}
+};
+
+void showUsage(const char* appname)
+{
+	std::cout<<"Usage: "<<std::endl;
+	std::cout<<"\t"<<appname<<" config [quick]"<<std::endl;
+	exit(1);
+}
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 2 || argc > 3)
+		showUsage(argv[0]);
+
+	if (!Setting::load(argv[1]))
+	{
+		std::cout<<"Config file error:"<< argv[1]<<std::endl;
+		return 1;
+	}
+
+	bool quick = (argc == 3 && strcmp(argv[2], "quick") == 0);
+
+	BenchOptions options;
+	options.columnCount = (int)Setting::getInt("CoreBench.columnCount", 8);
+	options.valueSize = (int)Setting::getInt("CoreBench.valueSize", 32);
+	if (quick)
+		options.cacheSizes = { 10000, 100000 };
+	else
+		options.cacheSizes = { 100000, 1000000 };
+
+	int maxThreads = (int)Setting::getInt("CoreBench.maxThreads", 8);
+	for (int threads = 1; threads <= maxThreads; threads *= 2)
+		options.threadCounts.push_back(threads);
+
+	benchTableKeyHash();
+	benchRowProjection(options);
+	benchRowCompression();
+	benchLruHashMap(options);
+	benchCacheMemory(options);
+	benchStringKeys(options);
+
+	ProcessorBench processorBench(options);
+	for (int64_t cacheSize: options.cacheSizes)
+	{
+		std::string suffix = std::string(" [").append(std::to_string(cacheSize)).append("]");
+		processorBench.benchAddRows(cacheSize, suffix);
+		processorBench.benchFetch(cacheSize, suffix);
+		processorBench.benchInvalidation(cacheSize, suffix);
+		processorBench.benchInfos(cacheSize, suffix);
+	}
+
+	int64_t snapshotRows = Setting::getInt("CoreBench.snapshotRows", 10000000);
+	processorBench.benchSnapshot(quick ? snapshotRows / 10 : snapshotRows,
+		Setting::getString("CoreBench.snapshotFile", "/tmp/tableCache-CoreBench.snapshot"));
+
+	return 0;
+}
@@ -0,0 +1,520 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "ignoreSignals.h"
+#include "TCPClient.h"
+#include "FPWriter.h"
+#include "FPReader.h"
+#include "LatencyHistogram.h"
+
+using namespace fpnn;
+
+struct BenchConfig
+{
+	std::string endpoint;
+	std::string table;
+	std::vector<std::string> fields;
+	std::string writeField;
+	std::string distribution;
+	std::string keyPrefix;
+	std::string output;
+	int connections;
+	int pipeline;
+	int duration;
+	int batchSize;
+	int valueSize;
+	int timeout;
+	int64_t keySpace;
+	int64_t keyOffset;
+	double writeRatio;
+	double zipfTheta;
+	double hotRatio;
+	double hotAccess;
+	bool stringKey;
+
+	BenchConfig(): distribution("uniform"), keyPrefix("key_"), connections(4), pipeline(8), duration(10),
+		batchSize(1), valueSize(16), timeout(5), keySpace(100000), keyOffset(0), writeRatio(0),
+		zipfTheta(0.99), hotRatio(0.01), hotAccess(0.9), stringKey(false) {}
+};
+
+//===============================================//
+//-- Key generators
+//===============================================//
+static std::mt19937_64& threadRandom()
+{
+	static thread_local std::mt19937_64 random(std::random_device{}() ^ std::hash<std::thread::id>()(std::this_thread::get_id()));
+	return random;
+}
+
+static double randomUnit()
+{
+	return (threadRandom()() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+class KeyGenerator
+{
+public:
+	virtual ~KeyGenerator() {}
+	virtual int64_t next() = 0;		//-- rank in [0, keySpace)
+};
+
+class UniformGenerator: public KeyGenerator
+{
+	int64_t _keySpace;
+
+public:
+	UniformGenerator(int64_t keySpace): _keySpace(keySpace) {}
+	virtual int64_t next() { return (int64_t)(threadRandom()() % (uint64_t)_keySpace); }
+};
+
+//-- Inverse CDF over precomputed cumulative weights. Rank 0 is the hottest key.
+class ZipfGenerator: public KeyGenerator
+{
+	std::vector<double> _cdf;
+
+public:
+	ZipfGenerator(int64_t keySpace, double theta): _cdf((size_t)keySpace)
+	{
+		double sum = 0;
+		for (int64_t i = 0; i < keySpace; i++)
+		{
+			sum += 1.0 / pow((double)(i + 1), theta);
+			_cdf[i] = sum;
+		}
+		for (auto& value: _cdf)
+			value /= sum;
+	}
+
+	virtual int64_t next()
+	{
+		auto it = std::lower_bound(_cdf.begin(), _cdf.end(), randomUnit());
+		if (it == _cdf.end())
+			return (int64_t)_cdf.size() - 1;
+
+		return (int64_t)(it - _cdf.begin());
+	}
+};
+
+//-- A small hot set takes hotAccess of requests, the rest sequentially scans the whole key space.
+class HotSetScanGenerator: public KeyGenerator
+{
+	int64_t _keySpace;
+	int64_t _hotCount;
+	double _hotAccess;
+	std::atomic<int64_t> _cursor;
+
+public:
+	HotSetScanGenerator(int64_t keySpace, double hotRatio, double hotAccess):
+		_keySpace(keySpace), _hotCount((int64_t)(keySpace * hotRatio)), _hotAccess(hotAccess), _cursor(0)
+	{
+		if (_hotCount < 1)
+			_hotCount = 1;
+	}
+
+	virtual int64_t next()
+	{
+		if (randomUnit() < _hotAccess)
+			return (int64_t)(threadRandom()() % (uint64_t)_hotCount);
+
+		return _cursor++ % _keySpace;
+	}
+};
+
+//===============================================//
+//-- Statistics
+//===============================================//
+struct OperationStatistics
+{
+	std::mutex mutex;
+	LatencyHistogram histogram;
+	uint64_t errorCount;
+	uint64_t timeoutCount;
+	uint64_t itemCount;
+
+	OperationStatistics(): errorCount(0), timeoutCount(0), itemCount(0) {}
+
+	void record(int64_t usec, int errorCode, bool failed, int items)
+	{
+		std::unique_lock<std::mutex> lck(mutex);
+		if (errorCode == FPNN_EC_CORE_TIMEOUT)
+			timeoutCount++;
+		else if (errorCode || failed)
+			errorCount++;
+		else
+		{
+			histogram.record(usec);
+			itemCount += items;
+		}
+	}
+};
+
+struct BenchConnection
+{
+	std::shared_ptr<TCPClient> client;
+	OperationStatistics reads;
+	OperationStatistics writes;
+};
+
+class Bench
+{
+	const BenchConfig& _config;
+	std::unique_ptr<KeyGenerator> _generator;
+	std::vector<std::shared_ptr<BenchConnection>> _connections;
+	std::atomic<bool> _running;
+	std::atomic<int> _outstanding;
+
+	void appendHintId(FPQWriter& qw, const char* name, int64_t rank)
+	{
+		int64_t key = _config.keyOffset + rank;
+		if (_config.stringKey)
+			qw.param(name, _config.keyPrefix + std::to_string(key));
+		else
+			qw.param(name, key);
+	}
+
+	FPQuestPtr buildFetch()
+	{
+		FPQWriter qw(3, "fetch");
+		qw.param("table", _config.table);
+
+		if (_config.batchSize == 1)
+			appendHintId(qw, "hintId", _generator->next());
+		else if (_config.stringKey)
+		{
+			std::vector<std::string> hintIds;
+			for (int i = 0; i < _config.batchSize; i++)
+				hintIds.push_back(_config.keyPrefix + std::to_string(_config.keyOffset + _generator->next()));
+
+			qw.param("hintIds", hintIds);
+		}
+		else
+		{
+			std::vector<int64_t> hintIds;
+			for (int i = 0; i < _config.batchSize; i++)
+				hintIds.push_back(_config.keyOffset + _generator->next());
+
+			qw.param("hintIds", hintIds);
+		}
+
+		qw.param("fields", _config.fields);
+		return qw.take();
+	}
+
+	FPQuestPtr buildModify()
+	{
+		std::string value(_config.valueSize, ' ');
+		for (auto& c: value)
+			c = 'a' + (char)(threadRandom()() % 26);
+
+		std::map<std::string, std::string> values;
+		values[_config.writeField] = value;
+
+		FPQWriter qw(3, "modify");
+		qw.param("table", _config.table);
+		appendHintId(qw, "hintId", _generator->next());
+		qw.param("values", values);
+		return qw.take();
+	}
+
+	//-- Keeps one in-flight quest on the connection: each answer issues the next quest.
+	void issue(std::shared_ptr<BenchConnection> connection)
+	{
+		while (_running)
+		{
+			bool isWrite = _config.writeRatio > 0 && randomUnit() < _config.writeRatio;
+			FPQuestPtr quest = isWrite ? buildModify() : buildFetch();
+			int64_t begin = latencyNowUsec();
+
+			bool status = connection->client->sendQuest(quest, [this, connection, isWrite, begin](FPAnswerPtr answer, int errorCode) {
+				bool failed = (errorCode == 0 && answer->status());
+				OperationStatistics& statistics = isWrite ? connection->writes : connection->reads;
+				statistics.record(latencyNowUsec() - begin, errorCode, failed, isWrite ? 1 : _config.batchSize);
+				issue(connection);
+			}, _config.timeout);
+
+			if (status)
+				return;
+
+			(isWrite ? connection->writes : connection->reads).record(0, FPNN_EC_CORE_UNKNOWN_ERROR, true, 0);
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		_outstanding--;
+	}
+
+public:
+	Bench(const BenchConfig& config): _config(config), _running(false), _outstanding(0)
+	{
+		if (config.distribution == "zipf")
+			_generator.reset(new ZipfGenerator(config.keySpace, config.zipfTheta));
+		else if (config.distribution == "hotset")
+			_generator.reset(new HotSetScanGenerator(config.keySpace, config.hotRatio, config.hotAccess));
+		else
+			_generator.reset(new UniformGenerator(config.keySpace));
+	}
+
+	void run(double& elapsedSeconds)
+	{
+		for (int i = 0; i < _config.connections; i++)
+		{
+			std::shared_ptr<BenchConnection> connection = std::make_shared<BenchConnection>();
+			connection->client = TCPClient::createClient(_config.endpoint);
+			_connections.push_back(connection);
+		}
+
+		_running = true;
+		int64_t begin = latencyNowUsec();
+		for (auto& connection: _connections)
+			for (int i = 0; i < _config.pipeline; i++)
+			{
+				_outstanding++;
+				issue(connection);
+			}
+
+		std::this_thread::sleep_for(std::chrono::seconds(_config.duration));
+		_running = false;
+		int64_t end = latencyNowUsec();
+
+		//-- Wait in-flight quests, at most timeout + 1 seconds.
+		int64_t waitDeadline = end + (_config.timeout + 1) * 1000000LL;
+		while (_outstanding > 0 && latencyNowUsec() < waitDeadline)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+		elapsedSeconds = (end - begin) / 1000000.0;
+	}
+
+	void merge(LatencyHistogram& histogram, uint64_t& errors, uint64_t& timeouts, uint64_t& items, bool isWrite)
+	{
+		for (auto& connection: _connections)
+		{
+			OperationStatistics& statistics = isWrite ? connection->writes : connection->reads;
+			std::unique_lock<std::mutex> lck(statistics.mutex);
+			histogram.merge(statistics.histogram);
+			errors += statistics.errorCount;
+			timeouts += statistics.timeoutCount;
+			items += statistics.itemCount;
+		}
+	}
+};
+
+//===============================================//
+//-- Server side hit counters, parsed from *infos.
+//===============================================//
+static int64_t findCounter(const std::string& infos, const char* name)
+{
+	size_t pos = infos.find(name);
+	if (pos == std::string::npos)
+		return -1;
+
+	pos += strlen(name);
+	while (pos < infos.size() && !isdigit((unsigned char)infos[pos]))
+		pos++;
+
+	return atoll(infos.c_str() + pos);
+}
+
+static bool fetchHitCounters(const std::string& endpoint, int64_t& itemFetchCount, int64_t& itemHitCount)
+{
+	std::shared_ptr<TCPClient> client = TCPClient::createClient(endpoint);
+	FPQWriter qw(0, "*infos");
+	FPAnswerPtr answer = client->sendQuest(qw.take());
+	if (!answer || answer->status())
+		return false;
+
+	std::string infos = answer->json();
+	itemFetchCount = findCounter(infos, "itemFetchCount");
+	itemHitCount = findCounter(infos, "itemHitCount");
+	return itemFetchCount >= 0 && itemHitCount >= 0;
+}
+
+//===============================================//
+//-- Report
+//===============================================//
+static void appendOperation(std::ostringstream& os, const char* name, const LatencyHistogram& histogram,
+	uint64_t errors, uint64_t timeouts, uint64_t items, double seconds)
+{
+	os<<"\""<<name<<"\":{";
+	os<<"\"count\":"<<histogram.count();
+	os<<",\"qps\":"<<(uint64_t)(histogram.count() / seconds);
+	os<<",\"itemsPerSecond\":"<<(uint64_t)(items / seconds);
+	os<<",\"errors\":"<<errors;
+	os<<",\"timeouts\":"<<timeouts;
+	os<<",\"mean\":"<<histogram.mean();
+	os<<",\"p50\":"<<histogram.percentile(50);
+	os<<",\"p90\":"<<histogram.percentile(90);
+	os<<",\"p99\":"<<histogram.percentile(99);
+	os<<",\"p999\":"<<histogram.percentile(99.9);
+	os<<",\"max\":"<<histogram.max();
+	os<<"}";
+}
+
+void showUsage(const char* appname)
+{
+	std::cout<<"Usage: "<<std::endl;
+	std::cout<<"\t"<<appname<<" host:port <table> [options] -f field1 [field2 ...]"<<std::endl;
+	std::cout<<"Options:"<<std::endl;
+	std::cout<<"\t-c <connections>          default 4"<<std::endl;
+	std::cout<<"\t-p <pipeline depth>       in-flight quests per connection, default 8"<<std::endl;
+	std::cout<<"\t-t <seconds>              duration, default 10"<<std::endl;
+	std::cout<<"\t-b <batch size>           hintIds per fetch, default 1"<<std::endl;
+	std::cout<<"\t-k <key space>            default 100000"<<std::endl;
+	std::cout<<"\t-o <key offset>           first hintId, default 0"<<std::endl;
+	std::cout<<"\t-s [prefix]               string hintIds: prefix + number, default prefix key_"<<std::endl;
+	std::cout<<"\t-d < uniform | zipf [theta] | hotset [hotRatio hotAccess] >"<<std::endl;
+	std::cout<<"\t                          default uniform; zipf theta 0.99; hotset 0.01 0.9"<<std::endl;
+	std::cout<<"\t-w <ratio> <field> [size] modify ratio, modified field and value size (default 16)"<<std::endl;
+	std::cout<<"\t-r <file>                 write JSON result to file, default stdout"<<std::endl;
+	std::cout<<"\t-q <seconds>              quest timeout, default 5"<<std::endl;
+	exit(1);
+}
+
+static bool isNumber(const char* str)
+{
+	return str && (isdigit((unsigned char)str[0]) || str[0] == '.');
+}
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 5)
+		showUsage(argv[0]);
+
+	ignoreSignals();
+
+	BenchConfig config;
+	config.endpoint = argv[1];
+	config.table = argv[2];
+
+	int idx = 3;
+	while (idx < argc)
+	{
+		std::string opt = argv[idx++];
+		const char* value = (idx < argc) ? argv[idx] : NULL;
+
+		if (opt == "-f")
+		{
+			while (idx < argc)
+				config.fields.push_back(argv[idx++]);
+		}
+		else if (opt == "-s")
+		{
+			config.stringKey = true;
+			if (value && value[0] != '-')
+			{
+				config.keyPrefix = value;
+				idx++;
+			}
+		}
+		else if (opt == "-d" && value)
+		{
+			config.distribution = value;
+			idx++;
+			if (config.distribution == "zipf" && idx < argc && isNumber(argv[idx]))
+				config.zipfTheta = atof(argv[idx++]);
+			else if (config.distribution == "hotset" && idx + 1 < argc && isNumber(argv[idx]))
+			{
+				config.hotRatio = atof(argv[idx++]);
+				config.hotAccess = atof(argv[idx++]);
+			}
+			else if (config.distribution != "uniform" && config.distribution != "zipf" && config.distribution != "hotset")
+				showUsage(argv[0]);
+		}
+		else if (opt == "-w" && idx + 1 < argc)
+		{
+			config.writeRatio = atof(argv[idx++]);
+			config.writeField = argv[idx++];
+			if (idx < argc && isNumber(argv[idx]))
+				config.valueSize = atoi(argv[idx++]);
+		}
+		else if (value)
+		{
+			idx++;
+			if (opt == "-c") config.connections = atoi(value);
+			else if (opt == "-p") config.pipeline = atoi(value);
+			else if (opt == "-t") config.duration = atoi(value);
+			else if (opt == "-b") config.batchSize = atoi(value);
+			else if (opt == "-k") config.keySpace = atoll(value);
+			else if (opt == "-o") config.keyOffset = atoll(value);
+			else if (opt == "-r") config.output = value;
+			else if (opt == "-q") config.timeout = atoi(value);
+			else
+				showUsage(argv[0]);
+		}
+		else
+			showUsage(argv[0]);
+	}
+
+	if (config.fields.empty() || config.connections < 1 || config.pipeline < 1 || config.duration < 1
+		|| config.batchSize < 1 || config.keySpace < 1 || config.timeout < 1)
+		showUsage(argv[0]);
+
+	int64_t fetchBefore = 0, hitBefore = 0, fetchAfter = 0, hitAfter = 0;
+	bool haveHitCounters = fetchHitCounters(config.endpoint, fetchBefore, hitBefore);
+
+	Bench bench(config);
+	double seconds = 0;
+	bench.run(seconds);
+
+	haveHitCounters = haveHitCounters && fetchHitCounters(config.endpoint, fetchAfter, hitAfter);
+
+	LatencyHistogram reads, writes;
+	uint64_t readErrors = 0, readTimeouts = 0, readItems = 0;
+	uint64_t writeErrors = 0, writeTimeouts = 0, writeItems = 0;
+	bench.merge(reads, readErrors, readTimeouts, readItems, false);
+	bench.merge(writes, writeErrors, writeTimeouts, writeItems, true);
+
+	std::ostringstream os;
+	os<<"{\"config\":{";
+	os<<"\"endpoint\":\""<<config.endpoint<<"\"";
+	os<<",\"table\":\""<<config.table<<"\"";
+	os<<",\"connections\":"<<config.connections;
+	os<<",\"pipeline\":"<<config.pipeline;
+	os<<",\"duration\":"<<config.duration;
+	os<<",\"batchSize\":"<<config.batchSize;
+	os<<",\"keySpace\":"<<config.keySpace;
+	os<<",\"keyType\":\""<<(config.stringKey ? "string" : "int")<<"\"";
+	os<<",\"distribution\":\""<<config.distribution<<"\"";
+	if (config.distribution == "zipf")
+		os<<",\"zipfTheta\":"<<config.zipfTheta;
+	else if (config.distribution == "hotset")
+		os<<",\"hotRatio\":"<<config.hotRatio<<",\"hotAccess\":"<<config.hotAccess;
+	os<<",\"writeRatio\":"<<config.writeRatio;
+	os<<"},\"elapsed\":"<<seconds;
+	os<<",\"qps\":"<<(uint64_t)((reads.count() + writes.count()) / seconds)<<",";
+
+	appendOperation(os, "fetch", reads, readErrors, readTimeouts, readItems, seconds);
+	os<<",";
+	appendOperation(os, "modify", writes, writeErrors, writeTimeouts, writeItems, seconds);
+
+	if (haveHitCounters && fetchAfter > fetchBefore)
+	{
+		int64_t fetched = fetchAfter - fetchBefore;
+		int64_t hit = hitAfter - hitBefore;
+		os<<",\"server\":{\"itemFetchCount\":"<<fetched<<",\"itemHitCount\":"<<hit;
+		os<<",\"hitRatio\":"<<((double)hit / fetched)<<"}";
+	}
+	os<<"}";
+
+	if (config.output.empty())
+		std::cout<<os.str()<<std::endl;
+	else
+	{
+		std::ofstream ofs(config.output.c_str());
+		ofs<<os.str()<<std::endl;
+		if (!ofs)
+		{
+			std::cout<<"Write result file "<<config.output<<" failed."<<std::endl;
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,335 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+#include "StringUtil.h"
+#include "CacheSimulator.h"
+#include "TrafficCapture.h"
+
+using namespace fpnn;
+
+struct TraceEvent
+{
+	uint32_t table;
+	bool invalidate;
+	int64_t hintId;
+};
+
+struct SimConfig
+{
+	std::string traceFile;
+	std::string output;
+	std::vector<size_t> capacities;
+	std::vector<SimulatedCache::Policy> policies;
+	double sampleRatio;
+	bool applyWrites;
+
+	SimConfig(): sampleRatio(0), applyWrites(true) {}
+};
+
+class TraceLoader
+{
+	std::vector<std::string> _tables;
+	std::unordered_map<std::string, uint32_t> _tableIndexes;
+
+	uint32_t tableIndex(const std::string& tableName)
+	{
+		auto it = _tableIndexes.find(tableName);
+		if (it != _tableIndexes.end())
+			return it->second;
+
+		uint32_t index = (uint32_t)_tables.size();
+		_tables.push_back(tableName);
+		_tableIndexes[tableName] = index;
+		return index;
+	}
+
+	//-- string keys are folded into the int64 key space, as the simulator only needs identities.
+	static int64_t stringKeyId(const std::string& hintString)
+	{
+		uint64_t high = jenkins_hash(hintString.data(), hintString.length(), 0);
+		uint64_t low = jenkins_hash(hintString.data(), hintString.length(), 0x5bd1e995);
+		return (int64_t)((high << 32) | low);
+	}
+
+	void append(std::vector<TraceEvent>& events, const TrafficRecord& record, bool invalidate)
+	{
+		TraceEvent event;
+		event.table = tableIndex(record.tableName);
+		event.invalidate = invalidate;
+
+		if (record.stringKey)
+			for (auto& hintString: record.hintStrings)
+			{
+				event.hintId = stringKeyId(hintString);
+				events.push_back(event);
+			}
+		else
+			for (int64_t hintId: record.hintIds)
+			{
+				event.hintId = hintId;
+				events.push_back(event);
+			}
+	}
+
+	bool loadCapture(const std::string& path, std::vector<TraceEvent>& events, bool applyWrites)
+	{
+		TrafficReader reader;
+		if (!reader.open(path))
+			return false;
+
+		TrafficRecord record;
+		while (reader.next(record))
+		{
+			if (record.kind == TrafficRecord::Fetch)
+				append(events, record, false);
+			else if (applyWrites && record.kind != TrafficRecord::InvalidateTable)
+				append(events, record, true);
+		}
+		return true;
+	}
+
+	//-- text trace: one "table hintId" per line, "-table hintId" for an invalidation.
+	bool loadText(const std::string& path, std::vector<TraceEvent>& events, bool applyWrites)
+	{
+		std::ifstream ifs(path.c_str());
+		if (!ifs)
+			return false;
+
+		std::string line;
+		while (std::getline(ifs, line))
+		{
+			std::istringstream is(line);
+			std::string tableName;
+			int64_t hintId;
+			if (!(is>>tableName>>hintId) || tableName.empty() || tableName[0] == '#')
+				continue;
+
+			TraceEvent event;
+			event.invalidate = (tableName[0] == '-');
+			if (event.invalidate)
+			{
+				if (!applyWrites)
+					continue;
+				tableName = tableName.substr(1);
+			}
+
+			event.table = tableIndex(tableName);
+			event.hintId = hintId;
+			events.push_back(event);
+		}
+		return true;
+	}
+
+public:
+	bool load(const std::string& path, std::vector<TraceEvent>& events, bool applyWrites)
+	{
+		if (loadCapture(path, events, applyWrites))
+			return true;
+
+		return loadText(path, events, applyWrites);
+	}
+
+	const std::string& tableName(uint32_t index) const { return _tables[index]; }
+};
+
+struct SimResult
+{
+	SimulatedCache::Policy policy;
+	size_t capacity;
+	double hitRatio;
+};
+
+void showUsage(const char* appname)
+{
+	std::cout<<"Usage: "<<std::endl;
+	std::cout<<"\t"<<appname<<" <capture file | text trace> [options]"<<std::endl;
+	std::cout<<"Options:"<<std::endl;
+	std::cout<<"\t-c <capacities>   comma separated rows count, default 1%,2%,5%,10%,20%,50%,100% of distinct keys"<<std::endl;
+	std::cout<<"\t-p <policies>     comma separated, lru and/or fifo, default lru,fifo"<<std::endl;
+	std::cout<<"\t-s <ratio>        also estimate the LRU curve with SHARDS sampling at ratio, as the server does online"<<std::endl;
+	std::cout<<"\t-i                ignore modify, delete & invalidations in the trace"<<std::endl;
+	std::cout<<"\t-r <file>         write JSON result to file, default stdout"<<std::endl;
+	std::cout<<"Text trace: one \"table hintId\" per line; \"-table hintId\" invalidates."<<std::endl;
+	exit(1);
+}
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 2)
+		showUsage(argv[0]);
+
+	SimConfig config;
+	config.traceFile = argv[1];
+
+	int idx = 2;
+	while (idx < argc)
+	{
+		std::string opt = argv[idx++];
+		if (opt == "-i")
+		{
+			config.applyWrites = false;
+			continue;
+		}
+
+		if (idx >= argc)
+			showUsage(argv[0]);
+
+		const char* value = argv[idx++];
+		if (opt == "-c")
+		{
+			std::vector<std::string> items;
+			StringUtil::split(value, ",", items);
+			for (auto& item: items)
+				if (atoll(item.c_str()) > 0)
+					config.capacities.push_back((size_t)atoll(item.c_str()));
+		}
+		else if (opt == "-p")
+		{
+			std::vector<std::string> items;
+			StringUtil::split(value, ",", items);
+			for (auto& item: items)
+			{
+				if (item == "lru") config.policies.push_back(SimulatedCache::LRU);
+				else if (item == "fifo") config.policies.push_back(SimulatedCache::FIFO);
+				else
+					showUsage(argv[0]);
+			}
+		}
+		else if (opt == "-s") config.sampleRatio = atof(value);
+		else if (opt == "-r") config.output = value;
+		else
+			showUsage(argv[0]);
+	}
+
+	if (config.policies.empty())
+	{
+		config.policies.push_back(SimulatedCache::LRU);
+		config.policies.push_back(SimulatedCache::FIFO);
+	}
+
+	TraceLoader loader;
+	std::vector<TraceEvent> events;
+	if (!loader.load(config.traceFile, events, config.applyWrites))
+	{
+		std::cout<<"Open trace file "<<config.traceFile<<" failed."<<std::endl;
+		return 1;
+	}
+
+	std::vector<uint64_t> keys;
+	std::unordered_set<uint64_t> distinctKeys;
+	uint64_t accessCount = 0;
+
+	keys.reserve(events.size());
+	for (auto& event: events)
+	{
+		uint64_t key = simulatedKeyHash(loader.tableName(event.table), event.hintId);
+		keys.push_back(key);
+		if (!event.invalidate)
+		{
+			distinctKeys.insert(key);
+			accessCount++;
+		}
+	}
+
+	if (config.capacities.empty())
+	{
+		const double fractions[] = { 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1 };
+		for (double fraction: fractions)
+		{
+			size_t capacity = (size_t)(distinctKeys.size() * fraction);
+			if (capacity && (config.capacities.empty() || config.capacities.back() != capacity))
+				config.capacities.push_back(capacity);
+		}
+	}
+	std::sort(config.capacities.begin(), config.capacities.end());
+
+	std::vector<SimResult> results;
+	for (auto policy: config.policies)
+		for (size_t capacity: config.capacities)
+		{
+			SimulatedCache cache(policy, capacity);
+			for (size_t i = 0; i < keys.size(); i++)
+			{
+				if (events[i].invalidate)
+					cache.invalidate(keys[i]);
+				else
+					cache.access(keys[i]);
+			}
+
+			SimResult result;
+			result.policy = policy;
+			result.capacity = capacity;
+			result.hitRatio = cache.hitRatio();
+			results.push_back(result);
+		}
+
+	std::string estimated;
+	if (config.sampleRatio > 0 && config.capacities.size())
+	{
+		MissRatioEstimator estimator(config.sampleRatio, config.capacities);
+		std::vector<int64_t> hintIds(1);
+		for (auto& event: events)
+		{
+			const std::string& tableName = loader.tableName(event.table);
+			if (event.invalidate)
+				estimator.invalidate(tableName, event.hintId);
+			else
+			{
+				hintIds[0] = event.hintId;
+				estimator.access(tableName, hintIds);
+			}
+		}
+		estimated = estimator.infos();
+	}
+
+	std::ostringstream os;
+	os<<"{\"traceFile\":\""<<config.traceFile<<"\"";
+	os<<",\"accesses\":"<<accessCount;
+	os<<",\"invalidations\":"<<(events.size() - accessCount);
+	os<<",\"distinctKeys\":"<<distinctKeys.size();
+
+	for (auto policy: config.policies)
+	{
+		os<<",\""<<SimulatedCache::policyName(policy)<<"\":[";
+		bool first = true;
+		for (auto& result: results)
+		{
+			if (result.policy != policy)
+				continue;
+
+			if (!first)
+				os<<",";
+			first = false;
+
+			char buf[32];
+			snprintf(buf, sizeof(buf), "%.4f", result.hitRatio);
+			os<<"{\"capacity\":"<<result.capacity<<",\"hitRatio\":"<<buf<<"}";
+		}
+		os<<"]";
+	}
+
+	if (estimated.size())
+		os<<",\"shards\":"<<estimated;
+	os<<"}";
+
+	if (config.output.empty())
+		std::cout<<os.str()<<std::endl;
+	else
+	{
+		std::ofstream ofs(config.output.c_str());
+		ofs<<os.str()<<std::endl;
+		if (!ofs)
+		{
+			std::cout<<"Write result file "<<config.output<<" failed."<<std::endl;
+			return 1;
+		}
+	}
+
+	return 0;
+}
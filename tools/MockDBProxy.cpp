@@ -0,0 +1,581 @@
+#include <iostream>
+#include <random>
+#include <mutex>
+#include <queue>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <string.h>
+#include <stdlib.h>
+#include "jenkins.h"
+#include "TCPEpollServer.h"
+#include "IQuestProcessor.h"
+#include "FPWriter.h"
+#include "FPReader.h"
+#include "Setting.h"
+#include "FPLog.h"
+
+using namespace fpnn;
+
+/*
+	Mock DBProxy: answers the quests TableCache sends (query, iQuery, sQuery, splitInfo, "desc <table>").
+	Every requested table exists, with the same generated scheme. Rows are generated from the hintId
+	on demand, written rows and deleted keys are kept in memory.
+*/
+struct MockStatistics
+{
+	std::atomic<uint64_t> descCount;
+	std::atomic<uint64_t> splitInfoCount;
+	std::atomic<uint64_t> selectCount;
+	std::atomic<uint64_t> selectKeyCount;
+	std::atomic<uint64_t> selectRowCount;
+	std::atomic<uint64_t> writeCount;
+	std::atomic<uint64_t> deleteCount;
+	std::atomic<uint64_t> injectedErrorCount;
+	std::atomic<uint64_t> droppedCount;
+	std::atomic<uint64_t> invalidQuestCount;
+
+	MockStatistics(): descCount(0), splitInfoCount(0), selectCount(0), selectKeyCount(0), selectRowCount(0),
+		writeCount(0), deleteCount(0), injectedErrorCount(0), droppedCount(0), invalidQuestCount(0) {}
+};
+
+//-- Sends answers when their delay expires.
+class DelayedAnswerSender
+{
+	struct DelayedAnswer
+	{
+		int64_t dueMsec;
+		IAsyncAnswerPtr async;
+		FPAnswerPtr answer;
+
+		bool operator < (const DelayedAnswer& other) const { return dueMsec > other.dueMsec; }
+	};
+
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	std::priority_queue<DelayedAnswer> _queue;
+	bool _running;
+	std::thread _thread;
+
+	static int64_t nowMsec()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void loop()
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		while (_running)
+		{
+			if (_queue.empty())
+			{
+				_condition.wait(lck);
+				continue;
+			}
+
+			int64_t now = nowMsec();
+			if (_queue.top().dueMsec > now)
+			{
+				_condition.wait_for(lck, std::chrono::milliseconds(_queue.top().dueMsec - now));
+				continue;
+			}
+
+			DelayedAnswer delayed = _queue.top();
+			_queue.pop();
+
+			lck.unlock();
+			delayed.async->sendAnswer(delayed.answer);
+			lck.lock();
+		}
+	}
+
+public:
+	DelayedAnswerSender(): _running(true)
+	{
+		_thread = std::thread(&DelayedAnswerSender::loop, this);
+	}
+
+	~DelayedAnswerSender()
+	{
+		{
+			std::unique_lock<std::mutex> lck(_mutex);
+			_running = false;
+			_condition.notify_one();
+		}
+		_thread.join();
+	}
+
+	void send(IAsyncAnswerPtr async, FPAnswerPtr answer, int delayMsec)
+	{
+		DelayedAnswer delayed;
+		delayed.dueMsec = nowMsec() + delayMsec;
+		delayed.async = async;
+		delayed.answer = answer;
+
+		std::unique_lock<std::mutex> lck(_mutex);
+		_queue.push(delayed);
+		_condition.notify_one();
+	}
+};
+
+class MockDBProxyProcessor: public IQuestProcessor
+{
+	QuestProcessorClassPrivateFields(MockDBProxyProcessor)
+
+	typedef std::unordered_map<std::string, std::string> RowValues;		//-- column => value
+
+	struct MockTable
+	{
+		std::unordered_map<std::string, RowValues> writtenRows;
+		std::unordered_set<std::string> deletedKeys;
+	};
+
+	//-- scheme
+	std::string _hintField;
+	bool _stringHint;
+	std::vector<std::string> _columns;		//-- hint field first.
+	int _valueSize;
+	int64_t _rowCount;
+	double _missingRatio;
+
+	//-- faults, tunable at runtime.
+	std::atomic<int> _minLatencyMsec;
+	std::atomic<int> _maxLatencyMsec;
+	std::atomic<int> _errorPermyriad;
+	std::atomic<int> _errorCode;
+	std::atomic<int> _dropPermyriad;
+	std::atomic<int> _dropHoldMsec;
+
+	std::mutex _mutex;
+	std::unordered_map<std::string, MockTable> _tables;
+
+	MockStatistics _statistics;
+	DelayedAnswerSender _sender;
+
+	static std::mt19937_64& threadRandom()
+	{
+		static thread_local std::mt19937_64 random(std::random_device{}());
+		return random;
+	}
+
+	static std::string trim(const std::string& str)
+	{
+		size_t begin = str.find_first_not_of(" \t`'");
+		if (begin == std::string::npos)
+			return std::string();
+
+		size_t end = str.find_last_not_of(" \t`'");
+		return str.substr(begin, end - begin + 1);
+	}
+
+	static std::vector<std::string> splitList(const std::string& str)
+	{
+		std::vector<std::string> items;
+		size_t begin = 0;
+		while (begin <= str.size())
+		{
+			size_t end = str.find(',', begin);
+			if (end == std::string::npos)
+				end = str.size();
+
+			std::string item = trim(str.substr(begin, end - begin));
+			if (item.size())
+				items.push_back(item);
+
+			begin = end + 1;
+		}
+		return items;
+	}
+
+	static std::string lowerPrefix(const std::string& sql, size_t len)
+	{
+		std::string prefix = sql.substr(0, len);
+		for (auto& c: prefix)
+			c = tolower(c);
+		return prefix;
+	}
+
+	bool generatedRowExists(const std::string& key)
+	{
+		if (!_stringHint && _rowCount > 0)
+		{
+			int64_t hintId = atoll(key.c_str());
+			if (hintId < 0 || hintId >= _rowCount)
+				return false;
+		}
+
+		if (_missingRatio <= 0)
+			return true;
+
+		uint32_t hash = jenkins_hash(key.data(), key.length(), 0x4D6F636B);
+		return (hash % 10000) >= (uint32_t)(_missingRatio * 10000);
+	}
+
+	std::string generatedValue(const std::string& key, size_t columnIndex)
+	{
+		std::string value(_valueSize, ' ');
+		uint32_t seed = jenkins_hash(key.data(), key.length(), (uint32_t)columnIndex);
+		for (auto& c: value)
+		{
+			seed = seed * 1103515245 + 12345;
+			c = 'a' + (char)((seed >> 16) % 26);
+		}
+		return value;
+	}
+
+	//-- caller must hold _mutex.
+	bool buildRow(MockTable& table, const std::string& key, const std::vector<std::string>& selectColumns, std::vector<std::string>& row)
+	{
+		if (table.deletedKeys.find(key) != table.deletedKeys.end())
+			return false;
+
+		auto it = table.writtenRows.find(key);
+		if (it == table.writtenRows.end() && !generatedRowExists(key))
+			return false;
+
+		row.clear();
+		for (const auto& column: selectColumns)
+		{
+			if (column == "''")
+			{
+				row.push_back(std::string());		//-- placeholder of columns not selected, as TableCache hot columns do.
+				continue;
+			}
+
+			if (column == _hintField)
+			{
+				row.push_back(key);
+				continue;
+			}
+
+			if (it != table.writtenRows.end())
+			{
+				auto vit = it->second.find(column);
+				if (vit != it->second.end())
+				{
+					row.push_back(vit->second);
+					continue;
+				}
+			}
+
+			size_t columnIndex = 0;
+			while (columnIndex < _columns.size() && _columns[columnIndex] != column)
+				columnIndex++;
+
+			row.push_back(generatedValue(key, columnIndex));
+		}
+		return true;
+	}
+
+	FPAnswerPtr finish(const FPQuestPtr quest, FPAnswerPtr answer)
+	{
+		int64_t random = (int64_t)(threadRandom()() % 10000);
+		if (random < _dropPermyriad)
+		{
+			_statistics.droppedCount++;
+			_sender.send(genAsyncAnswer(quest), FPAWriter::errorAnswer(quest, 20001, "Dropped by mock.", "MockDBProxy"), _dropHoldMsec);
+			return nullptr;
+		}
+
+		random = (int64_t)(threadRandom()() % 10000);
+		if (random < _errorPermyriad)
+		{
+			_statistics.injectedErrorCount++;
+			answer = FPAWriter::errorAnswer(quest, _errorCode, "Error injected by mock.", "MockDBProxy");
+		}
+
+		int minLatency = _minLatencyMsec;
+		int maxLatency = _maxLatencyMsec;
+		int latency = minLatency;
+		if (maxLatency > minLatency)
+			latency += (int)(threadRandom()() % (uint64_t)(maxLatency - minLatency + 1));
+
+		if (latency <= 0)
+			return answer;
+
+		_sender.send(genAsyncAnswer(quest), answer, latency);
+		return nullptr;
+	}
+
+	FPAnswerPtr invalidAnswer(const FPQuestPtr quest, const std::string& sql)
+	{
+		_statistics.invalidQuestCount++;
+		LOG_ERROR("Unsupported sql: %s", sql.c_str());
+		return FPAWriter::errorAnswer(quest, 100001, std::string("Unsupported sql: ").append(sql), "MockDBProxy");
+	}
+
+	FPAnswerPtr descAnswer(const FPQuestPtr quest)
+	{
+		_statistics.descCount++;
+
+		//-- MySQL desc layout: Field, Type, Null, Key, Default, Extra.
+		std::vector<std::vector<std::string>> rows;
+		for (size_t i = 0; i < _columns.size(); i++)
+		{
+			bool isHint = (i == 0);
+			std::string type = (isHint && !_stringHint) ? "bigint(20)" : "varchar(255)";
+			rows.push_back(std::vector<std::string>{ _columns[i], type, isHint ? "NO" : "YES", isHint ? "PRI" : "", "", "" });
+		}
+
+		FPAWriter aw(2, quest);
+		aw.param("fields", std::vector<std::string>{ "Field", "Type", "Null", "Key", "Default", "Extra" });
+		aw.param("rows", rows);
+		return aw.take();
+	}
+
+	FPAnswerPtr selectAnswer(const FPQuestPtr quest, const std::string& tableName, const std::string& sql, const std::vector<std::string>& keys)
+	{
+		size_t fromPos = sql.find(" from ");
+		if (fromPos == std::string::npos || fromPos < 7)
+			return invalidAnswer(quest, sql);
+
+		std::vector<std::string> selectColumns = splitList(sql.substr(7, fromPos - 7));
+		std::vector<std::vector<std::string>> rows;
+		{
+			std::unique_lock<std::mutex> lck(_mutex);
+			MockTable& table = _tables[tableName];
+			for (const auto& key: keys)
+			{
+				std::vector<std::string> row;
+				if (buildRow(table, key, selectColumns, row))
+					rows.push_back(row);
+			}
+		}
+
+		_statistics.selectCount++;
+		_statistics.selectKeyCount += keys.size();
+		_statistics.selectRowCount += rows.size();
+
+		FPAWriter aw(2, quest);
+		aw.param("fields", selectColumns);
+		aw.param("rows", rows);
+		return aw.take();
+	}
+
+	//-- insert into t (k,f1,f2) values (?,?,?) ON DUPLICATE KEY UPDATE ...
+	FPAnswerPtr insertAnswer(const FPQuestPtr quest, const std::string& tableName, const std::string& sql, const std::vector<std::string>& params)
+	{
+		size_t begin = sql.find('(');
+		size_t end = sql.find(')', begin);
+		if (begin == std::string::npos || end == std::string::npos)
+			return invalidAnswer(quest, sql);
+
+		std::vector<std::string> fields = splitList(sql.substr(begin + 1, end - begin - 1));
+		if (fields.empty() || params.size() < fields.size())
+			return invalidAnswer(quest, sql);
+
+		{
+			std::unique_lock<std::mutex> lck(_mutex);
+			MockTable& table = _tables[tableName];
+			const std::string& key = params[0];
+
+			//-- Materialize generated values, so untouched columns keep their values.
+			auto it = table.writtenRows.find(key);
+			if (it == table.writtenRows.end())
+			{
+				RowValues& values = table.writtenRows[key];
+				if (table.deletedKeys.find(key) == table.deletedKeys.end() && generatedRowExists(key))
+					for (size_t i = 1; i < _columns.size(); i++)
+						values[_columns[i]] = generatedValue(key, i);
+
+				it = table.writtenRows.find(key);
+			}
+
+			table.deletedKeys.erase(key);
+			for (size_t i = 1; i < fields.size(); i++)
+				it->second[fields[i]] = params[i];
+		}
+
+		_statistics.writeCount++;
+
+		FPAWriter aw(2, quest);
+		aw.param("affectedRows", 1);
+		aw.param("insertId", 0);
+		return aw.take();
+	}
+
+	FPAnswerPtr deleteAnswer(const FPQuestPtr quest, const std::string& tableName, const std::string& key)
+	{
+		{
+			std::unique_lock<std::mutex> lck(_mutex);
+			MockTable& table = _tables[tableName];
+			table.writtenRows.erase(key);
+			table.deletedKeys.insert(key);
+		}
+
+		_statistics.deleteCount++;
+
+		FPAWriter aw(2, quest);
+		aw.param("affectedRows", 1);
+		aw.param("insertId", 0);
+		return aw.take();
+	}
+
+	FPAnswerPtr processSql(const FPQuestPtr quest, const std::string& tableName, const std::string& sql,
+		const std::vector<std::string>& keys, const std::vector<std::string>& params)
+	{
+		if (lowerPrefix(sql, 5) == "desc ")
+			return finish(quest, descAnswer(quest));
+
+		if (lowerPrefix(sql, 7) == "select ")
+			return finish(quest, selectAnswer(quest, tableName, sql, keys));
+
+		if (lowerPrefix(sql, 7) == "insert ")
+			return finish(quest, insertAnswer(quest, tableName, sql, params));
+
+		if (lowerPrefix(sql, 7) == "delete " && keys.size() == 1)
+			return finish(quest, deleteAnswer(quest, tableName, keys[0]));
+
+		return invalidAnswer(quest, sql);
+	}
+
+	void configure()
+	{
+		_hintField = Setting::getString("MockDBProxy.table.hintField", "hintId");
+		_stringHint = (Setting::getString("MockDBProxy.table.hintType", "int") == "string");
+		_valueSize = (int)Setting::getInt("MockDBProxy.table.valueSize", 32);
+		_rowCount = Setting::getInt("MockDBProxy.table.rowCount", 0);
+		_missingRatio = Setting::getReal("MockDBProxy.table.missingRatio", 0);
+
+		int columnCount = (int)Setting::getInt("MockDBProxy.table.columnCount", 8);
+		_columns.push_back(_hintField);
+		for (int i = 1; i <= columnCount; i++)
+			_columns.push_back(std::string("field").append(std::to_string(i)));
+
+		_minLatencyMsec = (int)Setting::getInt("MockDBProxy.latency.minMsec", 0);
+		_maxLatencyMsec = (int)Setting::getInt("MockDBProxy.latency.maxMsec", 0);
+		_errorPermyriad = (int)(Setting::getReal("MockDBProxy.fault.errorRatio", 0) * 10000);
+		_errorCode = (int)Setting::getInt("MockDBProxy.fault.errorCode", 20001);
+		_dropPermyriad = (int)(Setting::getReal("MockDBProxy.fault.dropRatio", 0) * 10000);
+		_dropHoldMsec = (int)Setting::getInt("MockDBProxy.fault.dropHoldSeconds", 30) * 1000;
+	}
+
+public:
+	FPAnswerPtr query(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+	{
+		std::string sql = args->wantString("sql");
+		std::string tableName = args->getString("tableName");
+		std::vector<std::string> params = args->get("params", std::vector<std::string>());
+
+		int64_t hintId = args->wantInt("hintId");
+		std::vector<std::string> keys{ std::to_string(hintId) };
+
+		return processSql(quest, tableName, sql, keys, params);
+	}
+
+	FPAnswerPtr iQuery(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+	{
+		std::string sql = args->wantString("sql");
+		std::string tableName = args->wantString("tableName");
+		std::vector<int64_t> hintIds = args->want("hintIds", std::vector<int64_t>());
+
+		std::vector<std::string> keys;
+		for (int64_t hintId: hintIds)
+			keys.push_back(std::to_string(hintId));
+
+		return processSql(quest, tableName, sql, keys, std::vector<std::string>());
+	}
+
+	FPAnswerPtr sQuery(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+	{
+		std::string sql = args->wantString("sql");
+		std::string tableName = args->wantString("tableName");
+		std::vector<std::string> params = args->get("params", std::vector<std::string>());
+
+		//-- Selects & deletes bind the hintIds as params; inserts bind the hintId as the first param.
+		std::vector<std::string> keys = params;
+		return processSql(quest, tableName, sql, keys, params);
+	}
+
+	FPAnswerPtr splitInfo(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+	{
+		_statistics.splitInfoCount++;
+
+		FPAWriter aw(1, quest);
+		aw.param("splitHint", _hintField);
+		return finish(quest, aw.take());
+	}
+
+	virtual std::string infos()
+	{
+		size_t writtenRows = 0, deletedKeys = 0, tableCount = 0;
+		{
+			std::unique_lock<std::mutex> lck(_mutex);
+			tableCount = _tables.size();
+			for (auto& tablePair: _tables)
+			{
+				writtenRows += tablePair.second.writtenRows.size();
+				deletedKeys += tablePair.second.deletedKeys.size();
+			}
+		}
+
+		std::string infos("{\"descCount\":");
+		infos.append(std::to_string(_statistics.descCount));
+		infos.append(",\"splitInfoCount\":").append(std::to_string(_statistics.splitInfoCount));
+		infos.append(",\"selectCount\":").append(std::to_string(_statistics.selectCount));
+		infos.append(",\"selectKeyCount\":").append(std::to_string(_statistics.selectKeyCount));
+		infos.append(",\"selectRowCount\":").append(std::to_string(_statistics.selectRowCount));
+		infos.append(",\"writeCount\":").append(std::to_string(_statistics.writeCount));
+		infos.append(",\"deleteCount\":").append(std::to_string(_statistics.deleteCount));
+		infos.append(",\"injectedErrorCount\":").append(std::to_string(_statistics.injectedErrorCount));
+		infos.append(",\"droppedCount\":").append(std::to_string(_statistics.droppedCount));
+		infos.append(",\"invalidQuestCount\":").append(std::to_string(_statistics.invalidQuestCount));
+		infos.append(",\"tableCount\":").append(std::to_string(tableCount));
+		infos.append(",\"writtenRows\":").append(std::to_string(writtenRows));
+		infos.append(",\"deletedKeys\":").append(std::to_string(deletedKeys));
+		infos.append("}");
+		return infos;
+	}
+
+	virtual void tune(const std::string& key, std::string& value)
+	{
+		if (key == "MockDBProxy.latency.minMsec")
+			_minLatencyMsec = atoi(value.c_str());
+		else if (key == "MockDBProxy.latency.maxMsec")
+			_maxLatencyMsec = atoi(value.c_str());
+		else if (key == "MockDBProxy.fault.errorRatio")
+			_errorPermyriad = (int)(atof(value.c_str()) * 10000);
+		else if (key == "MockDBProxy.fault.errorCode")
+			_errorCode = atoi(value.c_str());
+		else if (key == "MockDBProxy.fault.dropRatio")
+			_dropPermyriad = (int)(atof(value.c_str()) * 10000);
+		else if (key == "MockDBProxy.fault.dropHoldSeconds")
+			_dropHoldMsec = atoi(value.c_str()) * 1000;
+	}
+
+	MockDBProxyProcessor()
+	{
+		registerMethod("query", &MockDBProxyProcessor::query);
+		registerMethod("iQuery", &MockDBProxyProcessor::iQuery);
+		registerMethod("sQuery", &MockDBProxyProcessor::sQuery);
+		registerMethod("splitInfo", &MockDBProxyProcessor::splitInfo);
+
+		configure();
+	}
+
+	QuestProcessorClassBasicPublicFuncs
+};
+
+int main(int argc, char* argv[])
+{
+	if (argc != 2)
+	{
+		std::cout<<"Usage: "<<argv[0]<<" config"<<std::endl;
+		return 0;
+	}
+	if (!Setting::load(argv[1]))
+	{
+		std::cout<<"Config file error:"<< argv[1]<<std::endl;
+		return 1;
+	}
+
+	ServerPtr server = TCPEpollServer::create();
+	server->setQuestProcessor(std::make_shared<MockDBProxyProcessor>());
+	if (server->startup())
+		server->run();
+
+	return 0;
+}
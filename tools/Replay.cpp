@@ -0,0 +1,335 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+#include "ignoreSignals.h"
+#include "TCPClient.h"
+#include "FPWriter.h"
+#include "FPReader.h"
+#include "LatencyHistogram.h"
+#include "TrafficCapture.h"
+
+using namespace fpnn;
+
+struct ReplayConfig
+{
+	std::string endpoint;
+	std::string captureFile;
+	std::string output;
+	double speed;
+	int connections;
+	int maxInFlight;
+	int timeout;
+	int64_t maxRecords;
+	bool replayWrites;
+
+	ReplayConfig(): speed(1.0), connections(4), maxInFlight(1024), timeout(5), maxRecords(0), replayWrites(false) {}
+};
+
+struct KindStatistics
+{
+	std::mutex mutex;
+	LatencyHistogram histogram;
+	uint64_t sentCount;
+	uint64_t errorCount;
+	uint64_t timeoutCount;
+	uint64_t skippedCount;
+
+	KindStatistics(): sentCount(0), errorCount(0), timeoutCount(0), skippedCount(0) {}
+
+	void record(int64_t usec, int errorCode, bool failed)
+	{
+		std::unique_lock<std::mutex> lck(mutex);
+		if (errorCode == FPNN_EC_CORE_TIMEOUT)
+			timeoutCount++;
+		else if (errorCode || failed)
+			errorCount++;
+		else
+			histogram.record(usec);
+	}
+};
+
+class Replayer
+{
+	const ReplayConfig& _config;
+	std::vector<std::shared_ptr<TCPClient>> _clients;
+	KindStatistics _statistics[TrafficRecord::InvalidateTable + 1];
+	std::atomic<int> _inFlight;
+	int64_t _maxLagUsec;
+	uint64_t _lateCount;
+	uint64_t _readCount;
+
+	static std::string randomValue(uint32_t length)
+	{
+		static thread_local std::mt19937_64 random(std::random_device{}());
+		std::string value(length, ' ');
+		for (auto& c: value)
+			c = 'a' + (char)(random() % 26);
+		return value;
+	}
+
+	FPQuestPtr buildQuest(const TrafficRecord& record)
+	{
+		switch (record.kind)
+		{
+			case TrafficRecord::Fetch:
+			{
+				FPQWriter qw(3, "fetch");
+				qw.param("table", record.tableName);
+				if (record.stringKey)
+					qw.param("hintIds", record.hintStrings);
+				else
+					qw.param("hintIds", record.hintIds);
+				qw.param("fields", record.fields);
+				return qw.take();
+			}
+			case TrafficRecord::Modify:
+			{
+				std::map<std::string, std::string> values;
+				for (size_t i = 0; i < record.fields.size() && i < record.valueLengths.size(); i++)
+					values[record.fields[i]] = randomValue(record.valueLengths[i]);
+
+				FPQWriter qw(3, "modify");
+				qw.param("table", record.tableName);
+				if (record.stringKey)
+					qw.param("hintId", record.hintStrings.empty() ? std::string() : record.hintStrings[0]);
+				else
+					qw.param("hintId", record.hintIds.empty() ? (int64_t)0 : record.hintIds[0]);
+				qw.param("values", values);
+				return qw.take();
+			}
+			case TrafficRecord::Delete:
+			{
+				FPQWriter qw(2, "delete");
+				qw.param("table", record.tableName);
+				if (record.stringKey)
+					qw.param("hintId", record.hintStrings.empty() ? std::string() : record.hintStrings[0]);
+				else
+					qw.param("hintId", record.hintIds.empty() ? (int64_t)0 : record.hintIds[0]);
+				return qw.take();
+			}
+			case TrafficRecord::Invalidate:
+			{
+				FPQWriter qw(2, "invalidate");
+				qw.param("table", record.tableName);
+				qw.param("hintIds", record.hintIds);
+				return qw.take();
+			}
+			case TrafficRecord::InvalidateTable:
+			{
+				//-- internal: replayed on one node, not broadcast to its cluster.
+				FPQWriter qw(2, "invalidateTable");
+				qw.param("table", record.tableName);
+				qw.param("internal", true);
+				return qw.take();
+			}
+		}
+		return nullptr;
+	}
+
+	void send(const TrafficRecord& record, std::shared_ptr<TCPClient> client)
+	{
+		KindStatistics& statistics = _statistics[record.kind];
+		bool isWrite = (record.kind != TrafficRecord::Fetch);
+		if (isWrite && !_config.replayWrites)
+		{
+			statistics.skippedCount++;
+			return;
+		}
+
+		FPQuestPtr quest = buildQuest(record);
+		int64_t begin = latencyNowUsec();
+		_inFlight++;
+		statistics.sentCount++;
+
+		bool status = client->sendQuest(quest, [this, &statistics, begin](FPAnswerPtr answer, int errorCode) {
+			statistics.record(latencyNowUsec() - begin, errorCode, errorCode == 0 && answer->status());
+			_inFlight--;
+		}, _config.timeout);
+
+		if (!status)
+		{
+			statistics.record(0, FPNN_EC_CORE_UNKNOWN_ERROR, true);
+			_inFlight--;
+		}
+	}
+
+public:
+	Replayer(const ReplayConfig& config): _config(config), _inFlight(0), _maxLagUsec(0), _lateCount(0), _readCount(0)
+	{
+		for (int i = 0; i < config.connections; i++)
+			_clients.push_back(TCPClient::createClient(config.endpoint));
+	}
+
+	bool run(double& elapsedSeconds)
+	{
+		TrafficReader reader;
+		if (!reader.open(_config.captureFile))
+			return false;
+
+		TrafficRecord record;
+		int64_t begin = latencyNowUsec();
+		size_t clientIndex = 0;
+
+		while (reader.next(record))
+		{
+			if (record.kind < TrafficRecord::Fetch || record.kind > TrafficRecord::InvalidateTable)
+				continue;
+
+			_readCount++;
+			if (_config.speed > 0)
+			{
+				int64_t due = begin + (int64_t)(record.offsetUsec / _config.speed);
+				int64_t now = latencyNowUsec();
+				if (due > now)
+					std::this_thread::sleep_for(std::chrono::microseconds(due - now));
+				else if (now - due > 1000)
+				{
+					_lateCount++;
+					if (now - due > _maxLagUsec)
+						_maxLagUsec = now - due;
+				}
+			}
+
+			while (_inFlight >= _config.maxInFlight)
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+			send(record, _clients[clientIndex]);
+			clientIndex = (clientIndex + 1) % _clients.size();
+
+			if (_config.maxRecords > 0 && (int64_t)_readCount >= _config.maxRecords)
+				break;
+		}
+
+		int64_t end = latencyNowUsec();
+		int64_t waitDeadline = end + (_config.timeout + 1) * 1000000LL;
+		while (_inFlight > 0 && latencyNowUsec() < waitDeadline)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+		elapsedSeconds = (end - begin) / 1000000.0;
+		return true;
+	}
+
+	std::string report(double seconds)
+	{
+		std::ostringstream os;
+		os<<"{\"config\":{";
+		os<<"\"endpoint\":\""<<_config.endpoint<<"\"";
+		os<<",\"captureFile\":\""<<_config.captureFile<<"\"";
+		os<<",\"speed\":"<<_config.speed;
+		os<<",\"connections\":"<<_config.connections;
+		os<<",\"maxInFlight\":"<<_config.maxInFlight;
+		os<<",\"replayWrites\":"<<(_config.replayWrites ? "true" : "false");
+		os<<"},\"elapsed\":"<<seconds;
+		os<<",\"records\":"<<_readCount;
+		os<<",\"lateRecords\":"<<_lateCount;
+		os<<",\"maxLagUsec\":"<<_maxLagUsec;
+
+		for (int kind = TrafficRecord::Fetch; kind <= TrafficRecord::InvalidateTable; kind++)
+		{
+			KindStatistics& statistics = _statistics[kind];
+			std::unique_lock<std::mutex> lck(statistics.mutex);
+			const LatencyHistogram& histogram = statistics.histogram;
+
+			os<<",\""<<TrafficRecord::kindName((uint8_t)kind)<<"\":{";
+			os<<"\"sent\":"<<statistics.sentCount;
+			os<<",\"skipped\":"<<statistics.skippedCount;
+			os<<",\"qps\":"<<(uint64_t)(seconds > 0 ? histogram.count() / seconds : 0);
+			os<<",\"errors\":"<<statistics.errorCount;
+			os<<",\"timeouts\":"<<statistics.timeoutCount;
+			os<<",\"mean\":"<<histogram.mean();
+			os<<",\"p50\":"<<histogram.percentile(50);
+			os<<",\"p90\":"<<histogram.percentile(90);
+			os<<",\"p99\":"<<histogram.percentile(99);
+			os<<",\"p999\":"<<histogram.percentile(99.9);
+			os<<",\"max\":"<<histogram.max();
+			os<<"}";
+		}
+		os<<"}";
+		return os.str();
+	}
+};
+
+void showUsage(const char* appname)
+{
+	std::cout<<"Usage: "<<std::endl;
+	std::cout<<"\t"<<appname<<" host:port <capture file> [options]"<<std::endl;
+	std::cout<<"Options:"<<std::endl;
+	std::cout<<"\t-x <speed>        replay speed factor, default 1 (original speed). 0 means as fast as possible"<<std::endl;
+	std::cout<<"\t-c <connections>  default 4"<<std::endl;
+	std::cout<<"\t-p <in-flight>    max in-flight quests, default 1024"<<std::endl;
+	std::cout<<"\t-n <records>      replay at most n records, default all"<<std::endl;
+	std::cout<<"\t-w                also replay modify, delete & invalidations. modify & delete CHANGE THE DATABASE"<<std::endl;
+	std::cout<<"\t-r <file>         write JSON result to file, default stdout"<<std::endl;
+	std::cout<<"\t-q <seconds>      quest timeout, default 5"<<std::endl;
+	exit(1);
+}
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 3)
+		showUsage(argv[0]);
+
+	ignoreSignals();
+
+	ReplayConfig config;
+	config.endpoint = argv[1];
+	config.captureFile = argv[2];
+
+	int idx = 3;
+	while (idx < argc)
+	{
+		std::string opt = argv[idx++];
+		if (opt == "-w")
+		{
+			config.replayWrites = true;
+			continue;
+		}
+
+		if (idx >= argc)
+			showUsage(argv[0]);
+
+		const char* value = argv[idx++];
+		if (opt == "-x") config.speed = atof(value);
+		else if (opt == "-c") config.connections = atoi(value);
+		else if (opt == "-p") config.maxInFlight = atoi(value);
+		else if (opt == "-n") config.maxRecords = atoll(value);
+		else if (opt == "-r") config.output = value;
+		else if (opt == "-q") config.timeout = atoi(value);
+		else
+			showUsage(argv[0]);
+	}
+
+	if (config.speed < 0 || config.connections < 1 || config.maxInFlight < 1 || config.timeout < 1)
+		showUsage(argv[0]);
+
+	Replayer replayer(config);
+	double seconds = 0;
+	if (!replayer.run(seconds))
+	{
+		std::cout<<"Open capture file "<<config.captureFile<<" failed."<<std::endl;
+		return 1;
+	}
+
+	std::string result = replayer.report(seconds);
+	if (config.output.empty())
+		std::cout<<result<<std::endl;
+	else
+	{
+		std::ofstream ofs(config.output.c_str());
+		ofs<<result<<std::endl;
+		if (!ofs)
+		{
+			std::cout<<"Write result file "<<config.output<<" failed."<<std::endl;
+			return 1;
+		}
+	}
+
+	return 0;
+}